@@ -5,11 +5,9 @@
 
 #define INITIAL_PROGRAM_MEMORY_SIZE MB(5)
 
-// You might want to increase this if you get a log warning saying the temporary storage was overflown.
-// In many cases, overflowing the temporary storage should be fine since it just wraps back around and
-// allocations made way earlier in the frame are likely not used anymore.
-// This might however not always be the case, so it's probably a good idea to make sure you always have
-// enough temporary storage for your game.
+// How much temporary storage is committed up front for each thread.
+// Temporary storage grows on demand when this runs out, so this only needs to be about the size of a
+// normal frame. Check get_temporary_storage_stats().last_frame_high_water_mark to see what you use.
 #define TEMPORARY_STORAGE_SIZE MB(2)
 
 // Enable VERY_DEBUG if you are having memory bugs to detect things like heap corruption earlier.
@@ -38,6 +36,16 @@ typedef struct Context_Extra
 // #include "oogabooga/examples/text_rendering.c"
 // #include "oogabooga/examples/custom_logger.c"
 // #include "oogabooga/examples/renderer_stress_test.c"
+// #include "oogabooga/examples/heap_benchmark.c"
+// #include "oogabooga/examples/allocator_scaling_benchmark.c"
+// #include "oogabooga/examples/arena_benchmark.c"
+// #include "oogabooga/examples/quad_packing_benchmark.c"
+// #include "oogabooga/examples/z_sort_benchmark.c"
+// #include "oogabooga/examples/sprite_batch_benchmark.c"
+// #include "oogabooga/examples/culling_benchmark.c"
+// #include "oogabooga/examples/parallel_packing_benchmark.c"
+// #include "oogabooga/examples/audio_mixing_benchmark.c"
+// #include "oogabooga/examples/audio_resampling_benchmark.c"
 // #include "oogabooga/examples/tile_game.c"
 // #include "oogabooga/examples/audio_test.c"
 // #include "oogabooga/examples/custom_shader.c"
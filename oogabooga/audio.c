@@ -28,6 +28,20 @@
 	void    audio_player_clear_source(Audio_Player *p);
 	void    audio_player_set_looping(Audio_Player *p, bool looping);
 	
+		Output:
+	
+	audio_output_limiter_enabled = true;  // Peak limiter on the final mix so many players don't clip
+	audio_output_dither_enabled  = false; // TPDF dither when the output device is s16
+	
+		Resampling, when a source's sample rate isn't the output's:
+	
+	player->resample_quality = AUDIO_RESAMPLE_SINC;   // Default, windowed-sinc
+	player->resample_quality = AUDIO_RESAMPLE_LINEAR; // Cheaper, duller
+	
+		Mixing:
+	
+	audio_mix_thread_count = -1; // Threads helping the audio thread with lots of players, -1 is auto
+	
 */
 
 
@@ -887,39 +901,473 @@ audio_source_sample_next_frames(Audio_Source *src, u64 first_frame_index, u64 nu
 #define S32_MIN -2147483648
 #define S32_MAX 2147483647
 
+///
+// Sample kernels
+// These work on interleaved samples, so channels only matter for gain ramps which step
+// the gain once per frame. s16 results saturate instead of wrapping around.
+//
+
+void mix_samples_f32_scalar(f32 *dst, const f32 *src, u64 sample_count) {
+	for (u64 i = 0; i < sample_count; i++) {
+		dst[i] += src[i];
+	}
+}
+void mix_samples_s16_scalar(s16 *dst, const s16 *src, u64 sample_count) {
+	for (u64 i = 0; i < sample_count; i++) {
+		dst[i] = (s16)clamp((s32)dst[i] + (s32)src[i], S16_MIN, S16_MAX);
+	}
+}
+
+// Gain goes linearly from gain_from on the first frame towards gain_to, so the next
+// buffer can pick up at gain_to without a step.
+void apply_gain_ramp_f32_scalar(f32 *samples, u64 frame_count, u64 channels, f32 gain_from, f32 gain_to) {
+	f32 step = frame_count ? (gain_to-gain_from)/(f32)frame_count : 0;
+	for (u64 f = 0; f < frame_count; f++) {
+		f32 gain = gain_from + step*(f32)f;
+		for (u64 c = 0; c < channels; c++) {
+			samples[f*channels+c] *= gain;
+		}
+	}
+}
+void apply_gain_ramp_s16_scalar(s16 *samples, u64 frame_count, u64 channels, f32 gain_from, f32 gain_to) {
+	f32 step = frame_count ? (gain_to-gain_from)/(f32)frame_count : 0;
+	for (u64 f = 0; f < frame_count; f++) {
+		f32 gain = gain_from + step*(f32)f;
+		for (u64 c = 0; c < channels; c++) {
+			f32 s = (f32)samples[f*channels+c]*gain;
+			samples[f*channels+c] = (s16)clamp(roundf(s), (f32)S16_MIN, (f32)S16_MAX);
+		}
+	}
+}
+
+#if ENABLE_SIMD && SIMD_ENABLE_SSE2
+
+void mix_samples_f32_simd(f32 *dst, const f32 *src, u64 sample_count) {
+	u64 i = 0;
+#if SIMD_ENABLE_AVX2
+	for (; i+8 <= sample_count; i += 8) {
+		_mm256_storeu_ps(dst+i, _mm256_add_ps(_mm256_loadu_ps(dst+i), _mm256_loadu_ps(src+i)));
+	}
+#endif
+	for (; i+4 <= sample_count; i += 4) {
+		_mm_storeu_ps(dst+i, _mm_add_ps(_mm_loadu_ps(dst+i), _mm_loadu_ps(src+i)));
+	}
+	mix_samples_f32_scalar(dst+i, src+i, sample_count-i);
+}
+void mix_samples_s16_simd(s16 *dst, const s16 *src, u64 sample_count) {
+	u64 i = 0;
+#if SIMD_ENABLE_AVX2
+	for (; i+16 <= sample_count; i += 16) {
+		__m256i d = _mm256_loadu_si256((__m256i*)(dst+i));
+		__m256i s = _mm256_loadu_si256((__m256i*)(src+i));
+		_mm256_storeu_si256((__m256i*)(dst+i), _mm256_adds_epi16(d, s));
+	}
+#endif
+	for (; i+8 <= sample_count; i += 8) {
+		__m128i d = _mm_loadu_si128((__m128i*)(dst+i));
+		__m128i s = _mm_loadu_si128((__m128i*)(src+i));
+		_mm_storeu_si128((__m128i*)(dst+i), _mm_adds_epi16(d, s));
+	}
+	mix_samples_s16_scalar(dst+i, src+i, sample_count-i);
+}
+
+// 8 samples at a time, so a ramp needs 8 to be a whole number of frames (1, 2, 4 or 8
+// channels) for every lane to know its frame. A constant gain works with any channel count.
+void apply_gain_ramp_f32_simd(f32 *samples, u64 frame_count, u64 channels, f32 gain_from, f32 gain_to) {
+	f32 step = frame_count ? (gain_to-gain_from)/(f32)frame_count : 0;
+	if (step != 0 && 8 % channels != 0) {
+		apply_gain_ramp_f32_scalar(samples, frame_count, channels, gain_from, gain_to);
+		return;
+	}
+	
+	u64 sample_count = frame_count*channels;
+	u64 i = 0;
+	
+#if SIMD_ENABLE_AVX2
+	const __m256 from8 = _mm256_set1_ps(gain_from);
+	const __m256 step8 = _mm256_set1_ps(step);
+	const __m256 lane_frames8 = _mm256_setr_ps(0/channels, 1/channels, 2/channels, 3/channels, 4/channels, 5/channels, 6/channels, 7/channels);
+	for (; i+8 <= sample_count; i += 8) {
+		__m256 frame = _mm256_add_ps(_mm256_set1_ps((f32)(i/channels)), lane_frames8);
+		__m256 gain = _mm256_add_ps(from8, _mm256_mul_ps(step8, frame));
+		_mm256_storeu_ps(samples+i, _mm256_mul_ps(_mm256_loadu_ps(samples+i), gain));
+	}
+#else
+	const __m128 from = _mm_set1_ps(gain_from);
+	const __m128 step4 = _mm_set1_ps(step);
+	const __m128 lane_frames_lo = _mm_setr_ps(0/channels, 1/channels, 2/channels, 3/channels);
+	const __m128 lane_frames_hi = _mm_setr_ps(4/channels, 5/channels, 6/channels, 7/channels);
+	for (; i+8 <= sample_count; i += 8) {
+		__m128 first_frame = _mm_set1_ps((f32)(i/channels));
+		__m128 gain_lo = _mm_add_ps(from, _mm_mul_ps(step4, _mm_add_ps(first_frame, lane_frames_lo)));
+		__m128 gain_hi = _mm_add_ps(from, _mm_mul_ps(step4, _mm_add_ps(first_frame, lane_frames_hi)));
+		_mm_storeu_ps(samples+i,   _mm_mul_ps(_mm_loadu_ps(samples+i),   gain_lo));
+		_mm_storeu_ps(samples+i+4, _mm_mul_ps(_mm_loadu_ps(samples+i+4), gain_hi));
+	}
+#endif
+	
+	for (; i < sample_count; i++) {
+		samples[i] *= gain_from + step*(f32)(i/channels);
+	}
+}
+// roundf for 4 floats: halves go away from zero, not to even like _mm_cvtps_epi32.
+// Adding 0.5 and truncating would round 0.49999997 up, so the fraction is compared instead.
+inline __m128i round_half_away_from_zero_ps(__m128 x) {
+	__m128i truncated = _mm_cvttps_epi32(x);
+	__m128 fraction = _mm_sub_ps(x, _mm_cvtepi32_ps(truncated));
+	__m128 abs_fraction = _mm_andnot_ps(_mm_set1_ps(-0.0f), fraction);
+	__m128i away = _mm_castps_si128(_mm_cmpge_ps(abs_fraction, _mm_set1_ps(0.5f)));
+	// -1 for negative x, 1 otherwise
+	__m128i direction = _mm_or_si128(_mm_srai_epi32(_mm_castps_si128(x), 31), _mm_set1_epi32(1));
+	return _mm_add_epi32(truncated, _mm_and_si128(away, direction));
+}
+void apply_gain_ramp_s16_simd(s16 *samples, u64 frame_count, u64 channels, f32 gain_from, f32 gain_to) {
+	f32 step = frame_count ? (gain_to-gain_from)/(f32)frame_count : 0;
+	if (step != 0 && 8 % channels != 0) {
+		apply_gain_ramp_s16_scalar(samples, frame_count, channels, gain_from, gain_to);
+		return;
+	}
+	
+	u64 sample_count = frame_count*channels;
+	u64 i = 0;
+	
+	const __m128 from = _mm_set1_ps(gain_from);
+	const __m128 step4 = _mm_set1_ps(step);
+	const __m128 lane_frames_lo = _mm_setr_ps(0/channels, 1/channels, 2/channels, 3/channels);
+	const __m128 lane_frames_hi = _mm_setr_ps(4/channels, 5/channels, 6/channels, 7/channels);
+	for (; i+8 <= sample_count; i += 8) {
+		__m128 first_frame = _mm_set1_ps((f32)(i/channels));
+		__m128 gain_lo = _mm_add_ps(from, _mm_mul_ps(step4, _mm_add_ps(first_frame, lane_frames_lo)));
+		__m128 gain_hi = _mm_add_ps(from, _mm_mul_ps(step4, _mm_add_ps(first_frame, lane_frames_hi)));
+		
+		// Sign extend to s32 by unpacking into the high halves and shifting back down
+		__m128i s = _mm_loadu_si128((__m128i*)(samples+i));
+		__m128 lo = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(s, s), 16));
+		__m128 hi = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(s, s), 16));
+		
+		// Rounds like the scalar tail, and the pack saturates
+		__m128i lo_i = round_half_away_from_zero_ps(_mm_mul_ps(lo, gain_lo));
+		__m128i hi_i = round_half_away_from_zero_ps(_mm_mul_ps(hi, gain_hi));
+		_mm_storeu_si128((__m128i*)(samples+i), _mm_packs_epi32(lo_i, hi_i));
+	}
+	
+	for (; i < sample_count; i++) {
+		f32 s = (f32)samples[i]*(gain_from + step*(f32)(i/channels));
+		samples[i] = (s16)clamp(roundf(s), (f32)S16_MIN, (f32)S16_MAX);
+	}
+}
+
+#endif // ENABLE_SIMD && SIMD_ENABLE_SSE2
+
+void mix_samples_f32(f32 *dst, const f32 *src, u64 sample_count) {
+#if ENABLE_SIMD && SIMD_ENABLE_SSE2
+	mix_samples_f32_simd(dst, src, sample_count);
+#else
+	mix_samples_f32_scalar(dst, src, sample_count);
+#endif
+}
+void mix_samples_s16(s16 *dst, const s16 *src, u64 sample_count) {
+#if ENABLE_SIMD && SIMD_ENABLE_SSE2
+	mix_samples_s16_simd(dst, src, sample_count);
+#else
+	mix_samples_s16_scalar(dst, src, sample_count);
+#endif
+}
+void apply_gain_ramp_f32(f32 *samples, u64 frame_count, u64 channels, f32 gain_from, f32 gain_to) {
+#if ENABLE_SIMD && SIMD_ENABLE_SSE2
+	apply_gain_ramp_f32_simd(samples, frame_count, channels, gain_from, gain_to);
+#else
+	apply_gain_ramp_f32_scalar(samples, frame_count, channels, gain_from, gain_to);
+#endif
+}
+void apply_gain_ramp_s16(s16 *samples, u64 frame_count, u64 channels, f32 gain_from, f32 gain_to) {
+#if ENABLE_SIMD && SIMD_ENABLE_SSE2
+	apply_gain_ramp_s16_simd(samples, frame_count, channels, gain_from, gain_to);
+#else
+	apply_gain_ramp_s16_scalar(samples, frame_count, channels, gain_from, gain_to);
+#endif
+}
+
+void
+apply_gain_ramp(void *frames, u64 frame_count, Audio_Format format, f32 gain_from, f32 gain_to) {
+	switch (format.bit_width) {
+		case AUDIO_BITS_32: apply_gain_ramp_f32((f32*)frames, frame_count, format.channels, gain_from, gain_to); break;
+		case AUDIO_BITS_16: apply_gain_ramp_s16((s16*)frames, frame_count, format.channels, gain_from, gain_to); break;
+		default: panic("Unhandled bits");
+	}
+}
+
 void 
 mix_frames(void *dst, void *src, u64 frame_count, Audio_Format format) {
-    u64 comp_size = get_audio_bit_width_byte_size(format.bit_width);
-    u64 frame_size = comp_size * format.channels;
-    u64 output_size = frame_count * frame_size;
-    
-    // #Speed #Simd #Incomplete
-    // Quality:
-    // - Dithering
-    // - Clipping. Dynamic Range Compression?
+    u64 sample_count = frame_count * format.channels;
     
-    for (u64 frame = 0; frame < frame_count; frame++) {
-        
-        for (u64 c = 0; c < format.channels; c++) {
-
-            void *src_sample = (u8*)src + frame*frame_size + c*comp_size;
-            void *dst_sample = (u8*)dst + frame*frame_size + c*comp_size;
-
-            switch (format.bit_width) {
-                case AUDIO_BITS_32: {
-                	*((f32*)dst_sample) += *((f32*)src_sample);
-            	}
-                case AUDIO_BITS_16: {
-                    s16 dst_int = *((s16*)dst_sample);
-                    s16 src_int = *((s16*)src_sample);
-                    *((s16*)dst_sample) = (s16)clamp((s64)(dst_int + src_int), S16_MIN, S16_MAX);
-                    break;
-                }
-            }
-        }
+    switch (format.bit_width) {
+        case AUDIO_BITS_32: mix_samples_f32((f32*)dst, (f32*)src, sample_count); break;
+        case AUDIO_BITS_16: mix_samples_s16((s16*)dst, (s16*)src, sample_count); break;
+        default: panic("Unhandled bits");
     }
 }
 
+///
+// Mix bus
+// Players are mixed into an f32 bus with out_format's channel count, which is converted to
+// out_format once per callback. A player's source frames go through one pass that
+// converts them to f32, maps source channels to output channels with a matrix that also
+// holds the spacialization gains, applies a gain ramp and adds the result to the bus.
+//
+
+#define AUDIO_MAX_MIX_CHANNELS 8
+
+// How much of each source channel goes into each output channel
+typedef struct Audio_Mix_Matrix {
+	f32 m[AUDIO_MAX_MIX_CHANNELS][AUDIO_MAX_MIX_CHANNELS]; // [out][in]
+} Audio_Mix_Matrix;
+
+// Same channel mapping as convert_frames()
+void 
+get_audio_channel_map(Audio_Mix_Matrix *matrix, u64 src_channels, u64 out_channels) {
+	assert(src_channels <= AUDIO_MAX_MIX_CHANNELS && out_channels <= AUDIO_MAX_MIX_CHANNELS, "Can only mix up to %d channels", AUDIO_MAX_MIX_CHANNELS);
+	
+	memset(matrix, 0, sizeof(Audio_Mix_Matrix));
+	f32 avg = 1.0f/(f32)src_channels;
+	
+	for (u64 o = 0; o < out_channels; o++) {
+		if (src_channels > out_channels) {
+			// Every output channel gets the average of all source channels
+			for (u64 i = 0; i < src_channels; i++) matrix->m[o][i] = avg;
+		} else if (src_channels == 1) {
+			matrix->m[o][0] = 1.0f;
+		} else if (o < src_channels) {
+			matrix->m[o][o] = 1.0f;
+		} else {
+			// Extra output channels get the average
+			for (u64 i = 0; i < src_channels; i++) matrix->m[o][i] = avg;
+		}
+	}
+}
+
+inline f32
+audio_load_sample(const void *src, Audio_Format_Bits bits, u64 index) {
+	if (bits == AUDIO_BITS_32) return ((f32*)src)[index];
+	return (f32)((s16*)src)[index] * (1.0f/32768.0f);
+}
+
+void 
+mix_frames_to_bus_scalar(f32 *bus, u64 out_channels, const void *src, Audio_Format_Bits src_bits, 
+                         u64 src_channels, const Audio_Mix_Matrix *matrix, u64 frame_count, 
+                         f32 gain_from, f32 gain_to) {
+	f32 step = frame_count ? (gain_to-gain_from)/(f32)frame_count : 0;
+	f32 in[AUDIO_MAX_MIX_CHANNELS];
+	for (u64 f = 0; f < frame_count; f++) {
+		for (u64 i = 0; i < src_channels; i++) {
+			in[i] = audio_load_sample(src, src_bits, f*src_channels+i);
+		}
+		f32 gain = gain_from + step*(f32)f;
+		for (u64 o = 0; o < out_channels; o++) {
+			f32 acc = 0;
+			for (u64 i = 0; i < src_channels; i++) acc += matrix->m[o][i]*in[i];
+			bus[f*out_channels+o] += acc*gain;
+		}
+	}
+}
+
+// Out of range samples saturate
+void
+convert_samples_f32_to_s16_scalar(s16 *dst, const f32 *src, u64 sample_count) {
+	for (u64 i = 0; i < sample_count; i++) {
+		dst[i] = (s16)clamp(roundf(src[i]*32768.0f), (f32)S16_MIN, (f32)S16_MAX);
+	}
+}
+
+#if ENABLE_SIMD && SIMD_ENABLE_SSE2
+
+inline __m128
+audio_load_samples4(const void *src, Audio_Format_Bits bits, u64 index) {
+	if (bits == AUDIO_BITS_32) return _mm_loadu_ps((f32*)src+index);
+	__m128i s = _mm_loadl_epi64((__m128i*)((s16*)src+index));
+	__m128 f = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(s, s), 16));
+	return _mm_mul_ps(f, _mm_set1_ps(1.0f/32768.0f));
+}
+
+// Mono and stereo sources into a stereo bus. Everything else goes through the scalar path.
+void 
+mix_frames_to_bus_simd(f32 *bus, u64 out_channels, const void *src, Audio_Format_Bits src_bits, 
+                       u64 src_channels, const Audio_Mix_Matrix *matrix, u64 frame_count, 
+                       f32 gain_from, f32 gain_to) {
+	if (out_channels != 2 || src_channels > 2) {
+		mix_frames_to_bus_scalar(bus, out_channels, src, src_bits, src_channels, matrix, frame_count, gain_from, gain_to);
+		return;
+	}
+	
+	f32 step = frame_count ? (gain_to-gain_from)/(f32)frame_count : 0;
+	const __m128 from = _mm_set1_ps(gain_from);
+	const __m128 step4 = _mm_set1_ps(step);
+	const __m128 lane_frames_lo = _mm_setr_ps(0, 0, 1, 1);
+	const __m128 lane_frames_hi = _mm_setr_ps(2, 2, 3, 3);
+	
+	u64 f = 0;
+	if (src_channels == 2) {
+		// (l0, r0, l1, r1) * (m00, m11, ..) + (r0, l0, r1, l1) * (m01, m10, ..)
+		const __m128 straight = _mm_setr_ps(matrix->m[0][0], matrix->m[1][1], matrix->m[0][0], matrix->m[1][1]);
+		const __m128 crossed  = _mm_setr_ps(matrix->m[0][1], matrix->m[1][0], matrix->m[0][1], matrix->m[1][0]);
+		for (; f+4 <= frame_count; f += 4) {
+			__m128 first_frame = _mm_set1_ps((f32)f);
+			__m128 gain_lo = _mm_add_ps(from, _mm_mul_ps(step4, _mm_add_ps(first_frame, lane_frames_lo)));
+			__m128 gain_hi = _mm_add_ps(from, _mm_mul_ps(step4, _mm_add_ps(first_frame, lane_frames_hi)));
+			
+			__m128 in_lo = audio_load_samples4(src, src_bits, f*2);
+			__m128 in_hi = audio_load_samples4(src, src_bits, f*2+4);
+			__m128 mixed_lo = _mm_add_ps(_mm_mul_ps(straight, in_lo), _mm_mul_ps(crossed, _mm_shuffle_ps(in_lo, in_lo, _MM_SHUFFLE(2, 3, 0, 1))));
+			__m128 mixed_hi = _mm_add_ps(_mm_mul_ps(straight, in_hi), _mm_mul_ps(crossed, _mm_shuffle_ps(in_hi, in_hi, _MM_SHUFFLE(2, 3, 0, 1))));
+			
+			_mm_storeu_ps(bus+f*2,   _mm_add_ps(_mm_loadu_ps(bus+f*2),   _mm_mul_ps(mixed_lo, gain_lo)));
+			_mm_storeu_ps(bus+f*2+4, _mm_add_ps(_mm_loadu_ps(bus+f*2+4), _mm_mul_ps(mixed_hi, gain_hi)));
+		}
+	} else {
+		// (m0, m0, m1, m1) * (m00, m10, ..)
+		const __m128 column = _mm_setr_ps(matrix->m[0][0], matrix->m[1][0], matrix->m[0][0], matrix->m[1][0]);
+		for (; f+4 <= frame_count; f += 4) {
+			__m128 first_frame = _mm_set1_ps((f32)f);
+			__m128 gain_lo = _mm_add_ps(from, _mm_mul_ps(step4, _mm_add_ps(first_frame, lane_frames_lo)));
+			__m128 gain_hi = _mm_add_ps(from, _mm_mul_ps(step4, _mm_add_ps(first_frame, lane_frames_hi)));
+			
+			__m128 in = audio_load_samples4(src, src_bits, f);
+			__m128 mixed_lo = _mm_mul_ps(column, _mm_unpacklo_ps(in, in));
+			__m128 mixed_hi = _mm_mul_ps(column, _mm_unpackhi_ps(in, in));
+			
+			_mm_storeu_ps(bus+f*2,   _mm_add_ps(_mm_loadu_ps(bus+f*2),   _mm_mul_ps(mixed_lo, gain_lo)));
+			_mm_storeu_ps(bus+f*2+4, _mm_add_ps(_mm_loadu_ps(bus+f*2+4), _mm_mul_ps(mixed_hi, gain_hi)));
+		}
+	}
+	
+	u64 src_comp_size = get_audio_bit_width_byte_size(src_bits);
+	mix_frames_to_bus_scalar(bus+f*2, 2, (u8*)src+f*src_channels*src_comp_size, src_bits, src_channels, matrix, frame_count-f, gain_from+step*(f32)f, gain_to);
+}
+
+void
+convert_samples_f32_to_s16_simd(s16 *dst, const f32 *src, u64 sample_count) {
+	const __m128 scale = _mm_set1_ps(32768.0f);
+	u64 i = 0;
+	for (; i+8 <= sample_count; i += 8) {
+		__m128i lo = _mm_cvtps_epi32(_mm_mul_ps(_mm_loadu_ps(src+i), scale));
+		__m128i hi = _mm_cvtps_epi32(_mm_mul_ps(_mm_loadu_ps(src+i+4), scale));
+		_mm_storeu_si128((__m128i*)(dst+i), _mm_packs_epi32(lo, hi));
+	}
+	convert_samples_f32_to_s16_scalar(dst+i, src+i, sample_count-i);
+}
+
+#endif // ENABLE_SIMD && SIMD_ENABLE_SSE2
+
+// Adds frame_count frames of src, times matrix and a gain going from gain_from towards gain_to, to bus
+void 
+mix_frames_to_bus(f32 *bus, u64 out_channels, const void *src, Audio_Format_Bits src_bits, 
+                  u64 src_channels, const Audio_Mix_Matrix *matrix, u64 frame_count, 
+                  f32 gain_from, f32 gain_to) {
+#if ENABLE_SIMD && SIMD_ENABLE_SSE2
+	mix_frames_to_bus_simd(bus, out_channels, src, src_bits, src_channels, matrix, frame_count, gain_from, gain_to);
+#else
+	mix_frames_to_bus_scalar(bus, out_channels, src, src_bits, src_channels, matrix, frame_count, gain_from, gain_to);
+#endif
+}
+
+void
+convert_samples_f32_to_s16(s16 *dst, const f32 *src, u64 sample_count) {
+#if ENABLE_SIMD && SIMD_ENABLE_SSE2
+	convert_samples_f32_to_s16_simd(dst, src, sample_count);
+#else
+	convert_samples_f32_to_s16_scalar(dst, src, sample_count);
+#endif
+}
+
+///
+// Output stage
+// Runs on the mix bus once per callback. A peak limiter keeps lots of players from
+// clipping, then the bus is converted to the output format, with optional TPDF dither
+// when that's s16.
+//
+
+#define AUDIO_LIMITER_THRESHOLD 0.98f
+#define AUDIO_LIMITER_RELEASE_MS 100
+
+// #Global
+// Safe to set from any thread, only the audio thread reads them.
+ogb_instance bool audio_output_limiter_enabled;
+ogb_instance bool audio_output_dither_enabled;
+
+#if !OOGABOOGA_LINK_EXTERNAL_INSTANCE
+bool audio_output_limiter_enabled = true;
+bool audio_output_dither_enabled = false;
+#endif
+
+f32
+get_audio_samples_peak(const f32 *samples, u64 sample_count) {
+	u64 i = 0;
+	f32 peak = 0;
+#if ENABLE_SIMD && SIMD_ENABLE_SSE2
+	const __m128 abs_mask = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+	__m128 peak4 = _mm_setzero_ps();
+	for (; i+4 <= sample_count; i += 4) {
+		peak4 = _mm_max_ps(peak4, _mm_and_ps(_mm_loadu_ps(samples+i), abs_mask));
+	}
+	peak4 = _mm_max_ps(peak4, _mm_shuffle_ps(peak4, peak4, _MM_SHUFFLE(1, 0, 3, 2)));
+	peak4 = _mm_max_ps(peak4, _mm_shuffle_ps(peak4, peak4, _MM_SHUFFLE(2, 3, 0, 1)));
+	peak = _mm_cvtss_f32(peak4);
+#endif
+	for (; i < sample_count; i++) {
+		peak = max(peak, fabsf(samples[i]));
+	}
+	return peak;
+}
+
+// Pulls the gain down right away on frames that would go over AUDIO_LIMITER_THRESHOLD and
+// lets it back up over about AUDIO_LIMITER_RELEASE_MS. All channels get the same gain so
+// the stereo image stays put. *gain carries over between calls and should start at 1.
+void
+audio_limit_samples(f32 *samples, u64 frame_count, u64 channels, u64 sample_rate, f32 *gain) {
+	// Nothing to do for the usual quiet buffer
+	if (*gain >= 1.0f && get_audio_samples_peak(samples, frame_count*channels) <= AUDIO_LIMITER_THRESHOLD) return;
+	
+	f32 release = 1.0f - expf(-1000.0f / (AUDIO_LIMITER_RELEASE_MS * (f32)sample_rate));
+	f32 g = *gain;
+	
+	for (u64 f = 0; f < frame_count; f++) {
+		f32 *frame = samples+f*channels;
+		
+		f32 peak = 0;
+		for (u64 c = 0; c < channels; c++) peak = max(peak, fabsf(frame[c]));
+		
+		f32 target = peak > AUDIO_LIMITER_THRESHOLD ? AUDIO_LIMITER_THRESHOLD/peak : 1.0f;
+		if (target < g) g = target;
+		else            g += (target-g)*release;
+		
+		for (u64 c = 0; c < channels; c++) frame[c] *= g;
+	}
+	
+	// The release slows to a crawl near 1 (and f32 can't get there), so snap back once the
+	// difference is inaudible and let the quiet path kick in again
+	if (g > 0.999f) g = 1.0f;
+	*gain = g;
+}
+
+// Adds triangular noise of +-1 LSB before rounding, which turns the quantization error of
+// quiet signals and fades into a constant noise floor instead of distortion.
+// *seed carries over between calls.
+void
+convert_samples_f32_to_s16_dithered(s16 *dst, const f32 *src, u64 sample_count, u64 *seed) {
+	u64 state = *seed;
+	for (u64 i = 0; i < sample_count; i++) {
+		// Same LCG as get_random(), but with its own state so the audio thread doesn't
+		// touch seed_for_random. Two 24 bit uniforms from the upper bits.
+		state = state * MULTIPLIER + INCREMENT;
+		f32 r1 = (f32)((state >> 40) & 0xFFFFFF) * (1.0f/16777216.0f);
+		f32 r2 = (f32)((state >> 16) & 0xFFFFFF) * (1.0f/16777216.0f);
+		
+		f32 s = src[i]*32768.0f + (r1-r2);
+		dst[i] = (s16)clamp(roundf(s), (f32)S16_MIN, (f32)S16_MAX);
+	}
+	*seed = state;
+}
+
 void
 convert_one_component(void *dst, Audio_Format_Bits dst_bits, 
                   void *src, Audio_Format_Bits src_bits) {
@@ -1013,6 +1461,322 @@ resample_frames(void *dst, Audio_Format dst_format,
 	}
 }
 
+// Buffers for mixing a player, grown as needed. Whoever mixes passes one in, so threads
+// that come and go (like mixing workers) don't each leave a set of buffers behind.
+typedef struct Audio_Scratch {
+	void *samples;
+	u64 samples_size;
+	f32 *resampled;
+	u64 resampled_size;
+	f32 *planar;
+	u64 planar_size;
+} Audio_Scratch;
+
+void *
+audio_scratch_get(void **buffer, u64 *size, u64 needed) {
+	if (!*buffer || *size < needed) {
+		u64 new_size = get_next_power_of_two(needed);
+		if (*buffer) dealloc(get_heap_allocator(), *buffer);
+		*buffer = alloc(get_heap_allocator(), new_size);
+		memset(*buffer, 0, new_size);
+		*size = new_size;
+	}
+	return *buffer;
+}
+
+void
+audio_scratch_release(Audio_Scratch *scratch) {
+	if (scratch->samples)   dealloc(get_heap_allocator(), scratch->samples);
+	if (scratch->resampled) dealloc(get_heap_allocator(), scratch->resampled);
+	if (scratch->planar)    dealloc(get_heap_allocator(), scratch->planar);
+	memset(scratch, 0, sizeof(Audio_Scratch));
+}
+
+///
+// Stateful resampling
+// A player keeps one of these so the resampling continues where the last callback left off.
+// The position is kept as an exact fraction of a source frame, so nothing drifts, and the last
+// few source frames are kept as history for the filter to look back on.
+//
+// AUDIO_RESAMPLE_SINC is a polyphase windowed-sinc FIR. The filter phases for a pair of rates
+// are computed once and shared by every resampler with the same rates. That's one phase per
+// position between two source frames the output can land on, which is exact for all the usual
+// rates (44100 to 48000 is 160 phases). Odd rates round to the nearest of AUDIO_RESAMPLER_MAX_PHASES.
+// AUDIO_RESAMPLE_LINEAR is cheap linear interpolation, but still without drift or clicks.
+//
+
+#define AUDIO_RESAMPLER_SINC_TAPS 16
+#define AUDIO_RESAMPLER_MAX_PHASES 1024
+#define AUDIO_RESAMPLER_MAX_FILTERS 16
+// Of the lower of the two nyquist frequencies
+#define AUDIO_RESAMPLER_CUTOFF 0.9
+
+typedef enum Audio_Resample_Quality {
+	AUDIO_RESAMPLE_SINC,
+	AUDIO_RESAMPLE_LINEAR,
+} Audio_Resample_Quality;
+
+typedef struct Audio_Resampler_Filter {
+	u64 step;  // Source frames per output frame is step/denom
+	u64 denom;
+	u64 phase_count;
+	f32 *coefficients; // [phase_count+1][AUDIO_RESAMPLER_SINC_TAPS], the last is the next frame's first
+} Audio_Resampler_Filter;
+
+typedef struct Audio_Resampler {
+	bool initted;
+	Audio_Resample_Quality quality; // What was asked for, filter is 0 when it's linear
+	u64 channels;
+	int src_rate;
+	int dst_rate;
+	u64 taps;
+	
+	// The taps of the next output frame start phase/denom frames into the history
+	u64 step;
+	u64 denom;
+	u64 phase;
+	
+	Audio_Resampler_Filter *filter; // 0 for linear
+	
+	f32 history[AUDIO_RESAMPLER_SINC_TAPS*AUDIO_MAX_MIX_CHANNELS]; // Interleaved
+	u64 history_frames;
+} Audio_Resampler;
+
+// #Global
+ogb_instance Audio_Resampler_Filter audio_resampler_filters[AUDIO_RESAMPLER_MAX_FILTERS];
+ogb_instance u64 audio_resampler_filter_count;
+ogb_instance Spinlock audio_resampler_filter_lock;
+
+#if !OOGABOOGA_LINK_EXTERNAL_INSTANCE
+Audio_Resampler_Filter audio_resampler_filters[AUDIO_RESAMPLER_MAX_FILTERS];
+u64 audio_resampler_filter_count = 0;
+Spinlock audio_resampler_filter_lock = {0};
+#endif
+
+// Returns 0 if we're out of room for filters
+Audio_Resampler_Filter *
+audio_get_resampler_filter(u64 step, u64 denom) {
+	spinlock_acquire_or_wait(&audio_resampler_filter_lock);
+	
+	Audio_Resampler_Filter *filter = 0;
+	for (u64 i = 0; i < audio_resampler_filter_count; i++) {
+		if (audio_resampler_filters[i].step == step && audio_resampler_filters[i].denom == denom) {
+			filter = &audio_resampler_filters[i];
+			break;
+		}
+	}
+	
+	if (!filter && audio_resampler_filter_count < AUDIO_RESAMPLER_MAX_FILTERS) {
+		filter = &audio_resampler_filters[audio_resampler_filter_count];
+		filter->step = step;
+		filter->denom = denom;
+		filter->phase_count = min(denom, AUDIO_RESAMPLER_MAX_PHASES);
+		
+		const u64 taps = AUDIO_RESAMPLER_SINC_TAPS;
+		filter->coefficients = alloc(get_heap_allocator(), (filter->phase_count+1)*taps*sizeof(f32));
+		
+		// Relative to the source rate, so when downsampling it's lowered to the output's nyquist
+		f64 cutoff = AUDIO_RESAMPLER_CUTOFF * min(1.0, (f64)denom/(f64)step);
+		
+		for (u64 p = 0; p <= filter->phase_count; p++) {
+			f32 *c = filter->coefficients + p*taps;
+			f64 sum = 0;
+			for (u64 t = 0; t < taps; t++) {
+				f64 x = (f64)t - (f64)(taps/2-1) - (f64)p/(f64)filter->phase_count;
+				f64 sinc = x == 0 ? 1.0 : sin(PI64*cutoff*x)/(PI64*cutoff*x);
+				// Blackman window over the taps
+				f64 w = 2.0*PI64*(x+(f64)taps/2.0)/(f64)taps;
+				f64 window = 0.42 - 0.5*cos(w) + 0.08*cos(2.0*w);
+				c[t] = (f32)(sinc*window);
+				sum += c[t];
+			}
+			// Unity gain for DC on every phase
+			for (u64 t = 0; t < taps; t++) c[t] = (f32)(c[t]/sum);
+		}
+		
+		MEMORY_BARRIER;
+		audio_resampler_filter_count += 1;
+	}
+	
+	spinlock_release(&audio_resampler_filter_lock);
+	
+	return filter;
+}
+
+void
+audio_resampler_init(Audio_Resampler *r, u64 channels, int src_rate, int dst_rate, Audio_Resample_Quality quality) {
+	assert(channels > 0 && channels <= AUDIO_MAX_MIX_CHANNELS, "Can only resample up to %d channels", AUDIO_MAX_MIX_CHANNELS);
+	assert(src_rate > 0 && dst_rate > 0, "Bad sample rate");
+	
+	memset(r, 0, sizeof(Audio_Resampler));
+	r->initted = true;
+	r->channels = channels;
+	r->src_rate = src_rate;
+	r->dst_rate = dst_rate;
+	
+	u64 a = (u64)src_rate;
+	u64 b = (u64)dst_rate;
+	while (b) {
+		u64 t = a % b;
+		a = b;
+		b = t;
+	}
+	r->step  = (u64)src_rate/a;
+	r->denom = (u64)dst_rate/a;
+	
+	if (quality == AUDIO_RESAMPLE_SINC) {
+		r->filter = audio_get_resampler_filter(r->step, r->denom);
+		if (!r->filter) {
+			log_warning("Too many different sample rates, resampling %d to %d linearly", src_rate, dst_rate);
+		}
+	}
+	r->quality = quality;
+	r->taps = r->filter ? AUDIO_RESAMPLER_SINC_TAPS : 2;
+	
+	// Silence before the first frame, so the first output frame lines up with it
+	r->history_frames = r->taps/2-1;
+}
+
+// Next audio_resampler_process call has to be given this many source frames
+u64
+audio_resampler_get_input_frame_count(Audio_Resampler *r, u64 output_frames) {
+	if (output_frames == 0) return 0;
+	
+	u64 last_needed = (r->phase + (output_frames-1)*r->step)/r->denom + r->taps;
+	u64 next_start = (r->phase + output_frames*r->step)/r->denom;
+	u64 needed = max(last_needed, next_start);
+	
+	return needed > r->history_frames ? needed-r->history_frames : 0;
+}
+
+inline const f32 *
+audio_resampler_get_phase_coefficients(const Audio_Resampler_Filter *filter, u64 frac) {
+	u64 phase_index = frac;
+	if (filter->phase_count != filter->denom) {
+		phase_index = (frac*filter->phase_count + filter->denom/2)/filter->denom;
+	}
+	return filter->coefficients + phase_index*AUDIO_RESAMPLER_SINC_TAPS;
+}
+
+void 
+audio_resample_channel_sinc_scalar(f32 *dst, u64 dst_stride, const f32 *x, const Audio_Resampler_Filter *filter, u64 phase, u64 frame_count) {
+	const u64 taps = AUDIO_RESAMPLER_SINC_TAPS;
+	u64 j = phase/filter->denom;
+	u64 frac = phase%filter->denom;
+	u64 step_whole = filter->step/filter->denom;
+	u64 step_frac = filter->step%filter->denom;
+	for (u64 f = 0; f < frame_count; f++) {
+		const f32 *in = x + j;
+		const f32 *c = audio_resampler_get_phase_coefficients(filter, frac);
+		f32 acc = 0;
+		for (u64 t = 0; t < taps; t++) acc += in[t]*c[t];
+		dst[f*dst_stride] = acc;
+		
+		j += step_whole;
+		frac += step_frac;
+		if (frac >= filter->denom) {
+			frac -= filter->denom;
+			j += 1;
+		}
+	}
+}
+
+#if ENABLE_SIMD && SIMD_ENABLE_SSE2
+void 
+audio_resample_channel_sinc_simd(f32 *dst, u64 dst_stride, const f32 *x, const Audio_Resampler_Filter *filter, u64 phase, u64 frame_count) {
+	u64 j = phase/filter->denom;
+	u64 frac = phase%filter->denom;
+	u64 step_whole = filter->step/filter->denom;
+	u64 step_frac = filter->step%filter->denom;
+	for (u64 f = 0; f < frame_count; f++) {
+		const f32 *in = x + j;
+		const f32 *c = audio_resampler_get_phase_coefficients(filter, frac);
+#if SIMD_ENABLE_AVX2
+		__m256 acc8 = _mm256_add_ps(
+			_mm256_mul_ps(_mm256_loadu_ps(in),   _mm256_loadu_ps(c)), 
+			_mm256_mul_ps(_mm256_loadu_ps(in+8), _mm256_loadu_ps(c+8))
+		);
+		__m128 acc = _mm_add_ps(_mm256_castps256_ps128(acc8), _mm256_extractf128_ps(acc8, 1));
+#else
+		__m128 acc = _mm_add_ps(
+			_mm_add_ps(_mm_mul_ps(_mm_loadu_ps(in),    _mm_loadu_ps(c)),    _mm_mul_ps(_mm_loadu_ps(in+4),  _mm_loadu_ps(c+4))),
+			_mm_add_ps(_mm_mul_ps(_mm_loadu_ps(in+8),  _mm_loadu_ps(c+8)),  _mm_mul_ps(_mm_loadu_ps(in+12), _mm_loadu_ps(c+12)))
+		);
+#endif
+		acc = _mm_add_ps(acc, _mm_movehl_ps(acc, acc));
+		acc = _mm_add_ss(acc, _mm_shuffle_ps(acc, acc, 1));
+		dst[f*dst_stride] = _mm_cvtss_f32(acc);
+		
+		j += step_whole;
+		frac += step_frac;
+		if (frac >= filter->denom) {
+			frac -= filter->denom;
+			j += 1;
+		}
+	}
+}
+#endif
+
+void 
+audio_resample_channel_sinc(f32 *dst, u64 dst_stride, const f32 *x, const Audio_Resampler_Filter *filter, u64 phase, u64 frame_count) {
+	assert(AUDIO_RESAMPLER_SINC_TAPS == 16, "audio_resample_channel_sinc_simd is unrolled for 16 taps");
+#if ENABLE_SIMD && SIMD_ENABLE_SSE2
+	audio_resample_channel_sinc_simd(dst, dst_stride, x, filter, phase, frame_count);
+#else
+	audio_resample_channel_sinc_scalar(dst, dst_stride, x, filter, phase, frame_count);
+#endif
+}
+
+// Resamples src, which has to have audio_resampler_get_input_frame_count(r, output_frames)
+// frames with r->channels channels, to output_frames interleaved f32 frames in dst.
+void
+audio_resampler_process(Audio_Resampler *r, f32 *dst, u64 output_frames, 
+                        const void *src, Audio_Format_Bits src_bits, u64 input_frames,
+                        Audio_Scratch *scratch) {
+	assert(r->initted, "Resampler is not initialized");
+	if (output_frames == 0) return;
+	assert(input_frames == audio_resampler_get_input_frame_count(r, output_frames), "Resampler was given the wrong number of input frames");
+	
+	u64 frames = r->history_frames + input_frames;
+	f32 *planar = audio_scratch_get((void**)&scratch->planar, &scratch->planar_size, frames*r->channels*sizeof(f32));
+	
+	// One channel after the other, so the filter reads its taps from consecutive samples
+	for (u64 c = 0; c < r->channels; c++) {
+		f32 *x = planar + c*frames;
+		for (u64 f = 0; f < r->history_frames; f++) x[f] = r->history[f*r->channels+c];
+		for (u64 f = 0; f < input_frames; f++) {
+			x[r->history_frames+f] = audio_load_sample(src, src_bits, f*r->channels+c);
+		}
+	}
+	
+	for (u64 c = 0; c < r->channels; c++) {
+		const f32 *x = planar + c*frames;
+		if (r->filter) {
+			audio_resample_channel_sinc(dst+c, r->channels, x, r->filter, r->phase, output_frames);
+		} else {
+			u64 phase = r->phase;
+			f32 frac_scale = 1.0f/(f32)r->denom;
+			for (u64 f = 0; f < output_frames; f++) {
+				const f32 *in = x + phase/r->denom;
+				f32 t = (f32)(phase%r->denom)*frac_scale;
+				dst[f*r->channels+c] = in[0] + (in[1]-in[0])*t;
+				phase += r->step;
+			}
+		}
+	}
+	
+	// Keep what the next call still needs
+	u64 end = r->phase + output_frames*r->step;
+	u64 next_start = end/r->denom;
+	r->phase = end%r->denom;
+	r->history_frames = frames-next_start;
+	assert(r->history_frames <= AUDIO_RESAMPLER_SINC_TAPS, "Resampler history overflow");
+	for (u64 c = 0; c < r->channels; c++) {
+		const f32 *x = planar + c*frames + next_start;
+		for (u64 f = 0; f < r->history_frames; f++) r->history[f*r->channels+c] = x[f];
+	}
+}
+
 // Assumes dst buffer is large enough
 int // Returns outputted number of frames
 convert_frames(void *dst, Audio_Format dst_format, 
@@ -1153,7 +1917,6 @@ typedef struct Audio_Player {
 	// Configure players with the player_xxxxx procedures
 	Audio_Source source;
 	bool has_source;
-	bool allocated;
 	bool marked_for_release; // We release on audio thread
 	Audio_Player_State state;
 	u64 frame_index;
@@ -1164,63 +1927,46 @@ typedef struct Audio_Player {
 	// I think we only need to sync when audio thread samples the source, which should be
 	// very quick and low contention, hence a spinlock.
 	Spinlock sample_lock; 
+	// Only touched by the thread mixing the player. Jumping in the source sets
+	// resampler_reset under sample_lock, and the mixing thread starts over when it sees it.
+	Audio_Resampler resampler;
+	bool resampler_reset;
 	
 	// These can be set safely
 	Vector3 position; // ndc space -1 to 1
 	bool disable_spacialization;
 	float32 volume;
+	Audio_Resample_Quality resample_quality; // When the source's sample rate isn't the output's
 	
 } Audio_Player;
 #define AUDIO_PLAYERS_PER_BLOCK 128
-typedef struct Audio_Player_Block {
-	Audio_Player players[AUDIO_PLAYERS_PER_BLOCK]; // Players need to be persistent in memory
-	
-	struct Audio_Player_Block *next;
-} Audio_Player_Block;
 
 // #Global
-ogb_instance Audio_Player_Block audio_player_block;
+// Players are acquired on any thread but only released on the audio thread,
+// so pointers to live players stay valid while the audio thread mixes them.
+ogb_instance Pool audio_player_pool;
+ogb_instance Spinlock audio_player_pool_lock;
 
 #if !OOGABOOGA_LINK_EXTERNAL_INSTANCE
-Audio_Player_Block audio_player_block = {0};
+Pool audio_player_pool = {0};
+Spinlock audio_player_pool_lock = {0};
 #endif
 
 Audio_Player *
 audio_player_get_one() {
 
-	Audio_Player_Block *block = &audio_player_block;
-	Audio_Player_Block *last = 0;
+	spinlock_acquire_or_wait(&audio_player_pool_lock);
 	
-	while (block) {
-		
-		for (u64 i = 0; i < AUDIO_PLAYERS_PER_BLOCK; i++) {
-			if (!block->players[i].allocated) {
-			
-				memset(&block->players[i], 0, sizeof(block->players[i]));
-				block->players[i].allocated = true;
-				block->players[i].volume = 1.0;
-				
-				return &block->players[i];
-			}
-		}
-		
-		last = block;
-		block = block->next;
+	if (audio_player_pool.item_size == 0) {
+		pool_init(&audio_player_pool, sizeof(Audio_Player), AUDIO_PLAYERS_PER_BLOCK, get_heap_allocator());
 	}
 	
-	// No free player found, make another block
-	// #Volatile can't assign to last->next before this is zero initialized
-	Audio_Player_Block *new_block = alloc(get_heap_allocator(), sizeof(Audio_Player_Block));
+	Audio_Player *p = pool_acquire(&audio_player_pool, 0);
+	p->volume = 1.0;
 	
-#if !DO_ZERO_INITIALIATION
-	memset(new_block, 0, sizeof(*new_block));
-#endif
-
-	last->next = new_block;
-
-	new_block->players[0].allocated = true;
-	new_block->players[0].volume = 1.0;
-	return &new_block->players[0];
+	spinlock_release(&audio_player_pool_lock);
+	
+	return p;
 }
 
 void 
@@ -1261,6 +2007,7 @@ audio_player_set_time_stamp(Audio_Player *p, float64 time_in_seconds) {
 	float64 progression = time_in_seconds/full_duration;
 	
 	p->frame_index = (u64)round((float64)p->source.number_of_frames*progression);
+	p->resampler_reset = true;
 	
 	spinlock_release(&p->sample_lock);
 }
@@ -1270,6 +2017,7 @@ audio_player_set_progression_factor(Audio_Player *p, float64 factor) {
 	assert(p->frame_index <= p->source.number_of_frames);
 	
 	p->frame_index = (u64)round((float64)p->source.number_of_frames*factor);
+	p->resampler_reset = true;
 	
 	spinlock_release(&p->sample_lock);
 }
@@ -1313,6 +2061,7 @@ audio_player_set_source(Audio_Player *p, Audio_Source src, bool retain_progressi
 	} else {
 		p->frame_index = 0;
 	}
+	p->resampler_reset = true;
 	
 	spinlock_release(&p->sample_lock);
 }
@@ -1324,6 +2073,7 @@ audio_player_clear_source(Audio_Player *p) {
 	p->has_source = false;
 	p->state = AUDIO_PLAYER_STATE_PAUSED;
 	p->source = ZERO(Audio_Source);
+	p->resampler_reset = true;
 	
 	spinlock_release(&p->sample_lock);
 }
@@ -1333,6 +2083,7 @@ audio_player_set_looping(Audio_Player *p, bool looping) {
 	
 	if (p->has_source && looping && !p->looping && p->frame_index == p->source.number_of_frames) {
 		p->frame_index = 0;
+		p->resampler_reset = true;
 	}
 	
 	p->looping = looping;
@@ -1389,214 +2140,358 @@ play_one_audio_clip(string path) {
 	play_one_audio_clip_at_position(path, v3(0, 0, 0));
 }
 
-void
-audio_apply_fade_in(void *frames, u64 number_of_frames, Audio_Format format, 
-					float64 fade_from, float64 fade_to) {
-	u64 comp_size  = get_audio_bit_width_byte_size(format.bit_width);
-    u64 frame_size = comp_size * format.channels;
-    
-    for (u64 f = 0; f < number_of_frames; f++) {
-    	f32 frame_t = (f32)f/(f32)number_of_frames;
-    	f32 log_scale = log10(1.0 + 9.0 * frame_t) / log10(10.0);
-    	for (u64 c = 0; c < format.channels; c++) {
-    		void *p = ((u8*)frames)+frame_size*f+c*comp_size;
-	    	switch (format.bit_width) {
-	    		case AUDIO_BITS_32: {
-	    			f32 s = (*(f32*)p);
-	    			*(f32*)p = smerpf(s * fade_from, s * fade_to, log_scale);
-	    			break;
-	    		}
-	    		case AUDIO_BITS_16: {
-	    			s16 s = (*(s16*)p);
-	    			*(s16*)p = smerpi((f32)s * fade_from, (f32)s * fade_to, log_scale);
-	    			break;
-	    		}
-	    	}
-	    }
-    }
-}
-void
-audio_apply_fade_out(void *frames, u64 number_of_frames, Audio_Format format, 
-					 float64 fade_from, float64 fade_to) {
-	u64 comp_size  = get_audio_bit_width_byte_size(format.bit_width);
-    u64 frame_size = comp_size * format.channels;
-    
-    for (u64 f = 0; f < number_of_frames; f++) {
-    	f64 frame_t = 1.0-(f32)f/(f32)number_of_frames;
-    	f64 log_scale = log10(1.0 + 9.0 * frame_t) / log10(10.0);
-    	for (u64 c = 0; c < format.channels; c++) {
-    		void *p = ((u8*)frames)+frame_size*f+c*comp_size;
-	    	switch (format.bit_width) {
-	    		case AUDIO_BITS_32: {
-	    			f32 s = (*(f32*)p);
-	    			*(f32*)p = smerpf(s * fade_from, s * fade_to, log_scale);
-	    			break;
-	    		}
-	    		case AUDIO_BITS_16: {
-	    			s16 s = (*(s16*)p);
-	    			*(s16*)p = smerpi((f64)s * fade_from, (f64)s * fade_to, log_scale);
-	    			break;
-	    		}
-	    	}
-	    }
-    }
-}
-
-void apply_audio_spacialization_mono(void* frames, Audio_Format format, u64 number_of_frames, Vector3 pos) {
-	// No idea if this actually gives the perception of audio being positioned.
-	// I also don't have a mono audio device to test it.
-    float* audio_data = (float*)frames;
-
-    float32 distance = sqrtf(pos.x * pos.x + pos.y * pos.y + pos.z * pos.z);
-    float32 attenuation = 1.0f / (1.0f + distance); 
-
-    float32 alpha = 0.1f;
-    float32 prev_sample = 0.0f;
-    
-    u64 comp_size  = get_audio_bit_width_byte_size(format.bit_width);
-    u64 frame_size = comp_size * format.channels;
+// Fades follow a log curve. We evaluate it every AUDIO_FADE_RAMP_FRAMES frames and ramp
+// the gain linearly in between.
+#define AUDIO_FADE_RAMP_FRAMES 32
 
-    for (u64 i = 0; i < number_of_frames; ++i) {
-        float32 sample = audio_data[i];
-        convert_one_component(
-        	&sample, 
-        	AUDIO_BITS_32, 
-        	(u8*)frames+i*frame_size,
-        	format.bit_width
-    	);
-
-        sample *= attenuation;
-
-        sample = alpha * sample + (1.0f - alpha) * prev_sample;
-        prev_sample = sample;
-
-        convert_one_component(
-	    	(u8*)frames+i*frame_size,
-	    	format.bit_width,
-	    	&sample, 
-	    	AUDIO_BITS_32
-		);
-    }
+// Gain at t (0 to 1) through a fade in. A fade out is the same curve backwards, so
+// pausing mid fade in continues from the same gain.
+f32
+audio_fade_in_gain(f64 t) {
+	f64 log_scale = log10(1.0 + 9.0 * t) / log10(10.0);
+	return (f32)smerpf(0.0, 1.0, log_scale);
 }
-void apply_audio_spacialization(void* frames, Audio_Format format, u64 number_of_frames, Vector3 pos) {
-
-	if (format.channels == 1) {
-		apply_audio_spacialization_mono(frames, format, number_of_frames, pos);
-	}
 
+// Gain for each output channel to place a sound at pos
+void 
+get_audio_spacialization_gains(Vector3 pos, u64 channels, f32 *gains) {
+	// No idea if this actually gives the perception of audio being positioned.
+	
     float32 distance = sqrtf(pos.x * pos.x + pos.y * pos.y + pos.z * pos.z);
     float32 attenuation = 1.0f / (1.0f + distance);
 
     float32 left_right_pan = (pos.x + 1.0f) * 0.5f;
     float32 up_down_pan = (pos.y + 1.0f) * 0.5f;   
     float32 front_back_pan = (pos.z + 1.0f) * 0.5f;
-
-	u64 comp_size  = get_audio_bit_width_byte_size(format.bit_width);
-    u64 frame_size = comp_size * format.channels;
 	
-	float32 high_pass_coeff = 0.8f + 0.2f * up_down_pan;
-    float32 low_pass_coeff = 1.0f - high_pass_coeff;
-	
-    // Apply gains to each frame
-    for (u64 i = 0; i < number_of_frames; ++i) {
-        for (u64 c = 0; c < format.channels; ++c) {
-        	// Convert whatever to float32 -1 to 1
-        	float32 sample;
-            convert_one_component(
-            	&sample, 
-            	AUDIO_BITS_32, 
-            	(u8*)frames+i*frame_size+c*comp_size, 
-            	format.bit_width
-        	);
-            float32 gain = 1.0f / format.channels;
-
-            if (format.channels == 2) {
-            
-            	// time delay and phase shift for vertical position
-			    float32 phase_shift = (up_down_pan - 0.5f) * 0.5f; // 0.5 radians phase shift range
-            
-                // Stereo
-                if (c == 0) {
-                    gain = (1.0f - left_right_pan) * attenuation;
-                    sample = sample * cos(phase_shift) - sample * sin(phase_shift);
-                } else if (c == 1) {
-                    gain = left_right_pan * attenuation;
-                    sample = sample * cos(phase_shift) + sample * sin(phase_shift);
-                }
-            } else if (format.channels == 4) {
-                // Quadraphonic sound (left-right, front-back)
-                if (c == 0) {
-                    gain = (1.0f - left_right_pan) * (1.0f - front_back_pan) * attenuation;
-                } else if (c == 1) {
-                    gain = left_right_pan * (1.0f - front_back_pan) * attenuation;
-                } else if (c == 2) {
-                    gain = (1.0f - left_right_pan) * front_back_pan * attenuation;
-                } else if (c == 3) {
-                    gain = left_right_pan * front_back_pan * attenuation;
-                }
-            } else if (format.channels == 6) {
-                // 5.1 surround sound (left, right, center, LFE, rear left, rear right)
-                if (c == 0) {
-                    gain = (1.0f - left_right_pan) * attenuation;
-                } else if (c == 1) {
-                    gain = left_right_pan * attenuation;
-                } else if (c == 2) {
-                    gain = (1.0f - front_back_pan) * attenuation;
-                } else if (c == 3) {
-                    gain = 0.5f * attenuation; // LFE (subwoofer) channel
-                } else if (c == 4) {
-                    gain = (1.0f - left_right_pan) * front_back_pan * attenuation;
-                } else if (c == 5) {
-                    gain = left_right_pan * front_back_pan * attenuation;
-                }
-            } else {
-            	// No idea what device this is, just distribute equally
-                gain = attenuation / format.channels;
-            }
+	for (u64 c = 0; c < channels; ++c) {
+		float32 gain = 1.0f / channels;
 
-			sample *= gain;
-			// Convert back to whatever
-			convert_one_component(
-            	(u8*)frames+i*frame_size+c*comp_size, 
-            	format.bit_width,
-            	&sample, 
-            	AUDIO_BITS_32
-        	);
-        }
-    }
+		if (channels == 2) {
+		
+			// time delay and phase shift for vertical position
+		    float32 phase_shift = (up_down_pan - 0.5f) * 0.5f; // 0.5 radians phase shift range
+		
+		    // Stereo
+		    if (c == 0) {
+		        gain = (1.0f - left_right_pan) * attenuation * (cos(phase_shift) - sin(phase_shift));
+		    } else if (c == 1) {
+		        gain = left_right_pan * attenuation * (cos(phase_shift) + sin(phase_shift));
+		    }
+		} else if (channels == 4) {
+		    // Quadraphonic sound (left-right, front-back)
+		    if (c == 0) {
+		        gain = (1.0f - left_right_pan) * (1.0f - front_back_pan) * attenuation;
+		    } else if (c == 1) {
+		        gain = left_right_pan * (1.0f - front_back_pan) * attenuation;
+		    } else if (c == 2) {
+		        gain = (1.0f - left_right_pan) * front_back_pan * attenuation;
+		    } else if (c == 3) {
+		        gain = left_right_pan * front_back_pan * attenuation;
+		    }
+		} else if (channels == 6) {
+		    // 5.1 surround sound (left, right, center, LFE, rear left, rear right)
+		    if (c == 0) {
+		        gain = (1.0f - left_right_pan) * attenuation;
+		    } else if (c == 1) {
+		        gain = left_right_pan * attenuation;
+		    } else if (c == 2) {
+		        gain = (1.0f - front_back_pan) * attenuation;
+		    } else if (c == 3) {
+		        gain = 0.5f * attenuation; // LFE (subwoofer) channel
+		    } else if (c == 4) {
+		        gain = (1.0f - left_right_pan) * front_back_pan * attenuation;
+		    } else if (c == 5) {
+		        gain = left_right_pan * front_back_pan * attenuation;
+		    }
+		} else {
+			// Mono, or no idea what device this is, just distribute equally
+		    gain = attenuation / channels;
+		}
+		
+		gains[c] = gain;
+	}
 }
 
 void apply_audio_volume(void* frames, Audio_Format format, u64 number_of_frames, float32 vol) {
-	
-	// #Speed
-	// This is lazy, also it can be combined with other passes.
-
 	u64 comp_size  = get_audio_bit_width_byte_size(format.bit_width);
     u64 frame_size = comp_size * format.channels;
 	if (vol <= 0.0) {
 		memset(frames, 0, frame_size*number_of_frames);
+		return;
 	}
 	
-	for (u64 i = 0; i < number_of_frames; ++i) {
-        for (u64 c = 0; c < format.channels; ++c) {
-        	float32 sample;
-            convert_one_component(
-            	&sample, 
-            	AUDIO_BITS_32, 
-            	(u8*)frames+i*frame_size+c*comp_size, 
-            	format.bit_width
-        	);
-        	
-        	sample *= vol;
-        	
-			convert_one_component(
-            	(u8*)frames+i*frame_size+c*comp_size, 
-            	format.bit_width,
-            	&sample, 
-            	AUDIO_BITS_32
-        	);
-        }
-    }
+	apply_gain_ramp(frames, number_of_frames, format, vol, vol);
+}
+
+// Samples the next number_of_output_frames frames of the player and adds them to bus, which
+// has out_format.channels f32 samples per frame.
+void
+audio_player_mix_to_bus(Audio_Player *p, f32 *bus, u64 number_of_output_frames, Audio_Format out_format, Audio_Scratch *scratch) {
+	if (p->state != AUDIO_PLAYER_STATE_PLAYING) {
+		if (p->fade_frames == 0) return;
+	}
+	
+	spinlock_acquire_or_wait(&p->sample_lock);
+	
+	Audio_Source src = p->source;
+	
+	mutex_acquire_or_wait(&src.mutex_for_destroy);
+	
+	u64 in_comp_size = get_audio_bit_width_byte_size(src.format.bit_width);
+	u64 in_frame_size = in_comp_size * src.format.channels;
+	
+	// The resampler picks up where it left off last callback, so it tells us how many
+	// source frames it needs for this one.
+	u64 number_of_sample_frames = number_of_output_frames;
+	Audio_Resampler *resampler = &p->resampler;
+	bool resampler_reset = p->resampler_reset;
+	p->resampler_reset = false;
+	bool need_resample = src.format.sample_rate != out_format.sample_rate;
+	if (need_resample) {
+		bool resampler_matches = resampler->initted
+		                      && !resampler_reset
+		                      && resampler->channels == (u64)src.format.channels
+		                      && resampler->src_rate == src.format.sample_rate
+		                      && resampler->dst_rate == out_format.sample_rate
+		                      && resampler->quality == p->resample_quality;
+		if (!resampler_matches) {
+			audio_resampler_init(resampler, src.format.channels, src.format.sample_rate, out_format.sample_rate, p->resample_quality);
+		}
+		number_of_sample_frames = audio_resampler_get_input_frame_count(resampler, number_of_output_frames);
+	}
+	
+	void *sample_buffer = audio_scratch_get(&scratch->samples, &scratch->samples_size, number_of_sample_frames*in_frame_size);
+
+	p->frame_index = audio_source_sample_next_frames(
+		&src,
+		p->frame_index, 
+		number_of_sample_frames,
+		sample_buffer,
+		p->looping
+	);
+	
+	// Everything from here on is on our copy in sample_buffer. Releasing early matters when
+	// players are mixed on several threads, since players of the same source share the mutex.
+	mutex_release(&src.mutex_for_destroy);
+	
+	// Where we are in the fade, if fading. The rest of the buffer is silent after a
+	// fade out and at full volume after a fade in.
+	bool fading_out = p->state == AUDIO_PLAYER_STATE_PAUSED;
+	u64 fade_output_frames = 0;
+	f64 fade_start = 0;
+	f64 fade_end = 0;
+	if (p->fade_frames > 0) {
+		u64 frames_to_fade = min(p->fade_frames, number_of_sample_frames);
+		u64 frames_faded_so_far = p->fade_frames_total-p->fade_frames;
+		
+		fade_start = (f64)frames_faded_so_far / (f64)p->fade_frames_total;
+		fade_end = (f64)(frames_faded_so_far + frames_to_fade) / (f64)p->fade_frames_total;
+		
+		if (frames_to_fade == number_of_sample_frames) {
+			fade_output_frames = number_of_output_frames;
+		} else {
+			fade_output_frames = (u64)round((f64)frames_to_fade*(f64)number_of_output_frames/(f64)number_of_sample_frames);
+			fade_output_frames = min(fade_output_frames, number_of_output_frames);
+		}
+		
+		p->fade_frames -= frames_to_fade;
+	}
+	
+	spinlock_release(&p->sample_lock);
+	
+	// What we mix from, one output frame per frame
+	void *mix_src = sample_buffer;
+	Audio_Format_Bits mix_bits = src.format.bit_width;
+	u64 mix_frame_size = in_frame_size;
+	
+	if (need_resample) {
+		f32 *resample_buffer = audio_scratch_get((void**)&scratch->resampled, &scratch->resampled_size, number_of_output_frames*src.format.channels*sizeof(f32));
+		
+		audio_resampler_process(resampler, resample_buffer, number_of_output_frames, sample_buffer, src.format.bit_width, number_of_sample_frames, scratch);
+		
+		mix_src = resample_buffer;
+		mix_bits = AUDIO_BITS_32;
+		mix_frame_size = src.format.channels*sizeof(f32);
+	}
+	
+	Audio_Mix_Matrix matrix;
+	get_audio_channel_map(&matrix, src.format.channels, out_format.channels);
+	
+	if (!p->disable_spacialization) {
+		f32 gains[AUDIO_MAX_MIX_CHANNELS];
+		get_audio_spacialization_gains(p->position, out_format.channels, gains);
+		for (u64 o = 0; o < out_format.channels; o++) {
+			for (u64 i = 0; i < src.format.channels; i++) matrix.m[o][i] *= gains[o];
+		}
+	}
+	
+	f32 volume = p->volume;
+	
+	if (volume > 0) {
+		u64 f = 0;
+		while (f < fade_output_frames) {
+			u64 n = min(AUDIO_FADE_RAMP_FRAMES, fade_output_frames-f);
+			f64 t0 = lerpf(fade_start, fade_end, (f64)f/(f64)fade_output_frames);
+			f64 t1 = lerpf(fade_start, fade_end, (f64)(f+n)/(f64)fade_output_frames);
+			if (fading_out) {
+				t0 = 1.0-t0;
+				t1 = 1.0-t1;
+			}
+			
+			mix_frames_to_bus(
+				bus+f*out_format.channels, 
+				out_format.channels, 
+				(u8*)mix_src+f*mix_frame_size, 
+				mix_bits, 
+				src.format.channels, 
+				&matrix, 
+				n, 
+				audio_fade_in_gain(t0)*volume, 
+				audio_fade_in_gain(t1)*volume
+			);
+			f += n;
+		}
+		
+		if (!fading_out && f < number_of_output_frames) {
+			mix_frames_to_bus(
+				bus+f*out_format.channels, 
+				out_format.channels, 
+				(u8*)mix_src+f*mix_frame_size, 
+				mix_bits, 
+				src.format.channels, 
+				&matrix, 
+				number_of_output_frames-f, 
+				volume, 
+				volume
+			);
+		}
+	}
+}
+
+///
+// Mixing on several threads
+// With lots of players the audio thread splits them over a worker pool. Every job mixes a
+// contiguous range of players into its own f32 submix, and the submixes are added to the bus
+// in job order at the end, so the result doesn't depend on which thread took which job.
+// Waking workers isn't free and they might not get scheduled in time when the game keeps
+// the cores busy, so we only go parallel when mixing serially would eat a good part of the
+// time until the device needs the buffer, and go back to serial for a while if a parallel
+// mix turns out slower than the serial estimate. The pool isn't started before that.
+// Players of streamed sources are always mixed on the audio thread, since decoding uses
+// thread_local buffers and reads the file under the source's mutex anyway.
+//
+
+#define AUDIO_MAX_MIX_THREADS 4 // Including the audio thread
+#define AUDIO_MIN_PLAYERS_PER_MIX_JOB 8
+// Part of the callback period serial mixing may take before we split it over threads
+#define AUDIO_PARALLEL_MIX_BUDGET 0.05
+// Callbacks to stay serial after a parallel mix was slower than serial would have been
+#define AUDIO_PARALLEL_MIX_BACKOFF 200
+
+// #Global
+// Threads helping the audio thread mix. -1 picks from the processor count.
+// Safe to set from any thread, the audio thread restarts its pool on the next callback.
+ogb_instance s64 audio_mix_thread_count;
+ogb_instance Worker_Pool audio_mix_pool;
+ogb_instance bool audio_mix_pool_initted;
+
+#if !OOGABOOGA_LINK_EXTERNAL_INSTANCE
+s64 audio_mix_thread_count = -1;
+Worker_Pool audio_mix_pool;
+bool audio_mix_pool_initted = false;
+#endif
+
+typedef struct Audio_Mix_Jobs {
+	Audio_Player **players;
+	u64 player_count;
+	u64 job_count;
+	f32 *bus;
+	f32 *submixes; // job_count-1 of them, job 0 mixes straight into bus
+	Audio_Scratch *scratch; // One per job
+	u64 number_of_output_frames;
+	Audio_Format out_format;
+} Audio_Mix_Jobs;
+
+void
+audio_mix_job(void *data, u64 job_index) {
+	Audio_Mix_Jobs *jobs = (Audio_Mix_Jobs*)data;
+	
+	u64 sample_count = jobs->number_of_output_frames*jobs->out_format.channels;
+	f32 *submix = jobs->bus;
+	if (job_index > 0) {
+		submix = jobs->submixes + (job_index-1)*sample_count;
+		memset(submix, 0, sample_count*sizeof(f32));
+	}
+	
+	u64 first = jobs->player_count*job_index/jobs->job_count;
+	u64 end   = jobs->player_count*(job_index+1)/jobs->job_count;
+	for (u64 i = first; i < end; i++) {
+		audio_player_mix_to_bus(jobs->players[i], submix, jobs->number_of_output_frames, jobs->out_format, &jobs->scratch[job_index]);
+	}
+}
+
+// Mixes the players into bus on the pool's threads and the calling thread.
+// The submixes need room for pool->thread_count*frames*channels samples, and there has to be
+// a scratch for each of pool->thread_count+1 jobs.
+void
+audio_mix_players_parallel(Worker_Pool *pool, Audio_Player **players, u64 player_count, f32 *bus, f32 *submixes, Audio_Scratch *scratch, u64 number_of_output_frames, Audio_Format out_format) {
+	Audio_Player **memory_players = talloc(max(player_count, 1)*sizeof(Audio_Player*));
+	Audio_Player **stream_players = talloc(max(player_count, 1)*sizeof(Audio_Player*));
+	u64 memory_count = 0;
+	u64 stream_count = 0;
+	for (u64 i = 0; i < player_count; i++) {
+		if (players[i]->source.kind == AUDIO_SOURCE_FILE_STREAM) stream_players[stream_count++] = players[i];
+		else                                                     memory_players[memory_count++] = players[i];
+	}
+	
+	u64 job_count = min(pool->thread_count+1, max(memory_count/AUDIO_MIN_PLAYERS_PER_MIX_JOB, 1));
+	
+	Audio_Mix_Jobs jobs = ZERO(Audio_Mix_Jobs);
+	jobs.players = memory_players;
+	jobs.player_count = memory_count;
+	jobs.job_count = job_count;
+	jobs.bus = bus;
+	jobs.submixes = submixes;
+	jobs.scratch = scratch;
+	jobs.number_of_output_frames = number_of_output_frames;
+	jobs.out_format = out_format;
+	
+	worker_pool_run(pool, audio_mix_job, &jobs, job_count);
+	
+	u64 sample_count = number_of_output_frames*out_format.channels;
+	for (u64 j = 1; j < job_count; j++) {
+		mix_samples_f32(bus, submixes+(j-1)*sample_count, sample_count);
+	}
+	
+	for (u64 i = 0; i < stream_count; i++) {
+		audio_player_mix_to_bus(stream_players[i], bus, number_of_output_frames, out_format, &scratch[0]);
+	}
+}
+
+u64
+audio_get_mix_thread_count() {
+	s64 thread_count = audio_mix_thread_count;
+	if (thread_count < 0) {
+		thread_count = clamp((s64)os.logical_processor_count, 1, AUDIO_MAX_MIX_THREADS)-1;
+	}
+	return (u64)min(thread_count, WORKER_POOL_MAX_THREADS);
+}
+
+// Called on the audio thread. Stops the pool if it's not the size we want anymore, and
+// starts it if start is set.
+Worker_Pool *
+audio_update_mix_pool(u64 thread_count, bool start) {
+	if (audio_mix_pool_initted && audio_mix_pool.thread_count != thread_count) {
+		worker_pool_destroy(&audio_mix_pool);
+		audio_mix_pool_initted = false;
+	}
+	if (!audio_mix_pool_initted && start && thread_count > 0) {
+		worker_pool_init(&audio_mix_pool, thread_count);
+		audio_mix_pool_initted = true;
+	}
+	
+	return audio_mix_pool_initted ? &audio_mix_pool : 0;
 }
 
 // This is supposed to be called by OS layer audio thread whenever it wants more audio samples
@@ -1605,187 +2500,110 @@ do_program_audio_sample(u64 number_of_output_frames, Audio_Format out_format,
 							 void *output) {
 							 
 	reset_temporary_storage();
-							 
-	u64 out_comp_size  = get_audio_bit_width_byte_size(out_format.bit_width);
-    u64 out_frame_size = out_comp_size * out_format.channels;
-    u64 output_size    = number_of_output_frames * out_frame_size;
-    
-	memset(output, 0, output_size);
 	
-	Audio_Player_Block *block = &audio_player_block;
+	u64 sample_count = number_of_output_frames * out_format.channels;
 	
 	// #Cleanup #Memory refactor intermediate buffers
-	thread_local local_persist void *mix_buffer = 0;
-	thread_local local_persist u64 mix_buffer_size;
-	thread_local local_persist void *convert_buffer = 0;
-	thread_local local_persist u64 convert_buffer_size;
+	thread_local local_persist f32 *bus = 0;
+	thread_local local_persist u64 bus_size;
+	
+	if (!bus || bus_size < sample_count*sizeof(f32)) {
+		u64 new_size = get_next_power_of_two(sample_count*sizeof(f32));
+		if (bus) dealloc(get_heap_allocator(), bus);
+		bus = alloc(get_heap_allocator(), new_size);
+		bus_size = new_size;
+	}
+	memset(bus, 0, sample_count*sizeof(f32));
 	
-	memset(mix_buffer, 0, mix_buffer_size);
+	// Release finished players and grab the ones we should mix while holding the lock,
+	// then mix without it so audio_player_get_one doesn't wait for us.
+	spinlock_acquire_or_wait(&audio_player_pool_lock);
 	
+	u64 player_count = pool_get_count(&audio_player_pool);
+	Audio_Player **players = player_count ? talloc(player_count*sizeof(Audio_Player*)) : 0;
+	u64 mix_count = 0;
 	
-	while (block) {
+	for (s64 i = (s64)player_count-1; i >= 0; i -= 1) {
+		Audio_Player *p = pool_get_nth(&audio_player_pool, i);
 		
-		for (u64 i = 0; i < AUDIO_PLAYERS_PER_BLOCK; i++) {
-			Audio_Player *p = &block->players[i];
-			if (p->release_when_done && (p->frame_index >= p->source.number_of_frames
-										  || !p->has_source)) {
-				p->allocated = false;
-			}
-			if (!p->allocated) {
-				continue;
-			}
-			
-			if (p->marked_for_release) {
-				p->marked_for_release = false;
-				p->allocated = false;
-				continue;
-			}
-			
-			if (p->state != AUDIO_PLAYER_STATE_PLAYING) {
-				if (p->fade_frames == 0) continue;
-			}
-			
-			spinlock_acquire_or_wait(&p->sample_lock);
-			
-			Audio_Source src = p->source;
-			
-			mutex_acquire_or_wait(&src.mutex_for_destroy);
-			
-			bool need_convert = !bytes_match(
-				&out_format, 
-				&src.format, 
-				sizeof(Audio_Format)
-			);
-			
-			u64 in_comp_size 
-				= get_audio_bit_width_byte_size(src.format.bit_width);
-			
-			u64 in_frame_size = in_comp_size * src.format.channels;
-			u64 input_size = number_of_output_frames * in_frame_size;
-			
-			u64 biggest_size = max(input_size, output_size);
-	
-			if (!mix_buffer || mix_buffer_size < biggest_size) {
-				u64 new_size = get_next_power_of_two(biggest_size);
-				if (mix_buffer) dealloc(get_heap_allocator(), mix_buffer);
-				mix_buffer = alloc(get_heap_allocator(), new_size);
-				mix_buffer_size = new_size;
-				memset(mix_buffer, 0, new_size);
-			}
-			
-			void *target_buffer = mix_buffer;
-			u64 number_of_sample_frames = number_of_output_frames;
-			
-			if (need_convert) {
-				if (src.format.sample_rate != out_format.sample_rate) {
-					f32 src_ratio 
-						= (f32)src.format.sample_rate 
-						  / (f32)out_format.sample_rate;
-						
-					number_of_sample_frames = round(number_of_output_frames * src_ratio);
-					input_size = number_of_sample_frames * in_frame_size;
-				}
-				
-				u64 biggest_size = max(input_size, output_size);
-				
-				if (!convert_buffer || convert_buffer_size < biggest_size) {
-					u64 new_size = get_next_power_of_two(biggest_size);
-					if (convert_buffer) dealloc(get_heap_allocator(), convert_buffer);
-					convert_buffer = alloc(get_heap_allocator(), new_size);
-					convert_buffer_size = new_size;
-					memset(convert_buffer, 0, new_size);
-				}
-				target_buffer = convert_buffer;
-				
-			}
+		bool done = p->release_when_done && (p->frame_index >= p->source.number_of_frames || !p->has_source);
+		if (done || p->marked_for_release) {
+			pool_release(&audio_player_pool, p);
+			continue;
+		}
+		
+		players[mix_count] = p;
+		mix_count += 1;
+	}
 	
-			p->frame_index = audio_source_sample_next_frames(
-				&src,
-				p->frame_index, 
-				number_of_sample_frames,
-				target_buffer,
-				p->looping
-			);
-			
-			if (p->fade_frames > 0) {
-				u64 frames_to_fade = min(p->fade_frames, number_of_sample_frames);
-				
-				u64 frames_faded_so_far = (p->fade_frames_total-p->fade_frames);
-				
-				switch (p->state) {
-					case AUDIO_PLAYER_STATE_PLAYING: {
-						// We need to fade in
-						float64 fade_from 
-							= (f64)frames_faded_so_far / (f64)p->fade_frames_total;
-							
-						float64 fade_to 
-							= (f64)(frames_faded_so_far + frames_to_fade) / (f64)p->fade_frames_total;
-						audio_apply_fade_in(
-							target_buffer, 
-							frames_to_fade, 
-							p->source.format, 
-							fade_from,
-							fade_to
-						);
-						break;
-					}
-					case AUDIO_PLAYER_STATE_PAUSED: {
-						// We need to fade out
-						// #Bug #Incomplete
-						// I can't get this to fade out without noise.
-						// I tried dithering but that didn't help.
-						float64 fade_from 
-							= 1.0 - (f64)frames_faded_so_far / (f64)p->fade_frames_total;
-							
-						float64 fade_to 
-							= 1.0 - (f64)(frames_faded_so_far + frames_to_fade) / (f64)p->fade_frames_total;
-						audio_apply_fade_out(
-							target_buffer, 
-							frames_to_fade, 
-							p->source.format, 
-							fade_from,
-							fade_to
-						);
-						break;
-					}
-				}
-				
-				p->fade_frames -= frames_to_fade;
-				
-				if (frames_to_fade < number_of_sample_frames) {
-					memset(
-						(u8*)target_buffer+frames_to_fade, 
-						0, 
-						number_of_sample_frames-frames_to_fade
-					);
-				}
-			}
-			
-			spinlock_release(&p->sample_lock);
-						
-			if (need_convert) {
-				int converted = convert_frames(
-					mix_buffer, 
-					out_format, 
-					convert_buffer, 
-					src.format,
-					number_of_sample_frames
-				);
-				assert(converted == number_of_output_frames);
-			}
-
-			if (!p->disable_spacialization) {
-				apply_audio_spacialization(mix_buffer, out_format, number_of_output_frames, p->position);
-			}
-			if (p->volume != 0.0) {
-				apply_audio_volume(mix_buffer, out_format, number_of_output_frames, p->volume);
-			}
-			
-			mix_frames(output, mix_buffer, number_of_output_frames, out_format);
-			
-			mutex_release(&src.mutex_for_destroy);
+	spinlock_release(&audio_player_pool_lock);
+	
+	// Measured on serial mixes, so we know when it's worth going parallel
+	thread_local local_persist f64 serial_seconds_per_player_frame = 0;
+	thread_local local_persist u64 parallel_backoff = 0;
+	
+	// One for each job, the first one is ours when mixing serially
+	thread_local local_persist Audio_Scratch mix_scratch[WORKER_POOL_MAX_THREADS+1];
+	
+	u64 mix_thread_count = audio_get_mix_thread_count();
+	
+	f64 deadline = (f64)number_of_output_frames/(f64)out_format.sample_rate;
+	f64 serial_estimate = serial_seconds_per_player_frame*(f64)(mix_count*number_of_output_frames);
+	
+	bool parallel = mix_thread_count > 0 
+	             && parallel_backoff == 0
+	             && mix_count >= AUDIO_MIN_PLAYERS_PER_MIX_JOB*2 
+	             && serial_estimate > deadline*AUDIO_PARALLEL_MIX_BUDGET;
+	if (parallel_backoff > 0) parallel_backoff -= 1;
+	
+	Worker_Pool *pool = audio_update_mix_pool(mix_thread_count, parallel);
+	
+	f64 mix_start = os_get_current_time_in_seconds();
+	
+	if (parallel) {
+		u64 submixes_size = pool->thread_count*sample_count*sizeof(f32);
+		thread_local local_persist f32 *submixes = 0;
+		thread_local local_persist u64 submixes_capacity = 0;
+		if (!submixes || submixes_capacity < submixes_size) {
+			u64 new_size = get_next_power_of_two(submixes_size);
+			if (submixes) dealloc(get_heap_allocator(), submixes);
+			submixes = alloc(get_heap_allocator(), new_size);
+			submixes_capacity = new_size;
 		}
 		
-		block = block->next;
+		audio_mix_players_parallel(pool, players, mix_count, bus, submixes, mix_scratch, number_of_output_frames, out_format);
+	} else {
+		for (u64 i = 0; i < mix_count; i++) {
+			audio_player_mix_to_bus(players[i], bus, number_of_output_frames, out_format, &mix_scratch[0]);
+		}
+	}
+	
+	f64 mix_time = os_get_current_time_in_seconds()-mix_start;
+	
+	if (parallel) {
+		// Workers were busy or slow to wake, don't bet the deadline on them for a while
+		if (mix_time > serial_estimate) parallel_backoff = AUDIO_PARALLEL_MIX_BACKOFF;
+	} else if (mix_count > 0) {
+		f64 per_player_frame = mix_time/(f64)(mix_count*number_of_output_frames);
+		if (serial_seconds_per_player_frame == 0) serial_seconds_per_player_frame = per_player_frame;
+		else serial_seconds_per_player_frame = lerpf(serial_seconds_per_player_frame, per_player_frame, 0.1);
+	}
+	
+	// Output stage
+	thread_local local_persist f32 limiter_gain = 1.0f;
+	thread_local local_persist u64 dither_seed = 1;
+	
+	if (audio_output_limiter_enabled) {
+		audio_limit_samples(bus, number_of_output_frames, out_format.channels, out_format.sample_rate, &limiter_gain);
+	}
+	
+	switch (out_format.bit_width) {
+		case AUDIO_BITS_32: memcpy(output, bus, sample_count*sizeof(f32)); break;
+		case AUDIO_BITS_16: {
+			if (audio_output_dither_enabled) convert_samples_f32_to_s16_dithered((s16*)output, bus, sample_count, &dither_seed);
+			else                             convert_samples_f32_to_s16((s16*)output, bus, sample_count);
+			break;
+		}
+		default: panic("Unhandled bits");
 	}
 }
\ No newline at end of file
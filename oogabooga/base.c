@@ -151,6 +151,29 @@ dealloc(Allocator allocator, void *p) {
 	allocator.proc(0, p, ALLOCATOR_DEALLOCATE, allocator.data);
 }
 
+// Resizes the allocation at p to new_size, keeping the first old_size bytes.
+// Allocators that handle ALLOCATOR_REALLOCATE may resize in place, if they return 0
+// we fall back to alloc + copy + dealloc.
+void*
+alloc_resize(Allocator allocator, void *p, u64 old_size, u64 new_size) {
+	if (!p) return alloc(allocator, new_size);
+	
+	assert(new_size > 0, "You requested an allocation of zero bytes. I'm not sure what you want with that.");
+	
+	void *result = allocator.proc(new_size, p, ALLOCATOR_REALLOCATE, allocator.data);
+	if (!result) {
+		result = allocator.proc(new_size, 0, ALLOCATOR_ALLOCATE, allocator.data);
+		memcpy(result, p, old_size < new_size ? old_size : new_size);
+		dealloc(allocator, p);
+	}
+	
+#if DO_ZERO_INITIALIZATION
+	if (new_size > old_size) memset((u8*)result+old_size, 0, new_size-old_size);
+#endif
+	
+	return result;
+}
+
 void 
 push_context(Context c) {
 	assert(num_contexts < CONTEXT_STACK_MAX, "Context stack overflow");
@@ -77,6 +77,46 @@ binary_semaphore_wait(Binary_Semaphore *sem);
 void ogb_instance
 binary_semaphore_signal(Binary_Semaphore *sem);
 
+///
+// Worker pool
+// A fixed set of threads for splitting one big piece of work into jobs, like a parallel for.
+// worker_pool_run calls proc(data, job_index) for every job index below job_count, spread over
+// the workers and the calling thread, and returns when all of them are done.
+// Idle workers sleep on a semaphore, so a pool costs nothing between runs.
+//
+//    Worker_Pool pool;
+//    worker_pool_init(&pool, os.logical_processor_count-1);
+//    worker_pool_run(&pool, do_chunk, &chunks, chunk_count);
+//    worker_pool_destroy(&pool);
+//
+#define WORKER_POOL_MAX_THREADS 64
+
+typedef void(*Worker_Job_Proc)(void *data, u64 job_index);
+
+typedef struct Worker_Pool {
+	Thread threads[WORKER_POOL_MAX_THREADS];
+	u64 thread_count;
+	Semaphore_Handle wake;
+	
+	// The current run
+	Worker_Job_Proc proc;
+	void *data;
+	u64 job_count;
+	volatile u64 next_job;
+	volatile u64 checked_in_count; // Workers that woke for this run and are done with it
+	volatile bool quit;
+} Worker_Pool;
+
+// thread_count may be 0, then runs are done on the calling thread only
+void ogb_instance
+worker_pool_init(Worker_Pool *pool, u64 thread_count);
+
+void ogb_instance
+worker_pool_destroy(Worker_Pool *pool);
+
+void ogb_instance
+worker_pool_run(Worker_Pool *pool, Worker_Job_Proc proc, void *data, u64 job_count);
+
 
 #if !OOGABOOGA_LINK_EXTERNAL_INSTANCE
 
@@ -195,4 +235,88 @@ void binary_semaphore_signal(Binary_Semaphore *sem) {
     mutex_release(&sem->mutex);
 }
 
-#endif
\ No newline at end of file
+
+
+///
+// Worker pool
+
+inline u64 worker_pool_atomic_increment(volatile u64 *x) {
+	while (true) {
+		u64 old = *x;
+		if (compare_and_swap_64((u64*)x, old+1, old)) return old;
+	}
+}
+
+void worker_pool_do_jobs(Worker_Pool *pool) {
+	while (true) {
+		u64 job = worker_pool_atomic_increment(&pool->next_job);
+		if (job >= pool->job_count) break;
+		pool->proc(pool->data, job);
+	}
+}
+
+void worker_pool_thread_proc(Thread *t) {
+	Worker_Pool *pool = (Worker_Pool*)t->data;
+	while (true) {
+		os_semaphore_wait(pool->wake);
+		MEMORY_BARRIER;
+		if (pool->quit) break;
+		
+		worker_pool_do_jobs(pool);
+		
+		MEMORY_BARRIER;
+		worker_pool_atomic_increment(&pool->checked_in_count);
+	}
+}
+
+void worker_pool_init(Worker_Pool *pool, u64 thread_count) {
+	assert(thread_count <= WORKER_POOL_MAX_THREADS, "A worker pool can have at most %d threads", WORKER_POOL_MAX_THREADS);
+	
+	memset(pool, 0, sizeof(Worker_Pool));
+	pool->thread_count = thread_count;
+	pool->wake = os_make_semaphore(0);
+	
+	for (u64 i = 0; i < thread_count; i++) {
+		os_thread_init(&pool->threads[i], worker_pool_thread_proc);
+		pool->threads[i].data = pool;
+		os_thread_start(&pool->threads[i]);
+	}
+}
+
+void worker_pool_destroy(Worker_Pool *pool) {
+	pool->quit = true;
+	MEMORY_BARRIER;
+	os_semaphore_signal(pool->wake, (u32)pool->thread_count);
+	for (u64 i = 0; i < pool->thread_count; i++) {
+		os_thread_destroy(&pool->threads[i]);
+	}
+	os_destroy_semaphore(pool->wake);
+	memset(pool, 0, sizeof(Worker_Pool));
+}
+
+void worker_pool_run(Worker_Pool *pool, Worker_Job_Proc proc, void *data, u64 job_count) {
+	if (job_count == 0) return;
+	
+	pool->proc = proc;
+	pool->data = data;
+	pool->job_count = job_count;
+	pool->next_job = 0;
+	pool->checked_in_count = 0;
+	MEMORY_BARRIER;
+	
+	// No point in waking more workers than there are jobs for
+	u64 wake_count = min(pool->thread_count, job_count-1);
+	os_semaphore_signal(pool->wake, (u32)wake_count);
+	
+	worker_pool_do_jobs(pool);
+	
+	// Every woken worker checks in once it's out of jobs, so after this none of them are
+	// still in this run when the next one is set up.
+	while (pool->checked_in_count < wake_count) {
+		os_yield_thread();
+		MEMORY_BARRIER;
+	}
+	MEMORY_BARRIER;
+}
+
+#endif
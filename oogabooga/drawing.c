@@ -5,15 +5,32 @@
 	void push_window_scissor(Vector2 min, Vector2 max);
 	void pop_window_scissor();
 	
+	Matrix4 draw_frame_get_world_to_clip();
+	Matrix4 draw_frame_get_clip_to_world();
+	Range2f draw_frame_get_visible_world_rect();
+	bool draw_frame_is_world_rect_visible(Range2f rect);
+	u64 draw_frame_cull_world_ranges(const Range2f *ranges, u32 *out_indices, u64 count);
+	
 	Draw_Quad *draw_rect(Vector2 position, Vector2 size, Vector4 color);
 	Draw_Quad *draw_rect_xform(Matrix4 xform, Vector2 size, Vector4 color);
 	Draw_Quad *draw_circle(Vector2 position, Vector2 size, Vector4 color);
 	Draw_Quad *draw_circle_xform(Matrix4 xform, Vector2 size, Vector4 color);
 	Draw_Quad *draw_image(Gfx_Image *image, Vector2 position, Vector2 size, Vector4 color);
 	Draw_Quad *draw_image_xform(Gfx_Image *image, Matrix4 xform, Vector2 size, Vector4 color);
+	u64 draw_sprites_batch(Gfx_Image *image, const Vector2 *positions, const Vector2 *sizes, const Vector4 *colors, u64 count);
+	u64 draw_sprites_batch_z(Gfx_Image *image, const Vector2 *positions, const Vector2 *sizes, const Vector4 *colors, const s32 *z, u64 count);
+	u64 draw_tilemap(Vector2 origin, Vector2 tile_size, u64 width, u64 height, Gfx_Image **images, const Vector4 *colors);
+	
+	void static_batch_begin(Static_Batch *batch);
+	void static_batch_end(Static_Batch *batch);
+	void draw_static_batch(Static_Batch *batch, Matrix4 xform);
+	void static_batch_invalidate(Static_Batch *batch);
+	bool static_batch_is_valid(Static_Batch *batch);
+	void delete_static_batch(Static_Batch *batch);
 	Draw_Quad *draw_quad_projected(Draw_Quad quad, Matrix4 world_to_clip);
 	Draw_Quad *draw_quad(Draw_Quad quad);
 	Draw_Quad *draw_quad_xform(Draw_Quad quad, Matrix4 xform);
+	Vector4 *draw_quad_userdata(Draw_Quad *q);
 	bool draw_text_callback(Gfx_Glyph glyph, Gfx_Font_Atlas *atlas, float glyph_x, float glyph_y, void *ud);
 	void draw_text_xform(Gfx_Font *font, string text, u32 raster_height, Matrix4 xform, Vector2 scale, Vector4 color);
 	void draw_text(Gfx_Font *font, string text, u32 raster_height, Vector2 position, Vector2 scale, Vector4 color);
@@ -21,62 +38,100 @@
 	void draw_line(Vector2 p0, Vector2 p1, float line_width, Vector4 color);
 */
 
-// We use radix sort so the exact bit count is of importance
-#define MAX_Z_BITS 21
-#define MAX_Z ((1 << MAX_Z_BITS)/2)
 #define Z_STACK_MAX 4096
 #define SCISSOR_STACK_MAX 4096
+// Quads index them with 16 bits
+#define MAX_SCISSORS_PER_FRAME 0xFFFF
+// More sorted runs than this are radix sorted instead of merged
+#define Z_SORT_MAX_MERGE_RUNS 8
+
 
-typedef struct Draw_Quad {
-	// BEWARE !! These are in ndc
-	Vector2 bottom_left, top_left, top_right, bottom_right;
-	// r, g, b, a
-	Vector4 color;
-	Gfx_Image *image;
-	Gfx_Filter_Mode image_min_filter;
-	Gfx_Filter_Mode image_mag_filter;
-	s32 z;
-	u8 type;
-	bool has_scissor;
-	// x1, y1, x2, y2
-	Vector4 uv;
-	Vector4 scissor;
-	
-	Vector4 userdata[VERTEX_2D_USER_DATA_COUNT]; // #Volatile do NOT change this to a pointer
-	
-} Draw_Quad;
 
+// More draw_static_batch calls than this in one frame is an error
+#define MAX_STATIC_BATCH_DRAWS 64
 
+typedef struct Static_Batch_Draw {
+	struct Static_Batch *batch;
+	Matrix4 transform; // world_to_clip * xform
+} Static_Batch_Draw;
 
 typedef struct Draw_Frame {
 	u64 num_quads;
+	// Used entries of scissor_buffer and userdata_buffer
+	u64 num_scissors;
+	u64 num_userdata;
 	
 	Matrix4 projection;
 	Matrix4 view;
 	
+	// projection * inverse(view) and its inverse, redone when projection or view has
+	// changed since. Get them with draw_frame_get_world_to_clip/clip_to_world.
+	Matrix4 _cached_projection;
+	Matrix4 _cached_view;
+	Matrix4 _world_to_clip;
+	Matrix4 _clip_to_world;
+	Range2f _visible_world_rect;
+	bool _world_to_clip_is_valid;
+	
 	bool enable_z_sorting;
+	// Only with enable_z_sorting. Quads with the same z are grouped by texture so batches
+	// run out of texture slots less often, at the cost of their order being undefined.
+	bool enable_texture_sorting;
 	s32 z_stack[Z_STACK_MAX];
 	u64 z_count;
 
-	Vector4 scissor_stack[SCISSOR_STACK_MAX];
+	u16 scissor_stack[SCISSOR_STACK_MAX]; // Draw_Quad.scissor_index of each pushed scissor
 	u64 scissor_count;
 	
 	void *cbuffer;
 	
+	// Drawn before the quads, in this order
+	Static_Batch_Draw static_batch_draws[MAX_STATIC_BATCH_DRAWS];
+	u64 static_batch_draw_count;
+	// Set between static_batch_begin and static_batch_end
+	struct Static_Batch *_recording_static_batch;
+	
 } Draw_Frame;
 
+typedef struct Draw_Frame_Stats {
+	u64 quad_count;
+	u64 draw_call_count;
+	// Draw calls that had to be made early because the batch ran out of texture slots
+	u64 texture_flush_count;
+	// How z sorting went. Quads already in z order skip it, a few sorted runs are merged
+	// and anything else is radix sorted.
+	u64 z_run_count;
+	u64 z_sort_skipped_count;
+	u64 z_sort_merged_count;
+	u64 z_sort_performed_count;
+	// Quads drawn from static batches, these are not in quad_count
+	u64 static_quad_count;
+} Draw_Frame_Stats;
+
 // #Cleanup this should be in Draw_Frame
 // #Global
 ogb_instance Draw_Quad *quad_buffer;
 ogb_instance u64 allocated_quads;
+// Side tables of the quads. Scissors are x1, y1, x2, y2 in window pixels with y up.
+ogb_instance Vector4 *scissor_buffer;
+ogb_instance u64 allocated_scissors;
+ogb_instance Draw_Quad_Userdata *userdata_buffer;
+ogb_instance u64 allocated_userdata;
 // This frame is passed to the platform layer and rendered in os_update.
 // Resets every frame.
 ogb_instance Draw_Frame draw_frame;
+// Stats of the last frame the renderer drew
+ogb_instance Draw_Frame_Stats draw_frame_stats;
 
 #if !OOGABOOGA_LINK_EXTERNAL_INSTANCE
 Draw_Quad *quad_buffer;
 u64 allocated_quads;
+Vector4 *scissor_buffer;
+u64 allocated_scissors;
+Draw_Quad_Userdata *userdata_buffer;
+u64 allocated_userdata;
 Draw_Frame draw_frame = ZERO(Draw_Frame);
+Draw_Frame_Stats draw_frame_stats = ZERO(Draw_Frame_Stats);
 #endif // NOT OOGABOOGA_LINK_EXTERNAL_INSTANCE
 
 void reset_draw_frame(Draw_Frame *frame) {
@@ -88,6 +143,24 @@ void reset_draw_frame(Draw_Frame *frame) {
 	frame->view = m4_scalar(1.0);	
 }
 
+// Grows a buffer of the draw frame so it has room for needed items, keeping the first used
+void draw_frame_grow_buffer(void **buffer, u64 *allocated, u64 used, u64 needed, u64 item_size) {
+	if (needed <= *allocated) return;
+	
+	// #Memory
+	u64 new_count = max(get_next_power_of_two(needed), 128);
+	
+	void *new_buffer = alloc(get_heap_allocator(), new_count*item_size);
+	
+	if (*buffer) {
+		memcpy(new_buffer, *buffer, used*item_size);
+		dealloc(get_heap_allocator(), *buffer);
+	}
+	
+	*buffer = new_buffer;
+	*allocated = new_count;
+}
+
 void push_z_layer(s32 z) {
 	assert(draw_frame.z_count < Z_STACK_MAX, "Too many z layers pushed. You can pop with pop_z_layer() when you are done drawing to it.");
 	
@@ -101,8 +174,13 @@ void pop_z_layer() {
 
 void push_window_scissor(Vector2 min, Vector2 max) {
 	assert(draw_frame.scissor_count < SCISSOR_STACK_MAX, "Too many scissors pushed. You can pop with pop_window_scissor() when you are done drawing to it.");
+	assert(draw_frame.num_scissors < MAX_SCISSORS_PER_FRAME, "Too many scissors pushed in one frame, max is %d", MAX_SCISSORS_PER_FRAME);
+	
+	draw_frame_grow_buffer((void**)&scissor_buffer, &allocated_scissors, draw_frame.num_scissors, draw_frame.num_scissors+1, sizeof(Vector4));
+	scissor_buffer[draw_frame.num_scissors] = v4(min.x, min.y, max.x, max.y);
+	draw_frame.num_scissors += 1;
 	
-	draw_frame.scissor_stack[draw_frame.scissor_count] = v4(min.x, min.y, max.x, max.y);
+	draw_frame.scissor_stack[draw_frame.scissor_count] = (u16)draw_frame.num_scissors;
 	draw_frame.scissor_count += 1;
 }
 void pop_window_scissor() {
@@ -110,12 +188,90 @@ void pop_window_scissor() {
 	draw_frame.scissor_count -= 1;
 }
 
+// projection and view are set directly, so we notice changes by comparing them to what
+// the cached matrices were made from. That's a lot cheaper than an inverse every quad.
+void draw_frame_update_world_to_clip(Draw_Frame *frame) {
+	if (frame->_world_to_clip_is_valid
+	 && bytes_match(&frame->_cached_projection, &frame->projection, sizeof(Matrix4))
+	 && bytes_match(&frame->_cached_view, &frame->view, sizeof(Matrix4))) {
+		return;
+	}
+	
+	frame->_cached_projection = frame->projection;
+	frame->_cached_view = frame->view;
+	frame->_world_to_clip = m4_mul(frame->projection, m4_inverse(frame->view));
+	frame->_clip_to_world = m4_mul(frame->view, m4_inverse(frame->projection));
+	frame->_world_to_clip_is_valid = true;
+	
+	// Bounding box of the screen corners in world space
+	Vector2 corners[4] = { v2(-1, -1), v2(-1, 1), v2(1, 1), v2(1, -1) };
+	m4_transform_points_2d(frame->_clip_to_world, corners, corners, 4);
+	Range2f rect = range2f_make(corners[0], corners[0]);
+	for (u64 i = 1; i < 4; i++) {
+		rect.min = v2(min(rect.min.x, corners[i].x), min(rect.min.y, corners[i].y));
+		rect.max = v2(max(rect.max.x, corners[i].x), max(rect.max.y, corners[i].y));
+	}
+	frame->_visible_world_rect = rect;
+}
+Matrix4 draw_frame_get_world_to_clip() {
+	draw_frame_update_world_to_clip(&draw_frame);
+	return draw_frame._world_to_clip;
+}
+Matrix4 draw_frame_get_clip_to_world() {
+	draw_frame_update_world_to_clip(&draw_frame);
+	return draw_frame._clip_to_world;
+}
+
+// What's on screen in world space with the current projection & view. If the view is rotated
+// this is the bounding box around it.
+Range2f draw_frame_get_visible_world_rect() {
+	draw_frame_update_world_to_clip(&draw_frame);
+	return draw_frame._visible_world_rect;
+}
+// For throwing away things that are off screen before doing any matrix work for them
+bool draw_frame_is_world_rect_visible(Range2f rect) {
+	return range2f_overlaps(draw_frame_get_visible_world_rect(), rect);
+}
+// Writes the indices of the world space ranges that are on screen to out_indices and returns
+// how many there were. Also works on the bounds of groups of things, to skip whole groups at once.
+u64 draw_frame_cull_world_ranges(const Range2f *ranges, u32 *out_indices, u64 count) {
+	return range2f_cull_ranges(draw_frame_get_visible_world_rect(), ranges, out_indices, count);
+}
+
+// Makes room for count more quads in quad_buffer
+void draw_frame_reserve_quads(u64 count) {
+	draw_frame_grow_buffer((void**)&quad_buffer, &allocated_quads, draw_frame.num_quads, draw_frame.num_quads+count, sizeof(Draw_Quad));
+}
+
+// The current scissor as a Draw_Quad.scissor_index
+inline u16 draw_frame_get_scissor_index() {
+	return draw_frame.scissor_count > 0 ? draw_frame.scissor_stack[draw_frame.scissor_count-1] : 0;
+}
+
+// Culled quads return this, so what's written to it goes nowhere
 Draw_Quad _nil_quad = {0};
+Draw_Quad_Userdata _nil_userdata = {0};
+
+// Returns the VERTEX_2D_USER_DATA_COUNT userdata vectors of a quad in the draw frame to
+// write to. They are zero until this is first called on the quad.
+Vector4 *draw_quad_userdata(Draw_Quad *q) {
+	if (q == &_nil_quad) {
+		memset(&_nil_userdata, 0, sizeof(Draw_Quad_Userdata));
+		return _nil_userdata.data;
+	}
+	
+	if (q->userdata_index == 0) {
+		draw_frame_grow_buffer((void**)&userdata_buffer, &allocated_userdata, draw_frame.num_userdata, draw_frame.num_userdata+1, sizeof(Draw_Quad_Userdata));
+		memset(&userdata_buffer[draw_frame.num_userdata], 0, sizeof(Draw_Quad_Userdata));
+		draw_frame.num_userdata += 1;
+		q->userdata_index = (u32)draw_frame.num_userdata;
+	}
+	
+	return userdata_buffer[q->userdata_index-1].data;
+}
 Draw_Quad *draw_quad_projected(Draw_Quad quad, Matrix4 world_to_clip) {
-	quad.bottom_left  = m4_transform(world_to_clip, v4(v2_expand(quad.bottom_left), 0, 1)).xy;
-	quad.top_left     = m4_transform(world_to_clip, v4(v2_expand(quad.top_left), 0, 1)).xy;
-	quad.top_right    = m4_transform(world_to_clip, v4(v2_expand(quad.top_right), 0, 1)).xy;
-	quad.bottom_right = m4_transform(world_to_clip, v4(v2_expand(quad.bottom_right), 0, 1)).xy;
+	// The corners are next to each other in Draw_Quad
+	m4_transform_points_2d(world_to_clip, &quad.bottom_left, &quad.bottom_left, 4);
 	
 	bool should_cull = 
 	    (quad.bottom_left.x < -1 && quad.top_left.x < -1 && quad.top_right.x < -1 && quad.bottom_right.x < -1) ||
@@ -123,7 +279,8 @@ Draw_Quad *draw_quad_projected(Draw_Quad quad, Matrix4 world_to_clip) {
 	    (quad.bottom_left.y < -1 && quad.top_left.y < -1 && quad.top_right.y < -1 && quad.bottom_right.y < -1) ||
 	    (quad.bottom_left.y > 1 && quad.top_left.y > 1 && quad.top_right.y > 1 && quad.bottom_right.y > 1);
 
-	if (should_cull) {
+	// Static batches are recorded in world space and culled when they are drawn
+	if (should_cull && !draw_frame._recording_static_batch) {
 		return &_nil_quad;
 	}
 	
@@ -134,29 +291,10 @@ Draw_Quad *draw_quad_projected(Draw_Quad quad, Matrix4 world_to_clip) {
 	quad.z = 0;
 	if (draw_frame.z_count > 0)  quad.z = draw_frame.z_stack[draw_frame.z_count-1];
 	
-	quad.has_scissor = false;
-	if (draw_frame.scissor_count > 0) {
-		quad.scissor = draw_frame.scissor_stack[draw_frame.scissor_count-1];
-		quad.has_scissor = true;
-	}
+	quad.scissor_index = draw_frame_get_scissor_index();
+	quad.userdata_index = 0;
 	
-	memset(quad.userdata, 0, sizeof(quad.userdata));
-	
-	if (draw_frame.num_quads >= allocated_quads) {
-		// #Memory
-		
-		u64 new_count = max(get_next_power_of_two(draw_frame.num_quads+1), 128);
-		
-		Draw_Quad *new_buffer = alloc(get_heap_allocator(), new_count*sizeof(Draw_Quad));
-		
-		if (quad_buffer) {
-			memcpy(new_buffer, quad_buffer, draw_frame.num_quads*sizeof(Draw_Quad));
-			dealloc(get_heap_allocator(), quad_buffer);
-		}
-		
-		quad_buffer = new_buffer;
-		allocated_quads = new_count;
-	}
+	draw_frame_reserve_quads(1);
 	
 	quad_buffer[draw_frame.num_quads] = quad;
 	draw_frame.num_quads += 1;
@@ -164,15 +302,11 @@ Draw_Quad *draw_quad_projected(Draw_Quad quad, Matrix4 world_to_clip) {
 	return &quad_buffer[draw_frame.num_quads-1];
 }
 Draw_Quad *draw_quad(Draw_Quad quad) {
-	return draw_quad_projected(quad, m4_mul(draw_frame.projection, m4_inverse(draw_frame.view)));
+	return draw_quad_projected(quad, draw_frame_get_world_to_clip());
 }
 
 Draw_Quad *draw_quad_xform(Draw_Quad quad, Matrix4 xform) {
-	Matrix4 world_to_clip = m4_scalar(1.0);
-	world_to_clip         = m4_mul(world_to_clip, draw_frame.projection);
-	world_to_clip         = m4_mul(world_to_clip, m4_inverse(draw_frame.view));
-	world_to_clip         = m4_mul(world_to_clip, xform);
-	return draw_quad_projected(quad, world_to_clip);
+	return draw_quad_projected(quad, m4_mul(draw_frame_get_world_to_clip(), xform));
 }
 
 Draw_Quad *draw_rect(Vector2 position, Vector2 size, Vector4 color) {
@@ -187,7 +321,7 @@ Draw_Quad *draw_rect(Vector2 position, Vector2 size, Vector4 color) {
 	q.top_left     = v2(left,  top);
 	q.top_right    = v2(right, top);
 	q.bottom_right = v2(right, bottom);
-	q.color = color;
+	q.color = quad_pack_color(color);
 	q.image = 0;
 	q.type = QUAD_TYPE_REGULAR;
 	
@@ -200,7 +334,7 @@ Draw_Quad *draw_rect_xform(Matrix4 xform, Vector2 size, Vector4 color) {
 	q.top_left     = v2(0,  size.y);
 	q.top_right    = v2(size.x, size.y);
 	q.bottom_right = v2(size.x, 0);
-	q.color = color;
+	q.color = quad_pack_color(color);
 	q.image = 0;
 	q.type = QUAD_TYPE_REGULAR;
 	
@@ -218,7 +352,7 @@ Draw_Quad *draw_circle(Vector2 position, Vector2 size, Vector4 color) {
 	q.top_left     = v2(left,  top);
 	q.top_right    = v2(right, top);
 	q.bottom_right = v2(right, bottom);
-	q.color = color;
+	q.color = quad_pack_color(color);
 	q.image = 0;
 	q.type = QUAD_TYPE_CIRCLE;
 	
@@ -231,29 +365,272 @@ Draw_Quad *draw_circle_xform(Matrix4 xform, Vector2 size, Vector4 color) {
 	q.top_left     = v2(0,  size.y);
 	q.top_right    = v2(size.x, size.y);
 	q.bottom_right = v2(size.x, 0);
-	q.color = color;
+	q.color = quad_pack_color(color);
 	q.image = 0;
 	q.type = QUAD_TYPE_CIRCLE;
 	
 	return draw_quad_xform(q, xform);
 }
+// Images packed into an atlas are drawn from the atlas texture
+inline void draw_quad_set_image(Draw_Quad *q, Gfx_Image *image) {
+	q->image = image;
+	q->uv = v4(0, 0, 1, 1);
+	if (image && image->atlas) {
+		q->image = image->atlas;
+		q->uv = image->atlas_uv;
+	}
+}
 Draw_Quad *draw_image(Gfx_Image *image, Vector2 position, Vector2 size, Vector4 color) {
 	Draw_Quad *q = draw_rect(position, size, color);
 	
-	q->image = image;
-	q->uv = v4(0, 0, 1, 1);
+	draw_quad_set_image(q, image);
 	
 	return q;
 }
 Draw_Quad *draw_image_xform(Gfx_Image *image, Matrix4 xform, Vector2 size, Vector4 color) {
 	Draw_Quad *q = draw_rect_xform(xform, size, color);
 	
-	q->image = image;
-	q->uv = v4(0, 0, 1, 1);
+	draw_quad_set_image(q, image);
 	
 	return q;
 }
 
+///
+///
+// Batched drawing
+///
+// Submitting many axis aligned sprites one draw_image at a time re-reads the z & scissor
+// stacks, builds and copies a whole quad per call and grows the buffer one quad at a time.
+// These reserve space once, project & cull the rects in bulk (with a SIMD path) and write
+// the quads straight into quad_buffer from a template.
+//
+
+// Projects rects (bottom left at positions[i], sizes[i] big) to their 4 corners in clip space
+// (bottom_left, top_left, top_right, bottom_right) and tells whether any of it is on screen.
+void project_rects_scalar(Affine2 a, const Vector2 *positions, const Vector2 *sizes, Vector2 *corners, bool *visible, u64 count) {
+	for (u64 i = 0; i < count; i++) {
+		Vector2 p = positions[i];
+		Vector2 s = sizes[i];
+		
+		Vector2 bl    = affine2_transform(a, p);
+		Vector2 right = v2(a.m[0][0]*s.x, a.m[1][0]*s.x);
+		Vector2 up    = v2(a.m[0][1]*s.y, a.m[1][1]*s.y);
+		
+		Vector2 *c = &corners[i*4];
+		c[0] = bl;
+		c[1] = v2_add(bl, up);
+		c[2] = v2_add(c[1], right);
+		c[3] = v2_add(bl, right);
+		
+		float32 min_x = min(min(c[0].x, c[1].x), min(c[2].x, c[3].x));
+		float32 max_x = max(max(c[0].x, c[1].x), max(c[2].x, c[3].x));
+		float32 min_y = min(min(c[0].y, c[1].y), min(c[2].y, c[3].y));
+		float32 max_y = max(max(c[0].y, c[1].y), max(c[2].y, c[3].y));
+		
+		// Same as the cull in draw_quad_projected
+		visible[i] = !(max_x < -1 || min_x > 1 || max_y < -1 || min_y > 1);
+	}
+}
+
+#if ENABLE_SIMD && SIMD_ENABLE_SSE2
+
+// 4 rects at a time, one in each lane
+void project_rects_simd(Affine2 a, const Vector2 *positions, const Vector2 *sizes, Vector2 *corners, bool *visible, u64 count) {
+	const __m128 m00 = _mm_set1_ps(a.m[0][0]);
+	const __m128 m01 = _mm_set1_ps(a.m[0][1]);
+	const __m128 m02 = _mm_set1_ps(a.m[0][2]);
+	const __m128 m10 = _mm_set1_ps(a.m[1][0]);
+	const __m128 m11 = _mm_set1_ps(a.m[1][1]);
+	const __m128 m12 = _mm_set1_ps(a.m[1][2]);
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 minus_one = _mm_set1_ps(-1.0f);
+	
+	u64 i = 0;
+	for (; i+4 <= count; i += 4) {
+		// (x0, y0, x1, y1), (x2, y2, x3, y3) -> (x0, x1, x2, x3), (y0, y1, y2, y3)
+		__m128 p01 = _mm_loadu_ps(&positions[i].x);
+		__m128 p23 = _mm_loadu_ps(&positions[i+2].x);
+		__m128 s01 = _mm_loadu_ps(&sizes[i].x);
+		__m128 s23 = _mm_loadu_ps(&sizes[i+2].x);
+		__m128 x = _mm_shuffle_ps(p01, p23, _MM_SHUFFLE(2, 0, 2, 0));
+		__m128 y = _mm_shuffle_ps(p01, p23, _MM_SHUFFLE(3, 1, 3, 1));
+		__m128 w = _mm_shuffle_ps(s01, s23, _MM_SHUFFLE(2, 0, 2, 0));
+		__m128 h = _mm_shuffle_ps(s01, s23, _MM_SHUFFLE(3, 1, 3, 1));
+		
+		// Same operations in the same order as the scalar path
+		__m128 bl_x = _mm_add_ps(_mm_add_ps(_mm_mul_ps(m00, x), _mm_mul_ps(m01, y)), m02);
+		__m128 bl_y = _mm_add_ps(_mm_add_ps(_mm_mul_ps(m10, x), _mm_mul_ps(m11, y)), m12);
+		__m128 right_x = _mm_mul_ps(m00, w);
+		__m128 right_y = _mm_mul_ps(m10, w);
+		__m128 up_x = _mm_mul_ps(m01, h);
+		__m128 up_y = _mm_mul_ps(m11, h);
+		
+		__m128 tl_x = _mm_add_ps(bl_x, up_x);
+		__m128 tl_y = _mm_add_ps(bl_y, up_y);
+		__m128 tr_x = _mm_add_ps(tl_x, right_x);
+		__m128 tr_y = _mm_add_ps(tl_y, right_y);
+		__m128 br_x = _mm_add_ps(bl_x, right_x);
+		__m128 br_y = _mm_add_ps(bl_y, right_y);
+		
+		__m128 min_x = _mm_min_ps(_mm_min_ps(bl_x, tl_x), _mm_min_ps(tr_x, br_x));
+		__m128 max_x = _mm_max_ps(_mm_max_ps(bl_x, tl_x), _mm_max_ps(tr_x, br_x));
+		__m128 min_y = _mm_min_ps(_mm_min_ps(bl_y, tl_y), _mm_min_ps(tr_y, br_y));
+		__m128 max_y = _mm_max_ps(_mm_max_ps(bl_y, tl_y), _mm_max_ps(tr_y, br_y));
+		__m128 culled = _mm_or_ps(_mm_or_ps(_mm_cmplt_ps(max_x, minus_one), _mm_cmpgt_ps(min_x, one)),
+		                          _mm_or_ps(_mm_cmplt_ps(max_y, minus_one), _mm_cmpgt_ps(min_y, one)));
+		int culled_mask = _mm_movemask_ps(culled);
+		
+		// Back to (x, y) pairs, then 2 corners per store
+		__m128 bl_lo = _mm_unpacklo_ps(bl_x, bl_y), bl_hi = _mm_unpackhi_ps(bl_x, bl_y);
+		__m128 tl_lo = _mm_unpacklo_ps(tl_x, tl_y), tl_hi = _mm_unpackhi_ps(tl_x, tl_y);
+		__m128 tr_lo = _mm_unpacklo_ps(tr_x, tr_y), tr_hi = _mm_unpackhi_ps(tr_x, tr_y);
+		__m128 br_lo = _mm_unpacklo_ps(br_x, br_y), br_hi = _mm_unpackhi_ps(br_x, br_y);
+		
+		float32 *c = &corners[i*4].x;
+		_mm_storeu_ps(c+0,  _mm_movelh_ps(bl_lo, tl_lo));
+		_mm_storeu_ps(c+4,  _mm_movelh_ps(tr_lo, br_lo));
+		_mm_storeu_ps(c+8,  _mm_movehl_ps(tl_lo, bl_lo));
+		_mm_storeu_ps(c+12, _mm_movehl_ps(br_lo, tr_lo));
+		_mm_storeu_ps(c+16, _mm_movelh_ps(bl_hi, tl_hi));
+		_mm_storeu_ps(c+20, _mm_movelh_ps(tr_hi, br_hi));
+		_mm_storeu_ps(c+24, _mm_movehl_ps(tl_hi, bl_hi));
+		_mm_storeu_ps(c+28, _mm_movehl_ps(br_hi, tr_hi));
+		
+		visible[i+0] = !(culled_mask & 1);
+		visible[i+1] = !(culled_mask & 2);
+		visible[i+2] = !(culled_mask & 4);
+		visible[i+3] = !(culled_mask & 8);
+	}
+	
+	project_rects_scalar(a, positions+i, sizes+i, corners+i*4, visible+i, count-i);
+}
+
+#endif // ENABLE_SIMD && SIMD_ENABLE_SSE2
+
+void project_rects(Affine2 a, const Vector2 *positions, const Vector2 *sizes, Vector2 *corners, bool *visible, u64 count) {
+#if ENABLE_SIMD && SIMD_ENABLE_SSE2
+	project_rects_simd(a, positions, sizes, corners, visible, count);
+#else
+	project_rects_scalar(a, positions, sizes, corners, visible, count);
+#endif
+}
+
+// What draw_quad_projected would fill in from the draw frame, for a regular quad
+Draw_Quad draw_frame_make_quad_template(Gfx_Image *image) {
+	Draw_Quad q = ZERO(Draw_Quad);
+	
+	q.color = 0xFFFFFFFF;
+	q.type = QUAD_TYPE_REGULAR;
+	q.image_min_filter = GFX_FILTER_MODE_NEAREST;
+	q.image_mag_filter = GFX_FILTER_MODE_NEAREST;
+	draw_quad_set_image(&q, image);
+	
+	if (draw_frame.z_count > 0)  q.z = draw_frame.z_stack[draw_frame.z_count-1];
+	
+	q.scissor_index = draw_frame_get_scissor_index();
+	
+	return q;
+}
+
+#define DRAW_BATCH_CHUNK 256
+
+// The shared part of the batches. images, colors and z may each be 0 to use what's in the template.
+u64 draw_rects_from_template(const Draw_Quad *template, Gfx_Image *const *images, const Vector2 *positions, const Vector2 *sizes, const Vector4 *colors, const s32 *z, u64 count) {
+	if (count == 0) return 0;
+	
+	Affine2 world_to_clip = m4_to_affine2(draw_frame_get_world_to_clip());
+	bool keep_culled = draw_frame._recording_static_batch != 0;
+	
+	// Culled rects leave some of this unused, which is fine
+	draw_frame_reserve_quads(count);
+	
+	Vector2 corners[DRAW_BATCH_CHUNK*4];
+	bool visible[DRAW_BATCH_CHUNK];
+	
+	u64 submitted = 0;
+	for (u64 start = 0; start < count; start += DRAW_BATCH_CHUNK) {
+		u64 n = min(count-start, DRAW_BATCH_CHUNK);
+		project_rects(world_to_clip, positions+start, sizes+start, corners, visible, n);
+		
+		for (u64 i = 0; i < n; i++) {
+			if (!visible[i] && !keep_culled) continue;
+			
+			Draw_Quad *q = &quad_buffer[draw_frame.num_quads];
+			*q = *template;
+			memcpy(&q->bottom_left, &corners[i*4], sizeof(Vector2)*4);
+			if (images) draw_quad_set_image(q, images[start+i]);
+			if (colors) q->color = quad_pack_color(colors[start+i]);
+			if (z)      q->z = z[start+i];
+			
+			draw_frame.num_quads += 1;
+			submitted += 1;
+		}
+	}
+	
+	return submitted;
+}
+
+// Draws count rects of the same image like draw_image, with per sprite z instead of the
+// current z layer. image, colors and z may be 0 for plain rects, white and the current z layer.
+// Returns how many were on screen and submitted.
+u64 draw_sprites_batch_z(Gfx_Image *image, const Vector2 *positions, const Vector2 *sizes, const Vector4 *colors, const s32 *z, u64 count) {
+	Draw_Quad template = draw_frame_make_quad_template(image);
+	return draw_rects_from_template(&template, 0, positions, sizes, colors, z, count);
+}
+u64 draw_sprites_batch(Gfx_Image *image, const Vector2 *positions, const Vector2 *sizes, const Vector4 *colors, u64 count) {
+	return draw_sprites_batch_z(image, positions, sizes, colors, 0, count);
+}
+
+// Draws a grid of width*height tiles, each tile_size big, with the bottom left of tile (0, 0)
+// at origin. Tile (x, y) is at index y*width+x in images and colors, either may be 0 for
+// plain rects or white. If the view isn't rotated only the tiles on screen are visited.
+// Returns how many tiles were submitted.
+u64 draw_tilemap(Vector2 origin, Vector2 tile_size, u64 width, u64 height, Gfx_Image **images, const Vector4 *colors) {
+	if (width == 0 || height == 0) return 0;
+	
+	Draw_Quad template = draw_frame_make_quad_template(0);
+	
+	u64 first_x = 0, end_x = width;
+	u64 first_y = 0, end_y = height;
+	
+	Affine2 a = m4_to_affine2(draw_frame_get_world_to_clip());
+	bool can_skip = !draw_frame._recording_static_batch;
+	if (can_skip && a.m[0][1] == 0 && a.m[1][0] == 0 && a.m[0][0] != 0 && a.m[1][1] != 0 && tile_size.x > 0 && tile_size.y > 0) {
+		// Clip space -1 to 1 in world space, in tiles
+		float32 x0 = ((-1 - a.m[0][2]) / a.m[0][0] - origin.x) / tile_size.x;
+		float32 x1 = (( 1 - a.m[0][2]) / a.m[0][0] - origin.x) / tile_size.x;
+		float32 y0 = ((-1 - a.m[1][2]) / a.m[1][1] - origin.y) / tile_size.y;
+		float32 y1 = (( 1 - a.m[1][2]) / a.m[1][1] - origin.y) / tile_size.y;
+		
+		// One tile of margin so edges are left to the exact cull
+		float32 min_x = floorf(min(x0, x1)) - 1, max_x = ceilf(max(x0, x1)) + 1;
+		float32 min_y = floorf(min(y0, y1)) - 1, max_y = ceilf(max(y0, y1)) + 1;
+		
+		first_x = (u64)clamp(min_x, 0.0f, (float32)width);
+		end_x   = (u64)clamp(max_x, 0.0f, (float32)width);
+		first_y = (u64)clamp(min_y, 0.0f, (float32)height);
+		end_y   = (u64)clamp(max_y, 0.0f, (float32)height);
+	}
+	
+	Vector2 positions[DRAW_BATCH_CHUNK];
+	Vector2 sizes[DRAW_BATCH_CHUNK];
+	for (u64 i = 0; i < DRAW_BATCH_CHUNK; i++) sizes[i] = tile_size;
+	
+	u64 submitted = 0;
+	for (u64 y = first_y; y < end_y; y++) {
+		for (u64 x = first_x; x < end_x; x += DRAW_BATCH_CHUNK) {
+			u64 n = min(end_x-x, DRAW_BATCH_CHUNK);
+			for (u64 i = 0; i < n; i++) {
+				positions[i] = v2(origin.x + (float32)(x+i)*tile_size.x, origin.y + (float32)y*tile_size.y);
+			}
+			u64 index = y*width + x;
+			submitted += draw_rects_from_template(&template, images ? images+index : 0, positions, sizes, colors ? colors+index : 0, 0, n);
+		}
+	}
+	
+	return submitted;
+}
+
 typedef struct {
 	Gfx_Font *font;
 	string text;
@@ -325,3 +702,182 @@ void draw_line(Vector2 p0, Vector2 p1, float line_width, Vector4 color) {
 #define COLOR_WHITE ((Vector4){1.0, 1.0, 1.0, 1.0})
 #define COLOR_BLACK ((Vector4){0.0, 0.0, 0.0, 1.0})
 
+
+// Keys the renderer sorts quads by when z sorting. They are unsigned so they sort right as
+// plain bits: z first, and with enable_texture_sorting a hash of the image after that so
+// quads with the same image end up next to each other. Images that collide in the hash
+// still work, they just share a group.
+#define Z_SORT_KEY_BITS (MAX_Z_BITS+1)
+#define TEXTURE_SORT_BITS 10
+#define TEXTURE_SORT_KEY_BITS (Z_SORT_KEY_BITS+TEXTURE_SORT_BITS)
+inline u32 draw_quad_get_sort_key(const Draw_Quad *q, bool sort_by_texture) {
+	u32 key = (u32)(q->z + MAX_Z);
+	if (sort_by_texture) {
+		u32 group = 0;
+		if (q->image) group = (u32)(((u64)q->image->gfx_handle * 0x9E3779B97F4A7C15ull) >> (64-TEXTURE_SORT_BITS));
+		key = (key << TEXTURE_SORT_BITS) | group;
+	}
+	return key;
+}
+
+// Quads usually come in z order already, or in a few runs that are, and then the renderer
+// can skip z sorting or just merge the runs. Returns how many runs there are and writes
+// where the first Z_SORT_MAX_MERGE_RUNS of them start to run_starts.
+// This is done on the quads as they are when the frame is drawn, because draw procedures
+// return the quad and its z may be changed after it was submitted.
+u64 draw_quads_find_z_runs(const Draw_Quad *quads, u64 count, u64 run_starts[Z_SORT_MAX_MERGE_RUNS]) {
+	u64 run_count = 0;
+	for (u64 i = 0; i < count; i++) {
+		if (i == 0 || quads[i].z < quads[i-1].z) {
+			if (run_count < Z_SORT_MAX_MERGE_RUNS) run_starts[run_count] = i;
+			run_count += 1;
+		}
+	}
+	return run_count;
+}
+
+
+///
+///
+// Static batches
+///
+// Geometry that doesn't change, like a tilemap or props, can be recorded once into a static
+// batch. Its quads are packed once and kept in their own GPU buffer, so drawing it costs a
+// draw call per MAX_BOUND_TEXTURES textures in it no matter how many quads it has.
+//
+//    if (!static_batch_is_valid(&tiles)) {
+//        static_batch_begin(&tiles);
+//        draw_tilemap(...); // Any draw procedures, in world space
+//        static_batch_end(&tiles);
+//    }
+//    draw_static_batch(&tiles, m4_scalar(1.0));
+//
+// Nothing is culled while recording, and the quads are sorted by z once. A batch is drawn
+// with the projection & view at the time of draw_static_batch, before the other quads of
+// the frame and not z sorted with them.
+// Scissors are kept in window pixels as they were when recorded.
+// A batch only changes when it's recorded again, so call static_batch_invalidate when what
+// went into it has changed.
+//
+
+typedef struct Static_Batch {
+	u64 quad_count;
+	Quad_Segment *segments; // Growing array
+	
+	// Owned by the renderer
+	void *gfx_buffer;
+	
+	bool is_valid;
+	
+	// Draw frame state from static_batch_begin, put back in static_batch_end
+	u64 _first_quad;
+	u64 _first_scissor;
+	u64 _first_userdata;
+	u64 _scissor_count;
+	Matrix4 _projection;
+	Matrix4 _view;
+} Static_Batch;
+
+// Implemented per renderer. Replaces the GPU buffer of the batch with one holding instances.
+ogb_instance void
+gfx_init_static_batch(Static_Batch *batch, const Quad_Instance *instances, u64 count);
+ogb_instance void
+gfx_deinit_static_batch(Static_Batch *batch);
+
+bool static_batch_is_valid(Static_Batch *batch) {
+	return batch->is_valid;
+}
+// The batch has to be recorded again before it can be drawn
+void static_batch_invalidate(Static_Batch *batch) {
+	batch->is_valid = false;
+}
+
+// Draw procedures called after this go into the batch instead of the frame
+void static_batch_begin(Static_Batch *batch) {
+	assert(!draw_frame._recording_static_batch, "Already recording a static batch");
+	
+	batch->_first_quad = draw_frame.num_quads;
+	batch->_first_scissor = draw_frame.num_scissors;
+	batch->_first_userdata = draw_frame.num_userdata;
+	batch->_scissor_count = draw_frame.scissor_count;
+	batch->_projection = draw_frame.projection;
+	batch->_view = draw_frame.view;
+	
+	// Quads are kept in world space and projected when drawn
+	draw_frame.projection = m4_scalar(1.0);
+	draw_frame.view = m4_scalar(1.0);
+	draw_frame._recording_static_batch = batch;
+}
+
+void static_batch_end(Static_Batch *batch) {
+	assert(draw_frame._recording_static_batch == batch, "static_batch_end without static_batch_begin on this batch");
+	// Scissors from the recording are given back below, so none of them can still be pushed
+	assert(draw_frame.scissor_count == batch->_scissor_count, "Scissors pushed while recording a static batch have to be popped before static_batch_end");
+	
+	Draw_Quad *recorded = quad_buffer + batch->_first_quad;
+	u64 count = draw_frame.num_quads - batch->_first_quad;
+	
+	// Sorted by z once here, stable so quads with the same z keep their order
+	u64 *sort_keys = alloc(get_heap_allocator(), max(count, 1)*sizeof(u64));
+	u64 *sort_help = alloc(get_heap_allocator(), max(count, 1)*sizeof(u64));
+	for (u64 i = 0; i < count; i++) {
+		sort_keys[i] = ((u64)draw_quad_get_sort_key(&recorded[i], false) << 32) | i;
+	}
+	u64 *sorted = radix_sort_key_index(sort_keys, sort_help, count, Z_SORT_KEY_BITS);
+	Draw_Quad *quads = alloc(get_heap_allocator(), max(count, 1)*sizeof(Draw_Quad));
+	for (u64 i = 0; i < count; i++) {
+		quads[i] = recorded[(u32)sorted[i]];
+	}
+	
+	// Same as the renderer does for the frame, every segment is a draw call
+	s8 *texture_indices = alloc(get_heap_allocator(), max(count, 1));
+	split_quads_into_segments(quads, count, texture_indices, &batch->segments);
+	
+	// Text is snapped to pixels when packed, which means nothing in world space, so those
+	// get their corners back.
+	Quad_Instance *instances = alloc(get_heap_allocator(), max(count, 1)*sizeof(Quad_Instance));
+	pack_quads_to_instances_scalar(quads, scissor_buffer, userdata_buffer, texture_indices, count, instances, 2.0/(float32)window.width, 2.0/(float32)window.height, (float32)window.pixel_height);
+	for (u64 i = 0; i < count; i++) {
+		memcpy(instances[i].corners, &quads[i].bottom_left, sizeof(instances[i].corners));
+	}
+	
+	batch->quad_count = count;
+	gfx_init_static_batch(batch, instances, count);
+	
+	dealloc(get_heap_allocator(), instances);
+	dealloc(get_heap_allocator(), texture_indices);
+	dealloc(get_heap_allocator(), quads);
+	dealloc(get_heap_allocator(), sort_keys);
+	dealloc(get_heap_allocator(), sort_help);
+	
+	draw_frame.num_quads = batch->_first_quad;
+	draw_frame.num_scissors = batch->_first_scissor;
+	draw_frame.num_userdata = batch->_first_userdata;
+	draw_frame.projection = batch->_projection;
+	draw_frame.view = batch->_view;
+	draw_frame._recording_static_batch = 0;
+	
+	batch->is_valid = true;
+}
+
+// Draws the batch this frame with xform applied to what was recorded
+void draw_static_batch(Static_Batch *batch, Matrix4 xform) {
+	assert(batch->is_valid, "Drawing a static batch which has not been recorded since it was invalidated");
+	assert(!draw_frame._recording_static_batch, "Can't draw a static batch while recording one");
+	assert(draw_frame.static_batch_draw_count < MAX_STATIC_BATCH_DRAWS, "Too many static batch draws in one frame, max is %d", MAX_STATIC_BATCH_DRAWS);
+	
+	if (batch->quad_count == 0) return;
+	
+	Static_Batch_Draw *d = &draw_frame.static_batch_draws[draw_frame.static_batch_draw_count];
+	d->batch = batch;
+	d->transform = m4_mul(draw_frame_get_world_to_clip(), xform);
+	draw_frame.static_batch_draw_count += 1;
+}
+
+void delete_static_batch(Static_Batch *batch) {
+	assert(!draw_frame._recording_static_batch, "Can't delete a static batch while recording one");
+	
+	if (batch->gfx_buffer) gfx_deinit_static_batch(batch);
+	if (batch->segments) growing_array_deinit((void**)&batch->segments);
+	memset(batch, 0, sizeof(Static_Batch));
+}
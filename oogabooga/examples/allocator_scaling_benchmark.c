@@ -0,0 +1,22 @@
+
+// Times the heap with 1 to 8 threads allocating and freeing at once, some of it freed by
+// another thread than the one that allocated it. With per-thread heaps the ops per second
+// should go up with the thread count until we run out of cores.
+
+int entry(int argc, char **argv) {
+	
+	const u64 round_count = 5000;
+	
+	// Once to warm up, once to measure
+	for (u64 run = 0; run < 2; run++) {
+		for (u64 thread_count = 1; thread_count <= TEST_ALLOCATOR_MAX_THREADS; thread_count *= 2) {
+			f64 seconds = test_allocator_scaling_run(thread_count, round_count);
+			
+			u64 op_count = thread_count*round_count*(TEST_ALLOCATOR_BATCH+1)*2;
+			print("%llu thread(s): %.2f million alloc+free per second, %.1f ns per op per thread\n", thread_count, ((f64)op_count/seconds)/1000000.0, (seconds*1000000000.0)/((f64)op_count/thread_count));
+		}
+	}
+	print("%llu logical processors\n", os.logical_processor_count);
+
+	return 0;
+}
@@ -0,0 +1,61 @@
+
+// Times building a bunch of small objects with a shared lifetime and freeing them all,
+// like loading and unloading a level, on the heap and on an arena.
+
+void benchmark_arena() {
+	const u64 rounds = 50;
+	const u64 allocation_count = 20000;
+	
+	void **pointers = alloc(get_heap_allocator(), allocation_count*sizeof(void*));
+	
+	u64 prev_seed = seed_for_random;
+	seed_for_random = 1337;
+	
+	float64 heap_start = os_get_current_time_in_seconds();
+	for (u64 r = 0; r < rounds; r += 1) {
+		for (u64 i = 0; i < allocation_count; i += 1) {
+			u64 size = get_random_int_in_range(8, 512);
+			pointers[i] = heap_alloc(size);
+			*(u64*)pointers[i] = i;
+		}
+		for (u64 i = 0; i < allocation_count; i += 1) {
+			assert(*(u64*)pointers[i] == i, "Heap corruption");
+			heap_dealloc(pointers[i]);
+		}
+	}
+	float64 heap_end = os_get_current_time_in_seconds();
+	
+	seed_for_random = 1337;
+	
+	Arena *arena = make_arena(0);
+	float64 arena_start = os_get_current_time_in_seconds();
+	for (u64 r = 0; r < rounds; r += 1) {
+		for (u64 i = 0; i < allocation_count; i += 1) {
+			u64 size = get_random_int_in_range(8, 512);
+			pointers[i] = arena_push(arena, size);
+			*(u64*)pointers[i] = i;
+		}
+		for (u64 i = 0; i < allocation_count; i += 1) {
+			assert(*(u64*)pointers[i] == i, "Arena corruption");
+		}
+		arena_clear(arena);
+	}
+	float64 arena_end = os_get_current_time_in_seconds();
+	destroy_arena(arena);
+	
+	seed_for_random = prev_seed;
+	dealloc(get_heap_allocator(), pointers);
+	
+	u64 op_count = rounds*allocation_count;
+	print("Heap , %llu allocations freed one by one: %.2f ms, %.1f ns per allocation\n", op_count, (heap_end-heap_start)*1000.0, (heap_end-heap_start)*1000000000.0/(float64)op_count);
+	print("Arena, %llu allocations freed by clearing: %.2f ms, %.1f ns per allocation\n", op_count, (arena_end-arena_start)*1000.0, (arena_end-arena_start)*1000000000.0/(float64)op_count);
+}
+
+int entry(int argc, char **argv) {
+	
+	// Once to warm up, once to measure
+	benchmark_arena();
+	benchmark_arena();
+
+	return 0;
+}
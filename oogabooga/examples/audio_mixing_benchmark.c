@@ -0,0 +1,136 @@
+// Times do_program_audio_sample() mixing different numbers of players, without an audio device,
+// and then mixing them on worker pools of different sizes.
+// Build this with OOGABOOGA_HEADLESS so there's no audio thread mixing the same players.
+
+void benchmark_release_all_audio_players(Audio_Format out_format, void *output) {
+	for (u64 i = 0; i < pool_get_count(&audio_player_pool); i++) {
+		audio_player_release(pool_get_nth(&audio_player_pool, i));
+	}
+	do_program_audio_sample(1, out_format, output);
+	assert(pool_get_count(&audio_player_pool) == 0, "Players were not released");
+}
+
+// Mixes player_count looping players like the audio thread would, in 10ms callbacks, and prints
+// how long it takes per output frame. Half of the players need their source converted.
+void benchmark_audio_callback(u64 player_count) {
+	const u64 frames_per_callback = 480;
+	const u64 callback_count = 100;
+	
+	Audio_Format out_formats[] = {
+		{ AUDIO_BITS_32, 2, 48000 },
+		{ AUDIO_BITS_16, 2, 48000 },
+	};
+	
+	void *output = alloc(get_heap_allocator(), frames_per_callback*2*sizeof(f32));
+	
+	for (u64 o = 0; o < sizeof(out_formats)/sizeof(out_formats[0]); o++) {
+		Audio_Format out_format = out_formats[o];
+		Audio_Source same_src = test_make_audio_source(out_format, 48000);
+		Audio_Source convert_src = test_make_audio_source((Audio_Format){ AUDIO_BITS_16, 1, 44100 }, 44100);
+		
+		for (u64 i = 0; i < player_count; i++) {
+			Audio_Player *p = audio_player_get_one();
+			audio_player_set_source(p, i % 2 ? convert_src : same_src, false);
+			audio_player_set_looping(p, true);
+			audio_player_set_progression_factor(p, get_random_float32_in_range(0, 0.9));
+			p->position = v3(get_random_float32_in_range(-1, 1), get_random_float32_in_range(-1, 1), 0);
+			p->volume = get_random_float32_in_range(0.1, 1.0);
+			audio_player_set_state(p, AUDIO_PLAYER_STATE_PLAYING);
+		}
+		
+		// Get past the fade in
+		for (u64 i = 0; i < 8; i++) do_program_audio_sample(frames_per_callback, out_format, output);
+		
+		float64 start = os_get_current_time_in_seconds();
+		for (u64 i = 0; i < callback_count; i++) {
+			do_program_audio_sample(frames_per_callback, out_format, output);
+		}
+		float64 end = os_get_current_time_in_seconds();
+		
+		float64 ns_per_frame = (end-start)*1000000000.0/(float64)(callback_count*frames_per_callback);
+		print("%cs%llu players, %cs out: %.1f ns per output frame (%.2f per player)", o == 0 ? "" : ", ", player_count, out_format.bit_width == AUDIO_BITS_32 ? "f32" : "s16", ns_per_frame, ns_per_frame/(float64)max(player_count, 1));
+		
+		benchmark_release_all_audio_players(out_format, output);
+		audio_source_destroy(&same_src);
+		audio_source_destroy(&convert_src);
+	}
+	print("\n");
+	
+	dealloc(get_heap_allocator(), output);
+}
+
+// Times mixing the same callback on one thread and on worker pools of different sizes.
+void benchmark_parallel_audio_mixing(u64 player_count) {
+	const u64 frames = 480;
+	const u64 callback_count = 50;
+	Audio_Format out_format = { AUDIO_BITS_32, 2, 48000 };
+	u64 sample_count = frames*out_format.channels;
+	
+	f32 *bus       = alloc(get_heap_allocator(), sample_count*sizeof(f32));
+	f32 *submixes  = alloc(get_heap_allocator(), 15*sample_count*sizeof(f32));
+	Audio_Player **players = alloc(get_heap_allocator(), player_count*sizeof(Audio_Player*));
+	Audio_Scratch scratch[WORKER_POOL_MAX_THREADS+1] = {0};
+	
+	Audio_Source same_src = test_make_audio_source(out_format, 48000);
+	Audio_Source convert_src = test_make_audio_source((Audio_Format){ AUDIO_BITS_16, 1, 44100 }, 44100);
+	Audio_Player *player_array = test_make_audio_players(player_count, same_src, convert_src);
+	for (u64 i = 0; i < player_count; i++) players[i] = &player_array[i];
+	
+	float64 single_start = os_get_current_time_in_seconds();
+	for (u64 c = 0; c < callback_count; c++) {
+		for (u64 i = 0; i < player_count; i++) audio_player_mix_to_bus(players[i], bus, frames, out_format, &scratch[0]);
+	}
+	float64 single_end = os_get_current_time_in_seconds();
+	float64 single_us = (single_end-single_start)*1000000.0/(float64)callback_count;
+	
+	print("%llu players: 1 thread %.0f us", player_count, single_us);
+	
+	u64 thread_counts[] = { 1, 3, 7, 15 };
+	for (u64 t = 0; t < sizeof(thread_counts)/sizeof(thread_counts[0]); t++) {
+		Worker_Pool pool;
+		worker_pool_init(&pool, thread_counts[t]);
+		
+		float64 start = os_get_current_time_in_seconds();
+		for (u64 c = 0; c < callback_count; c++) {
+			audio_mix_players_parallel(&pool, players, player_count, bus, submixes, scratch, frames, out_format);
+		}
+		float64 end = os_get_current_time_in_seconds();
+		float64 us = (end-start)*1000000.0/(float64)callback_count;
+		
+		print(", %llu threads %.0f us (%.2fx)", thread_counts[t]+1, us, single_us/us);
+		
+		worker_pool_destroy(&pool);
+	}
+	print(" (%llu logical processors, %.0f us per callback)\n", os.logical_processor_count, (float64)frames*1000000.0/(float64)out_format.sample_rate);
+	
+	audio_source_destroy(&same_src);
+	audio_source_destroy(&convert_src);
+	
+	dealloc(get_heap_allocator(), bus);
+	dealloc(get_heap_allocator(), submixes);
+	dealloc(get_heap_allocator(), players);
+	dealloc(get_heap_allocator(), player_array);
+	for (u64 i = 0; i < WORKER_POOL_MAX_THREADS+1; i++) audio_scratch_release(&scratch[i]);
+}
+
+int entry(int argc, char **argv) {
+	
+	seed_for_random = 69;
+	
+	u64 player_counts[] = { 1, 16, 64, 256 };
+	
+	for (u64 i = 0; i < sizeof(player_counts)/sizeof(player_counts[0]); i++) {
+		// Once to warm up, once to measure
+		benchmark_audio_callback(player_counts[i]);
+		benchmark_audio_callback(player_counts[i]);
+	}
+	
+	u64 parallel_player_counts[] = { 64, 256, 1024 };
+	
+	for (u64 i = 0; i < sizeof(parallel_player_counts)/sizeof(parallel_player_counts[0]); i++) {
+		benchmark_parallel_audio_mixing(parallel_player_counts[i]);
+		benchmark_parallel_audio_mixing(parallel_player_counts[i]);
+	}
+	
+	return 0;
+}
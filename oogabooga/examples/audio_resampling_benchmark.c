@@ -0,0 +1,27 @@
+// Compares resampling a sine the way players used to (linear interpolation, every callback on
+// its own) with the stateful resampler players have now, in linear and windowed-sinc quality.
+// Prints how clean the result is in dB and the cost per output frame. No audio device needed.
+
+int entry(int argc, char **argv) {
+	
+	int rates[][2] = {
+		{ 44100, 48000 },
+		{ 22050, 48000 },
+		{ 48000, 44100 },
+		{ 96000, 48000 },
+		{ 44100, 48001 },
+	};
+	
+	for (u64 i = 0; i < sizeof(rates)/sizeof(rates[0]); i++) {
+		// Once to warm up, once to measure
+		test_audio_resampling(rates[i][0], rates[i][1], 200);
+		Test_Resampling_Result r = test_audio_resampling(rates[i][0], rates[i][1], 200);
+		
+		f64 frames = (f64)r.output_frames;
+		print("%d -> %d Hz: per callback linear %.1f dB %.1f ns/frame", rates[i][0], rates[i][1], r.old_snr, r.old_seconds*1e9/frames);
+		print(", linear %.1f dB %.1f ns/frame", r.snrs[0], r.seconds[0]*1e9/frames);
+		print(", sinc %.1f dB %.1f ns/frame\n", r.snrs[1], r.seconds[1]*1e9/frames);
+	}
+
+	return 0;
+}
@@ -0,0 +1,106 @@
+
+// Times throwing away off screen things by their world space bounds, before any quads are
+// built for them. Only uses range.c so it also works with OOGABOOGA_HEADLESS.
+
+// Culls item_count world space ranges against a view that sees a small part of the world, first one by
+// one and then grouped into cells of a grid so whole cells are thrown away at once. Prints how many
+// ranges are culled per microsecond both ways.
+void benchmark_range_culling(u64 item_count) {
+	const float32 world_size = 10000;
+	const u64 cells_per_side = 32;
+	const float32 cell_size = world_size / (float32)cells_per_side;
+	const u64 cell_count = cells_per_side*cells_per_side;
+	
+	Range2f view = range2f_make(v2(4000, 4000), v2(4640, 4360));
+	
+	Range2f *items = alloc(get_heap_allocator(), item_count*sizeof(Range2f));
+	u32 *visible = alloc(get_heap_allocator(), item_count*sizeof(u32));
+	for (u64 i = 0; i < item_count; i++) {
+		Vector2 p = v2(get_random_float32_in_range(0, world_size), get_random_float32_in_range(0, world_size));
+		items[i] = range2f_make(p, v2_add(p, v2(16, 16)));
+	}
+	
+	u64 expected_count = 0;
+	for (u64 i = 0; i < item_count; i++) {
+		if (range2f_overlaps(view, items[i])) expected_count += 1;
+	}
+	
+	// Flat
+	float64 flat_start = os_get_current_time_in_seconds();
+	u64 visible_count = range2f_cull_ranges(view, items, visible, item_count);
+	float64 flat_end = os_get_current_time_in_seconds();
+	
+	assert(visible_count == expected_count, "Culled to %llu ranges, expected %llu", visible_count, expected_count);
+	for (u64 i = 0; i < visible_count; i++) {
+		assert(range2f_overlaps(view, items[visible[i]]), "Range %u is not visible", visible[i]);
+		if (i > 0) assert(visible[i] > visible[i-1], "Visible indices are not in order");
+	}
+	
+	// Spatially batched: items sorted into grid cells, each cell with the bounds of what's in it.
+	// Items are bucketed by their min corner, so a cell's bounds can reach a bit into the next one.
+	u64 *cell_starts = alloc(get_heap_allocator(), (cell_count+1)*sizeof(u64));
+	Range2f *cell_bounds = alloc(get_heap_allocator(), cell_count*sizeof(Range2f));
+	Range2f *sorted_items = alloc(get_heap_allocator(), item_count*sizeof(Range2f));
+	u32 *visible_cells = alloc(get_heap_allocator(), cell_count*sizeof(u32));
+	memset(cell_starts, 0, (cell_count+1)*sizeof(u64));
+	for (u64 i = 0; i < cell_count; i++) {
+		cell_bounds[i] = range2f_make(v2(F32_MAX, F32_MAX), v2(-F32_MAX, -F32_MAX));
+	}
+	
+	#define CULL_TEST_CELL(r) (min((u64)((r).min.y/cell_size), cells_per_side-1)*cells_per_side + min((u64)((r).min.x/cell_size), cells_per_side-1))
+	for (u64 i = 0; i < item_count; i++) {
+		u64 cell = CULL_TEST_CELL(items[i]);
+		cell_starts[cell+1] += 1;
+		Range2f *b = &cell_bounds[cell];
+		b->min = v2(min(b->min.x, items[i].min.x), min(b->min.y, items[i].min.y));
+		b->max = v2(max(b->max.x, items[i].max.x), max(b->max.y, items[i].max.y));
+	}
+	for (u64 i = 0; i < cell_count; i++) cell_starts[i+1] += cell_starts[i];
+	u64 *cell_heads = alloc(get_heap_allocator(), cell_count*sizeof(u64));
+	memcpy(cell_heads, cell_starts, cell_count*sizeof(u64));
+	for (u64 i = 0; i < item_count; i++) {
+		sorted_items[cell_heads[CULL_TEST_CELL(items[i])]++] = items[i];
+	}
+	#undef CULL_TEST_CELL
+	
+	float64 batched_start = os_get_current_time_in_seconds();
+	u64 batched_visible_count = 0;
+	u64 visible_cell_count = range2f_cull_ranges(view, cell_bounds, visible_cells, cell_count);
+	for (u64 i = 0; i < visible_cell_count; i++) {
+		u64 cell = visible_cells[i];
+		u64 first = cell_starts[cell];
+		batched_visible_count += range2f_cull_ranges(view, sorted_items+first, visible+batched_visible_count, cell_starts[cell+1]-first);
+	}
+	float64 batched_end = os_get_current_time_in_seconds();
+	
+	assert(batched_visible_count == expected_count, "Batched culling found %llu ranges, expected %llu", batched_visible_count, expected_count);
+	
+	float64 flat_us = max((flat_end-flat_start)*1000000.0, 0.001);
+	float64 batched_us = max((batched_end-batched_start)*1000000.0, 0.001);
+	print("%llu ranges, %llu visible: ", item_count, visible_count);
+	print("%.0f culled per us one by one, ", (float64)item_count/flat_us);
+	print("%.0f culled per us in %llu cells\n", (float64)item_count/batched_us, cell_count);
+	
+	dealloc(get_heap_allocator(), items);
+	dealloc(get_heap_allocator(), visible);
+	dealloc(get_heap_allocator(), cell_starts);
+	dealloc(get_heap_allocator(), cell_bounds);
+	dealloc(get_heap_allocator(), sorted_items);
+	dealloc(get_heap_allocator(), visible_cells);
+	dealloc(get_heap_allocator(), cell_heads);
+}
+
+int entry(int argc, char **argv) {
+	
+	seed_for_random = 69;
+	
+	u64 range_counts[] = { 10000, 100000, 1000000 };
+	
+	for (u64 i = 0; i < sizeof(range_counts)/sizeof(range_counts[0]); i++) {
+		// Once to warm up, once to measure
+		benchmark_range_culling(range_counts[i]);
+		benchmark_range_culling(range_counts[i]);
+	}
+
+	return 0;
+}
@@ -117,58 +117,64 @@ Vector2 world_size_to_screen_size(Vector2 s) {
 
 Draw_Quad *draw_rounded_rect(Vector2 p, Vector2 size, Vector4 color, float radius) {
 	Draw_Quad *q = draw_rect(p, size, color);
+	Vector4 *userdata = draw_quad_userdata(q);
 	// detail_type
-	q->userdata[0].x = DETAIL_TYPE_ROUNDED_CORNERS;
+	userdata[0].x = DETAIL_TYPE_ROUNDED_CORNERS;
 	// corner_radius
-	q->userdata[0].y = radius;
+	userdata[0].y = radius;
 	return q;
 }
 Draw_Quad *draw_rounded_rect_xform(Matrix4 xform, Vector2 size, Vector4 color, float radius) {
 	Draw_Quad *q = draw_rect_xform(xform, size, color);
+	Vector4 *userdata = draw_quad_userdata(q);
 	// detail_type
-	q->userdata[0].x = DETAIL_TYPE_ROUNDED_CORNERS;
+	userdata[0].x = DETAIL_TYPE_ROUNDED_CORNERS;
 	// corner_radius
-	q->userdata[0].y = radius;
+	userdata[0].y = radius;
 	return q;
 }
 Draw_Quad *draw_outlined_rect(Vector2 p, Vector2 size, Vector4 color, float line_width_pixels) {
 	Draw_Quad *q = draw_rect(p, size, color);
+	Vector4 *userdata = draw_quad_userdata(q);
 	// detail_type
-	q->userdata[0].x = DETAIL_TYPE_OUTLINED;
+	userdata[0].x = DETAIL_TYPE_OUTLINED;
 	// line_width_pixels
-	q->userdata[0].y = line_width_pixels;
+	userdata[0].y = line_width_pixels;
 	// rect_size
-	q->userdata[0].zw = world_size_to_screen_size(size);
+	userdata[0].zw = world_size_to_screen_size(size);
 	return q;
 }
 Draw_Quad *draw_outlined_rect_xform(Matrix4 xform, Vector2 size, Vector4 color, float line_width_pixels) {
 	Draw_Quad *q = draw_rect_xform(xform, size, color);
+	Vector4 *userdata = draw_quad_userdata(q);
 	// detail_type
-	q->userdata[0].x = DETAIL_TYPE_OUTLINED;
+	userdata[0].x = DETAIL_TYPE_OUTLINED;
 	// line_width_pixels
-	q->userdata[0].y = line_width_pixels;
+	userdata[0].y = line_width_pixels;
 	// rect_size
-	q->userdata[0].zw = world_size_to_screen_size(size);
+	userdata[0].zw = world_size_to_screen_size(size);
 	return q;
 }
 Draw_Quad *draw_outlined_circle(Vector2 p, Vector2 size, Vector4 color, float line_width_pixels) {
 	Draw_Quad *q = draw_rect(p, size, color);
+	Vector4 *userdata = draw_quad_userdata(q);
 	// detail_type
-	q->userdata[0].x = DETAIL_TYPE_OUTLINED_CIRCLE;
+	userdata[0].x = DETAIL_TYPE_OUTLINED_CIRCLE;
 	// line_width_pixels
-	q->userdata[0].y = line_width_pixels;
+	userdata[0].y = line_width_pixels;
 	// rect_size_pixels
-	q->userdata[0].zw = world_size_to_screen_size(size); // Transform world space to screen space
+	userdata[0].zw = world_size_to_screen_size(size); // Transform world space to screen space
 	return q;
 }
 Draw_Quad *draw_outlined_circle_xform(Matrix4 xform, Vector2 size, Vector4 color, float line_width_pixels) {
 	Draw_Quad *q = draw_rect_xform(xform, size, color);
+	Vector4 *userdata = draw_quad_userdata(q);
 	// detail_type
-	q->userdata[0].x = DETAIL_TYPE_OUTLINED_CIRCLE;
+	userdata[0].x = DETAIL_TYPE_OUTLINED_CIRCLE;
 	// line_width_pixels
-	q->userdata[0].y = line_width_pixels;
+	userdata[0].y = line_width_pixels;
 	// rect_size_pixels
-	q->userdata[0].zw = world_size_to_screen_size(size); // Transform world space to screen space
+	userdata[0].zw = world_size_to_screen_size(size); // Transform world space to screen space
 	
 	return q;
 }
\ No newline at end of file
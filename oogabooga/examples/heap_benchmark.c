@@ -0,0 +1,52 @@
+
+// Times the randomized alloc/free workload of test_heap_workloads() on the size class heap
+// and on the free list heap alone, and how fragmented each one ends up. Then times growing
+// arrays on a heap that resizes in place and on one that always copies.
+
+void benchmark_heap_workload(string name, Test_Alloc_Proc alloc_proc, Test_Dealloc_Proc dealloc_proc) {
+	const u64 op_count = 200000;
+	
+	float64 start_seconds = os_get_current_time_in_seconds();
+	u64 start_cycles = rdtsc();
+	
+	Test_Heap_Workload_Result result = test_heap_workload(alloc_proc, dealloc_proc, op_count);
+	
+	u64 end_cycles = rdtsc();
+	float64 end_seconds = os_get_current_time_in_seconds();
+	
+	Heap_Stats stats = result.stats;
+	f64 ms = (end_seconds-start_seconds)*1000.0;
+	print("%s: %llu ops in %.2f ms, %.1f ns and %llu cycles per op\n", name, op_count, ms, (ms*1000000.0)/op_count, (end_cycles-start_cycles)/op_count);
+	print("\tlive %llu kb (peak %llu kb), size class used %llu kb of %llu kb committed, free list %llu kb free in %llu nodes, largest %llu kb\n",
+		result.live_bytes/1024, result.peak_live_bytes/1024,
+		stats.slab_used_bytes/1024, stats.slab_committed_bytes/1024,
+		stats.block_free_bytes/1024, stats.block_free_node_count, stats.block_largest_free_node/1024);
+}
+
+void benchmark_heap_realloc_workload(string name, Allocator allocator, u64 array_count, u64 item_count) {
+	float64 start_seconds = os_get_current_time_in_seconds();
+	Test_Realloc_Workload_Result result = test_heap_realloc_workload(allocator, array_count, item_count);
+	float64 end_seconds = os_get_current_time_in_seconds();
+	
+	print("%s, %llu array(s) of %llu items: moved %llu times, copied %llu kb, %.2f ms\n", name, array_count, item_count, result.move_count, result.moved_bytes/1024, (end_seconds-start_seconds)*1000.0);
+}
+
+int entry(int argc, char **argv) {
+	
+	// Once to warm up, once to measure
+	for (u64 i = 0; i < 2; i++) {
+		benchmark_heap_workload(STR("Free list heap "), heap_block_alloc, heap_block_dealloc);
+		benchmark_heap_workload(STR("Size class heap"), heap_alloc, heap_dealloc);
+	}
+	
+	Allocator heap = get_heap_allocator();
+	Allocator copying_heap = heap;
+	copying_heap.proc = test_copying_heap_allocator_proc;
+	
+	benchmark_heap_realloc_workload(STR("Copying heap  "), copying_heap, 1, 1000000);
+	benchmark_heap_realloc_workload(STR("Resizing heap "), heap,         1, 1000000);
+	benchmark_heap_realloc_workload(STR("Copying heap  "), copying_heap, 8, 100000);
+	benchmark_heap_realloc_workload(STR("Resizing heap "), heap,         8, 100000);
+
+	return 0;
+}
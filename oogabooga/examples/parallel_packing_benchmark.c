@@ -0,0 +1,94 @@
+// Times packing quads to instances on worker pools of different sizes, without drawing anything.
+// This is what the renderer does with the quads of a frame after their texture slots are known.
+// Packing is mostly bound by memory bandwidth, so expect it to stop scaling before the core count does.
+// Doesn't need a window, so it also works with OOGABOOGA_HEADLESS.
+//
+// Every pool size is tried with a few job sizes, on frames from below QUAD_PACK_MIN_PARALLEL_COUNT
+// and up. Pick QUAD_PACK_JOB_SIZE from the fastest job size, and QUAD_PACK_MIN_PARALLEL_COUNT from
+// the smallest frame where the pools beat one thread. Numbers from a machine with fewer cores than
+// threads only show the overhead.
+
+// Best of a few runs, so one unlucky wake up doesn't decide it
+#define BENCHMARK_PACKING_RUN_COUNT 5
+
+void benchmark_parallel_quad_packing(u64 quad_count) {
+	Draw_Quad *quads = alloc(get_heap_allocator(), quad_count*sizeof(Draw_Quad));
+	s8 *texture_indices = alloc(get_heap_allocator(), quad_count);
+	Quad_Instance *instances = alloc(get_heap_allocator(), quad_count*sizeof(Quad_Instance));
+	const u64 scissor_count = 64;
+	const u64 userdata_count = 64;
+	Vector4 *scissors = alloc(get_heap_allocator(), scissor_count*sizeof(Vector4));
+	Draw_Quad_Userdata *userdata = alloc(get_heap_allocator(), userdata_count*sizeof(Draw_Quad_Userdata));
+	
+	test_fill_random_draw_quads(quads, texture_indices, quad_count, scissors, scissor_count, userdata, userdata_count);
+	Gfx_Image *images = test_give_quads_texture_runs(quads, quad_count, 100);
+	
+	Quad_Segment *segments = 0;
+	float64 split_start = os_get_current_time_in_seconds();
+	split_quads_into_segments(quads, quad_count, texture_indices, &segments);
+	float64 split_end = os_get_current_time_in_seconds();
+	
+	float32 ndc_pixel_width = 2.0/1280.0;
+	float32 ndc_pixel_height = 2.0/720.0;
+	float32 window_pixel_height = 720.0;
+	
+	// Fault the output pages in first, or whichever runs first pays for it
+	memset(instances, 0, quad_count*sizeof(Quad_Instance));
+	
+	float64 single_ms = F32_MAX;
+	for (u64 r = 0; r < BENCHMARK_PACKING_RUN_COUNT; r++) {
+		float64 start = os_get_current_time_in_seconds();
+		pack_quads_to_instances(quads, scissors, userdata, texture_indices, quad_count, instances, ndc_pixel_width, ndc_pixel_height, window_pixel_height);
+		float64 end = os_get_current_time_in_seconds();
+		single_ms = min(single_ms, (end-start)*1000.0);
+	}
+	
+	print("%llu quads in %llu segments: texture slots %.2f ms, packing on 1 thread %.3f ms\n", quad_count, growing_array_get_valid_count(segments), (split_end-split_start)*1000.0, single_ms);
+	
+	u64 thread_counts[] = { 1, 3, 7, 15 };
+	u64 job_sizes[] = { 2048, 4096, 8192, 16384, 32768 };
+	for (u64 t = 0; t < sizeof(thread_counts)/sizeof(thread_counts[0]); t++) {
+		Worker_Pool pool;
+		worker_pool_init(&pool, thread_counts[t]);
+		
+		print("    %llu threads:", thread_counts[t]+1);
+		for (u64 j = 0; j < sizeof(job_sizes)/sizeof(job_sizes[0]); j++) {
+			float64 ms = F32_MAX;
+			for (u64 r = 0; r < BENCHMARK_PACKING_RUN_COUNT; r++) {
+				float64 start = os_get_current_time_in_seconds();
+				pack_quads_to_instances_in_jobs(&pool, quads, scissors, userdata, texture_indices, quad_count, instances, ndc_pixel_width, ndc_pixel_height, window_pixel_height, job_sizes[j]);
+				float64 end = os_get_current_time_in_seconds();
+				ms = min(ms, (end-start)*1000.0);
+			}
+			print("%cs %llu per job %.3f ms (%.2fx)", j == 0 ? "" : ",", job_sizes[j], ms, single_ms/ms);
+		}
+		print("\n");
+		
+		worker_pool_destroy(&pool);
+	}
+	
+	growing_array_deinit((void**)&segments);
+	dealloc(get_heap_allocator(), images);
+	dealloc(get_heap_allocator(), scissors);
+	dealloc(get_heap_allocator(), userdata);
+	dealloc(get_heap_allocator(), quads);
+	dealloc(get_heap_allocator(), texture_indices);
+	dealloc(get_heap_allocator(), instances);
+}
+
+int entry(int argc, char **argv) {
+	
+	seed_for_random = 69;
+	
+	print("%llu logical processors, QUAD_PACK_JOB_SIZE %llu, QUAD_PACK_MIN_PARALLEL_COUNT %llu\n", os.logical_processor_count, (u64)QUAD_PACK_JOB_SIZE, (u64)QUAD_PACK_MIN_PARALLEL_COUNT);
+	
+	u64 quad_counts[] = { 8192, 16384, 32768, 65536, 100000, 300000, 1000000 };
+	
+	for (u64 i = 0; i < sizeof(quad_counts)/sizeof(quad_counts[0]); i++) {
+		// Once to warm up, once to measure
+		benchmark_parallel_quad_packing(quad_counts[i]);
+		benchmark_parallel_quad_packing(quad_counts[i]);
+	}
+	
+	return 0;
+}
@@ -0,0 +1,63 @@
+
+// Times the quad to instance packing the renderer does every frame, without drawing anything.
+// Compares pack_quads_to_instances (SIMD when enabled) to the plain scalar version
+// at about the quad counts of renderer_stress_test.c and up.
+// Doesn't need a window, so it also works with OOGABOOGA_HEADLESS.
+
+void benchmark_quad_instance_packing(u64 quad_count) {
+	Draw_Quad *quads = alloc(get_heap_allocator(), quad_count*sizeof(Draw_Quad));
+	s8 *texture_indices = alloc(get_heap_allocator(), quad_count);
+	Quad_Instance *instances = alloc(get_heap_allocator(), quad_count*sizeof(Quad_Instance));
+	const u64 scissor_count = 64;
+	const u64 userdata_count = 64;
+	Vector4 *scissors = alloc(get_heap_allocator(), scissor_count*sizeof(Vector4));
+	Draw_Quad_Userdata *userdata = alloc(get_heap_allocator(), userdata_count*sizeof(Draw_Quad_Userdata));
+	
+	test_fill_random_draw_quads(quads, texture_indices, quad_count, scissors, scissor_count, userdata, userdata_count);
+	
+	float32 ndc_pixel_width = 2.0/1280.0;
+	float32 ndc_pixel_height = 2.0/720.0;
+	float32 window_pixel_height = 720.0;
+	
+	// Fault the output pages in first, or whichever version runs first pays for it
+	memset(instances, 0, quad_count*sizeof(Quad_Instance));
+	
+	float64 scalar_start = os_get_current_time_in_seconds();
+	pack_quads_to_instances_scalar(quads, scissors, userdata, texture_indices, quad_count, instances, ndc_pixel_width, ndc_pixel_height, window_pixel_height);
+	float64 scalar_end = os_get_current_time_in_seconds();
+	
+	float64 start = os_get_current_time_in_seconds();
+	pack_quads_to_instances(quads, scissors, userdata, texture_indices, quad_count, instances, ndc_pixel_width, ndc_pixel_height, window_pixel_height);
+	float64 end = os_get_current_time_in_seconds();
+	
+	print("%llu quads (%llu bytes each, %llu byte instances): scalar %.2f ms, ", quad_count, (u64)sizeof(Draw_Quad), (u64)sizeof(Quad_Instance), (scalar_end-scalar_start)*1000.0);
+	print("pack_quads_to_instances %.2f ms\n", (end-start)*1000.0);
+	
+	dealloc(get_heap_allocator(), scissors);
+	dealloc(get_heap_allocator(), userdata);
+	dealloc(get_heap_allocator(), quads);
+	dealloc(get_heap_allocator(), texture_indices);
+	dealloc(get_heap_allocator(), instances);
+}
+
+int entry(int argc, char **argv) {
+	
+	seed_for_random = 69;
+	
+	// So the numbers say what they measured
+#if ENABLE_SIMD && SIMD_ENABLE_SSE2
+	print("pack_quads_to_instances uses the SSE2 path\n");
+#else
+	print("pack_quads_to_instances uses the scalar path, SIMD is disabled\n");
+#endif
+	
+	u64 quad_counts[] = { 30000, 100000, 300000, 1000000 };
+	
+	for (u64 i = 0; i < sizeof(quad_counts)/sizeof(quad_counts[0]); i++) {
+		// Once to warm up, once to measure
+		benchmark_quad_instance_packing(quad_counts[i]);
+		benchmark_quad_instance_packing(quad_counts[i]);
+	}
+
+	return 0;
+}
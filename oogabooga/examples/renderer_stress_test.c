@@ -99,7 +99,11 @@ int entry(int argc, char **argv) {
 		}
 		
 		seed_for_random = 69;
-		for (u64 i = 0; i < 30000; i++) {
+		const u64 bush_count = 30000;
+		Vector2 *bush_positions = talloc(bush_count*sizeof(Vector2));
+		Vector2 *bush_sizes = talloc(bush_count*sizeof(Vector2));
+		s32 *bush_z = talloc(bush_count*sizeof(s32));
+		for (u64 i = 0; i < bush_count; i++) {
 			float32 aspect = (float32)window.width/(float32)window.height;
 			float min_x = -aspect;
 			float max_x = aspect;
@@ -109,10 +113,11 @@ int entry(int argc, char **argv) {
 			float x = get_random_float32() * (max_x-min_x) + min_x;
 			float y = get_random_float32() * (max_y-min_y) + min_y;
 			
-			push_z_layer((s32)(y*100));
-			draw_image(bush_image, v2(x, y), v2(0.1, 0.1), COLOR_WHITE);
-			pop_z_layer();
+			bush_positions[i] = v2(x, y);
+			bush_sizes[i] = v2(0.1, 0.1);
+			bush_z[i] = (s32)(y*100);
 		}
+		draw_sprites_batch_z(bush_image, bush_positions, bush_sizes, 0, bush_z, bush_count);
 		seed_for_random = rdtsc();
 		
 		Matrix4 hammer_xform = m4_scalar(1.0);
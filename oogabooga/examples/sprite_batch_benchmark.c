@@ -0,0 +1,61 @@
+// Times submitting sprites one by one with draw_image against one draw_sprites_batch_z call,
+// without drawing anything. Some of the sprites are off screen so culling is part of it.
+
+void benchmark_draw_sprites_batch(u64 sprite_count) {
+	Draw_Frame saved_frame = draw_frame;
+	draw_frame = ZERO(Draw_Frame);
+	draw_frame.projection = m4_make_orthographic_projection(-640, 640, -360, 360, -1, 10);
+	draw_frame.view = m4_make_translation(v3(30, -20, 0));
+	
+	Gfx_Image image = ZERO(Gfx_Image);
+	
+	Vector2 *positions = alloc(get_heap_allocator(), sprite_count*sizeof(Vector2));
+	Vector2 *sizes = alloc(get_heap_allocator(), sprite_count*sizeof(Vector2));
+	Vector4 *colors = alloc(get_heap_allocator(), sprite_count*sizeof(Vector4));
+	s32 *z = alloc(get_heap_allocator(), sprite_count*sizeof(s32));
+	for (u64 i = 0; i < sprite_count; i++) {
+		positions[i] = v2(get_random_float32_in_range(-800, 800), get_random_float32_in_range(-500, 500));
+		sizes[i] = v2(get_random_float32_in_range(1, 64), get_random_float32_in_range(1, 64));
+		colors[i] = v4(get_random_float32(), get_random_float32(), get_random_float32(), 1);
+		z[i] = (s32)(positions[i].y*100);
+	}
+	
+	float64 one_by_one_start = os_get_current_time_in_seconds();
+	for (u64 i = 0; i < sprite_count; i++) {
+		push_z_layer(z[i]);
+		draw_image(&image, positions[i], sizes[i], colors[i]);
+		pop_z_layer();
+	}
+	float64 one_by_one_end = os_get_current_time_in_seconds();
+	
+	draw_frame.num_quads = 0;
+	
+	float64 batch_start = os_get_current_time_in_seconds();
+	draw_sprites_batch_z(&image, positions, sizes, colors, z, sprite_count);
+	float64 batch_end = os_get_current_time_in_seconds();
+	
+	print("%llu sprites: draw_image %.2f ms, ", sprite_count, (one_by_one_end-one_by_one_start)*1000.0);
+	print("draw_sprites_batch_z %.2f ms\n", (batch_end-batch_start)*1000.0);
+	
+	dealloc(get_heap_allocator(), positions);
+	dealloc(get_heap_allocator(), sizes);
+	dealloc(get_heap_allocator(), colors);
+	dealloc(get_heap_allocator(), z);
+	
+	draw_frame = saved_frame;
+}
+
+int entry(int argc, char **argv) {
+	
+	seed_for_random = 69;
+	
+	u64 sprite_counts[] = { 30000, 100000, 300000 };
+	
+	for (u64 i = 0; i < sizeof(sprite_counts)/sizeof(sprite_counts[0]); i++) {
+		// Once to warm up, once to measure
+		benchmark_draw_sprites_batch(sprite_counts[i]);
+		benchmark_draw_sprites_batch(sprite_counts[i]);
+	}
+	
+	return 0;
+}
@@ -0,0 +1,64 @@
+// Times z sorting the quads of a frame without drawing anything. Compares radix_sort on
+// whole quads to radix_sort_key_index plus one move per quad, which is what the renderer does.
+
+void benchmark_quad_z_sort(u64 quad_count) {
+	Draw_Quad *quads = alloc(get_heap_allocator(), quad_count*sizeof(Draw_Quad));
+	Draw_Quad *reference = alloc(get_heap_allocator(), quad_count*sizeof(Draw_Quad));
+	Draw_Quad *help = alloc(get_heap_allocator(), quad_count*sizeof(Draw_Quad));
+	Draw_Quad *sorted_quads = alloc(get_heap_allocator(), quad_count*sizeof(Draw_Quad));
+	u64 *keys = alloc(get_heap_allocator(), quad_count*sizeof(u64));
+	u64 *help_keys = alloc(get_heap_allocator(), quad_count*sizeof(u64));
+	
+	memset(quads, 0, quad_count*sizeof(Draw_Quad));
+	for (u64 i = 0; i < quad_count; i++) {
+		// Half random, half in order, like test_quad_z_sort
+		if (i % 2 == 0) quads[i].z = get_random_int_in_range(-MAX_Z+1, MAX_Z-1);
+		else            quads[i].z = (s32)(i/64);
+	}
+	memcpy(reference, quads, quad_count*sizeof(Draw_Quad));
+	
+	// Fault the pages in first, or whichever sort runs first pays for it
+	memset(help, 0, quad_count*sizeof(Draw_Quad));
+	memset(sorted_quads, 0, quad_count*sizeof(Draw_Quad));
+	memset(keys, 0, quad_count*sizeof(u64));
+	memset(help_keys, 0, quad_count*sizeof(u64));
+	
+	float64 reference_start = os_get_current_time_in_seconds();
+	radix_sort(reference, help, quad_count, sizeof(Draw_Quad), offsetof(Draw_Quad, z), MAX_Z_BITS);
+	float64 reference_end = os_get_current_time_in_seconds();
+	
+	float64 start = os_get_current_time_in_seconds();
+	for (u64 i = 0; i < quad_count; i++) {
+		keys[i] = ((u64)draw_quad_get_sort_key(&quads[i], false) << 32) | i;
+	}
+	u64 *sorted = radix_sort_key_index(keys, help_keys, quad_count, Z_SORT_KEY_BITS);
+	for (u64 i = 0; i < quad_count; i++) {
+		sorted_quads[i] = quads[(u32)sorted[i]];
+	}
+	float64 end = os_get_current_time_in_seconds();
+	
+	print("%llu quads (%llu bytes each): radix_sort %.2f ms, ", quad_count, (u64)sizeof(Draw_Quad), (reference_end-reference_start)*1000.0);
+	print("radix_sort_key_index with one move %.2f ms\n", (end-start)*1000.0);
+	
+	dealloc(get_heap_allocator(), quads);
+	dealloc(get_heap_allocator(), reference);
+	dealloc(get_heap_allocator(), help);
+	dealloc(get_heap_allocator(), sorted_quads);
+	dealloc(get_heap_allocator(), keys);
+	dealloc(get_heap_allocator(), help_keys);
+}
+
+int entry(int argc, char **argv) {
+	
+	seed_for_random = 69;
+	
+	u64 quad_counts[] = { 100000, 300000, 1000000 };
+	
+	for (u64 i = 0; i < sizeof(quad_counts)/sizeof(quad_counts[0]); i++) {
+		// Once to warm up, once to measure
+		benchmark_quad_z_sort(quad_counts[i]);
+		benchmark_quad_z_sort(quad_counts[i]);
+	}
+	
+	return 0;
+}
@@ -7,24 +7,9 @@ const Gfx_Handle GFX_INVALID_HANDLE = 0;
 
 string temp_win32_null_terminated_wide_to_fixed_utf8(const u16 *utf16);
 
-// We wanna pack this at some point
-// #Cleanup #Memory why am I doing alignat(16)?
-typedef struct alignat(16) D3D11_Vertex {
-	
-	Vector4 color;
-	Vector4 position;
-	Vector2 uv;
-	Vector2 self_uv;
-	s8 texture_index;
-	u8 type;
-	u8 sampler;
-	u8 has_scissor;
-	
-	Vector4 userdata[VERTEX_2D_USER_DATA_COUNT];
-	
-	Vector4 scissor;
-	
-} D3D11_Vertex;
+// Quads are packed to one instance each on the cpu with pack_quads_to_instances() in drawing.c
+// and expanded to vertices in the vertex shader.
+typedef Quad_Instance D3D11_Instance;
 
 ID3D11Debug *d3d11_debug = 0;
 
@@ -58,9 +43,21 @@ void *d3d11_staging_quad_buffer = 0;
 ID3D11Buffer *d3d11_cbuffer = 0;
 u64 d3d11_cbuffer_size = 0;
 
+// Vertex shader transform of the quad corners, world_to_clip*xform for static batches
+ID3D11Buffer *d3d11_batch_transform_cbuffer = 0;
+bool d3d11_batch_transform_is_identity = false;
+
 Draw_Quad *sort_quad_buffer = 0;
 u64 sort_quad_buffer_size = 0;
 
+// Draw calls of the frame's quads, growing array
+Quad_Segment *d3d11_quad_segments = 0;
+// Packs the quads of big frames in parallel
+#ifndef D3D11_MAX_PACKING_THREADS
+	#define D3D11_MAX_PACKING_THREADS 8
+#endif
+Worker_Pool d3d11_worker_pool;
+
 // Defined at the bottom of this file
 extern const char *d3d11_image_shader_source;
 
@@ -275,89 +272,91 @@ d3d11_compile_shader(string source) {
 
 
 
+	// Everything is per instance, the vertex shader picks the corner from SV_VertexID
 	#define layout_base_count 9
 	D3D11_INPUT_ELEMENT_DESC layout[layout_base_count+VERTEX_2D_USER_DATA_COUNT];
 	memset(layout, 0, sizeof(layout));
 	
-	layout[0].SemanticName = "POSITION";
+	layout[0].SemanticName = "CORNERS";
 	layout[0].SemanticIndex = 0;
 	layout[0].Format = DXGI_FORMAT_R32G32B32A32_FLOAT;
 	layout[0].InputSlot = 0;
-	layout[0].AlignedByteOffset = offsetof(D3D11_Vertex, position);
-	layout[0].InputSlotClass = D3D11_INPUT_PER_VERTEX_DATA;
-	layout[0].InstanceDataStepRate = 0;
+	layout[0].AlignedByteOffset = offsetof(D3D11_Instance, corners[0]);
+	layout[0].InputSlotClass = D3D11_INPUT_PER_INSTANCE_DATA;
+	layout[0].InstanceDataStepRate = 1;
 	
-	layout[1].SemanticName = "TEXCOORD";
-	layout[1].SemanticIndex = 0;
-	layout[1].Format = DXGI_FORMAT_R32G32_FLOAT;
+	layout[1].SemanticName = "CORNERS";
+	layout[1].SemanticIndex = 1;
+	layout[1].Format = DXGI_FORMAT_R32G32B32A32_FLOAT;
 	layout[1].InputSlot = 0;
-	layout[1].AlignedByteOffset = offsetof(D3D11_Vertex, uv);
-	layout[1].InputSlotClass = D3D11_INPUT_PER_VERTEX_DATA;
-	layout[1].InstanceDataStepRate = 0;
+	layout[1].AlignedByteOffset = offsetof(D3D11_Instance, corners[2]);
+	layout[1].InputSlotClass = D3D11_INPUT_PER_INSTANCE_DATA;
+	layout[1].InstanceDataStepRate = 1;
 	
-	layout[2].SemanticName = "COLOR";
+	layout[2].SemanticName = "TEXCOORD";
 	layout[2].SemanticIndex = 0;
 	layout[2].Format = DXGI_FORMAT_R32G32B32A32_FLOAT;
 	layout[2].InputSlot = 0;
-	layout[2].AlignedByteOffset = offsetof(D3D11_Vertex, color);
-	layout[2].InputSlotClass = D3D11_INPUT_PER_VERTEX_DATA;
-	layout[2].InstanceDataStepRate = 0;
+	layout[2].AlignedByteOffset = offsetof(D3D11_Instance, uv);
+	layout[2].InputSlotClass = D3D11_INPUT_PER_INSTANCE_DATA;
+	layout[2].InstanceDataStepRate = 1;
 	
-	layout[3].SemanticName = "TEXTURE_INDEX";
+	layout[3].SemanticName = "COLOR";
 	layout[3].SemanticIndex = 0;
-	layout[3].Format = DXGI_FORMAT_R8_SINT;
+	layout[3].Format = DXGI_FORMAT_R8G8B8A8_UNORM;
 	layout[3].InputSlot = 0;
-	layout[3].AlignedByteOffset = offsetof(D3D11_Vertex, texture_index);
-	layout[3].InputSlotClass = D3D11_INPUT_PER_VERTEX_DATA;
-	layout[3].InstanceDataStepRate = 0;
+	layout[3].AlignedByteOffset = offsetof(D3D11_Instance, color);
+	layout[3].InputSlotClass = D3D11_INPUT_PER_INSTANCE_DATA;
+	layout[3].InstanceDataStepRate = 1;
 	
-	layout[4].SemanticName = "TYPE";
+	layout[4].SemanticName = "TEXTURE_INDEX";
 	layout[4].SemanticIndex = 0;
-	layout[4].Format = DXGI_FORMAT_R8_UINT;
+	layout[4].Format = DXGI_FORMAT_R8_SINT;
 	layout[4].InputSlot = 0;
-	layout[4].AlignedByteOffset = offsetof(D3D11_Vertex, type);
-	layout[4].InputSlotClass = D3D11_INPUT_PER_VERTEX_DATA;
-	layout[4].InstanceDataStepRate = 0;
+	layout[4].AlignedByteOffset = offsetof(D3D11_Instance, texture_index);
+	layout[4].InputSlotClass = D3D11_INPUT_PER_INSTANCE_DATA;
+	layout[4].InstanceDataStepRate = 1;
 	
-	layout[5].SemanticName = "SAMPLER_INDEX";
+	layout[5].SemanticName = "TYPE";
 	layout[5].SemanticIndex = 0;
-	layout[5].Format = DXGI_FORMAT_R8_SINT;
+	layout[5].Format = DXGI_FORMAT_R8_UINT;
 	layout[5].InputSlot = 0;
-	layout[5].AlignedByteOffset = offsetof(D3D11_Vertex, sampler);
-	layout[5].InputSlotClass = D3D11_INPUT_PER_VERTEX_DATA;
-	layout[5].InstanceDataStepRate = 0;
+	layout[5].AlignedByteOffset = offsetof(D3D11_Instance, type);
+	layout[5].InputSlotClass = D3D11_INPUT_PER_INSTANCE_DATA;
+	layout[5].InstanceDataStepRate = 1;
 	
-	layout[6].SemanticName = "SELF_UV";
+	layout[6].SemanticName = "SAMPLER_INDEX";
 	layout[6].SemanticIndex = 0;
-	layout[6].Format = DXGI_FORMAT_R32G32_FLOAT;
+	layout[6].Format = DXGI_FORMAT_R8_UINT;
 	layout[6].InputSlot = 0;
-	layout[6].AlignedByteOffset = offsetof(D3D11_Vertex, self_uv);
-	layout[6].InputSlotClass = D3D11_INPUT_PER_VERTEX_DATA;
-	layout[6].InstanceDataStepRate = 0;
+	layout[6].AlignedByteOffset = offsetof(D3D11_Instance, sampler);
+	layout[6].InputSlotClass = D3D11_INPUT_PER_INSTANCE_DATA;
+	layout[6].InstanceDataStepRate = 1;
 	
-	layout[7].SemanticName = "SCISSOR";
+	layout[7].SemanticName = "HAS_SCISSOR";
 	layout[7].SemanticIndex = 0;
-	layout[7].Format = DXGI_FORMAT_R32G32B32A32_FLOAT;
+	layout[7].Format = DXGI_FORMAT_R8_UINT;
 	layout[7].InputSlot = 0;
-	layout[7].AlignedByteOffset = offsetof(D3D11_Vertex, scissor);
-	layout[7].InputSlotClass = D3D11_INPUT_PER_VERTEX_DATA;
-	layout[7].InstanceDataStepRate = 0;
+	layout[7].AlignedByteOffset = offsetof(D3D11_Instance, has_scissor);
+	layout[7].InputSlotClass = D3D11_INPUT_PER_INSTANCE_DATA;
+	layout[7].InstanceDataStepRate = 1;
 	
-	layout[8].SemanticName = "HAS_SCISSOR";
+	layout[8].SemanticName = "SCISSOR";
 	layout[8].SemanticIndex = 0;
-	layout[8].Format = DXGI_FORMAT_R8_UINT;
+	layout[8].Format = DXGI_FORMAT_R16G16B16A16_SINT;
 	layout[8].InputSlot = 0;
-	layout[8].AlignedByteOffset = offsetof(D3D11_Vertex, has_scissor);
-	layout[8].InputSlotClass = D3D11_INPUT_PER_VERTEX_DATA;
-	layout[8].InstanceDataStepRate = 0;
+	layout[8].AlignedByteOffset = offsetof(D3D11_Instance, scissor);
+	layout[8].InputSlotClass = D3D11_INPUT_PER_INSTANCE_DATA;
+	layout[8].InstanceDataStepRate = 1;
 	
 	for (int i = 0; i < VERTEX_2D_USER_DATA_COUNT; ++i) {
 	    layout[layout_base_count + i].SemanticName = "USERDATA";
 	    layout[layout_base_count + i].SemanticIndex = i;
 	    layout[layout_base_count + i].Format = DXGI_FORMAT_R32G32B32A32_FLOAT;
 	    layout[layout_base_count + i].InputSlot = 0;
-	    layout[layout_base_count + i].AlignedByteOffset = offsetof(D3D11_Vertex, userdata) + sizeof(Vector4) * i;
-	    layout[layout_base_count + i].InputSlotClass = D3D11_INPUT_PER_VERTEX_DATA;
+	    layout[layout_base_count + i].AlignedByteOffset = offsetof(D3D11_Instance, userdata) + sizeof(Vector4) * i;
+	    layout[layout_base_count + i].InputSlotClass = D3D11_INPUT_PER_INSTANCE_DATA;
+	    layout[layout_base_count + i].InstanceDataStepRate = 1;
 	}
 	
 	
@@ -517,6 +516,21 @@ void gfx_init() {
 	    win32_check_hr(hr);
 	}
 	
+	{
+		D3D11_BUFFER_DESC desc = ZERO(D3D11_BUFFER_DESC);
+		desc.ByteWidth      = sizeof(Matrix4);
+		desc.Usage          = D3D11_USAGE_DYNAMIC;
+		desc.BindFlags      = D3D11_BIND_CONSTANT_BUFFER;
+		desc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+		hr = ID3D11Device_CreateBuffer(d3d11_device, &desc, null, &d3d11_batch_transform_cbuffer);
+		win32_check_hr(hr);
+	}
+	
+	// The thread calling gfx_update packs too. Packing is mostly memory bandwidth, so it's
+	// capped, see examples/parallel_packing_benchmark.c for where it stops scaling.
+	u64 packing_threads = clamp(os.logical_processor_count, 1, D3D11_MAX_PACKING_THREADS);
+	worker_pool_init(&d3d11_worker_pool, packing_threads-1);
+	
 	string source = STR(d3d11_image_shader_source);
 	
 	bool ok = d3d11_compile_shader(source);
@@ -527,7 +541,16 @@ void gfx_init() {
 	
 }
 
-void d3d11_draw_call(int number_of_rendered_quads, ID3D11ShaderResourceView **textures, u64 num_textures) {
+void d3d11_set_batch_transform(Matrix4 transform) {
+	D3D11_MAPPED_SUBRESOURCE mapping;
+	HRESULT hr = ID3D11DeviceContext_Map(d3d11_context, (ID3D11Resource*)d3d11_batch_transform_cbuffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &mapping);
+	win32_check_hr(hr);
+	memcpy(mapping.pData, &transform, sizeof(Matrix4));
+	ID3D11DeviceContext_Unmap(d3d11_context, (ID3D11Resource*)d3d11_batch_transform_cbuffer, 0);
+}
+
+// Draws instance_count instances starting at first_instance in instance_buffer
+void d3d11_draw_call(ID3D11Buffer *instance_buffer, u64 first_instance, u64 instance_count, ID3D11ShaderResourceView **textures, u64 num_textures) {
 	ID3D11DeviceContext_OMSetBlendState(d3d11_context, d3d11_blend_state, 0, 0xffffffff);
 	ID3D11DeviceContext_OMSetRenderTargets(d3d11_context, 1, &d3d11_window_render_target_view, 0); 
 	ID3D11DeviceContext_RSSetState(d3d11_context, d3d11_rasterizer);
@@ -537,14 +560,15 @@ void d3d11_draw_call(int number_of_rendered_quads, ID3D11ShaderResourceView **te
 	viewport.MaxDepth = 1.0;
 	ID3D11DeviceContext_RSSetViewports(d3d11_context, 1, &viewport);
 	
-    UINT stride = sizeof(D3D11_Vertex);
+    UINT stride = sizeof(D3D11_Instance);
     UINT offset = 0;
 	
 	ID3D11DeviceContext_IASetInputLayout(d3d11_context, d3d11_image_vertex_layout);
-    ID3D11DeviceContext_IASetVertexBuffers(d3d11_context, 0, 1, &d3d11_quad_vbo, &stride, &offset);
+    ID3D11DeviceContext_IASetVertexBuffers(d3d11_context, 0, 1, &instance_buffer, &stride, &offset);
     ID3D11DeviceContext_IASetPrimitiveTopology(d3d11_context, D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
 
     ID3D11DeviceContext_VSSetShader(d3d11_context, d3d11_vertex_shader_for_2d, NULL, 0);
+    ID3D11DeviceContext_VSSetConstantBuffers(d3d11_context, 1, 1, &d3d11_batch_transform_cbuffer);
     ID3D11DeviceContext_PSSetShader(d3d11_context, d3d11_fragment_shader_for_2d, NULL, 0);
     
 	if (draw_frame.cbuffer && d3d11_cbuffer && d3d11_cbuffer_size) {
@@ -569,7 +593,9 @@ void d3d11_draw_call(int number_of_rendered_quads, ID3D11ShaderResourceView **te
     ID3D11DeviceContext_PSSetSamplers(d3d11_context, 3, 1, &d3d11_image_sampler_nl_fp);
     ID3D11DeviceContext_PSSetShaderResources(d3d11_context, 0, num_textures, textures);
 
-    ID3D11DeviceContext_Draw(d3d11_context, number_of_rendered_quads * 6, 0);
+    // 6 vertices (two triangles) per quad instance
+    ID3D11DeviceContext_DrawInstanced(d3d11_context, 6, instance_count, 0, first_instance);
+    draw_frame_stats.draw_call_count += 1;
 }
 
 void d3d11_process_draw_frame() {
@@ -578,9 +604,12 @@ void d3d11_process_draw_frame() {
 	
 	ID3D11DeviceContext_ClearRenderTargetView(d3d11_context, d3d11_window_render_target_view, (float*)&window.clear_color);
 	
+	draw_frame_stats = ZERO(Draw_Frame_Stats);
+	draw_frame_stats.quad_count = draw_frame.num_quads;
+	
 	///
 	// Maybe grow quad vbo
-	u32 required_size = sizeof(D3D11_Vertex) * allocated_quads*6;
+	u32 required_size = sizeof(D3D11_Instance) * allocated_quads;
 
 	if (required_size > d3d11_quad_vbo_size) {
 		if (d3d11_quad_vbo) {
@@ -602,160 +631,96 @@ void d3d11_process_draw_frame() {
 		log_verbose("Grew quad vbo to %d bytes.", d3d11_quad_vbo_size);
 	}
 
+	///
+	// Static batches, already on the gpu so it's just the draw calls
+	if (draw_frame.static_batch_draw_count > 0) tm_scope("Static batches") {
+		for (u64 i = 0; i < draw_frame.static_batch_draw_count; i++) {
+			Static_Batch_Draw *d = &draw_frame.static_batch_draws[i];
+			
+			d3d11_set_batch_transform(d->transform);
+			d3d11_batch_transform_is_identity = false;
+			
+			u64 segment_count = growing_array_get_valid_count(d->batch->segments);
+			for (u64 j = 0; j < segment_count; j++) {
+				Quad_Segment *segment = &d->batch->segments[j];
+				d3d11_draw_call((ID3D11Buffer*)d->batch->gfx_buffer, segment->first_quad, segment->quad_count, segment->textures, segment->texture_count);
+			}
+			draw_frame_stats.static_quad_count += d->batch->quad_count;
+		}
+	}
+	// The quads of the frame are already in clip space
+	if (!d3d11_batch_transform_is_identity) {
+		d3d11_set_batch_transform(m4_scalar(1.0));
+		d3d11_batch_transform_is_identity = true;
+	}
+
 	if (draw_frame.num_quads > 0) {
 		///
 		// Render geometry from into vbo quad list
-	    
-		
-		ID3D11ShaderResourceView *textures[32];
-		ID3D11ShaderResourceView *last_texture = 0;
-		u64 num_textures = 0;
-		s8 last_texture_index = 0;
-		
-		D3D11_Vertex* head = (D3D11_Vertex*)d3d11_staging_quad_buffer;
-		D3D11_Vertex* pointer = head;
-		u64 number_of_rendered_quads = 0;
 		
 		tm_scope("Quad processing") {
-			if (draw_frame.enable_z_sorting) tm_scope("Z sorting") {
+			// Quads are drawn from here, which is quad_buffer or its sorted copy
+			Draw_Quad *quads = quad_buffer;
+			
+			// Texture sorting reorders quads within a layer, so it needs the full sort even
+			// when they come in z order.
+			bool sort_by_texture = draw_frame.enable_texture_sorting;
+			
+			u64 z_run_starts[Z_SORT_MAX_MERGE_RUNS];
+			u64 z_run_count = 0;
+			if (draw_frame.enable_z_sorting) {
+				z_run_count = draw_quads_find_z_runs(quad_buffer, draw_frame.num_quads, z_run_starts);
+				draw_frame_stats.z_run_count = z_run_count;
+			}
+			bool already_sorted = !sort_by_texture && z_run_count <= 1;
+			
+			if (draw_frame.enable_z_sorting && already_sorted) {
+				draw_frame_stats.z_sort_skipped_count += 1;
+			} else if (draw_frame.enable_z_sorting) tm_scope("Z sorting") {
 				if (!sort_quad_buffer || (sort_quad_buffer_size < allocated_quads*sizeof(Draw_Quad))) {
 					// #Memory #Heapalloc
 					if (sort_quad_buffer) dealloc(get_heap_allocator(), sort_quad_buffer);
 					sort_quad_buffer = alloc(get_heap_allocator(), allocated_quads*sizeof(Draw_Quad));
 					sort_quad_buffer_size = allocated_quads*sizeof(Draw_Quad);
 				}
-				radix_sort(quad_buffer, sort_quad_buffer, draw_frame.num_quads, sizeof(Draw_Quad), offsetof(Draw_Quad, z), MAX_Z_BITS);
-			}
-		
-			for (u64 i = 0; i < draw_frame.num_quads; i++)  {
-				
-				Draw_Quad *q = &quad_buffer[i];
 				
-				assert(q->z <= MAX_Z, "Z is too high. Z is %d, Max is %d.", q->z, MAX_Z);
-				assert(q->z >= (-MAX_Z+1), "Z is too low. Z is %d, Min is %d.", q->z, -MAX_Z+1);
-				
-				s8 texture_index = -1;
-				
-				if (q->image) {
-					
-					if (last_texture == q->image->gfx_handle) {
-						texture_index = last_texture_index;
-					} else {
-						// First look if texture is already bound
-						for (u64 j = 0; j < num_textures; j++) {
-							if (textures[j] == q->image->gfx_handle) {
-								texture_index = (s8)j;
-								break;
-							}
-						}
-						// Otherwise use a new slot
-						if (texture_index <= -1) {
-							if (num_textures >= 32) {
-								// If max textures reached, make a draw call and start over
-								D3D11_MAPPED_SUBRESOURCE buffer_mapping;
-								ID3D11DeviceContext_Map(d3d11_context, (ID3D11Resource*)d3d11_quad_vbo, 0, D3D11_MAP_WRITE_DISCARD, 0, &buffer_mapping);
-								memcpy(buffer_mapping.pData, d3d11_staging_quad_buffer, number_of_rendered_quads*sizeof(D3D11_Vertex)*6);
-								ID3D11DeviceContext_Unmap(d3d11_context, (ID3D11Resource*)d3d11_quad_vbo, 0);
-								d3d11_draw_call(number_of_rendered_quads, textures, num_textures);
-								head = (D3D11_Vertex*)d3d11_staging_quad_buffer;
-								num_textures = 0;
-								texture_index = 0;
-								number_of_rendered_quads = 0;
-								pointer = head;
-							} else {
-								texture_index = (s8)num_textures;
-								num_textures += 1;
-							}
-						}
-					}
-					textures[texture_index] = q->image->gfx_handle;
-					last_texture = q->image->gfx_handle;
-					last_texture_index = texture_index;
+				// Sort (key, index) pairs and then move every quad once, rather than moving
+				// the whole quads on every radix pass.
+				u64 key_bits = sort_by_texture ? TEXTURE_SORT_KEY_BITS : Z_SORT_KEY_BITS;
+				u64 *sort_keys = talloc(draw_frame.num_quads*sizeof(u64));
+				u64 *sort_help = talloc(draw_frame.num_quads*sizeof(u64));
+				for (u64 i = 0; i < draw_frame.num_quads; i++) {
+					sort_keys[i] = ((u64)draw_quad_get_sort_key(&quad_buffer[i], sort_by_texture) << 32) | i;
 				}
 				
-				if (q->type == QUAD_TYPE_TEXT) {
-					float pixel_width = 2.0/(float)window.width;
-					float pixel_height = 2.0/(float)window.height;
-					
-					q->bottom_left.x  = round(q->bottom_left.x  / pixel_width)  * pixel_width;
-				    q->bottom_left.y  = round(q->bottom_left.y  / pixel_height) * pixel_height;
-				    q->top_left.x     = round(q->top_left.x     / pixel_width)  * pixel_width;
-				    q->top_left.y     = round(q->top_left.y     / pixel_height) * pixel_height;
-				    q->top_right.x    = round(q->top_right.x    / pixel_width)  * pixel_width;
-				    q->top_right.y    = round(q->top_right.y    / pixel_height) * pixel_height;
-				    q->bottom_right.x = round(q->bottom_right.x / pixel_width)  * pixel_width;
-				    q->bottom_right.y = round(q->bottom_right.y / pixel_height) * pixel_height;
+				u64 *sorted;
+				if (!sort_by_texture && z_run_count <= Z_SORT_MAX_MERGE_RUNS) {
+					sorted = merge_sorted_runs(sort_keys, sort_help, draw_frame.num_quads, z_run_starts, z_run_count);
+					draw_frame_stats.z_sort_merged_count += 1;
+				} else {
+					sorted = radix_sort_key_index(sort_keys, sort_help, draw_frame.num_quads, key_bits);
+					draw_frame_stats.z_sort_performed_count += 1;
 				}
 				
-				// We will write to 6 vertices for the one quad (two tris)
-				 {
-				
-					D3D11_Vertex* BL  = pointer + 0;
-					D3D11_Vertex* TL  = pointer + 1;
-					D3D11_Vertex* TR  = pointer + 2;
-					D3D11_Vertex* BL2 = pointer + 3;
-					D3D11_Vertex* TR2 = pointer + 4;
-					D3D11_Vertex* BR  = pointer + 5;
-					pointer += 6;
-					
-					BL->position = v4(q->bottom_left.x,  q->bottom_left.y,  0, 1);
-					TL->position = v4(q->top_left.x,     q->top_left.y,     0, 1);
-					TR->position = v4(q->top_right.x,    q->top_right.y,    0, 1);
-					BR->position = v4(q->bottom_right.x, q->bottom_right.y, 0, 1);
-					
-					BL->uv = v2(q->uv.x1, q->uv.y1);
-					TL->uv = v2(q->uv.x1, q->uv.y2);
-					TR->uv = v2(q->uv.x2, q->uv.y2);
-					BR->uv = v2(q->uv.x2, q->uv.y1);
-					
-					BL->self_uv = v2(0, 0);
-					TL->self_uv = v2(0, 1);
-					TR->self_uv = v2(1, 1);
-					BR->self_uv = v2(1, 0);
-					
-					// #Speed
-					memcpy(BL->userdata, q->userdata, sizeof(q->userdata));
-					memcpy(TL->userdata, q->userdata, sizeof(q->userdata));
-					memcpy(TR->userdata, q->userdata, sizeof(q->userdata));
-					memcpy(BR->userdata, q->userdata, sizeof(q->userdata));
-					
-					BL->color = TL->color = TR->color = BR->color = q->color;
-					
-					BL->texture_index=TL->texture_index=TR->texture_index=BR->texture_index = texture_index;
-					BL->type=TL->type=TR->type=BR->type = (u8)q->type;
-					
-					float t = q->scissor.y1;
-					q->scissor.y1 = q->scissor.y2;
-					q->scissor.y2 = t;
-					
-					q->scissor.y1 = window.pixel_height - q->scissor.y1;
-					q->scissor.y2 = window.pixel_height - q->scissor.y2;
-					
-					BL->has_scissor=TL->has_scissor=TR->has_scissor=BR->has_scissor = q->has_scissor;
-					BL->scissor=TL->scissor=TR->scissor=BR->scissor = q->scissor;
-					
-					u8 sampler = -1;
-					if (q->image_min_filter == GFX_FILTER_MODE_NEAREST
-						 		&& q->image_mag_filter == GFX_FILTER_MODE_NEAREST)
-						 	sampler = 0;
-					if (q->image_min_filter == GFX_FILTER_MODE_LINEAR
-						 		&& q->image_mag_filter == GFX_FILTER_MODE_LINEAR)
-						 	sampler = 1;
-					if (q->image_min_filter == GFX_FILTER_MODE_LINEAR
-						 		&& q->image_mag_filter == GFX_FILTER_MODE_NEAREST)
-						 	sampler = 2;
-					if (q->image_min_filter == GFX_FILTER_MODE_NEAREST
-						 		&& q->image_mag_filter == GFX_FILTER_MODE_LINEAR)
-						 	sampler = 3;
-						 	
-					BL->type=TL->type=TR->type=BR->type = (u8)q->type;
-					BL->sampler=TL->sampler=TR->sampler=BR->sampler = (u8)sampler;
-					
-					*BL2 = *BL;
-					*TR2 = *TR;
-					
-					number_of_rendered_quads += 1;
+				for (u64 i = 0; i < draw_frame.num_quads; i++) {
+					sort_quad_buffer[i] = quad_buffer[(u32)sorted[i]];
 				}
+				quads = sort_quad_buffer;
+			}
+		
+			// Texture slots in order first, then the quads can be packed in parallel into
+			// the staging buffer. Each segment is drawn from its part of it.
+			s8 *texture_indices = talloc(draw_frame.num_quads);
+			tm_scope("Texture slots") {
+				split_quads_into_segments(quads, draw_frame.num_quads, texture_indices, &d3d11_quad_segments);
+			}
+			
+			float32 ndc_pixel_width  = 2.0/(float32)window.width;
+			float32 ndc_pixel_height = 2.0/(float32)window.height;
+			float32 window_pixel_height = (float32)window.pixel_height;
+			
+			tm_scope("Quad instance packing") {
+				pack_quads_to_instances_parallel(&d3d11_worker_pool, quads, scissor_buffer, userdata_buffer, texture_indices, draw_frame.num_quads, (D3D11_Instance*)d3d11_staging_quad_buffer, ndc_pixel_width, ndc_pixel_height, window_pixel_height);
 			}
 		}
 		
@@ -766,7 +731,7 @@ void d3d11_process_draw_frame() {
 			win32_check_hr(hr);
 			}
 			tm_scope("The memcpy") {
-				memcpy(buffer_mapping.pData, d3d11_staging_quad_buffer, number_of_rendered_quads*sizeof(D3D11_Vertex)*6);
+				memcpy(buffer_mapping.pData, d3d11_staging_quad_buffer, draw_frame.num_quads*sizeof(D3D11_Instance));
 			}
 			tm_scope("The Unmap call") {
 				ID3D11DeviceContext_Unmap(d3d11_context, (ID3D11Resource*)d3d11_quad_vbo, 0);
@@ -774,8 +739,16 @@ void d3d11_process_draw_frame() {
 		}
 		
 		///
-		// Draw call
-		tm_scope("Draw call") d3d11_draw_call(number_of_rendered_quads, textures, num_textures);
+		// Draw calls, one per segment
+		tm_scope("Draw call") {
+			u64 segment_count = growing_array_get_valid_count(d3d11_quad_segments);
+			for (u64 i = 0; i < segment_count; i++) {
+				Quad_Segment *segment = &d3d11_quad_segments[i];
+				d3d11_draw_call(d3d11_quad_vbo, segment->first_quad, segment->quad_count, segment->textures, segment->texture_count);
+			}
+			// Every segment after the first is there because the one before ran out of texture slots
+			if (segment_count > 1) draw_frame_stats.texture_flush_count += segment_count-1;
+		}
     }
     
     reset_draw_frame(&draw_frame);
@@ -917,6 +890,33 @@ void gfx_deinit_image(Gfx_Image *image) {
 	}
 }
 
+void gfx_init_static_batch(Static_Batch *batch, const Quad_Instance *instances, u64 count) {
+	if (batch->gfx_buffer) gfx_deinit_static_batch(batch);
+	if (count == 0) return;
+	
+	// Never changes after this, rebuilding a batch makes a new buffer
+	D3D11_BUFFER_DESC desc = ZERO(D3D11_BUFFER_DESC);
+	desc.Usage = D3D11_USAGE_IMMUTABLE;
+	desc.ByteWidth = count*sizeof(D3D11_Instance);
+	desc.BindFlags = D3D11_BIND_VERTEX_BUFFER;
+	D3D11_SUBRESOURCE_DATA data = ZERO(D3D11_SUBRESOURCE_DATA);
+	data.pSysMem = instances;
+	ID3D11Buffer *buffer = 0;
+	HRESULT hr = ID3D11Device_CreateBuffer(d3d11_device, &desc, &data, &buffer);
+	win32_check_hr(hr);
+	
+	batch->gfx_buffer = buffer;
+	
+	log_verbose("Created static batch buffer with %llu quads", count);
+}
+void gfx_deinit_static_batch(Static_Batch *batch) {
+	if (batch->gfx_buffer) {
+		ID3D11Buffer *buffer = (ID3D11Buffer*)batch->gfx_buffer;
+		D3D11Release(buffer);
+		batch->gfx_buffer = 0;
+	}
+}
+
 bool 
 shader_recompile_with_extension(string ext_source, u64 cbuffer_size) {
 	
@@ -950,16 +950,16 @@ const char *d3d11_image_shader_source = RAW_STRING(
 	
 struct VS_INPUT
 {
-    float4 position : POSITION;
-    float2 uv : TEXCOORD;
-    float2 self_uv : SELF_UV;
+    float4 corners01 : CORNERS0; // bottom left, top left
+    float4 corners23 : CORNERS1; // top right, bottom right
+    float4 uv : TEXCOORD; // x1, y1, x2, y2
     float4 color : COLOR;
     int texture_index : TEXTURE_INDEX;
     uint type : TYPE;
     uint sampler_index : SAMPLER_INDEX;
     uint has_scissor : HAS_SCISSOR;
     float4 userdata[$VERTEX_2D_USER_DATA_COUNT] : USERDATA;
-    float4 scissor : SCISSOR;
+    int4 scissor : SCISSOR;
 };
 
 struct PS_INPUT
@@ -979,21 +979,42 @@ struct PS_INPUT
 
 
 
-PS_INPUT vs_main(VS_INPUT input)
+// Identity for the quads of the frame which are already in clip space.
+// world_to_clip*xform when drawing a static batch, which is recorded in world space.
+cbuffer Batch_Transform : register(b1)
+{
+    row_major float4x4 batch_transform;
+};
+
+// Each quad is one instance, drawn as 6 vertices:
+// bottom left, top left, top right, bottom left, top right, bottom right
+PS_INPUT vs_main(VS_INPUT input, uint vertex_id : SV_VertexID)
 {
+    static const uint corner_of_vertex[6] = { 0, 1, 2, 0, 2, 3 };
+    uint corner = corner_of_vertex[vertex_id];
+    
+    float2 corner_position;
+    if      (corner == 0) corner_position = input.corners01.xy;
+    else if (corner == 1) corner_position = input.corners01.zw;
+    else if (corner == 2) corner_position = input.corners23.xy;
+    else                  corner_position = input.corners23.zw;
+    
+    bool right = corner >= 2;
+    bool top   = corner == 1 || corner == 2;
+    
     PS_INPUT output;
-    output.position_screen = input.position;
-    output.position = input.position;
-    output.uv = input.uv;
+    output.position_screen = mul(batch_transform, float4(corner_position, 0, 1));
+    output.position = output.position_screen;
+    output.uv = float2(right ? input.uv.z : input.uv.x, top ? input.uv.w : input.uv.y);
+    output.self_uv = float2(right ? 1.0 : 0.0, top ? 1.0 : 0.0);
     output.color = input.color;
     output.texture_index = input.texture_index;
     output.type          = input.type;
     output.sampler_index = input.sampler_index;
-    output.self_uv = input.self_uv;
 	for (int i = 0; i < $VERTEX_2D_USER_DATA_COUNT; i++) {
     	output.userdata[i] = input.userdata[i];
 	}
-	output.scissor = input.scissor;
+	output.scissor = float4(input.scissor);
 	output.has_scissor = input.has_scissor;
     return output;
 }
@@ -1,4 +1,9 @@
-#if GFX_RENDERER == GFX_RENDERER_D3D11
+#ifdef OOGABOOGA_HEADLESS
+	// Nothing is drawn and no images can be made, but the types are still here so the parts of
+	// drawing that don't need a renderer (quad_packing.c) can be tested & benchmarked.
+	typedef void * Gfx_Handle;
+	
+#elif GFX_RENDERER == GFX_RENDERER_D3D11
 	#include <d3d11.h>
 	#include <dxgi.h>
 	#include <dxgi1_2.h>
@@ -35,8 +40,15 @@ typedef struct Gfx_Image {
 	u32 width, height, channels;
 	Gfx_Handle gfx_handle;
 	Allocator allocator;
+	
+	// Set if this image is a part of another texture, like the images in an Image_Atlas.
+	// Drawing it draws atlas_uv of atlas.
+	struct Gfx_Image *atlas;
+	Vector4 atlas_uv;
 } Gfx_Image;
 
+#ifndef OOGABOOGA_HEADLESS
+
 Gfx_Image *
 make_image(u32 width, u32 height, u32 channels, void *initial_data, Allocator allocator);
 Gfx_Image *
@@ -72,6 +84,7 @@ make_image(u32 width, u32 height, u32 channels, void *initial_data, Allocator al
     image->gfx_handle = GFX_INVALID_HANDLE;  // This is handled in gfx
     image->allocator = allocator;
     image->channels = channels;
+    image->atlas = 0;
     
     gfx_init_image(image, initial_data);
     
@@ -103,6 +116,7 @@ load_image_from_disk(string path, Allocator allocator) {
     image->gfx_handle = GFX_INVALID_HANDLE;  // This is handled in gfx
     image->allocator = allocator;
     image->channels = 4;
+    image->atlas = 0;
 
     dealloc_string(allocator, png);
     
@@ -117,9 +131,12 @@ load_image_from_disk(string path, Allocator allocator) {
 
 void 
 delete_image(Gfx_Image *image) {
+    assert(!image->atlas, "Images in an atlas are deleted with delete_image_atlas");
       // Free the image data allocated by stb_image
     image->width = 0;
     image->height = 0;
     gfx_deinit_image(image);
     dealloc(image->allocator, image);
 }
+
+#endif // NOT OOGABOOGA_HEADLESS
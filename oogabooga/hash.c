@@ -25,7 +25,12 @@ static inline u64 city_hash(string s) {
     u64 c = 9;
     u64 d = b;
 
-    if (s.count <= 16) {
+    if (s.count < 8) {
+        // Don't read outside the string, or the same string at two addresses hashes differently
+        a = 0;
+        b = s.count;
+        memcpy(&a, s.data, s.count);
+    } else if (s.count <= 16) {
         memcpy(&a, s.data, sizeof(u64));
         memcpy(&b, s.data + s.count - 8, sizeof(u64));
     } else {
@@ -1,6 +1,9 @@
-
-// Very naive implementation but it should be very cache efficient so it's alright
-// for non-excessive use for now.
+// Open addressing hash table with Robin Hood linear probing.
+//
+// Entries are stored densely (hash-key-value) so iterating with hash_table_get_nth_value()
+// stays cache friendly, and a separate power-of-two slot array indexes into the entries.
+// Keys are stored and compared, so colliding hashes resolve to the correct value.
+// Deletion uses backward shifting so there are no tombstones.
 
 /*
 
@@ -30,6 +33,11 @@
 		
 	}
 	
+	// Remove an entry. Returns whether or not the key existed.
+	// Note: this moves the last entry into the removed entry's place, so pointers
+	// returned by hash_table_find() are invalidated.
+	hash_table_remove(&table, key);
+	
 	// Reset all entries (but keep allocated memory)
 	hash_table_reset(&table);
 	
@@ -38,12 +46,14 @@
 	
 	
 	Limitations:
-		- Key can only be a base type or pointer
+		- Key can only be a base type, pointer or string.
+		  String keys are copied with the table allocator, so temporary strings are fine as keys.
 		- Key and value passed to the following function needs to be lvalues (we need to be able to take their addresses with '&'):
 			- hash_table_add
 			- hash_table_find
 			- hash_table_contains
 			- hash_table_set
+			- hash_table_remove
 			
 			Example:
 			
@@ -53,6 +63,7 @@
 			int value = my_value+3;
 			hash_table_set(&table, key, value); // OK
 			
+		- Pointers to values are invalidated when the table grows or when an entry is removed.
 
 */
 
@@ -60,95 +71,226 @@ typedef struct Hash_Table Hash_Table;
 
 // API:
 #define make_hash_table_reserve(Key_Type, Value_Type, capacity_count, allocator) \
-	make_hash_table_reserve(sizeof(Key_Type), sizeof(Value_Type), capacity_count, allocator)
+	make_hash_table_reserve_raw(sizeof(Key_Type), sizeof(Value_Type), _hash_table_key_is_string(Key_Type), capacity_count, allocator)
 	
 #define make_hash_table(Key_Type, Value_Type, allocator) \
-	make_hash_table_raw(sizeof(Key_Type), sizeof(Value_Type), allocator)
+	make_hash_table_raw(sizeof(Key_Type), sizeof(Value_Type), _hash_table_key_is_string(Key_Type), allocator)
 
 #define hash_table_add(table_ptr, key, value) \
 	hash_table_add_raw((table_ptr), get_hash(key), &(key), &(value), sizeof(key), sizeof(value))
 
 #define hash_table_find(table_ptr, key) \
-	hash_table_find_raw((table_ptr), get_hash(key))
+	hash_table_find_raw((table_ptr), get_hash(key), &(key), sizeof(key))
 	
 #define hash_table_contains(table_ptr, key) \
-	hash_table_contains_raw((table_ptr), get_hash(key))
+	hash_table_contains_raw((table_ptr), get_hash(key), &(key), sizeof(key))
 	
 #define hash_table_set(table_ptr, key, value) \
-	hash_table_set_raw((table_ptr), get_hash(key), &key, &value, sizeof(key), sizeof(value))
+	hash_table_set_raw((table_ptr), get_hash(key), &(key), &(value), sizeof(key), sizeof(value))
+	
+#define hash_table_remove(table_ptr, key) \
+	hash_table_remove_raw((table_ptr), get_hash(key), &(key), sizeof(key))
 
 void hash_table_reserve(Hash_Table *t, u64 required_count);
 
+#define _hash_table_key_is_string(Key_Type) _Generic((Key_Type){0}, string: true, default: false)
+
+// Slots are allowed to fill up to this before the slot array is doubled
+#define HASH_TABLE_MAX_LOAD_PERCENT 75
+
+typedef struct Hash_Table_Slot {
+	u32 entry_index_plus_one; // 0 means the slot is empty
+	u32 hash_bits; // Low 32 bits of the entry hash, so we rarely need to touch the entry while probing
+} Hash_Table_Slot;
 
 typedef struct Hash_Table {
 	
 	// Each entry is hash-key-value
-	// Hash is sizeof(u64) bytes, key is _key_size bytes and value is _value_size bytes
+	// Hash is sizeof(u64) bytes, key is _key_size bytes and value is _value_size bytes.
+	// Key and value are aligned to 16 bytes within the entry.
 	void *entries; 
 	
 	u64 count; // Number of valid entries
 	u64 capacity_count; // Number of allocated entries
 	
+	Hash_Table_Slot *slots;
+	u64 slot_count; // Always a power of two
+	
 	u64 _key_size;
 	u64 _value_size;
+	bool _key_is_string;
 	
 	Allocator allocator;
 } Hash_Table;
 
-Hash_Table make_hash_table_reserve_raw(u64 key_size, u64 value_size, u64 capacity_count, Allocator allocator) {
+inline u64 _hash_table_key_offset(Hash_Table *t) {
+	return sizeof(u64);
+}
+inline u64 _hash_table_value_offset(Hash_Table *t) {
+	return (sizeof(u64)+t->_key_size+15) & ~15ull;
+}
+inline u64 _hash_table_entry_size(Hash_Table *t) {
+	return (_hash_table_value_offset(t)+t->_value_size+15) & ~15ull;
+}
+inline u8 *_hash_table_get_entry(Hash_Table *t, u64 index) {
+	return (u8*)t->entries + index*_hash_table_entry_size(t);
+}
+inline u64 _hash_table_get_entry_hash(Hash_Table *t, u64 index) {
+	return *(u64*)_hash_table_get_entry(t, index);
+}
+// How far the slot at slot_index is from where its hash wants it to be
+inline u64 _hash_table_probe_distance(Hash_Table *t, u64 slot_index, u32 hash_bits) {
+	return (slot_index - (hash_bits & (t->slot_count-1))) & (t->slot_count-1);
+}
+
+bool _hash_table_keys_match(Hash_Table *t, void *a, void *b) {
+	if (t->_key_is_string) return strings_match(*(string*)a, *(string*)b);
+	return bytes_match(a, b, t->_key_size);
+}
+
+void _hash_table_insert_slot(Hash_Table *t, u64 entry_index, u64 hash) {
+	
+	Hash_Table_Slot incoming;
+	incoming.entry_index_plus_one = (u32)(entry_index+1);
+	incoming.hash_bits = (u32)hash;
+	
+	u64 mask = t->slot_count-1;
+	u64 i = incoming.hash_bits & mask;
+	u64 distance = 0;
+	
+	while (true) {
+		Hash_Table_Slot *slot = &t->slots[i];
+		if (slot->entry_index_plus_one == 0) {
+			*slot = incoming;
+			return;
+		}
+		
+		// Robin hood: take the slot from entries that are closer to their ideal slot than we are
+		u64 existing_distance = _hash_table_probe_distance(t, i, slot->hash_bits);
+		if (existing_distance < distance) {
+			Hash_Table_Slot tmp = *slot;
+			*slot = incoming;
+			incoming = tmp;
+			distance = existing_distance;
+		}
+		
+		i = (i+1) & mask;
+		distance += 1;
+	}
+}
+
+// Returns the slot index for the key or -1 if it does not exist
+s64 _hash_table_find_slot(Hash_Table *t, u64 hash, void *k) {
+	if (t->count == 0) return -1;
+	
+	u32 hash_bits = (u32)hash;
+	u64 mask = t->slot_count-1;
+	u64 i = hash_bits & mask;
+	u64 distance = 0;
+	
+	while (true) {
+		Hash_Table_Slot slot = t->slots[i];
+		if (slot.entry_index_plus_one == 0) return -1;
+		
+		// If we had been inserted we would have displaced this entry, so we're not here.
+		if (_hash_table_probe_distance(t, i, slot.hash_bits) < distance) return -1;
+		
+		if (slot.hash_bits == hash_bits) {
+			u64 entry_index = slot.entry_index_plus_one-1;
+			u8 *entry = _hash_table_get_entry(t, entry_index);
+			if (*(u64*)entry == hash && _hash_table_keys_match(t, entry+_hash_table_key_offset(t), k)) {
+				return (s64)i;
+			}
+		}
+		
+		i = (i+1) & mask;
+		distance += 1;
+	}
+}
+
+void _hash_table_rebuild_slots(Hash_Table *t, u64 slot_count) {
+	assert(slot_count <= 0xFFFFFFFFull, "Hash table is too big");
+	
+	if (t->slot_count != slot_count) {
+		if (t->slots) dealloc(t->allocator, t->slots);
+		t->slots = alloc(t->allocator, slot_count*sizeof(Hash_Table_Slot));
+		t->slot_count = slot_count;
+	}
+	memset(t->slots, 0, t->slot_count*sizeof(Hash_Table_Slot));
+	
+	for (u64 i = 0; i < t->count; i += 1) {
+		_hash_table_insert_slot(t, i, _hash_table_get_entry_hash(t, i));
+	}
+}
+
+Hash_Table make_hash_table_reserve_raw(u64 key_size, u64 value_size, bool key_is_string, u64 capacity_count, Allocator allocator) {
 
-	capacity_count = min(capacity_count, 8);
+	capacity_count = max(capacity_count, 8);
 
 	Hash_Table t = ZERO(Hash_Table);
 	
 	t._key_size = key_size;
 	t._value_size = value_size;
+	t._key_is_string = key_is_string;
 	t.allocator = allocator;
 	
-	u64 entry_size = value_size+sizeof(u64);
-	t.entries = alloc(t.allocator, entry_size*capacity_count);
-	memset(t.entries, 0, entry_size*capacity_count);
-	t.capacity_count = capacity_count;
+	hash_table_reserve(&t, capacity_count);
 	
 	return t;
 }
-inline Hash_Table make_hash_table_raw(u64 key_size, u64 value_size, Allocator allocator) {
-	return make_hash_table_reserve_raw(key_size, value_size, 128, allocator);
+inline Hash_Table make_hash_table_raw(u64 key_size, u64 value_size, bool key_is_string, Allocator allocator) {
+	return make_hash_table_reserve_raw(key_size, value_size, key_is_string, 128, allocator);
+}
+
+void _hash_table_free_key(Hash_Table *t, u64 entry_index) {
+	if (!t->_key_is_string) return;
+	
+	string *key = (string*)(_hash_table_get_entry(t, entry_index)+_hash_table_key_offset(t));
+	if (key->count > 0) dealloc_string(t->allocator, *key);
 }
 
 void hash_table_reset(Hash_Table *t) {
+	for (u64 i = 0; i < t->count; i += 1) {
+		_hash_table_free_key(t, i);
+	}
 	t->count = 0;
+	if (t->slots) memset(t->slots, 0, t->slot_count*sizeof(Hash_Table_Slot));
 }
 void hash_table_destroy(Hash_Table *t) {
-	dealloc(t->allocator, t->entries);
+	for (u64 i = 0; i < t->count; i += 1) {
+		_hash_table_free_key(t, i);
+	}
+	
+	if (t->entries) dealloc(t->allocator, t->entries);
+	if (t->slots)   dealloc(t->allocator, t->slots);
 	
 	t->entries = 0;
+	t->slots = 0;
 	t->count = 0;
 	t->capacity_count = 0;
+	t->slot_count = 0;
 }
 
 void hash_table_reserve(Hash_Table *t, u64 required_count) {
-	u64 entry_size = t->_value_size+sizeof(u64);
-	
-	u64 required_size = required_count*entry_size;
-	
-	u64 current_size = t->capacity_count*entry_size;
-	
-	if (current_size >= required_size) return;
 	
-	u64 new_count = get_next_power_of_two(required_count);
-	u64 new_size = new_count*entry_size;
-	
-	void *new_entries = alloc(t->allocator, new_size);
-	memcpy(new_entries, t->entries, current_size);
-	
-	dealloc(t->allocator, t->entries);
+	if (t->capacity_count < required_count) {
+		u64 entry_size = _hash_table_entry_size(t);
+		
+		u64 new_count = get_next_power_of_two(required_count);
+		
+		t->entries = alloc_resize(t->allocator, t->entries, t->count*entry_size, new_count*entry_size);
+		t->capacity_count = new_count;
+	}
 	
-	t->entries = new_entries;
-	t->capacity_count = new_count;
+	// Keep the slots under the max load factor
+	u64 required_slots = get_next_power_of_two((required_count*100)/HASH_TABLE_MAX_LOAD_PERCENT + 1);
+	if (t->slot_count < required_slots) {
+		_hash_table_rebuild_slots(t, required_slots);
+	}
 }
 
-// This can add multiple entries of same hash, beware!
+// This does not check if the key already exists, so it can add multiple entries with the same key.
+// Use hash_table_set if the key might exist.
 void hash_table_add_raw(Hash_Table *t, u64 hash, void *k, void *v, u64 key_size, u64 value_size) {
 
 	assert(t->_key_size == key_size, "Key type size does not match hash table initted key type size");
@@ -156,63 +298,110 @@ void hash_table_add_raw(Hash_Table *t, u64 hash, void *k, void *v, u64 key_size,
 
 	hash_table_reserve(t, t->count+1);
 	
-	u64 entry_size = t->_value_size+sizeof(u64);
-	
-	u64 index = entry_size*t->count;
+	u64 index = t->count;
 	t->count += 1;
 	
-	u64 hash_offset = 0;
-	u64 value_offset = hash_offset + sizeof(u64);
+	u8 *entry = _hash_table_get_entry(t, index);
 	
-	memcpy((u8*)t->entries+index+hash_offset,  &hash, sizeof(u64));
-	memcpy((u8*)t->entries+index+value_offset, v,     value_size);
-}
-
-void *hash_table_find_raw(Hash_Table *t, u64 hash) {
-
-	// #Speed #Incomplete
-	// Do quadratic probe 'triangular numbers'
-
-	u64 entry_size = t->_value_size+sizeof(u64);
-	u64 hash_offset = 0;
-	u64 value_offset = hash_offset + sizeof(u64);
+	memcpy(entry, &hash, sizeof(u64));
+	memcpy(entry+_hash_table_key_offset(t), k, key_size);
+	memcpy(entry+_hash_table_value_offset(t), v, value_size);
 	
-	for (u64 i = 0; i < t->count; i += 1) {
-		u64 existing_hash = *(u64*)((u8*)t->entries+i*entry_size+hash_offset);
-		if (existing_hash == hash) {
-			void *value = ((u8*)t->entries+i*entry_size+value_offset);
-			return value;
+	if (t->_key_is_string) {
+		string *key = (string*)(entry+_hash_table_key_offset(t));
+		if (key->count > 0) {
+			string copy = alloc_string(t->allocator, key->count);
+			memcpy(copy.data, key->data, key->count);
+			*key = copy;
 		}
 	}
-	return 0;
+	
+	_hash_table_insert_slot(t, index, hash);
+}
+
+void *hash_table_find_raw(Hash_Table *t, u64 hash, void *k, u64 key_size) {
+	assert(t->_key_size == key_size, "Key type size does not match hash table initted key type size");
+	
+	s64 slot_index = _hash_table_find_slot(t, hash, k);
+	if (slot_index == -1) return 0;
+	
+	u64 entry_index = t->slots[slot_index].entry_index_plus_one-1;
+	
+	return _hash_table_get_entry(t, entry_index)+_hash_table_value_offset(t);
 }
 
 void *hash_table_get_nth_value(Hash_Table *t, u64 n) {
 	assert(n < t->count, "Hash table n is out of range");
 	
-	u64 entry_size = t->_value_size+sizeof(u64);
-	u64 hash_offset = 0;
-	u64 value_offset = hash_offset + sizeof(u64);
+	return _hash_table_get_entry(t, n)+_hash_table_value_offset(t);
+}
+void *hash_table_get_nth_key(Hash_Table *t, u64 n) {
+	assert(n < t->count, "Hash table n is out of range");
 	
-	return (u8*)t->entries+entry_size*n+value_offset;
+	return _hash_table_get_entry(t, n)+_hash_table_key_offset(t);
 }
 
-bool hash_table_contains_raw(Hash_Table *t, u64 hash) {
-	return hash_table_find_raw(t, hash) != 0;
+bool hash_table_contains_raw(Hash_Table *t, u64 hash, void *k, u64 key_size) {
+	return hash_table_find_raw(t, hash, k, key_size) != 0;
 }
 
 // Returns true if key was newly added or false if it already existed
 bool hash_table_set_raw(Hash_Table *t, u64 hash, void *k, void *v, u64 key_size, u64 value_size) {
-	bool newly_added = true;
 	
-	if (hash_table_contains_raw(t, hash)) newly_added = false;
+	assert(t->_value_size == value_size, "Value type size does not match hash table initted value type size");
 	
-	if (newly_added) {
-		hash_table_add_raw(t, hash, k, v, key_size, value_size);
-	} else {
-		memcpy(hash_table_find_raw(t, hash), v, value_size);
+	void *existing = hash_table_find_raw(t, hash, k, key_size);
+	
+	if (existing) {
+		memcpy(existing, v, value_size);
+		return false;
 	}
 	
-	return newly_added;
+	hash_table_add_raw(t, hash, k, v, key_size, value_size);
+	return true;
 }
 
+// Returns true if the key existed and was removed.
+// The last entry is moved into the removed entry's place.
+bool hash_table_remove_raw(Hash_Table *t, u64 hash, void *k, u64 key_size) {
+	assert(t->_key_size == key_size, "Key type size does not match hash table initted key type size");
+	
+	s64 slot_index = _hash_table_find_slot(t, hash, k);
+	if (slot_index == -1) return false;
+	
+	u64 mask = t->slot_count-1;
+	u64 entry_index = t->slots[slot_index].entry_index_plus_one-1;
+	
+	// Backward shift the following slots until we hit an empty one or one that is in its ideal slot
+	u64 i = (u64)slot_index;
+	while (true) {
+		u64 next = (i+1) & mask;
+		Hash_Table_Slot next_slot = t->slots[next];
+		if (next_slot.entry_index_plus_one == 0 || _hash_table_probe_distance(t, next, next_slot.hash_bits) == 0) {
+			t->slots[i] = ZERO(Hash_Table_Slot);
+			break;
+		}
+		t->slots[i] = next_slot;
+		i = next;
+	}
+	
+	_hash_table_free_key(t, entry_index);
+	
+	// Move last entry into the hole and point its slot to the new place
+	u64 last_index = t->count-1;
+	if (entry_index != last_index) {
+		u64 entry_size = _hash_table_entry_size(t);
+		memcpy(_hash_table_get_entry(t, entry_index), _hash_table_get_entry(t, last_index), entry_size);
+		
+		u32 last_hash_bits = (u32)_hash_table_get_entry_hash(t, entry_index);
+		u64 j = last_hash_bits & mask;
+		while (t->slots[j].entry_index_plus_one != last_index+1) {
+			j = (j+1) & mask;
+		}
+		t->slots[j].entry_index_plus_one = (u32)(entry_index+1);
+	}
+	
+	t->count -= 1;
+	
+	return true;
+}
@@ -0,0 +1,477 @@
+
+/*
+
+    Packs many images into one texture so they can be drawn in the same batch.
+
+    Image_Atlas_Builder builder;
+    image_atlas_builder_init(&builder, get_heap_allocator());
+    s64 player = image_atlas_add_image_from_disk(&builder, STR("res/player.png")); // -1 if the file could not be read
+    s64 tree   = image_atlas_add_image_from_disk(&builder, STR("res/tree.png"));
+
+    // Packs the images, or loads the previous pack from the cache file if none of them changed.
+    // Pass an empty string to not use a cache.
+    Image_Atlas *atlas = image_atlas_build(&builder, STR("build/sprites.atlas"));
+    image_atlas_builder_deinit(&builder);
+
+    // Images in an atlas are drawn like any other image
+    draw_image(image_atlas_get_image(atlas, player), pos, size, COLOR_WHITE);
+
+    // A cache file can also be shipped on its own and loaded without the source images
+    Image_Atlas *shipped = load_image_atlas_from_disk(STR("res/sprites.atlas"), get_heap_allocator());
+
+    delete_image_atlas(atlas);
+
+*/
+
+#define IMAGE_ATLAS_DEFAULT_PADDING 1
+// Edge pixels are repeated this many times around each image so linear filtering
+// doesn't pick up the neighbouring images.
+#define IMAGE_ATLAS_DEFAULT_EXTRUDE 1
+#define IMAGE_ATLAS_DEFAULT_MAX_SIZE 4096
+
+#define IMAGE_ATLAS_CACHE_MAGIC 0x31534C544142474Full // "OGBATLS1"
+
+typedef struct Image_Atlas_Rect {
+	u32 x, y, width, height;
+} Image_Atlas_Rect;
+
+typedef struct Image_Atlas_Source {
+	string file_data; // Encoded image file if added from disk
+	u8 *pixels;       // RGBA8, bottom row first. Decoded in image_atlas_build for files.
+	u32 width, height;
+} Image_Atlas_Source;
+
+typedef struct Image_Atlas_Builder {
+	u32 padding;
+	u32 extrude;
+	u32 max_size;
+
+	Image_Atlas_Source *sources; // Growing array
+
+	Allocator allocator;
+} Image_Atlas_Builder;
+
+typedef struct Image_Atlas {
+	Gfx_Image *image;        // The packed texture
+	Gfx_Image *images;       // One sub image per added image
+	Image_Atlas_Rect *rects; // Where each image is in the atlas, in pixels with y up
+	u64 count;
+
+	Allocator allocator;
+} Image_Atlas;
+
+typedef struct Image_Atlas_Cache_Header {
+	u64 magic;
+	u64 key;
+	u32 width, height;
+	u32 count;
+	u32 _pad;
+	// Image_Atlas_Rect rects[count];
+	// u8 pixels[width*height*4];
+} Image_Atlas_Cache_Header;
+
+void
+image_atlas_builder_init(Image_Atlas_Builder *builder, Allocator allocator) {
+	memset(builder, 0, sizeof(Image_Atlas_Builder));
+	builder->padding = IMAGE_ATLAS_DEFAULT_PADDING;
+	builder->extrude = IMAGE_ATLAS_DEFAULT_EXTRUDE;
+	builder->max_size = IMAGE_ATLAS_DEFAULT_MAX_SIZE;
+	builder->allocator = allocator;
+	growing_array_init((void**)&builder->sources, sizeof(Image_Atlas_Source), allocator);
+}
+
+void
+image_atlas_builder_deinit(Image_Atlas_Builder *builder) {
+	u64 count = growing_array_get_valid_count(builder->sources);
+	for (u64 i = 0; i < count; i++) {
+		Image_Atlas_Source *source = &builder->sources[i];
+		if (source->file_data.data) dealloc_string(builder->allocator, source->file_data);
+		if (source->pixels) dealloc(builder->allocator, source->pixels);
+	}
+	growing_array_deinit((void**)&builder->sources);
+	memset(builder, 0, sizeof(Image_Atlas_Builder));
+}
+
+// Returns the index of the image in the atlas, or -1 if the file could not be read.
+// The file is only decoded if the atlas has to be packed.
+s64
+image_atlas_add_image_from_disk(Image_Atlas_Builder *builder, string path) {
+	Image_Atlas_Source source = ZERO(Image_Atlas_Source);
+	bool ok = os_read_entire_file(path, &source.file_data, builder->allocator);
+	if (!ok) {
+		log_error("Could not read image '%s' for atlas", path);
+		return -1;
+	}
+
+	growing_array_add((void**)&builder->sources, &source);
+	return (s64)growing_array_get_valid_count(builder->sources)-1;
+}
+
+// pixels are RGBA8 with the bottom row first, like images loaded with load_image_from_disk.
+// They are copied.
+s64
+image_atlas_add_image_from_pixels(Image_Atlas_Builder *builder, void *pixels, u32 width, u32 height) {
+	Image_Atlas_Source source = ZERO(Image_Atlas_Source);
+	source.width = width;
+	source.height = height;
+	source.pixels = alloc(builder->allocator, (u64)width*height*4);
+	memcpy(source.pixels, pixels, (u64)width*height*4);
+
+	growing_array_add((void**)&builder->sources, &source);
+	return (s64)growing_array_get_valid_count(builder->sources)-1;
+}
+
+Gfx_Image *
+image_atlas_get_image(Image_Atlas *atlas, s64 index) {
+	assert(index >= 0 && (u64)index < atlas->count, "Image atlas index %lld out of range", index);
+	return &atlas->images[index];
+}
+
+int
+image_atlas_compare_rect_order(const void *a, const void *b) {
+	const Image_Atlas_Rect *ra = (const Image_Atlas_Rect*)a;
+	const Image_Atlas_Rect *rb = (const Image_Atlas_Rect*)b;
+	// Tallest first, then widest
+	if (ra->height != rb->height) return ra->height > rb->height ? -1 : 1;
+	if (ra->width != rb->width) return ra->width > rb->width ? -1 : 1;
+	return 0;
+}
+
+typedef struct Image_Atlas_Skyline_Node {
+	u32 x, y, width;
+} Image_Atlas_Skyline_Node;
+
+// Skyline bottom left packer. Rects come in with a width and height and get an x and y.
+// Returns false if they don't all fit in atlas_width*atlas_height.
+bool
+image_atlas_pack_rects(Image_Atlas_Rect *rects, u64 count, u32 atlas_width, u32 atlas_height) {
+	if (count == 0) return true;
+
+	// Going from tallest to shortest packs a lot tighter. We sort copies and keep the
+	// original index in x since that's written last.
+	Image_Atlas_Rect *order = talloc(count*sizeof(Image_Atlas_Rect));
+	Image_Atlas_Rect *sort_buffer = talloc(count*sizeof(Image_Atlas_Rect));
+	for (u64 i = 0; i < count; i++) {
+		order[i] = rects[i];
+		order[i].x = (u32)i;
+	}
+	merge_sort(order, sort_buffer, count, sizeof(Image_Atlas_Rect), image_atlas_compare_rect_order);
+
+	// Every rect adds at most one node
+	Image_Atlas_Skyline_Node *nodes = talloc((count+1)*sizeof(Image_Atlas_Skyline_Node));
+	u64 node_count = 1;
+	nodes[0] = (Image_Atlas_Skyline_Node){0, 0, atlas_width};
+
+	for (u64 r = 0; r < count; r++) {
+		Image_Atlas_Rect *rect = &rects[order[r].x];
+		u32 w = rect->width;
+		u32 h = rect->height;
+
+		if (w == 0 || h == 0) {
+			rect->x = 0;
+			rect->y = 0;
+			continue;
+		}
+
+		// Lowest spot, and of those the one on the narrowest node
+		s64 best_node = -1;
+		u32 best_y = 0;
+		u32 best_node_width = 0;
+		for (u64 i = 0; i < node_count; i++) {
+			u32 x = nodes[i].x;
+			if ((u64)x + w > atlas_width) break;
+
+			// The rect rests on the highest node under it
+			u32 y = 0;
+			u32 width_left = w;
+			for (u64 j = i; ; j++) {
+				y = max(y, nodes[j].y);
+				if (nodes[j].width >= width_left) break;
+				width_left -= nodes[j].width;
+			}
+			if ((u64)y + h > atlas_height) continue;
+
+			if (best_node == -1 || y < best_y || (y == best_y && nodes[i].width < best_node_width)) {
+				best_node = (s64)i;
+				best_y = y;
+				best_node_width = nodes[i].width;
+			}
+		}
+
+		if (best_node == -1) return false;
+
+		rect->x = nodes[best_node].x;
+		rect->y = best_y;
+
+		// Insert the top of the new rect as a node
+		memmove(&nodes[best_node+1], &nodes[best_node], (node_count-best_node)*sizeof(Image_Atlas_Skyline_Node));
+		nodes[best_node] = (Image_Atlas_Skyline_Node){rect->x, best_y+h, w};
+		node_count += 1;
+
+		// Cut away what's now under it from the following nodes
+		u64 i = best_node+1;
+		while (i < node_count) {
+			u32 previous_end = nodes[i-1].x + nodes[i-1].width;
+			if (nodes[i].x >= previous_end) break;
+
+			u32 shrink = previous_end - nodes[i].x;
+			if (nodes[i].width > shrink) {
+				nodes[i].x += shrink;
+				nodes[i].width -= shrink;
+				break;
+			}
+			memmove(&nodes[i], &nodes[i+1], (node_count-i-1)*sizeof(Image_Atlas_Skyline_Node));
+			node_count -= 1;
+		}
+
+		// Merge neighbours at the same height
+		for (u64 j = 0; j+1 < node_count; ) {
+			if (nodes[j].y == nodes[j+1].y) {
+				nodes[j].width += nodes[j+1].width;
+				memmove(&nodes[j+1], &nodes[j+2], (node_count-j-2)*sizeof(Image_Atlas_Skyline_Node));
+				node_count -= 1;
+			} else {
+				j++;
+			}
+		}
+	}
+
+	return true;
+}
+
+// Copies an RGBA8 image to x, y in the atlas and repeats its edge pixels extrude times
+// around it. There must be room for the extruded pixels.
+void
+image_atlas_blit(u8 *atlas_pixels, u32 atlas_width, const u8 *pixels, u32 width, u32 height, u32 x, u32 y, u32 extrude) {
+	if (width == 0 || height == 0) return;
+
+	u32 *atlas_texels = (u32*)atlas_pixels;
+	const u32 *texels = (const u32*)pixels;
+
+	for (u32 row = 0; row < height; row++) {
+		u32 *dst = atlas_texels + (u64)(y+row)*atlas_width + x;
+		const u32 *src = texels + (u64)row*width;
+		memcpy(dst, src, width*sizeof(u32));
+		for (u32 e = 1; e <= extrude; e++) {
+			*(dst - e) = src[0];
+			dst[width-1+e] = src[width-1];
+		}
+	}
+
+	// Then the bottom and top rows, including the corners extruded above
+	u64 row_size = (u64)(width + 2*extrude)*sizeof(u32);
+	u32 *bottom = atlas_texels + (u64)y*atlas_width + x - extrude;
+	u32 *top    = atlas_texels + (u64)(y+height-1)*atlas_width + x - extrude;
+	for (u32 e = 1; e <= extrude; e++) {
+		memcpy(bottom - (u64)e*atlas_width, bottom, row_size);
+		memcpy(top    + (u64)e*atlas_width, top,    row_size);
+	}
+}
+
+// Identifies the pack a builder would make, so we know if a cache file is still good
+u64
+image_atlas_builder_get_key(Image_Atlas_Builder *builder) {
+	u64 count = growing_array_get_valid_count(builder->sources);
+
+	u64 key = xx_hash(IMAGE_ATLAS_CACHE_MAGIC ^ builder->padding ^ ((u64)builder->extrude << 16) ^ ((u64)builder->max_size << 32));
+	key = xx_hash(key ^ count);
+	for (u64 i = 0; i < count; i++) {
+		Image_Atlas_Source *source = &builder->sources[i];
+		if (source->file_data.data) {
+			key = xx_hash(key ^ djb2_hash(source->file_data));
+		} else {
+			string pixels = (string){ (u64)source->width*source->height*4, source->pixels };
+			key = xx_hash(key ^ djb2_hash(pixels) ^ ((u64)source->width << 32) ^ source->height);
+		}
+	}
+	return key;
+}
+
+// Makes the atlas texture and sub images. rects are copied.
+Image_Atlas *
+image_atlas_make(u8 *pixels, u32 width, u32 height, Image_Atlas_Rect *rects, u64 count, Allocator allocator) {
+	Image_Atlas *atlas = alloc(allocator, sizeof(Image_Atlas));
+	memset(atlas, 0, sizeof(Image_Atlas));
+	atlas->allocator = allocator;
+	atlas->count = count;
+	atlas->image = make_image(width, height, 4, pixels, allocator);
+
+	atlas->rects = alloc(allocator, count*sizeof(Image_Atlas_Rect));
+	memcpy(atlas->rects, rects, count*sizeof(Image_Atlas_Rect));
+
+	atlas->images = alloc(allocator, count*sizeof(Gfx_Image));
+	memset(atlas->images, 0, count*sizeof(Gfx_Image));
+	for (u64 i = 0; i < count; i++) {
+		Gfx_Image *image = &atlas->images[i];
+		Image_Atlas_Rect r = rects[i];
+		image->width = r.width;
+		image->height = r.height;
+		image->channels = 4;
+		image->gfx_handle = atlas->image->gfx_handle;
+		image->allocator = allocator;
+		image->atlas = atlas->image;
+		image->atlas_uv = v4(
+			(float32)r.x / (float32)width,
+			(float32)r.y / (float32)height,
+			(float32)(r.x+r.width) / (float32)width,
+			(float32)(r.y+r.height) / (float32)height
+		);
+	}
+
+	return atlas;
+}
+
+// Returns 0 if data is not a valid cache, or if key is non-zero and does not match
+Image_Atlas *
+image_atlas_make_from_cache(string data, u64 key, Allocator allocator) {
+	if (data.count < sizeof(Image_Atlas_Cache_Header)) return 0;
+
+	Image_Atlas_Cache_Header header;
+	memcpy(&header, data.data, sizeof(header));
+	if (header.magic != IMAGE_ATLAS_CACHE_MAGIC) return 0;
+	if (key != 0 && header.key != key) return 0;
+
+	u64 rects_size = (u64)header.count*sizeof(Image_Atlas_Rect);
+	u64 pixels_size = (u64)header.width*header.height*4;
+	if (data.count != sizeof(header) + rects_size + pixels_size) return 0;
+
+	Image_Atlas_Rect *rects = (Image_Atlas_Rect*)(data.data + sizeof(header));
+	u8 *pixels = data.data + sizeof(header) + rects_size;
+
+	return image_atlas_make(pixels, header.width, header.height, rects, header.count, allocator);
+}
+
+Image_Atlas *
+load_image_atlas_from_disk(string path, Allocator allocator) {
+	string data;
+	bool ok = os_read_entire_file(path, &data, allocator);
+	if (!ok) return 0;
+
+	Image_Atlas *atlas = image_atlas_make_from_cache(data, 0, allocator);
+	if (!atlas) log_error("'%s' is not a valid image atlas", path);
+
+	dealloc_string(allocator, data);
+	return atlas;
+}
+
+// Returns 0 if the images don't fit in builder->max_size*builder->max_size.
+// The builder can be deinitialized right after.
+Image_Atlas *
+image_atlas_build(Image_Atlas_Builder *builder, string cache_path) {
+	Allocator allocator = builder->allocator;
+	u64 count = growing_array_get_valid_count(builder->sources);
+	u64 key = image_atlas_builder_get_key(builder);
+
+	if (cache_path.count > 0 && os_is_file(cache_path)) {
+		string data;
+		if (os_read_entire_file(cache_path, &data, allocator)) {
+			Image_Atlas *atlas = image_atlas_make_from_cache(data, key, allocator);
+			dealloc_string(allocator, data);
+			if (atlas) return atlas;
+			log_verbose("Image atlas cache '%s' is out of date, repacking", cache_path);
+		}
+	}
+
+	///
+	// Decode images from disk
+	for (u64 i = 0; i < count; i++) {
+		Image_Atlas_Source *source = &builder->sources[i];
+		if (source->pixels) continue;
+
+		int width, height, channels;
+		stbi_set_flip_vertically_on_load(1);
+		third_party_allocator = allocator;
+		u8 *stb_data = stbi_load_from_memory(source->file_data.data, source->file_data.count, &width, &height, &channels, STBI_rgb_alpha);
+		third_party_allocator = ZERO(Allocator);
+
+		if (!stb_data) {
+			log_error("Could not decode image %llu for atlas, it will be empty", i);
+			width = 0;
+			height = 0;
+		}
+
+		// stb allocated with our allocator so we can keep it
+		source->width = width;
+		source->height = height;
+		source->pixels = stb_data;
+	}
+
+	///
+	// Pack, growing the atlas until everything fits
+	u32 border = 2*builder->extrude + builder->padding;
+	Image_Atlas_Rect *cells = talloc(count*sizeof(Image_Atlas_Rect));
+	u64 area = 0;
+	u32 widest = 1, tallest = 1;
+	for (u64 i = 0; i < count; i++) {
+		Image_Atlas_Source *source = &builder->sources[i];
+		cells[i] = ZERO(Image_Atlas_Rect);
+		if (source->width > 0 && source->height > 0) {
+			cells[i].width  = source->width  + border;
+			cells[i].height = source->height + border;
+		}
+		area += (u64)cells[i].width*cells[i].height;
+		widest  = max(widest,  cells[i].width);
+		tallest = max(tallest, cells[i].height);
+	}
+
+	u32 width  = (u32)get_next_power_of_two(max(widest, (u32)ceil(sqrt((float64)area))));
+	u32 height = (u32)get_next_power_of_two(max(tallest, (u32)((area+width-1)/width)));
+	while (!image_atlas_pack_rects(cells, count, width, height)) {
+		if (width <= height) width *= 2;
+		else                 height *= 2;
+
+		if (width > builder->max_size || height > builder->max_size) {
+			log_error("Images don't fit in a %dx%d atlas", builder->max_size, builder->max_size);
+			return 0;
+		}
+	}
+
+	///
+	// Copy the images in
+	u64 pixels_size = (u64)width*height*4;
+	u8 *pixels = alloc(allocator, pixels_size);
+	memset(pixels, 0, pixels_size);
+	Image_Atlas_Rect *rects = talloc(count*sizeof(Image_Atlas_Rect));
+	for (u64 i = 0; i < count; i++) {
+		Image_Atlas_Source *source = &builder->sources[i];
+		rects[i].x = cells[i].x + builder->extrude;
+		rects[i].y = cells[i].y + builder->extrude;
+		rects[i].width = source->width;
+		rects[i].height = source->height;
+		image_atlas_blit(pixels, width, source->pixels, source->width, source->height, rects[i].x, rects[i].y, builder->extrude);
+	}
+
+	Image_Atlas *atlas = image_atlas_make(pixels, width, height, rects, count, allocator);
+
+	if (cache_path.count > 0) {
+		Image_Atlas_Cache_Header header = ZERO(Image_Atlas_Cache_Header);
+		header.magic = IMAGE_ATLAS_CACHE_MAGIC;
+		header.key = key;
+		header.width = width;
+		header.height = height;
+		header.count = (u32)count;
+
+		u64 rects_size = count*sizeof(Image_Atlas_Rect);
+		string data = alloc_string(allocator, sizeof(header) + rects_size + pixels_size);
+		memcpy(data.data, &header, sizeof(header));
+		memcpy(data.data + sizeof(header), rects, rects_size);
+		memcpy(data.data + sizeof(header) + rects_size, pixels, pixels_size);
+		if (!os_write_entire_file(cache_path, data)) {
+			log_warning("Could not write image atlas cache '%s'", cache_path);
+		}
+		dealloc_string(allocator, data);
+	}
+
+	dealloc(allocator, pixels);
+
+	return atlas;
+}
+
+void
+delete_image_atlas(Image_Atlas *atlas) {
+	Allocator allocator = atlas->allocator;
+	delete_image(atlas->image);
+	dealloc(allocator, atlas->images);
+	dealloc(allocator, atlas->rects);
+	dealloc(allocator, atlas);
+}
@@ -475,6 +475,41 @@ Matrix4 m4_inverse(LMATH_ALIGN Matrix4 m) {
 }
 
 
+// The part of a Matrix4 that matters for 2D points (z = 0, w = 1) when we only keep x and y
+// of the result, as two rows of (x, y, translation). 6 multiply-adds per point instead of 16.
+typedef struct Affine2 {
+    float32 m[2][3];
+} Affine2;
+
+inline Affine2 m4_to_affine2(Matrix4 m) {
+    Affine2 a;
+    a.m[0][0] = m.m[0][0]; a.m[0][1] = m.m[0][1]; a.m[0][2] = m.m[0][3];
+    a.m[1][0] = m.m[1][0]; a.m[1][1] = m.m[1][1]; a.m[1][2] = m.m[1][3];
+    return a;
+}
+
+inline Vector2 affine2_transform(Affine2 a, Vector2 p) {
+    return v2(
+        a.m[0][0] * p.x + a.m[0][1] * p.y + a.m[0][2],
+        a.m[1][0] * p.x + a.m[1][1] * p.y + a.m[1][2]
+    );
+}
+
+// points and out may be the same
+void affine2_transform_points(Affine2 a, const Vector2 *points, Vector2 *out, u64 count) {
+    for (u64 i = 0; i < count; i++) {
+        float32 x = points[i].x;
+        float32 y = points[i].y;
+        out[i].x = a.m[0][0] * x + a.m[0][1] * y + a.m[0][2];
+        out[i].y = a.m[1][0] * x + a.m[1][1] * y + a.m[1][2];
+    }
+}
+
+// Same as m4_transform(m, v4(p.x, p.y, 0, 1)).xy for every point, points and out may be the same
+void m4_transform_points_2d(Matrix4 m, const Vector2 *points, Vector2 *out, u64 count) {
+    affine2_transform_points(m4_to_affine2(m), points, out, count);
+}
+
 
 // This isn't really linmath but just putting it here for now
 #define clamp(x, lo, hi) ((x) < (lo) ? (lo) : ((x) > (hi) ? (hi) : (x)))
@@ -58,9 +58,9 @@ Allocator get_initialization_allocator() {
 // Basic general heap allocator, free list
 ///
 // Technically thread safe but synchronization is horrible.
-// Fragmentation is catastrophic.
-// We could fix it by merging free nodes every now and then
-// BUT: We aren't really supposed to allocate/deallocate directly on the heap too much anyways...
+// Small allocations go to the size classes below, this is only for larger ones.
+// Free nodes are kept sorted by address and merged with their neighbours, which also
+// lets reallocations grow into the free space right after them.
 
 #define MAX_HEAP_BLOCK_SIZE ((MB(500)+os.page_size)& ~(os.page_size-1))
 #define DEFAULT_HEAP_BLOCK_SIZE (min(MAX_HEAP_BLOCK_SIZE, program_memory_size))
@@ -125,8 +125,9 @@ bool is_pointer_in_stack(void* p) {
 bool is_pointer_in_static_memory(void* p) {
     return (uintptr_t)p >= (uintptr_t)os.static_memory_start && (uintptr_t)p < (uintptr_t)os.static_memory_end;
 }
+bool is_pointer_in_slab_memory(void *p);
 bool is_pointer_valid(void *p) {
-	return is_pointer_in_program_memory(p) || is_pointer_in_stack(p) || is_pointer_in_static_memory(p);
+	return is_pointer_in_program_memory(p) || is_pointer_in_slab_memory(p) || is_pointer_in_stack(p) || is_pointer_in_static_memory(p);
 }
 
 // Meant for debug
@@ -266,6 +267,627 @@ Heap_Block *make_heap_block(Heap_Block *parent, u64 size) {
 	return block;
 }
 
+///
+///
+// Small allocations: segregated size classes
+///
+// Allocations up to SLAB_MAX_SIZE are served from 64kb spans where every object in a
+// span has the same size. The span header is found from the object address, so there
+// is no per-allocation metadata, and the span headers live in an array at the start of
+// the slab reservation.
+//
+// Each thread owns the spans it allocates from, so allocating and freeing on the same
+// thread takes no lock. Freeing an object owned by another thread pushes it lock-free
+// onto the span's remote free list, which the owner collects when it runs out of room.
+// When a thread exits (heap_release_thread_cache) its spans are abandoned to the size
+// class, where other threads can adopt them.
+// Spans know their owner by a heap id that is never reused, not by the address of the
+// thread_local heap. A thread that exits without releasing its cache would otherwise leave
+// its spans to whichever new thread gets the same TLS address.
+// Empty spans go back to a shared pool so size classes don't hog memory from each other.
+
+#ifndef SLAB_RESERVE_SIZE
+	#define SLAB_RESERVE_SIZE GB(64)
+#endif
+
+#define SLAB_SPAN_SHIFT 16
+#define SLAB_SPAN_SIZE (1ull << SLAB_SPAN_SHIFT)
+#define SLAB_MIN_SIZE 16
+#define SLAB_MAX_SIZE KB(32)
+#define SLAB_CLASS_COUNT 40
+#define SLAB_HEADER_COMMIT_SIZE KB(64)
+// How many owned spans we look at for room before taking a new span
+#define SLAB_MAX_SPANS_SEARCHED 8
+
+typedef struct Slab_Free_Object Slab_Free_Object;
+typedef struct Slab_Span Slab_Span;
+typedef struct Slab_Thread_Heap Slab_Thread_Heap;
+
+typedef struct Slab_Free_Object {
+	Slab_Free_Object *next;
+} Slab_Free_Object;
+
+typedef struct Slab_Span {
+	// Only touched by the owning thread, or under the size class lock if abandoned
+	Slab_Free_Object *free_list;
+	u8 *bump; // Objects from here to end have never been handed out
+	u8 *end;
+	u32 used_count; // Includes objects waiting in remote_free
+	u32 capacity;
+	u32 class_index;
+	bool in_pool;
+	
+	// Objects freed by other threads than the owner
+	Slab_Free_Object *volatile remote_free;
+	// Id of the owning thread heap, 0 if abandoned or in the pool
+	volatile u64 owner;
+	
+	// In the owner's span ring, the size class abandoned list or the pool
+	Slab_Span *next;
+	Slab_Span *prev;
+} Slab_Span;
+
+typedef struct Slab_Size_Class {
+	Spinlock lock;
+	u32 object_size;
+	Slab_Span *abandoned; // Spans from exited threads that still have live objects
+} Slab_Size_Class;
+
+typedef struct Slab_Thread_Heap {
+	u64 id; // 0 until the thread takes its first span
+	// Rings of spans owned by this thread, we allocate from the head
+	Slab_Span *spans[SLAB_CLASS_COUNT];
+} Slab_Thread_Heap;
+
+typedef struct Slab_State {
+	bool initted;
+	
+	u8 *reservation;
+	Slab_Span *spans; // Header for span n is spans[n]
+	u8 *memory; // Span n starts at memory + n*SLAB_SPAN_SIZE
+	u64 span_capacity;
+	
+	Spinlock span_lock;
+	u64 committed_span_count;
+	u64 committed_header_size;
+	Slab_Span *free_spans;
+	u64 free_span_count;
+	
+	Slab_Size_Class classes[SLAB_CLASS_COUNT];
+	u8 size_to_class[SLAB_MAX_SIZE/SLAB_MIN_SIZE+1];
+	
+	volatile u64 last_heap_id;
+} Slab_State;
+
+// #Global
+ogb_instance Slab_State slab;
+
+#if !OOGABOOGA_LINK_EXTERNAL_INSTANCE
+Slab_State slab;
+thread_local Slab_Thread_Heap slab_thread_heap;
+#endif // NOT OOGABOOGA_LINK_EXTERNAL_INSTANCE
+
+bool is_pointer_in_slab_memory(void *p) {
+	return slab.initted && (u8*)p >= slab.memory && (u8*)p < slab.memory+slab.span_capacity*SLAB_SPAN_SIZE;
+}
+inline Slab_Span *slab_get_span(void *p) {
+	return &slab.spans[((u8*)p - slab.memory) >> SLAB_SPAN_SHIFT];
+}
+inline u8 *slab_get_span_memory(Slab_Span *span) {
+	return slab.memory + (u64)(span - slab.spans)*SLAB_SPAN_SIZE;
+}
+inline u64 slab_get_object_size(void *p) {
+	return slab.classes[slab_get_span(p)->class_index].object_size;
+}
+
+void slab_init() {
+	if (slab.initted) return;
+	
+	// 16 to 128 in steps of 16, then 4 classes per power of two up to SLAB_MAX_SIZE
+	u64 class_index = 0;
+	for (u32 size = SLAB_MIN_SIZE; size <= 128; size += 16) {
+		slab.classes[class_index++].object_size = size;
+	}
+	for (u32 base = 128; base < SLAB_MAX_SIZE; base *= 2) {
+		for (u32 step = 1; step <= 4; step += 1) {
+			slab.classes[class_index++].object_size = base + (base/4)*step;
+		}
+	}
+	assert(class_index == SLAB_CLASS_COUNT, "Internal slab error: wrong number of size classes");
+	assert(slab.classes[SLAB_CLASS_COUNT-1].object_size == SLAB_MAX_SIZE, "Internal slab error: last size class should be SLAB_MAX_SIZE");
+	
+	class_index = 0;
+	for (u64 i = 0; i < SLAB_MAX_SIZE/SLAB_MIN_SIZE+1; i += 1) {
+		while (slab.classes[class_index].object_size < i*SLAB_MIN_SIZE) class_index += 1;
+		slab.size_to_class[i] = (u8)class_index;
+	}
+	
+	for (u64 i = 0; i < SLAB_CLASS_COUNT; i += 1) {
+		spinlock_init(&slab.classes[i].lock);
+	}
+	spinlock_init(&slab.span_lock);
+	
+	u64 span_capacity = SLAB_RESERVE_SIZE/SLAB_SPAN_SIZE;
+	u64 header_size = (span_capacity*sizeof(Slab_Span)+SLAB_SPAN_SIZE-1) & ~(SLAB_SPAN_SIZE-1);
+	
+	slab.reservation = (u8*)os_reserve_memory(header_size + span_capacity*SLAB_SPAN_SIZE + SLAB_SPAN_SIZE);
+	assert(slab.reservation, "Failed reserving slab memory. Maybe try a smaller SLAB_RESERVE_SIZE?");
+	
+	slab.spans = (Slab_Span*)slab.reservation;
+	slab.memory = (u8*)(((u64)slab.reservation + header_size + SLAB_SPAN_SIZE-1) & ~(SLAB_SPAN_SIZE-1));
+	slab.span_capacity = span_capacity;
+	
+	slab.initted = true;
+}
+
+Slab_Span *slab_acquire_span() {
+	spinlock_acquire_or_wait(&slab.span_lock);
+	
+	Slab_Span *span = slab.free_spans;
+	if (span) {
+		slab.free_spans = span->next;
+		slab.free_span_count -= 1;
+	} else {
+		u64 index = slab.committed_span_count;
+		assert(index < slab.span_capacity, "Out of slab memory. You can increase SLAB_RESERVE_SIZE.");
+		
+		u64 required_header_size = (index+1)*sizeof(Slab_Span);
+		if (required_header_size > slab.committed_header_size) {
+			bool ok = os_commit_memory((u8*)slab.spans+slab.committed_header_size, SLAB_HEADER_COMMIT_SIZE);
+			assert(ok, "Failed committing slab span headers. Out of memory?");
+			slab.committed_header_size += SLAB_HEADER_COMMIT_SIZE;
+		}
+		
+		bool ok = os_commit_memory(slab.memory+index*SLAB_SPAN_SIZE, SLAB_SPAN_SIZE);
+		assert(ok, "Failed committing slab span. Out of memory?");
+		
+		slab.committed_span_count += 1;
+		span = &slab.spans[index];
+	}
+	
+	span->in_pool = false;
+	span->next = 0;
+	span->prev = 0;
+	
+	spinlock_release(&slab.span_lock);
+	
+	return span;
+}
+void slab_release_span(Slab_Span *span) {
+	assert(span->used_count == 0, "Internal slab error: releasing a span with live objects");
+	
+	span->owner = 0;
+	span->in_pool = true;
+	
+	spinlock_acquire_or_wait(&slab.span_lock);
+	span->prev = 0;
+	span->next = slab.free_spans;
+	slab.free_spans = span;
+	slab.free_span_count += 1;
+	spinlock_release(&slab.span_lock);
+}
+
+// Owned spans are kept in a circular list so rotating past full spans is O(1)
+inline void slab_ring_insert(Slab_Span **head, Slab_Span *span) {
+	if (*head) {
+		span->next = *head;
+		span->prev = (*head)->prev;
+		span->prev->next = span;
+		(*head)->prev = span;
+	} else {
+		span->next = span;
+		span->prev = span;
+	}
+	*head = span;
+}
+inline void slab_ring_remove(Slab_Span **head, Slab_Span *span) {
+	if (span->next == span) {
+		*head = 0;
+	} else {
+		span->prev->next = span->next;
+		span->next->prev = span->prev;
+		if (*head == span) *head = span->next;
+	}
+	span->next = 0;
+	span->prev = 0;
+}
+
+inline void slab_list_remove(Slab_Span **head, Slab_Span *span) {
+	if (span->prev) span->prev->next = span->next;
+	else *head = span->next;
+	if (span->next) span->next->prev = span->prev;
+	span->next = 0;
+	span->prev = 0;
+}
+inline void slab_list_push_front(Slab_Span **head, Slab_Span *span) {
+	span->prev = 0;
+	span->next = *head;
+	if (*head) (*head)->prev = span;
+	*head = span;
+}
+
+// Moves objects freed by other threads to the span free list.
+// Expects the caller to be the owner, or to hold the size class lock for abandoned spans.
+void slab_collect_remote_frees(Slab_Span *span) {
+	if (!span->remote_free) return;
+	
+	Slab_Free_Object *head;
+	do {
+		head = span->remote_free;
+	} while (!compare_and_swap_64((u64*)&span->remote_free, 0, (u64)head));
+	
+	Slab_Free_Object *tail = head;
+	u32 count = 1;
+	while (tail->next) {
+		tail = tail->next;
+		count += 1;
+	}
+	
+	tail->next = span->free_list;
+	span->free_list = head;
+	span->used_count -= count;
+}
+
+inline bool slab_span_has_room(Slab_Span *span) {
+	return span->free_list || span->bump < span->end;
+}
+inline void *slab_span_pop(Slab_Span *span, u32 object_size) {
+	void *p;
+	if (span->free_list) {
+		p = span->free_list;
+		span->free_list = span->free_list->next;
+	} else {
+		p = span->bump;
+		span->bump += object_size;
+	}
+	span->used_count += 1;
+	return p;
+}
+
+// Adopt an abandoned span for the class, or take a fresh one from the pool
+Slab_Span *slab_take_span(Slab_Thread_Heap *h, u32 class_index) {
+	Slab_Size_Class *c = &slab.classes[class_index];
+	
+	while (h->id == 0) {
+		u64 last = slab.last_heap_id;
+		if (compare_and_swap_64((u64*)&slab.last_heap_id, last+1, last)) h->id = last+1;
+	}
+	
+	Slab_Span *span = 0;
+	if (c->abandoned) {
+		spinlock_acquire_or_wait(&c->lock);
+		// Threads often exit with full spans, those stay abandoned until something in them is freed
+		Slab_Span *abandoned = c->abandoned;
+		for (u64 i = 0; abandoned && i < SLAB_MAX_SPANS_SEARCHED; i += 1) {
+			slab_collect_remote_frees(abandoned);
+			if (slab_span_has_room(abandoned)) {
+				slab_list_remove(&c->abandoned, abandoned);
+				abandoned->owner = h->id;
+				span = abandoned;
+				break;
+			}
+			abandoned = abandoned->next;
+		}
+		spinlock_release(&c->lock);
+	}
+	
+	if (!span) {
+		span = slab_acquire_span();
+		
+		u8 *memory = slab_get_span_memory(span);
+		span->capacity = (u32)(SLAB_SPAN_SIZE/c->object_size);
+		span->free_list = 0;
+		span->remote_free = 0;
+		span->bump = memory;
+		span->end = memory + span->capacity*c->object_size;
+		span->used_count = 0;
+		span->class_index = class_index;
+		span->owner = h->id;
+	}
+	
+	return span;
+}
+
+void *slab_alloc_slow(Slab_Thread_Heap *h, u32 class_index) {
+	
+	u32 object_size = slab.classes[class_index].object_size;
+	
+	// Look for an owned span with room, collecting remote frees on the way.
+	// Rotating the ring past full spans keeps the next search short.
+	Slab_Span **head = &h->spans[class_index];
+	Slab_Span *first = *head;
+	for (u64 i = 0; *head && i < SLAB_MAX_SPANS_SEARCHED; i += 1) {
+		slab_collect_remote_frees(*head);
+		if (slab_span_has_room(*head)) return slab_span_pop(*head, object_size);
+		
+		*head = (*head)->next;
+		if (*head == first) break;
+	}
+	
+	Slab_Span *span = slab_take_span(h, class_index);
+	slab_ring_insert(head, span);
+	
+	return slab_span_pop(span, object_size);
+}
+
+void *slab_alloc(u64 size) {
+	assert(size <= SLAB_MAX_SIZE, "Internal slab error: size too large for slab");
+	
+	if (!slab.initted) slab_init();
+	
+	u32 class_index = slab.size_to_class[(size+SLAB_MIN_SIZE-1)/SLAB_MIN_SIZE];
+	Slab_Thread_Heap *h = &slab_thread_heap;
+	
+	Slab_Span *span = h->spans[class_index];
+	if (span && slab_span_has_room(span)) {
+		return slab_span_pop(span, slab.classes[class_index].object_size);
+	}
+	
+	return slab_alloc_slow(h, class_index);
+}
+
+void slab_dealloc(void *p) {
+	Slab_Span *span = slab_get_span(p);
+	
+	assert(!span->in_pool && span->used_count > 0, "A bad pointer was passed to heap_dealloc, or it was freed twice");
+	
+	Slab_Size_Class *c = &slab.classes[span->class_index];
+	
+#if CONFIGURATION == DEBUG
+	assert(((u8*)p - slab_get_span_memory(span)) % c->object_size == 0, "A bad pointer was passed to heap_dealloc: it is not the start of an allocation");
+	assert((u8*)p < span->bump, "A bad pointer was passed to heap_dealloc: it was never allocated");
+	memset(p, 0x69, c->object_size);
+#endif
+	
+	Slab_Free_Object *object = (Slab_Free_Object*)p;
+	Slab_Thread_Heap *h = &slab_thread_heap;
+	
+	// A heap without an id owns nothing, and 0 is what abandoned spans have
+	if (h->id && span->owner == h->id) {
+		object->next = span->free_list;
+		span->free_list = object;
+		span->used_count -= 1;
+		
+		// Keep the span we allocate from, give back the others when they're empty
+		if (span->used_count == 0 && span != h->spans[span->class_index]) {
+			slab_ring_remove(&h->spans[span->class_index], span);
+			slab_release_span(span);
+		}
+		return;
+	}
+	
+	if (span->owner == 0) {
+		spinlock_acquire_or_wait(&c->lock);
+		// Someone might have adopted it while we were waiting
+		if (span->owner == 0) {
+			object->next = span->free_list;
+			span->free_list = object;
+			span->used_count -= 1;
+			
+			slab_collect_remote_frees(span);
+			if (span->used_count == 0) {
+				slab_list_remove(&c->abandoned, span);
+				slab_release_span(span);
+			}
+			spinlock_release(&c->lock);
+			return;
+		}
+		spinlock_release(&c->lock);
+	}
+	
+	// Owned by another thread
+	Slab_Free_Object *head;
+	do {
+		head = span->remote_free;
+		object->next = head;
+	} while (!compare_and_swap_64((u64*)&span->remote_free, (u64)object, (u64)head));
+}
+
+// Call this before a thread exits so its spans can be used by other threads.
+// os threads do this automatically.
+void heap_release_thread_cache() {
+	if (!slab.initted) return;
+	
+	Slab_Thread_Heap *h = &slab_thread_heap;
+	
+	for (u32 class_index = 0; class_index < SLAB_CLASS_COUNT; class_index += 1) {
+		Slab_Size_Class *c = &slab.classes[class_index];
+		
+		while (h->spans[class_index]) {
+			Slab_Span *span = h->spans[class_index];
+			slab_ring_remove(&h->spans[class_index], span);
+			
+			spinlock_acquire_or_wait(&c->lock);
+			span->owner = 0;
+			MEMORY_BARRIER;
+			slab_collect_remote_frees(span);
+			if (span->used_count == 0) {
+				slab_release_span(span);
+			} else {
+				slab_list_push_front(&c->abandoned, span);
+			}
+			spinlock_release(&c->lock);
+		}
+	}
+}
+
+///
+///
+// Large allocations
+///
+// Allocations of LARGE_ALLOCATION_THRESHOLD bytes or more get their own virtual memory
+// straight from the OS and are given back to the OS when freed, so they never fragment
+// the heap blocks. They are tracked in a side table keyed by address.
+// We reserve twice the address space we commit so reallocations can grow in place.
+
+#ifndef LARGE_ALLOCATION_THRESHOLD
+	#define LARGE_ALLOCATION_THRESHOLD MB(2)
+#endif
+
+#define LARGE_ALLOCATION_TABLE_INITIAL_CAPACITY 1024
+
+typedef struct Large_Allocation {
+	void *p; // 0 means the slot is empty
+	u64 reserved_size;
+	u64 committed_size;
+} Large_Allocation;
+
+typedef struct Large_Allocation_Table {
+	Spinlock lock;
+	Large_Allocation *slots;
+	u64 capacity; // Always a power of two
+	u64 count;
+	u64 committed_size;
+} Large_Allocation_Table;
+
+// #Global
+ogb_instance Large_Allocation_Table large_allocations;
+
+#if !OOGABOOGA_LINK_EXTERNAL_INSTANCE
+Large_Allocation_Table large_allocations;
+#endif // NOT OOGABOOGA_LINK_EXTERNAL_INSTANCE
+
+inline u64 large_allocation_page_align(u64 size) {
+	return (size+os.page_size-1) & ~(os.page_size-1);
+}
+
+// Expects large_allocations.lock to be held. Returns the slot index or -1.
+s64 large_allocation_find_slot(void *p) {
+	if (!large_allocations.slots) return -1;
+	
+	u64 mask = large_allocations.capacity-1;
+	u64 i = xx_hash((u64)p) & mask;
+	while (large_allocations.slots[i].p) {
+		if (large_allocations.slots[i].p == p) return (s64)i;
+		i = (i+1) & mask;
+	}
+	return -1;
+}
+
+// Expects large_allocations.lock to be held
+void large_allocation_table_insert(Large_Allocation a) {
+	Large_Allocation_Table *t = &large_allocations;
+	
+	if ((t->count+1)*4 > t->capacity*3) {
+		
+		// The table gets its memory from the OS too so we don't depend on the heap here
+		u64 new_capacity = t->capacity ? t->capacity*2 : LARGE_ALLOCATION_TABLE_INITIAL_CAPACITY;
+		u64 new_size = new_capacity*sizeof(Large_Allocation);
+		Large_Allocation *new_slots = (Large_Allocation*)os_reserve_memory(new_size);
+		bool ok = new_slots && os_commit_memory(new_slots, new_size);
+		assert(ok, "Failed allocating large allocation table. Out of memory?");
+		memset(new_slots, 0, new_size);
+		
+		Large_Allocation *old_slots = t->slots;
+		u64 old_capacity = t->capacity;
+		t->slots = new_slots;
+		t->capacity = new_capacity;
+		t->count = 0;
+		
+		for (u64 i = 0; i < old_capacity; i += 1) {
+			if (old_slots[i].p) large_allocation_table_insert(old_slots[i]);
+		}
+		if (old_slots) os_release_memory(old_slots, old_capacity*sizeof(Large_Allocation));
+	}
+	
+	u64 mask = t->capacity-1;
+	u64 i = xx_hash((u64)a.p) & mask;
+	while (t->slots[i].p) i = (i+1) & mask;
+	t->slots[i] = a;
+	t->count += 1;
+}
+
+// Expects large_allocations.lock to be held
+void large_allocation_table_remove(u64 slot_index) {
+	Large_Allocation_Table *t = &large_allocations;
+	u64 mask = t->capacity-1;
+	
+	// Backward shift entries that were displaced past this slot
+	u64 hole = slot_index;
+	u64 i = (hole+1) & mask;
+	while (t->slots[i].p) {
+		u64 ideal = xx_hash((u64)t->slots[i].p) & mask;
+		if (((i-ideal) & mask) >= ((i-hole) & mask)) {
+			t->slots[hole] = t->slots[i];
+			hole = i;
+		}
+		i = (i+1) & mask;
+	}
+	t->slots[hole] = ZERO(Large_Allocation);
+	t->count -= 1;
+}
+
+void *large_alloc(u64 size) {
+	Large_Allocation a;
+	a.committed_size = large_allocation_page_align(size);
+	a.reserved_size = (a.committed_size*2+os.granularity-1) & ~(os.granularity-1);
+	a.p = os_reserve_memory(a.reserved_size);
+	assert(a.p, "Failed reserving %llu bytes of memory. Out of address space?", a.reserved_size);
+	bool ok = os_commit_memory(a.p, a.committed_size);
+	assert(ok, "Failed committing %llu bytes of memory. Out of memory?", a.committed_size);
+	
+	spinlock_acquire_or_wait(&large_allocations.lock);
+	large_allocation_table_insert(a);
+	large_allocations.committed_size += a.committed_size;
+	spinlock_release(&large_allocations.lock);
+	
+	return a.p;
+}
+
+// Returns false if p is not a large allocation
+bool large_dealloc(void *p) {
+	spinlock_acquire_or_wait(&large_allocations.lock);
+	s64 slot_index = large_allocation_find_slot(p);
+	if (slot_index == -1) {
+		spinlock_release(&large_allocations.lock);
+		return false;
+	}
+	Large_Allocation a = large_allocations.slots[slot_index];
+	large_allocation_table_remove(slot_index);
+	large_allocations.committed_size -= a.committed_size;
+	spinlock_release(&large_allocations.lock);
+	
+	os_release_memory(a.p, a.reserved_size);
+	return true;
+}
+
+// Returns the usable size of the large allocation, or 0 if p is not one
+u64 large_allocation_get_size(void *p) {
+	spinlock_acquire_or_wait(&large_allocations.lock);
+	s64 slot_index = large_allocation_find_slot(p);
+	u64 size = slot_index == -1 ? 0 : large_allocations.slots[slot_index].committed_size;
+	spinlock_release(&large_allocations.lock);
+	return size;
+}
+
+// Commits or decommits pages at the end of the reservation. Returns false if it doesn't fit.
+bool large_try_resize(void *p, u64 size) {
+	u64 new_committed_size = large_allocation_page_align(size);
+	
+	spinlock_acquire_or_wait(&large_allocations.lock);
+	s64 slot_index = large_allocation_find_slot(p);
+	assert(slot_index != -1, "A bad pointer was passed to heap reallocate: it is not a heap allocation");
+	Large_Allocation *a = &large_allocations.slots[slot_index];
+	
+	bool resized = false;
+	if (new_committed_size <= a->reserved_size) {
+		resized = true;
+		if (new_committed_size > a->committed_size) {
+			resized = os_commit_memory((u8*)p+a->committed_size, new_committed_size-a->committed_size);
+		} else if (new_committed_size < a->committed_size) {
+			os_decommit_memory((u8*)p+new_committed_size, a->committed_size-new_committed_size);
+		}
+		if (resized) {
+			large_allocations.committed_size -= a->committed_size;
+			large_allocations.committed_size += new_committed_size;
+			a->committed_size = new_committed_size;
+		}
+	}
+	spinlock_release(&large_allocations.lock);
+	
+	return resized;
+}
+
 void heap_init() {
 	if (heap_initted) return;
 	assert(HEAP_ALIGNMENT == 16);
@@ -273,11 +895,43 @@ void heap_init() {
 	heap_initted = true;
 	heap_head = make_heap_block(0, DEFAULT_HEAP_BLOCK_SIZE);
 	spinlock_init(&heap_lock);
+	spinlock_init(&large_allocations.lock);
+	slab_init();
 }
 
 
 
-void *heap_alloc(u64 size) {
+inline u64 heap_block_get_required_size(u64 size) {
+	size += sizeof(Heap_Allocation_Metadata);
+	return (size+HEAP_ALIGNMENT) & ~(HEAP_ALIGNMENT-1);
+}
+
+// Expects heap_lock to be held.
+// Free nodes are kept sorted by address so we can merge them with their neighbours.
+void heap_block_insert_free_node(Heap_Block *block, Heap_Free_Node *new_node) {
+	Heap_Free_Node *previous = 0;
+	Heap_Free_Node *next = block->free_head;
+	while (next && next < new_node) {
+		previous = next;
+		next = next->next;
+	}
+	
+	new_node->next = next;
+	if (previous) previous->next = new_node;
+	else block->free_head = new_node;
+	
+	if (next && (u8*)new_node+new_node->size == (u8*)next) {
+		new_node->size += next->size;
+		new_node->next = next->next;
+	}
+	if (previous && (u8*)previous+previous->size == (u8*)new_node) {
+		previous->size += new_node->size;
+		previous->next = new_node->next;
+	}
+}
+
+// Free list allocation, used for everything larger than SLAB_MAX_SIZE
+void *heap_block_alloc(u64 size) {
 
 	if (!heap_initted) heap_init();
 
@@ -288,11 +942,7 @@ void *heap_alloc(u64 size) {
 
 
 	
-	size += sizeof(Heap_Allocation_Metadata);
-	
-	size = (size+HEAP_ALIGNMENT) & ~(HEAP_ALIGNMENT-1);
-	
-	assert(size < MAX_HEAP_BLOCK_SIZE, "Past Charlie has been lazy and did not handle large allocations like this. I apologize on behalf of past Charlie. A quick fix could be to increase the heap block size for now. #Incomplete #Limitation");
+	size = heap_block_get_required_size(size);
 	
 	
 #if VERY_DEBUG
@@ -404,14 +1054,14 @@ void *heap_alloc(u64 size) {
 	assert((u64)p % HEAP_ALIGNMENT == 0, "Internal heap error. Result pointer is not aligned to HEAP_ALIGNMENT");
 	return p;
 }
-void heap_dealloc(void *p) {
+void heap_block_dealloc(void *p) {
 	// #Sync #Speed oof
 	
 	if (!heap_initted) heap_init();
 
 	spinlock_acquire_or_wait(&heap_lock);
 	
-	assert(is_pointer_in_program_memory(p), "A bad pointer was passed tp heap_dealloc: it is out of program memory bounds!"); 
+	assert(is_pointer_in_program_memory(p), "A bad pointer was passed to heap_dealloc: it is out of program memory bounds!"); 
 	p = (u8*)p-sizeof(Heap_Allocation_Metadata);
 	Heap_Allocation_Metadata *meta = (Heap_Allocation_Metadata*)(p);
 	check_meta(meta);
@@ -431,67 +1081,198 @@ void heap_dealloc(void *p) {
 	Heap_Free_Node *new_node = cast(Heap_Free_Node*)p;
 	new_node->size = size;
 	
-	if (new_node < block->free_head) {
-		if ((u8*)new_node+size == (u8*)block->free_head) {
-			new_node->size = size + block->free_head->size;
-			new_node->next = block->free_head->next;
-			block->free_head = new_node;
-		} else {
-			new_node->next = block->free_head;
-			block->free_head = new_node;
+	heap_block_insert_free_node(block, new_node);
+	
+#if CONFIGURATION == DEBUG
+	block->total_allocated -= size;
+#endif
+
+#if VERY_DEBUG
+	sanity_check_block(block);
+#endif
+	// #Sync #Speed oof
+	spinlock_release(&heap_lock);
+}
+
+// Don't bother giving back tails smaller than this when shrinking
+#define HEAP_MIN_SHRINK_SIZE 64
+
+// Resizes a free list allocation without moving it if possible.
+// Growing takes from the adjacent free node, shrinking gives the tail back to the free list.
+bool heap_block_try_resize(void *p, u64 size) {
+	
+	u64 required_size = heap_block_get_required_size(size);
+	
+	spinlock_acquire_or_wait(&heap_lock);
+	
+	Heap_Allocation_Metadata *meta = (Heap_Allocation_Metadata*)((u8*)p-sizeof(Heap_Allocation_Metadata));
+	check_meta(meta);
+	Heap_Block *block = meta->block;
+	
+	bool resized = false;
+	
+	if (required_size <= meta->size) {
+		u64 remainder = meta->size - required_size;
+		if (remainder >= HEAP_MIN_SHRINK_SIZE) {
+			Heap_Free_Node *tail = (Heap_Free_Node*)((u8*)meta+required_size);
+			tail->size = remainder;
+			meta->size = required_size;
+			heap_block_insert_free_node(block, tail);
+#if CONFIGURATION == DEBUG
+			block->total_allocated -= remainder;
+#endif
 		}
+		resized = true;
 	} else {
-	
-		if (!block->free_head) {
-			block->free_head = new_node;
-			new_node->next = 0;
-		} else {
-			Heap_Free_Node *node = block->free_head;
+		u64 missing = required_size - meta->size;
+		u8 *end = (u8*)meta+meta->size;
 		
-			while (true) {
-			
-				assert(node != 0, "We didn't find where the free node should be! This is likely heap corruption (or, hopefully not, an internal error)");
-				
-				// In retrospect, I don't remember a good reason to care about where the
-				// free nodes are... maybe I'm just dumb right now? #Speed #Memory
-				// ... ACtually, it's probably to easily know when to merge free nodes.
-				// BUT. Maybe it's not worth the performance hit? Then again, if the heap
-				// allocator slows down your program you should rethink your memory management
-				// anyways...
-				
-				if (new_node >= node) {
-					u8* node_tail = (u8*)node + node->size;
-					if (cast(u8*)new_node == node_tail) {
-						node->size += new_node->size;
-						break;
-					} else {
-						new_node->next = node->next;
-						node->next = new_node;
-						
-						u8* new_node_tail = (u8*)new_node + new_node->size;
-						if (new_node->next && (u8*)new_node->next == new_node_tail) {
-							new_node->size += new_node->next->size;
-							new_node->next = new_node->next->next;
-						}
-						break;
-					}
-				}
-				
-				node = node->next;
+		Heap_Free_Node *previous = 0;
+		Heap_Free_Node *node = block->free_head;
+		while (node && (u8*)node < end) {
+			previous = node;
+			node = node->next;
+		}
+		
+		if (node && (u8*)node == end && node->size >= missing) {
+			Heap_Free_Node *replacement;
+			if (node->size > missing) {
+				replacement = (Heap_Free_Node*)(end+missing);
+				replacement->size = node->size-missing;
+				replacement->next = node->next;
+			} else {
+				replacement = node->next;
 			}
+			
+			if (previous) previous->next = replacement;
+			else block->free_head = replacement;
+			
+			meta->size = required_size;
+#if CONFIGURATION == DEBUG
+			block->total_allocated += missing;
+#endif
+			resized = true;
 		}
 	}
 	
-
-#if CONFIGURATION == DEBUG
-	block->total_allocated -= size;
-#endif
-
 #if VERY_DEBUG
 	sanity_check_block(block);
 #endif
-	// #Sync #Speed oof
+	
+	spinlock_release(&heap_lock);
+	
+	return resized;
+}
+
+void *heap_alloc(u64 size) {
+	if (!heap_initted) heap_init();
+	
+	if (size <= SLAB_MAX_SIZE) return slab_alloc(size);
+	if (size >= LARGE_ALLOCATION_THRESHOLD) return large_alloc(size);
+	
+	return heap_block_alloc(size);
+}
+void heap_dealloc(void *p) {
+	if (!heap_initted) heap_init();
+	
+	if (is_pointer_in_slab_memory(p)) {
+		slab_dealloc(p);
+	} else if (is_pointer_in_program_memory(p)) {
+		heap_block_dealloc(p);
+	} else {
+		bool ok = large_dealloc(p);
+		assert(ok, "A bad pointer was passed to heap_dealloc: it is not a heap allocation");
+	}
+}
+// Number of usable bytes in the allocation, which may be more than what was requested
+u64 heap_get_allocation_size(void *p) {
+	if (is_pointer_in_slab_memory(p)) return slab_get_object_size(p);
+	if (!is_pointer_in_program_memory(p)) {
+		u64 size = large_allocation_get_size(p);
+		assert(size, "A bad pointer was passed to the heap: it is not a heap allocation");
+		return size;
+	}
+	
+	Heap_Allocation_Metadata *meta = (Heap_Allocation_Metadata*)(((u64)p)-sizeof(Heap_Allocation_Metadata));
+	check_meta(meta);
+	return meta->size-sizeof(Heap_Allocation_Metadata);
+}
+
+void *heap_realloc(void *p, u64 size) {
+	if (!p) return heap_alloc(size);
+	
+	u64 old_size = heap_get_allocation_size(p);
+	
+	if (is_pointer_in_slab_memory(p)) {
+		// Keep the object unless it shrinks enough to fit a much smaller size class
+		if (size <= old_size) {
+			u64 new_object_size = slab.classes[slab.size_to_class[(size+SLAB_MIN_SIZE-1)/SLAB_MIN_SIZE]].object_size;
+			if (new_object_size*2 > old_size) return p;
+		}
+	} else if (is_pointer_in_program_memory(p)) {
+		if (size < LARGE_ALLOCATION_THRESHOLD && heap_block_try_resize(p, size)) return p;
+	} else {
+		if (size >= LARGE_ALLOCATION_THRESHOLD/2 && large_try_resize(p, size)) return p;
+	}
+	
+	void *new = heap_alloc(size);
+	memcpy(new, p, min(size, old_size));
+	heap_dealloc(p);
+	return new;
+}
+
+typedef struct Heap_Stats {
+	// Size class allocations
+	u64 slab_committed_bytes;
+	u64 slab_used_bytes; // Bytes handed out, including size class rounding
+	u64 slab_free_span_count;
+	
+	// Allocations mapped straight from the OS
+	u64 large_allocation_count;
+	u64 large_committed_bytes;
+	
+	// Free list allocations
+	u64 block_total_bytes;
+	u64 block_free_bytes;
+	u64 block_largest_free_node;
+	u64 block_free_node_count;
+} Heap_Stats;
+
+// Not synchronized with allocations on other threads, so treat it as a rough snapshot
+Heap_Stats heap_get_stats() {
+	Heap_Stats stats = ZERO(Heap_Stats);
+	
+	if (!heap_initted) heap_init();
+	
+	stats.slab_committed_bytes = slab.committed_span_count*SLAB_SPAN_SIZE;
+	stats.slab_free_span_count = slab.free_span_count;
+	for (u64 i = 0; i < slab.committed_span_count; i += 1) {
+		Slab_Span *span = &slab.spans[i];
+		if (span->in_pool) continue;
+		stats.slab_used_bytes += (u64)span->used_count*slab.classes[span->class_index].object_size;
+	}
+	
+	spinlock_acquire_or_wait(&large_allocations.lock);
+	stats.large_allocation_count = large_allocations.count;
+	stats.large_committed_bytes = large_allocations.committed_size;
+	spinlock_release(&large_allocations.lock);
+	
+	spinlock_acquire_or_wait(&heap_lock);
+	Heap_Block *block = heap_head;
+	while (block) {
+		stats.block_total_bytes += block->size;
+		Heap_Free_Node *node = block->free_head;
+		while (node) {
+			stats.block_free_bytes += node->size;
+			stats.block_largest_free_node = max(stats.block_largest_free_node, node->size);
+			stats.block_free_node_count += 1;
+			node = node->next;
+		}
+		block = block->next;
+	}
 	spinlock_release(&heap_lock);
+	
+	return stats;
 }
 
 void* heap_allocator_proc(u64 size, void *p, Allocator_Message message, void* data) {
@@ -505,16 +1286,7 @@ void* heap_allocator_proc(u64 size, void *p, Allocator_Message message, void* da
 			return 0;
 		}
 		case ALLOCATOR_REALLOCATE: {
-			if (!p) {
-				return heap_alloc(size);
-			}
-			assert(is_pointer_valid(p), "Invalid pointer passed to heap allocator reallocate");
-			Heap_Allocation_Metadata *meta = (Heap_Allocation_Metadata*)(((u64)p)-sizeof(Heap_Allocation_Metadata));
-			check_meta(meta);
-			void *new = heap_alloc(size);
-			memcpy(new, p, min(size, meta->size));
-			heap_dealloc(p);
-			return new;
+			return heap_realloc(p, size);
 		}
 	}
 	return 0;
@@ -529,14 +1301,275 @@ Allocator get_heap_allocator() {
 	return heap_allocator;
 }
 
+///
+///
+// Arenas
+///
+// Bump allocator for things that share a lifetime, like everything loaded for a level or
+// everything built for a frame. Instead of freeing each allocation you free all of them
+// at once with arena_clear() or by restoring a save point.
+//
+// An arena reserves a range of virtual memory up front and commits it as it fills up,
+// so pointers into it stay valid as it grows. The Arena header lives at the start of
+// the reservation.
+//
+//	Arena *level_arena = make_arena(0);
+//	Entity *entities = arena_push_array(level_arena, Entity, 1024);
+//	Allocator allocator = arena_get_allocator(level_arena); // For growing arrays etc
+//	...
+//	arena_clear(level_arena); // Everything for the level is gone
+//
+
+#ifndef ARENA_DEFAULT_RESERVE_SIZE
+	#define ARENA_DEFAULT_RESERVE_SIZE (GB(1))
+#endif
+#define ARENA_COMMIT_SIZE (KB(64))
+#define ARENA_DEFAULT_ALIGNMENT 16
+
+typedef struct Arena {
+	u8 *base; // Start of the reservation, which is also where this header lives
+	u64 position; // Offset from base to the next free byte
+	u64 committed;
+	u64 reserved;
+	u64 start; // Offset to the first byte after the header
+	u64 last_allocation; // Offset of the most recent allocation, so it can be resized in place
+	u64 high_water_mark;
+} Arena;
+
+typedef struct Arena_Save_Point {
+	Arena *arena;
+	u64 position;
+	u64 last_allocation;
+} Arena_Save_Point;
+
+// Pass 0 for ARENA_DEFAULT_RESERVE_SIZE.
+// Reserving is only address space, so be generous.
+ogb_instance Arena *
+make_arena(u64 reserve_size);
+
+ogb_instance void
+destroy_arena(Arena *arena);
+
+ogb_instance void *
+arena_push_aligned(Arena *arena, u64 size, u64 alignment);
+
+ogb_instance void *
+arena_push(Arena *arena, u64 size);
+
+ogb_instance void *
+arena_push_zero(Arena *arena, u64 size);
+
+// Gives back the size most recently pushed bytes
+ogb_instance void
+arena_pop(Arena *arena, u64 size);
+
+ogb_instance void
+arena_clear(Arena *arena);
+
+// Bytes currently in use, excluding the header
+ogb_instance u64
+arena_get_used(Arena *arena);
+
+ogb_instance Arena_Save_Point
+arena_save(Arena *arena);
+
+// Frees everything pushed since the save point
+ogb_instance void
+arena_restore(Arena_Save_Point save_point);
+
+ogb_instance void* 
+arena_allocator_proc(u64 size, void *p, Allocator_Message message, void* data);
+
+// Deallocating through the allocator only frees anything if it's the last allocation,
+// and reallocating resizes in place if it's the last allocation.
+ogb_instance Allocator
+arena_get_allocator(Arena *arena);
+
+#define arena_push_struct(arena, T) ((T*)arena_push(arena, sizeof(T)))
+#define arena_push_array(arena, T, count) ((T*)arena_push(arena, sizeof(T)*(count)))
+
+#define arena_scope(arena) \
+	for (Arena_Save_Point _arena_save = arena_save(arena), *_arena_scope_once = &_arena_save; _arena_scope_once; _arena_scope_once = 0, arena_restore(_arena_save))
+
+#if !OOGABOOGA_LINK_EXTERNAL_INSTANCE
+
+inline u64 arena_align_up(u64 x, u64 alignment) {
+	return (x+alignment-1) & ~(alignment-1);
+}
+
+Arena *make_arena(u64 reserve_size) {
+	if (reserve_size == 0) reserve_size = ARENA_DEFAULT_RESERVE_SIZE;
+	reserve_size = arena_align_up(reserve_size, os.granularity);
+	
+	u8 *base = (u8*)os_reserve_memory(reserve_size);
+	assert(base, "Failed reserving memory for arena. Out of address space?");
+	
+	u64 commit_size = min(arena_align_up(sizeof(Arena), ARENA_COMMIT_SIZE), reserve_size);
+	bool ok = os_commit_memory(base, commit_size);
+	assert(ok, "Failed committing memory for arena. Out of memory?");
+	
+	Arena *arena = (Arena*)base;
+	arena->base = base;
+	arena->start = arena_align_up(sizeof(Arena), ARENA_DEFAULT_ALIGNMENT);
+	arena->position = arena->start;
+	arena->last_allocation = arena->start;
+	arena->committed = commit_size;
+	arena->reserved = reserve_size;
+	arena->high_water_mark = 0;
+	
+	return arena;
+}
+
+void destroy_arena(Arena *arena) {
+	os_release_memory(arena->base, arena->reserved);
+}
+
+// Commits enough pages for the arena to reach end
+void arena_commit_to(Arena *arena, u64 end) {
+	assert(end <= arena->reserved, "Arena is out of reserved memory (%llu bytes). Reserve more in make_arena.", arena->reserved);
+	
+	u64 new_committed = min(arena_align_up(end, ARENA_COMMIT_SIZE), arena->reserved);
+	bool ok = os_commit_memory(arena->base+arena->committed, new_committed-arena->committed);
+	assert(ok, "Failed committing memory for arena. Out of memory?");
+	arena->committed = new_committed;
+}
+
+void *arena_push_aligned(Arena *arena, u64 size, u64 alignment) {
+	assert(alignment > 0 && (alignment & (alignment-1)) == 0, "Arena alignment must be a power of two");
+	
+	u64 offset = arena_align_up(arena->position, alignment);
+	u64 end = offset+size;
+	
+	if (end > arena->committed) arena_commit_to(arena, end);
+	
+	arena->position = end;
+	arena->last_allocation = offset;
+	arena->high_water_mark = max(arena->high_water_mark, end-arena->start);
+	
+	return arena->base+offset;
+}
+
+void *arena_push(Arena *arena, u64 size) {
+	return arena_push_aligned(arena, size, ARENA_DEFAULT_ALIGNMENT);
+}
+
+void *arena_push_zero(Arena *arena, u64 size) {
+	void *p = arena_push_aligned(arena, size, ARENA_DEFAULT_ALIGNMENT);
+	memset(p, 0, size);
+	return p;
+}
+
+void arena_pop(Arena *arena, u64 size) {
+	assert(size <= arena->position-arena->start, "Popped more than what's in the arena");
+	arena->position -= size;
+	arena->last_allocation = min(arena->last_allocation, arena->position);
+}
+
+void arena_clear(Arena *arena) {
+	arena->position = arena->start;
+	arena->last_allocation = arena->start;
+}
+
+u64 arena_get_used(Arena *arena) {
+	return arena->position-arena->start;
+}
+
+Arena_Save_Point arena_save(Arena *arena) {
+	Arena_Save_Point save_point;
+	save_point.arena = arena;
+	save_point.position = arena->position;
+	save_point.last_allocation = arena->last_allocation;
+	return save_point;
+}
+
+void arena_restore(Arena_Save_Point save_point) {
+	Arena *arena = save_point.arena;
+	assert(save_point.position >= arena->start && save_point.position <= arena->position, "Invalid arena save point. Save points must be restored in reverse order.");
+	arena->position = save_point.position;
+	arena->last_allocation = save_point.last_allocation;
+}
+
+void* arena_allocator_proc(u64 size, void *p, Allocator_Message message, void* data) {
+	Arena *arena = (Arena*)data;
+	switch (message) {
+		case ALLOCATOR_ALLOCATE: {
+			return arena_push(arena, size);
+			break;
+		}
+		case ALLOCATOR_DEALLOCATE: {
+			if ((u8*)p == arena->base+arena->last_allocation) {
+				arena->position = arena->last_allocation;
+			}
+			return 0;
+		}
+		case ALLOCATOR_REALLOCATE: {
+			if ((u8*)p != arena->base+arena->last_allocation) return 0;
+			
+			u64 end = arena->last_allocation+size;
+			if (end > arena->committed) arena_commit_to(arena, end);
+			arena->position = end;
+			arena->high_water_mark = max(arena->high_water_mark, end-arena->start);
+			return p;
+		}
+	}
+	return 0;
+}
+
+Allocator arena_get_allocator(Arena *arena) {
+	Allocator allocator;
+	allocator.proc = arena_allocator_proc;
+	allocator.data = arena;
+	return allocator;
+}
+
+#endif // NOT OOGABOOGA_LINK_EXTERNAL_INSTANCE
+
 ///
 ///
 // Temporary storage
 ///
+// A per-thread bump allocator which is reset once per frame with reset_temporary_storage().
+// It's a chain of chunks of reserved virtual memory which are committed as they are used,
+// so it grows on demand instead of wrapping around.
+// Use temp_mark()/temp_restore() or temp_scope() to give back scratch memory early:
+//
+//	temp_scope() {
+//		string s = tprint("%i", 69);
+//		// ...
+//	} // Everything allocated in the scope is released here
+//
 
 #ifndef TEMPORARY_STORAGE_SIZE
-	#define TEMPORARY_STORAGE_SIZE (1024ULL*1024ULL*2ULL) // 2mb
+	#define TEMPORARY_STORAGE_SIZE (1024ULL*1024ULL*2ULL) // 2mb, committed up front
+#endif
+#ifndef TEMPORARY_STORAGE_CHUNK_RESERVE_SIZE
+	#define TEMPORARY_STORAGE_CHUNK_RESERVE_SIZE (MB(256))
 #endif
+#define TEMPORARY_STORAGE_COMMIT_SIZE (KB(64))
+#define TEMPORARY_STORAGE_ALIGNMENT 16
+
+typedef struct Temporary_Storage_Chunk Temporary_Storage_Chunk;
+typedef struct Temporary_Storage_Chunk {
+	Temporary_Storage_Chunk *next;
+	u8 *start;
+	u8 *committed_end;
+	u8 *reserved_end;
+	u64 used_before; // Bytes used in the chunks before this one, set when we move into it
+} Temporary_Storage_Chunk;
+
+typedef struct Temp_Mark {
+	Temporary_Storage_Chunk *chunk;
+	u8 *pointer;
+} Temp_Mark;
+
+typedef struct Temporary_Storage_Stats {
+	u64 used; // Bytes allocated since the last reset
+	u64 high_water_mark; // Most bytes used since the last reset
+	u64 last_frame_high_water_mark; // high_water_mark at the last reset_temporary_storage()
+	u64 all_time_high_water_mark;
+	u64 committed;
+	u64 chunk_count;
+} Temporary_Storage_Stats;
 
 ogb_instance void* talloc(u64);
 ogb_instance void* temp_allocator_proc(u64 size, void *p, Allocator_Message message, void*);
@@ -546,10 +1579,11 @@ ogb_instance Allocator
 get_temporary_allocator();
 
 #if !OOGABOOGA_LINK_EXTERNAL_INSTANCE
-thread_local void * temporary_storage = 0;
+thread_local Temporary_Storage_Chunk *temporary_storage = 0; // First chunk
+thread_local Temporary_Storage_Chunk *temporary_storage_chunk = 0; // Chunk we're allocating from
 thread_local bool   temporary_storage_initted = false;
-thread_local void * temporary_storage_pointer = 0;
-thread_local bool   has_warned_temporary_storage_overflow = false;
+thread_local u8 *   temporary_storage_pointer = 0;
+thread_local Temporary_Storage_Stats temporary_storage_stats;
 thread_local Allocator temp_allocator;
 
 ogb_instance Allocator 
@@ -565,12 +1599,29 @@ temp_allocator_proc(u64 size, void *p, Allocator_Message message, void* data);
 ogb_instance void 
 temporary_storage_init();
 
+// Gives the temporary storage of this thread back to the OS. os threads do this when they exit.
+ogb_instance void 
+temporary_storage_release();
+
 ogb_instance void* 
 talloc(u64 size);
 
 ogb_instance void 
 reset_temporary_storage();
 
+ogb_instance Temp_Mark 
+temp_mark();
+
+// Releases everything allocated after the mark. Marks must be restored in reverse order.
+ogb_instance void 
+temp_restore(Temp_Mark mark);
+
+ogb_instance Temporary_Storage_Stats 
+get_temporary_storage_stats();
+
+#define temp_scope() \
+	for (Temp_Mark _temp_mark = temp_mark(), *_temp_scope_once = &_temp_mark; _temp_scope_once; _temp_scope_once = 0, temp_restore(_temp_mark))
+
 
 #if !OOGABOOGA_LINK_EXTERNAL_INSTANCE
 void* temp_allocator_proc(u64 size, void *p, Allocator_Message message, void* data) {
@@ -589,36 +1640,102 @@ void* temp_allocator_proc(u64 size, void *p, Allocator_Message message, void* da
 	return 0;
 }
 
+Temporary_Storage_Chunk *temporary_storage_make_chunk(u64 min_size) {
+	u64 header_size = (sizeof(Temporary_Storage_Chunk)+TEMPORARY_STORAGE_ALIGNMENT-1) & ~(TEMPORARY_STORAGE_ALIGNMENT-1);
+	u64 reserve_size = max(TEMPORARY_STORAGE_CHUNK_RESERVE_SIZE, min_size+header_size);
+	reserve_size = (reserve_size+os.granularity-1) & ~(os.granularity-1);
+	
+	u8 *memory = (u8*)os_reserve_memory(reserve_size);
+	assert(memory, "Failed reserving temporary storage. Out of address space?");
+	
+	u64 commit_size = (max(TEMPORARY_STORAGE_SIZE, header_size)+os.page_size-1) & ~(os.page_size-1);
+	commit_size = min(commit_size, reserve_size);
+	bool ok = os_commit_memory(memory, commit_size);
+	assert(ok, "Failed committing temporary storage. Out of memory?");
+	
+	Temporary_Storage_Chunk *chunk = (Temporary_Storage_Chunk*)memory;
+	chunk->next = 0;
+	chunk->start = memory+header_size;
+	chunk->committed_end = memory+commit_size;
+	chunk->reserved_end = memory+reserve_size;
+	chunk->used_before = 0;
+	
+	temporary_storage_stats.committed += commit_size;
+	temporary_storage_stats.chunk_count += 1;
+	
+	return chunk;
+}
+
 void temporary_storage_init() {
 	if (temporary_storage_initted) return;
 	
-	temporary_storage = heap_alloc(TEMPORARY_STORAGE_SIZE);
-	assert(temporary_storage, "Failed allocating temporary storage");
-	temporary_storage_pointer = temporary_storage;
+	temporary_storage = temporary_storage_make_chunk(TEMPORARY_STORAGE_SIZE);
+	temporary_storage_chunk = temporary_storage;
+	temporary_storage_pointer = temporary_storage->start;
 
 	temp_allocator.proc = temp_allocator_proc;
 	temp_allocator.data = 0;
 	
 	temporary_storage_initted = true;
+}
+
+void temporary_storage_release() {
+	if (!temporary_storage_initted) return;
 	
-	temp_allocator.proc = temp_allocator_proc;
+	Temporary_Storage_Chunk *chunk = temporary_storage;
+	while (chunk) {
+		Temporary_Storage_Chunk *next = chunk->next;
+		os_release_memory(chunk, chunk->reserved_end-(u8*)chunk);
+		chunk = next;
+	}
+	
+	temporary_storage = 0;
+	temporary_storage_chunk = 0;
+	temporary_storage_pointer = 0;
+	temporary_storage_stats = ZERO(Temporary_Storage_Stats);
+	temporary_storage_initted = false;
 }
 
 void* talloc(u64 size) {
 	if (!temporary_storage_initted) temporary_storage_init();
 	
-	assert(size < TEMPORARY_STORAGE_SIZE, "Bruddah this is too large for temp allocator");
-	
-	void* p = temporary_storage_pointer;
+	Temporary_Storage_Chunk *chunk = temporary_storage_chunk;
 	
-	temporary_storage_pointer = (u8*)temporary_storage_pointer + size;
+	u8 *p = (u8*)(((u64)temporary_storage_pointer+TEMPORARY_STORAGE_ALIGNMENT-1) & ~(TEMPORARY_STORAGE_ALIGNMENT-1));
 	
-	if ((u8*)temporary_storage_pointer >= (u8*)temporary_storage+TEMPORARY_STORAGE_SIZE) {
-		if (!has_warned_temporary_storage_overflow) {
-			os_write_string_to_stdout(STR("WARNING: temporary storage was overflown, we wrap around at the start.\n"));
+	if (size > (u64)(chunk->reserved_end-p)) {
+		// Move on to the next chunk, or make a new one if it's missing or too small
+		Temporary_Storage_Chunk *next = chunk->next;
+		if (!next || size > (u64)(next->reserved_end-next->start)) {
+			Temporary_Storage_Chunk *new_chunk = temporary_storage_make_chunk(size);
+			new_chunk->next = next;
+			chunk->next = new_chunk;
+			next = new_chunk;
 		}
-		temporary_storage_pointer = temporary_storage;
-		return talloc(size);;
+		// The tail we leave behind in this chunk isn't used, so it doesn't count
+		next->used_before = chunk->used_before + (u64)(temporary_storage_pointer-chunk->start);
+		chunk = next;
+		temporary_storage_chunk = chunk;
+		p = chunk->start;
+	}
+	
+	u8 *end = p+size;
+	
+	if (end > chunk->committed_end) {
+		u64 commit_size = ((u64)(end-chunk->committed_end)+TEMPORARY_STORAGE_COMMIT_SIZE-1) & ~(TEMPORARY_STORAGE_COMMIT_SIZE-1);
+		commit_size = min(commit_size, (u64)(chunk->reserved_end-chunk->committed_end));
+		bool ok = os_commit_memory(chunk->committed_end, commit_size);
+		assert(ok, "Failed committing temporary storage. Out of memory?");
+		chunk->committed_end += commit_size;
+		temporary_storage_stats.committed += commit_size;
+	}
+	
+	temporary_storage_pointer = end;
+	
+	u64 used = chunk->used_before + (u64)(end-chunk->start);
+	temporary_storage_stats.used = used;
+	if (used > temporary_storage_stats.high_water_mark) {
+		temporary_storage_stats.high_water_mark = used;
 	}
 	
 	return p;
@@ -627,9 +1744,39 @@ void* talloc(u64 size) {
 void reset_temporary_storage() {
 	if (!temporary_storage_initted) temporary_storage_init();
 	
-	temporary_storage_pointer = temporary_storage;
+	temporary_storage_chunk = temporary_storage;
+	temporary_storage_pointer = temporary_storage->start;
 	
-	has_warned_temporary_storage_overflow = true;
+	Temporary_Storage_Stats *stats = &temporary_storage_stats;
+	stats->last_frame_high_water_mark = stats->high_water_mark;
+	stats->all_time_high_water_mark = max(stats->all_time_high_water_mark, stats->high_water_mark);
+	stats->high_water_mark = 0;
+	stats->used = 0;
 }
 
-#endif // NOT OOGABOOGA_LINK_EXTERNAL_INSTANCE
\ No newline at end of file
+Temp_Mark temp_mark() {
+	if (!temporary_storage_initted) temporary_storage_init();
+	
+	Temp_Mark mark;
+	mark.chunk = temporary_storage_chunk;
+	mark.pointer = temporary_storage_pointer;
+	return mark;
+}
+
+void temp_restore(Temp_Mark mark) {
+	assert(temporary_storage_initted && mark.chunk, "Invalid temp mark");
+	
+	temporary_storage_chunk = mark.chunk;
+	temporary_storage_pointer = mark.pointer;
+	temporary_storage_stats.used = mark.chunk->used_before + (u64)(mark.pointer-mark.chunk->start);
+}
+
+Temporary_Storage_Stats get_temporary_storage_stats() {
+	if (!temporary_storage_initted) temporary_storage_init();
+	
+	Temporary_Storage_Stats stats = temporary_storage_stats;
+	stats.all_time_high_water_mark = max(stats.all_time_high_water_mark, stats.high_water_mark);
+	return stats;
+}
+
+#endif // NOT OOGABOOGA_LINK_EXTERNAL_INSTANCE
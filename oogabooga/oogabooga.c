@@ -103,7 +103,7 @@
 					tm_scope_accum
 					
 		- OOGABOOGA_HEADLESS
-            Run oogabooga in headless mode, i.e. no window, no graphics, no audio.
+            Run oogabooga in headless mode, i.e. no window, no graphics, no audio device.
             Useful if you only need the oogabooga standard library for something like a game server.
             
             0: Disable
@@ -290,6 +290,7 @@ typedef u8 bool;
 
 #include "hash_table.c"
 #include "growing_array.c"
+#include "pool.c"
 
 #include "os_interface.c"
 
@@ -312,17 +313,23 @@ typedef u8 bool;
 #include "memory.c"
 #include "input.c"
 
-#ifndef OOGABOOGA_HEADLESS
+// Images and quads are just memory until they're drawn, so these are here headless too
+#include "gfx_interface.c"
+#include "quad_packing.c"
 
-    #include "gfx_interface.c"
+#ifndef OOGABOOGA_HEADLESS
 
     #include "font.c"
 
     #include "drawing.c"
-
-    #include "audio.c"
+    
+    #include "image_atlas.c"
 #endif
 
+// There's no audio device in headless mode, but the mixer is still here so it can be
+// driven with do_program_audio_sample() directly.
+#include "audio.c"
+
 #if !OOGABOOGA_LINK_EXTERNAL_INSTANCE
 
     #if TARGET_OS == WINDOWS
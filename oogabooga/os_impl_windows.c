@@ -11,6 +11,8 @@
 
 void* heap_alloc(u64);
 void heap_dealloc(void*);
+void heap_release_thread_cache();
+void temporary_storage_release();
 
 #define win32_check_hr(hr) win32_check_hr_impl(hr, __LINE__, __FILE__);
 void win32_check_hr_impl(HRESULT hr, u32 line, const char* file_name) {
@@ -259,6 +261,7 @@ void os_init(u64 program_memory_size) {
     GetSystemInfo(&si);
 	os.granularity = cast(u64)si.dwAllocationGranularity;
 	os.page_size = cast(u64)si.dwPageSize;
+	os.logical_processor_count = cast(u64)si.dwNumberOfProcessors;
 	
 	os.static_memory_start = 0;
 	os.static_memory_end = 0;
@@ -411,6 +414,21 @@ bool os_grow_program_memory(u64 new_size) {
 	return true;
 }
 
+void* os_reserve_memory(u64 size) {
+	size = (size+os.granularity-1) & ~(os.granularity-1);
+	return VirtualAlloc(0, size, MEM_RESERVE, PAGE_NOACCESS);
+}
+bool os_commit_memory(void *p, u64 size) {
+	return VirtualAlloc(p, size, MEM_COMMIT, PAGE_READWRITE) != 0;
+}
+bool os_decommit_memory(void *p, u64 size) {
+	return VirtualFree(p, size, MEM_DECOMMIT) != 0;
+}
+bool os_release_memory(void *p, u64 size) {
+	// Windows wants size 0 for MEM_RELEASE, the whole reservation is released.
+	return VirtualFree(p, 0, MEM_RELEASE) != 0;
+}
+
 
 ///
 ///
@@ -432,6 +450,8 @@ DWORD WINAPI win32_thread_invoker(LPVOID param) {
 	context = t->initial_context;
 	context.thread_id = GetCurrentThreadId();
 	t->proc(t);
+	temporary_storage_release();
+	heap_release_thread_cache();
 	return 0;
 }
 
@@ -534,6 +554,24 @@ void os_unlock_mutex(Mutex_Handle m) {
 	assert(result, "Unlock mutex 0x%x failed with error %d", m, GetLastError());
 }
 
+Semaphore_Handle os_make_semaphore(u32 initial_count) {
+	HANDLE s = CreateSemaphoreW(0, (LONG)initial_count, 0x7FFFFFFF, 0);
+	assert(s != 0, "Failed creating win32 semaphore. error %d", GetLastError());
+	return s;
+}
+void os_destroy_semaphore(Semaphore_Handle s) {
+	CloseHandle(s);
+}
+void os_semaphore_wait(Semaphore_Handle s) {
+	DWORD wait_result = WaitForSingleObject(s, INFINITE);
+	assert(wait_result == WAIT_OBJECT_0, "Waiting on semaphore 0x%x failed with error %d", s, GetLastError());
+}
+void os_semaphore_signal(Semaphore_Handle s, u32 count) {
+	if (count == 0) return;
+	BOOL result = ReleaseSemaphore(s, (LONG)count, 0);
+	assert(result, "Signaling semaphore 0x%x failed with error %d", s, GetLastError());
+}
+
 
 void os_sleep(u32 ms) {
     Sleep(ms);
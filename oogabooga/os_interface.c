@@ -2,6 +2,7 @@
 
 #ifdef _WIN32
 	typedef HANDLE Mutex_Handle;
+	typedef HANDLE Semaphore_Handle;
 	typedef HANDLE Thread_Handle;
 	typedef HMODULE Dynamic_Library_Handle;
 	typedef HWND Window_Handle;
@@ -12,6 +13,7 @@
     #define "Linux is only supported for headless builds"
     #endif
 	typedef SOMETHING Mutex_Handle;
+	typedef SOMETHING Semaphore_Handle;
 	typedef SOMETHING Thread_Handle;
 	typedef SOMETHING Dynamic_Library_Handle;
 	typedef SOMETHING Window_Handle;
@@ -19,6 +21,7 @@
 	#error "Linux is not supported yet";
 #elif defined(__APPLE__) && defined(__MACH__)
 	typedef SOMETHING Mutex_Handle;
+	typedef SOMETHING Semaphore_Handle;
 	typedef SOMETHING Thread_Handle;
 	typedef SOMETHING Dynamic_Library_Handle;
 	typedef SOMETHING Window_Handle;
@@ -40,6 +43,7 @@ typedef int   (__cdecl *Crt_Vsnprintf_Proc) (char*, size_t, const char*, va_list
 typedef struct Os_Info {
 	u64 page_size;
 	u64 granularity;
+	u64 logical_processor_count;
 	
 	Dynamic_Library_Handle crt;
 	
@@ -90,6 +94,28 @@ inline int vsnprintf(char* buffer, size_t n, const char* fmt, va_list args) {
 bool ogb_instance
 os_grow_program_memory(size_t new_size);
 
+///
+///
+// Virtual memory
+///
+
+// Reserves address space without backing it with physical memory.
+// Size is rounded up to os.granularity. Returns 0 on failure.
+ogb_instance void*
+os_reserve_memory(u64 size);
+
+// Backs reserved pages with physical memory. Committing already committed pages is fine.
+bool ogb_instance
+os_commit_memory(void *p, u64 size);
+
+// Gives the physical memory back to the OS but keeps the address space reserved.
+bool ogb_instance
+os_decommit_memory(void *p, u64 size);
+
+// Releases the whole reservation, p must be the pointer returned by os_reserve_memory.
+bool ogb_instance
+os_release_memory(void *p, u64 size);
+
 ///
 ///
 // Threading
@@ -143,6 +169,21 @@ os_lock_mutex(Mutex_Handle m);
 void ogb_instance
 os_unlock_mutex(Mutex_Handle m);
 
+///
+// Low-level counting semaphore. Waiting on it puts the thread to sleep instead of spinning.
+Semaphore_Handle ogb_instance
+os_make_semaphore(u32 initial_count);
+
+void ogb_instance
+os_destroy_semaphore(Semaphore_Handle s);
+
+// Waits until the count is above 0 and then decrements it
+void ogb_instance
+os_semaphore_wait(Semaphore_Handle s);
+
+void ogb_instance
+os_semaphore_signal(Semaphore_Handle s, u32 count);
+
 ///
 // Threading utilities
 
@@ -0,0 +1,217 @@
+
+/*
+
+    Pool of same sized items with stable pointers and O(1) acquire/release.
+
+    Pool pool;
+    pool_init(&pool, sizeof(Thing), 0, get_heap_allocator());
+
+    Pool_Handle handle;
+    Thing *thing = pool_acquire(&pool, &handle); // Zero initialized, handle is optional
+
+    // Handles can be stored and checked later, they go stale when the item is released
+    Thing *same_thing = pool_get(&pool, handle);
+    Thing *stale = pool_get(&pool, old_handle); // 0 if old_handle was released
+
+    pool_release(&pool, thing);
+    pool_release_handle(&pool, handle);
+
+    // Live items are kept in a dense array for iteration. Releasing swaps the last item
+    // into the released one's place, so go backwards if you release while iterating.
+    for (s64 i = pool_get_count(&pool)-1; i >= 0; i -= 1) {
+        Thing *thing = pool_get_nth(&pool, i);
+    }
+
+    pool_deinit(&pool);
+
+*/
+
+#define POOL_DEFAULT_ITEMS_PER_BLOCK 64
+
+typedef struct Pool_Handle {
+	u32 index;
+	u32 generation; // 0 is never a valid generation, so a zeroed handle is always invalid
+} Pool_Handle;
+
+// Sits in front of every item so we can go from a pointer to its slot in O(1)
+typedef struct Pool_Item_Header {
+	u32 index;
+	u32 generation; // Odd when alive
+	u32 live_index; // Index in live_items if alive, next free slot index+1 if not
+	u32 _pad;
+} Pool_Item_Header;
+
+typedef struct Pool {
+	u64 item_size;
+	u64 stride; // Header + item, 16 byte aligned
+	u64 items_per_block; // Power of two
+	u64 block_shift;
+
+	// Items live in blocks that never move, so pointers to them stay valid
+	u8 **blocks;
+	u64 block_count;
+	u64 block_capacity;
+
+	void **live_items;
+	u64 live_count;
+
+	u32 free_head; // Slot index+1, 0 if empty
+
+	Allocator allocator;
+} Pool;
+
+void
+pool_init(Pool *pool, u64 item_size, u64 items_per_block, Allocator allocator) {
+	assert(item_size > 0, "Pool item size must be more than 0");
+	if (items_per_block == 0) items_per_block = POOL_DEFAULT_ITEMS_PER_BLOCK;
+
+	memset(pool, 0, sizeof(Pool));
+
+	pool->item_size = item_size;
+	pool->stride = (sizeof(Pool_Item_Header)+item_size+15) & ~15ULL;
+	pool->items_per_block = get_next_power_of_two(items_per_block);
+	while ((1ULL << pool->block_shift) < pool->items_per_block) pool->block_shift += 1;
+	pool->allocator = allocator;
+}
+
+void
+pool_deinit(Pool *pool) {
+	for (u64 i = 0; i < pool->block_count; i += 1) {
+		dealloc(pool->allocator, pool->blocks[i]);
+	}
+	if (pool->blocks)     dealloc(pool->allocator, pool->blocks);
+	if (pool->live_items) dealloc(pool->allocator, pool->live_items);
+	memset(pool, 0, sizeof(Pool));
+}
+
+inline Pool_Item_Header *
+pool_get_header_at_index(Pool *pool, u32 index) {
+	u8 *block = pool->blocks[index >> pool->block_shift];
+	return (Pool_Item_Header*)(block + (index & (pool->items_per_block-1))*pool->stride);
+}
+
+inline Pool_Item_Header *
+pool_get_header(void *item) {
+	return ((Pool_Item_Header*)item)-1;
+}
+
+void
+pool_add_block(Pool *pool) {
+	if (pool->block_count == pool->block_capacity) {
+		u64 new_capacity = max(pool->block_capacity*2, 8);
+		pool->blocks = alloc_resize(pool->allocator, pool->blocks, pool->block_capacity*sizeof(u8*), new_capacity*sizeof(u8*));
+		pool->live_items = alloc_resize(pool->allocator, pool->live_items, pool->block_capacity*pool->items_per_block*sizeof(void*), new_capacity*pool->items_per_block*sizeof(void*));
+		pool->block_capacity = new_capacity;
+	}
+
+	u8 *block = alloc(pool->allocator, pool->items_per_block*pool->stride);
+	pool->blocks[pool->block_count] = block;
+
+	u64 first_index = pool->block_count*pool->items_per_block;
+	assert(first_index+pool->items_per_block <= 0xFFFFFFFFull, "Pool is full");
+	pool->block_count += 1;
+
+	// Link the new slots into the free list, in order so we fill the block front to back
+	for (s64 i = (s64)pool->items_per_block-1; i >= 0; i -= 1) {
+		Pool_Item_Header *header = (Pool_Item_Header*)(block + i*pool->stride);
+		header->index = (u32)(first_index+i);
+		header->generation = 0;
+		header->live_index = pool->free_head;
+		pool->free_head = header->index+1;
+	}
+}
+
+// Returns a zero initialized item. out_handle may be 0.
+void *
+pool_acquire(Pool *pool, Pool_Handle *out_handle) {
+	if (pool->free_head == 0) pool_add_block(pool);
+
+	Pool_Item_Header *header = pool_get_header_at_index(pool, pool->free_head-1);
+	pool->free_head = header->live_index;
+
+	header->generation += 1;
+	header->live_index = (u32)pool->live_count;
+
+	void *item = header+1;
+	memset(item, 0, pool->item_size);
+
+	pool->live_items[pool->live_count] = item;
+	pool->live_count += 1;
+
+	if (out_handle) {
+		out_handle->index = header->index;
+		out_handle->generation = header->generation;
+	}
+
+	return item;
+}
+
+void
+pool_release(Pool *pool, void *item) {
+	Pool_Item_Header *header = pool_get_header(item);
+	assert(header->generation & 1, "Released a pool item which is not alive");
+	assert(header->live_index < pool->live_count && pool->live_items[header->live_index] == item, "Pool item does not belong to this pool");
+
+	// Swap the last live item into our place
+	void *last = pool->live_items[pool->live_count-1];
+	pool->live_items[header->live_index] = last;
+	pool_get_header(last)->live_index = header->live_index;
+	pool->live_count -= 1;
+
+	header->generation += 1;
+	header->live_index = pool->free_head;
+	pool->free_head = header->index+1;
+}
+
+// Returns 0 if the handle is stale
+void *
+pool_get(Pool *pool, Pool_Handle handle) {
+	if (handle.generation == 0) return 0;
+	if ((u64)handle.index >= pool->block_count*pool->items_per_block) return 0;
+
+	Pool_Item_Header *header = pool_get_header_at_index(pool, handle.index);
+	if (header->generation != handle.generation) return 0;
+
+	return header+1;
+}
+
+bool
+pool_handle_is_valid(Pool *pool, Pool_Handle handle) {
+	return pool_get(pool, handle) != 0;
+}
+
+Pool_Handle
+pool_get_handle(Pool *pool, void *item) {
+	(void)pool;
+	Pool_Item_Header *header = pool_get_header(item);
+	Pool_Handle handle;
+	handle.index = header->index;
+	handle.generation = header->generation;
+	return handle;
+}
+
+bool
+pool_release_handle(Pool *pool, Pool_Handle handle) {
+	void *item = pool_get(pool, handle);
+	if (!item) return false;
+	pool_release(pool, item);
+	return true;
+}
+
+u64
+pool_get_count(Pool *pool) {
+	return pool->live_count;
+}
+
+void *
+pool_get_nth(Pool *pool, u64 n) {
+	assert(n < pool->live_count, "Pool index out of range");
+	return pool->live_items[n];
+}
+
+void
+pool_clear(Pool *pool) {
+	while (pool->live_count > 0) {
+		pool_release(pool, pool->live_items[pool->live_count-1]);
+	}
+}
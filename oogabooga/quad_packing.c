@@ -0,0 +1,400 @@
+
+///
+///
+// Quads
+///
+// What the draw procedures build, and how the renderer turns them into GPU instances.
+// None of this touches the gfx api, so it's compiled with OOGABOOGA_HEADLESS too and can
+// be tested & benchmarked without a window.
+//
+
+// We use radix sort so the exact bit count is of importance
+#define MAX_Z_BITS 21
+#define MAX_Z ((1 << MAX_Z_BITS)/2)
+
+// Kept small since every quad is written, sorted and copied each frame. Scissors and
+// userdata are rare, so they live in side tables of the draw frame and quads just index them.
+typedef struct Draw_Quad {
+	// BEWARE !! These are in ndc
+	Vector2 bottom_left, top_left, top_right, bottom_right;
+	// x1, y1, x2, y2
+	Vector4 uv;
+	Gfx_Image *image;
+	u32 color; // RGBA8, red in the lowest byte. Make it with quad_pack_color
+	s32 z;
+	u16 image_min_filter : 4; // Gfx_Filter_Mode
+	u16 image_mag_filter : 4; // Gfx_Filter_Mode
+	u16 type : 8;
+	u16 scissor_index;  // 1 + index in scissor_buffer, 0 if no scissor
+	u32 userdata_index; // 1 + index in userdata_buffer, 0 if all zero. Write it with draw_quad_userdata
+} Draw_Quad;
+
+typedef struct Draw_Quad_Userdata {
+	Vector4 data[VERTEX_2D_USER_DATA_COUNT];
+} Draw_Quad_Userdata;
+
+// Colors are clamped to 0-1 and rounded to 8 bits per channel
+inline u32 quad_pack_color(Vector4 color) {
+	u32 r = (u32)(clamp(color.r, 0.0f, 1.0f)*255.0f + 0.5f);
+	u32 g = (u32)(clamp(color.g, 0.0f, 1.0f)*255.0f + 0.5f);
+	u32 b = (u32)(clamp(color.b, 0.0f, 1.0f)*255.0f + 0.5f);
+	u32 a = (u32)(clamp(color.a, 0.0f, 1.0f)*255.0f + 0.5f);
+	return r | (g << 8) | (b << 16) | (a << 24);
+}
+inline Vector4 quad_unpack_color(u32 color) {
+	return v4(
+		(float32)((color >>  0) & 0xFF) / 255.0f,
+		(float32)((color >>  8) & 0xFF) / 255.0f,
+		(float32)((color >> 16) & 0xFF) / 255.0f,
+		(float32)((color >> 24) & 0xFF) / 255.0f
+	);
+}
+
+///
+///
+// Texture slots
+///
+// The 2D batch shader samples from MAX_BOUND_TEXTURES textures per draw call. The renderer
+// gives every distinct texture in a batch a slot and flushes the batch when it runs out.
+// Handles are looked up in a small open addressing table which is cleared in O(1) by
+// bumping a generation, so finding a slot is O(1) no matter how many are taken.
+//
+
+// #Volatile with the texture array in the 2D batch shader
+#define MAX_BOUND_TEXTURES 32
+#define TEXTURE_SLOT_TABLE_BITS 7 // Room for 4x MAX_BOUND_TEXTURES so probes stay short
+#define TEXTURE_SLOT_TABLE_SIZE (1 << TEXTURE_SLOT_TABLE_BITS)
+
+typedef struct Texture_Slots {
+	Gfx_Handle textures[MAX_BOUND_TEXTURES]; // Indexed by slot
+	u64 count;
+	
+	Gfx_Handle table_handles[TEXTURE_SLOT_TABLE_SIZE];
+	s8 table_slots[TEXTURE_SLOT_TABLE_SIZE];
+	u32 table_generations[TEXTURE_SLOT_TABLE_SIZE]; // Entries from an older generation are empty
+	u32 generation;
+} Texture_Slots;
+
+void texture_slots_reset(Texture_Slots *slots) {
+	slots->count = 0;
+	slots->generation += 1;
+	if (slots->generation == 0) {
+		// Wrapped, so old entries could look current
+		memset(slots->table_generations, 0, sizeof(slots->table_generations));
+		slots->generation = 1;
+	}
+}
+
+// Returns the slot of the texture, giving it the next free one if it doesn't have one yet.
+// Returns -1 if all slots are taken, then the batch needs to be flushed and the slots reset.
+s8 texture_slots_get(Texture_Slots *slots, Gfx_Handle texture) {
+	if (slots->generation == 0) texture_slots_reset(slots);
+	
+	u64 i = ((u64)texture * 0x9E3779B97F4A7C15ull) >> (64-TEXTURE_SLOT_TABLE_BITS);
+	while (true) {
+		if (slots->table_generations[i] != slots->generation) {
+			if (slots->count >= MAX_BOUND_TEXTURES) return -1;
+			
+			s8 slot = (s8)slots->count;
+			slots->count += 1;
+			slots->textures[slot] = texture;
+			
+			slots->table_handles[i] = texture;
+			slots->table_slots[i] = slot;
+			slots->table_generations[i] = slots->generation;
+			return slot;
+		}
+		if (slots->table_handles[i] == texture) return slots->table_slots[i];
+		
+		// The table is never more than a quarter full so this always finds an empty entry
+		i = (i+1) & (TEXTURE_SLOT_TABLE_SIZE-1);
+	}
+}
+
+// Quads that are drawn with one draw call, and the textures bound for it
+typedef struct Quad_Segment {
+	u64 first_quad;
+	u64 quad_count;
+	Gfx_Handle textures[MAX_BOUND_TEXTURES]; // By texture index of the quads in the segment
+	u64 texture_count;
+} Quad_Segment;
+
+void quad_segments_add(Quad_Segment **segments, u64 first_quad, u64 end_quad, Texture_Slots *slots) {
+	Quad_Segment *segment = growing_array_add_empty((void**)segments);
+	memset(segment, 0, sizeof(Quad_Segment));
+	segment->first_quad = first_quad;
+	segment->quad_count = end_quad-first_quad;
+	segment->texture_count = slots->count;
+	memcpy(segment->textures, slots->textures, slots->count*sizeof(Gfx_Handle));
+}
+
+// Gives every quad its texture slot in texture_indices, and starts a new segment wherever the
+// slots run out. Which slot a quad gets depends on all quads before it, so this has to be done
+// in order. It's kept to just that so packing the quads can be split up after.
+// segments is a growing array and is cleared first.
+void split_quads_into_segments(const Draw_Quad *quads, u64 count, s8 *texture_indices, Quad_Segment **segments) {
+	if (!*segments) growing_array_init((void**)segments, sizeof(Quad_Segment), get_heap_allocator());
+	growing_array_clear((void**)segments);
+	
+	Texture_Slots slots = ZERO(Texture_Slots);
+	texture_slots_reset(&slots);
+	Gfx_Handle last_texture = 0;
+	s8 last_texture_index = 0;
+	u64 segment_start = 0;
+	
+	for (u64 i = 0; i < count; i++) {
+		const Draw_Quad *q = &quads[i];
+		
+		assert(q->z <= MAX_Z, "Z is too high. Z is %d, Max is %d.", q->z, MAX_Z);
+		assert(q->z >= (-MAX_Z+1), "Z is too low. Z is %d, Min is %d.", q->z, -MAX_Z+1);
+		
+		s8 texture_index = -1;
+		if (q->image) {
+			Gfx_Handle texture = q->image->gfx_handle;
+			if (texture == last_texture) {
+				texture_index = last_texture_index;
+			} else {
+				texture_index = texture_slots_get(&slots, texture);
+				if (texture_index == -1) {
+					quad_segments_add(segments, segment_start, i, &slots);
+					segment_start = i;
+					texture_slots_reset(&slots);
+					texture_index = texture_slots_get(&slots, texture);
+				}
+				last_texture = texture;
+				last_texture_index = texture_index;
+			}
+		}
+		texture_indices[i] = texture_index;
+	}
+	
+	if (count > segment_start) quad_segments_add(segments, segment_start, count, &slots);
+}
+
+///
+///
+// Quad instance packing
+///
+// Every quad is uploaded as one compact instance and the vertex shader expands it into
+// 6 vertices (two triangles). This is the hot loop of the renderer so it's kept independent
+// of the gfx api and has a SIMD path.
+// The renderer resolves which texture slot each quad uses and passes them in texture_indices.
+// scissors & userdata are the side tables the quads index, normally scissor_buffer and userdata_buffer.
+//
+
+// #Volatile with the input layout & the 2D batch shader in the renderer
+typedef struct alignat(16) Quad_Instance {
+	
+	Vector2 corners[4]; // bottom_left, top_left, top_right, bottom_right in ndc
+	Vector4 uv;         // x1, y1, x2, y2
+	
+	Vector4 userdata[VERTEX_2D_USER_DATA_COUNT];
+	
+	u32 color; // RGBA8, red in the lowest byte
+	s8 texture_index;
+	u8 type;
+	u8 sampler;
+	u8 has_scissor;
+	s16 scissor[4]; // x1, y1, x2, y2 in window pixels with y down, rounded to whole pixels
+	
+} Quad_Instance;
+
+// [min_filter][mag_filter], #Volatile with the samplers bound by the renderer
+const u8 quad_sampler_table[2][2] = {
+	{ 0, 3 }, // min nearest: mag nearest, mag linear
+	{ 2, 1 }, // min linear:  mag nearest, mag linear
+};
+
+// Text quads are snapped to the pixel grid so glyphs stay crisp
+inline void quad_snap_corners_to_pixels(const Draw_Quad *q, float32 corners[8], float32 ndc_pixel_width, float32 ndc_pixel_height) {
+	corners[0] = round(q->bottom_left.x  / ndc_pixel_width)  * ndc_pixel_width;
+	corners[1] = round(q->bottom_left.y  / ndc_pixel_height) * ndc_pixel_height;
+	corners[2] = round(q->top_left.x     / ndc_pixel_width)  * ndc_pixel_width;
+	corners[3] = round(q->top_left.y     / ndc_pixel_height) * ndc_pixel_height;
+	corners[4] = round(q->top_right.x    / ndc_pixel_width)  * ndc_pixel_width;
+	corners[5] = round(q->top_right.y    / ndc_pixel_height) * ndc_pixel_height;
+	corners[6] = round(q->bottom_right.x / ndc_pixel_width)  * ndc_pixel_width;
+	corners[7] = round(q->bottom_right.y / ndc_pixel_height) * ndc_pixel_height;
+}
+
+inline s16 quad_pack_scissor_coordinate(float32 x) {
+	return (s16)clamp(floor(x + 0.5f), -32768.0f, 32767.0f);
+}
+
+// The plain field by field version. Used when SIMD is disabled and as a reference to test against.
+void pack_quads_to_instances_scalar(const Draw_Quad *quads, const Vector4 *scissors, const Draw_Quad_Userdata *userdata, const s8 *texture_indices, u64 count, Quad_Instance *out, float32 ndc_pixel_width, float32 ndc_pixel_height, float32 window_pixel_height) {
+	for (u64 i = 0; i < count; i++) {
+		const Draw_Quad *q = &quads[i];
+		Quad_Instance *instance = &out[i];
+		
+		if (q->type == QUAD_TYPE_TEXT) {
+			quad_snap_corners_to_pixels(q, (float32*)instance->corners, ndc_pixel_width, ndc_pixel_height);
+		} else {
+			memcpy(instance->corners, &q->bottom_left, sizeof(instance->corners));
+		}
+		
+		instance->uv = q->uv;
+		if (q->userdata_index) {
+			memcpy(instance->userdata, userdata[q->userdata_index-1].data, sizeof(instance->userdata));
+		} else {
+			memset(instance->userdata, 0, sizeof(instance->userdata));
+		}
+		
+		instance->color = q->color;
+		instance->texture_index = texture_indices[i];
+		instance->type = (u8)q->type;
+		instance->sampler = quad_sampler_table[q->image_min_filter][q->image_mag_filter];
+		instance->has_scissor = q->scissor_index != 0;
+		
+		// Scissors come in with y up, the rasterizer wants y down
+		Vector4 scissor = q->scissor_index ? scissors[q->scissor_index-1] : v4(0, 0, 0, 0);
+		instance->scissor[0] = quad_pack_scissor_coordinate(scissor.x1);
+		instance->scissor[1] = quad_pack_scissor_coordinate(window_pixel_height - scissor.y2);
+		instance->scissor[2] = quad_pack_scissor_coordinate(scissor.x2);
+		instance->scissor[3] = quad_pack_scissor_coordinate(window_pixel_height - scissor.y1);
+	}
+}
+
+#if ENABLE_SIMD && SIMD_ENABLE_SSE2
+
+// The instance buffer is written once and not read back by us, so we use non temporal
+// stores which skip reading the destination into cache first.
+void pack_quads_to_instances_simd(const Draw_Quad *quads, const Vector4 *scissors, const Draw_Quad_Userdata *userdata, const s8 *texture_indices, u64 count, Quad_Instance *out, float32 ndc_pixel_width, float32 ndc_pixel_height, float32 window_pixel_height) {
+	assert((u64)out % 16 == 0, "Instance output must be 16 byte aligned");
+	
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 half = _mm_set1_ps(0.5f);
+	const __m128 scissor_sign = _mm_setr_ps(1, -1, 1, -1);
+	const __m128 scissor_offset = _mm_setr_ps(0, window_pixel_height, 0, window_pixel_height);
+	
+	for (u64 i = 0; i < count; i++) {
+		const Draw_Quad *q = &quads[i];
+		Quad_Instance *instance = &out[i];
+		
+		// bottom_left, top_left | top_right, bottom_right
+		__m128 corners01, corners23;
+		if (q->type == QUAD_TYPE_TEXT) {
+			float32 corners[8];
+			quad_snap_corners_to_pixels(q, corners, ndc_pixel_width, ndc_pixel_height);
+			corners01 = _mm_loadu_ps(corners);
+			corners23 = _mm_loadu_ps(corners+4);
+		} else {
+			corners01 = _mm_loadu_ps(&q->bottom_left.x);
+			corners23 = _mm_loadu_ps(&q->top_right.x);
+		}
+		
+		_mm_stream_ps(&instance->corners[0].x, corners01);
+		_mm_stream_ps(&instance->corners[2].x, corners23);
+		_mm_stream_ps(instance->uv.data, _mm_loadu_ps(q->uv.data));
+		if (q->userdata_index) {
+			const Vector4 *quad_userdata = userdata[q->userdata_index-1].data;
+			for (u64 j = 0; j < VERTEX_2D_USER_DATA_COUNT; j++) {
+				_mm_stream_ps(instance->userdata[j].data, _mm_loadu_ps(quad_userdata[j].data));
+			}
+		} else {
+			for (u64 j = 0; j < VERTEX_2D_USER_DATA_COUNT; j++) {
+				_mm_stream_ps(instance->userdata[j].data, zero);
+			}
+		}
+		
+		__m128i color_i = _mm_cvtsi32_si128((s32)q->color);
+		
+		u8 sampler = quad_sampler_table[q->image_min_filter][q->image_mag_filter];
+		__m128i flags = _mm_cvtsi32_si128((s32)((u32)(u8)texture_indices[i]
+		                                      | ((u32)q->type << 8)
+		                                      | ((u32)sampler << 16)
+		                                      | ((u32)(q->scissor_index != 0) << 24)));
+		
+		// (x1, y1, x2, y2) -> (x1, h-y2, x2, h-y1), then floor(x+0.5) like quad_pack_scissor_coordinate.
+		// There's no floor in SSE2 so we truncate and step down where that rounded up.
+		__m128 scissor = q->scissor_index ? _mm_loadu_ps(scissors[q->scissor_index-1].data) : zero;
+		scissor = _mm_shuffle_ps(scissor, scissor, _MM_SHUFFLE(1, 2, 3, 0));
+		scissor = _mm_add_ps(_mm_add_ps(_mm_mul_ps(scissor, scissor_sign), scissor_offset), half);
+		__m128i scissor_i = _mm_cvttps_epi32(scissor);
+		scissor_i = _mm_add_epi32(scissor_i, _mm_castps_si128(_mm_cmpgt_ps(_mm_cvtepi32_ps(scissor_i), scissor)));
+		scissor_i = _mm_packs_epi32(scissor_i, scissor_i);
+		
+		// color, flags, scissor
+		__m128i tail = _mm_unpacklo_epi64(_mm_unpacklo_epi32(color_i, flags), scissor_i);
+		_mm_stream_si128((__m128i*)&instance->color, tail);
+	}
+	
+	// Make the non temporal stores visible before anyone reads the instances
+	_mm_sfence();
+}
+
+#endif // ENABLE_SIMD && SIMD_ENABLE_SSE2
+
+// Writes count instances to out, which must be 16 byte aligned.
+// ndc_pixel_width/height is the size of a pixel in ndc (2/window.width), which text quads are snapped to.
+// Scissors are flipped from y up to y down with window_pixel_height.
+void pack_quads_to_instances(const Draw_Quad *quads, const Vector4 *scissors, const Draw_Quad_Userdata *userdata, const s8 *texture_indices, u64 count, Quad_Instance *out, float32 ndc_pixel_width, float32 ndc_pixel_height, float32 window_pixel_height) {
+#if ENABLE_SIMD && SIMD_ENABLE_SSE2
+	pack_quads_to_instances_simd(quads, scissors, userdata, texture_indices, count, out, ndc_pixel_width, ndc_pixel_height, window_pixel_height);
+#else
+	pack_quads_to_instances_scalar(quads, scissors, userdata, texture_indices, count, out, ndc_pixel_width, ndc_pixel_height, window_pixel_height);
+#endif
+}
+
+// Quads don't depend on each other once their texture slots are known, so big frames are
+// packed in chunks on a worker pool, each into its own part of out.
+// Neither of these are tuned on a multi core machine yet. examples/parallel_packing_benchmark.c
+// sweeps both, so measure there before changing them.
+#ifndef QUAD_PACK_JOB_SIZE
+	#define QUAD_PACK_JOB_SIZE 8192
+#endif
+// Fewer quads than this are packed on the calling thread, waking workers costs more
+#ifndef QUAD_PACK_MIN_PARALLEL_COUNT
+	#define QUAD_PACK_MIN_PARALLEL_COUNT 32768
+#endif
+
+typedef struct Quad_Pack_Jobs {
+	const Draw_Quad *quads;
+	const Vector4 *scissors;
+	const Draw_Quad_Userdata *userdata;
+	const s8 *texture_indices;
+	u64 count;
+	Quad_Instance *out;
+	float32 ndc_pixel_width;
+	float32 ndc_pixel_height;
+	float32 window_pixel_height;
+	u64 job_size;
+} Quad_Pack_Jobs;
+
+void quad_pack_job(void *data, u64 job_index) {
+	Quad_Pack_Jobs *jobs = (Quad_Pack_Jobs*)data;
+	u64 first = job_index*jobs->job_size;
+	u64 count = min(jobs->count-first, jobs->job_size);
+	pack_quads_to_instances(jobs->quads+first, jobs->scissors, jobs->userdata, jobs->texture_indices+first, count, jobs->out+first, jobs->ndc_pixel_width, jobs->ndc_pixel_height, jobs->window_pixel_height);
+}
+
+// Packs job_size quads per job on pool no matter how few there are. This is what
+// pack_quads_to_instances_parallel does for big frames, the benchmark calls it directly to
+// try other job sizes.
+void pack_quads_to_instances_in_jobs(Worker_Pool *pool, const Draw_Quad *quads, const Vector4 *scissors, const Draw_Quad_Userdata *userdata, const s8 *texture_indices, u64 count, Quad_Instance *out, float32 ndc_pixel_width, float32 ndc_pixel_height, float32 window_pixel_height, u64 job_size) {
+	assert(job_size > 0, "Quad pack job size must be more than 0");
+	
+	Quad_Pack_Jobs jobs;
+	jobs.quads = quads;
+	jobs.scissors = scissors;
+	jobs.userdata = userdata;
+	jobs.texture_indices = texture_indices;
+	jobs.count = count;
+	jobs.out = out;
+	jobs.ndc_pixel_width = ndc_pixel_width;
+	jobs.ndc_pixel_height = ndc_pixel_height;
+	jobs.window_pixel_height = window_pixel_height;
+	jobs.job_size = job_size;
+	
+	worker_pool_run(pool, quad_pack_job, &jobs, (count+job_size-1)/job_size);
+}
+
+// Same as pack_quads_to_instances, split over pool when there are enough quads. pool may be 0.
+void pack_quads_to_instances_parallel(Worker_Pool *pool, const Draw_Quad *quads, const Vector4 *scissors, const Draw_Quad_Userdata *userdata, const s8 *texture_indices, u64 count, Quad_Instance *out, float32 ndc_pixel_width, float32 ndc_pixel_height, float32 window_pixel_height) {
+	if (!pool || pool->thread_count == 0 || count < QUAD_PACK_MIN_PARALLEL_COUNT) {
+		pack_quads_to_instances(quads, scissors, userdata, texture_indices, count, out, ndc_pixel_width, ndc_pixel_height, window_pixel_height);
+		return;
+	}
+	
+	pack_quads_to_instances_in_jobs(pool, quads, scissors, userdata, texture_indices, count, out, ndc_pixel_width, ndc_pixel_height, window_pixel_height, QUAD_PACK_JOB_SIZE);
+}
@@ -48,4 +48,24 @@ Vector2 range2f_size(Range2f range) {
 
 bool range2f_contains(Range2f range, Vector2 v) {
   return v.x >= range.min.x && v.x <= range.max.x && v.y >= range.min.y && v.y <= range.max.y;
+}
+
+// Touching counts as overlapping
+bool range2f_overlaps(Range2f a, Range2f b) {
+  return a.min.x <= b.max.x && a.max.x >= b.min.x && a.min.y <= b.max.y && a.max.y >= b.min.y;
+}
+
+// Writes the indices of the ranges that overlap range to out_indices and returns how many there were.
+// This is only compares, so it's cheap enough to run over everything in a world to throw away what's
+// off screen before building any quads or transforms for it. out_indices needs room for count indices.
+u64 range2f_cull_ranges(Range2f range, const Range2f *ranges, u32 *out_indices, u64 count) {
+  u64 visible_count = 0;
+  for (u64 i = 0; i < count; i++) {
+    const Range2f *r = &ranges[i];
+    // & instead of && and always writing the index, so there are no branches to mispredict
+    bool visible = (r->min.x <= range.max.x) & (r->max.x >= range.min.x) & (r->min.y <= range.max.y) & (r->max.y >= range.min.y);
+    out_indices[visible_count] = (u32)i;
+    visible_count += visible;
+  }
+  return visible_count;
 }
\ No newline at end of file
@@ -197,6 +197,335 @@ void test_allocator(bool do_log_heap) {
     if (do_log_heap) log_heap();
 }
 
+// Randomized alloc/free workload, mostly small allocations like a game would do.
+// Runs it on the size class heap and on the free list alone, examples/heap_benchmark.c
+// times the same workload with more ops.
+typedef void*(*Test_Alloc_Proc)(u64);
+typedef void (*Test_Dealloc_Proc)(void*);
+u64 test_heap_random_size() {
+	u64 r = get_random_int_in_range(0, 99);
+	if (r < 70) return get_random_int_in_range(1, 128);
+	if (r < 95) return get_random_int_in_range(129, 4096);
+	return get_random_int_in_range(4097, KB(32));
+}
+typedef struct Test_Heap_Workload_Result {
+	u64 live_bytes;
+	u64 peak_live_bytes;
+	Heap_Stats stats; // Before the live allocations are freed
+} Test_Heap_Workload_Result;
+Test_Heap_Workload_Result test_heap_workload(Test_Alloc_Proc alloc_proc, Test_Dealloc_Proc dealloc_proc, u64 op_count) {
+	
+	const u64 slot_count = 8192;
+	
+	void **slots = alloc(get_heap_allocator(), slot_count*sizeof(void*));
+	u64 *sizes = alloc(get_heap_allocator(), slot_count*sizeof(u64));
+	memset(slots, 0, slot_count*sizeof(void*));
+	
+	u64 prev_seed = seed_for_random;
+	seed_for_random = 1337;
+	Test_Heap_Workload_Result result = ZERO(Test_Heap_Workload_Result);
+	
+	for (u64 i = 0; i < op_count; i += 1) {
+		u64 slot = get_random_int_in_range(0, slot_count-1);
+		if (slots[slot]) {
+			assert(*(u8*)slots[slot] == (u8)slot, "Memory corrupted in heap workload");
+			dealloc_proc(slots[slot]);
+			result.live_bytes -= sizes[slot];
+			slots[slot] = 0;
+		} else {
+			sizes[slot] = test_heap_random_size();
+			slots[slot] = alloc_proc(sizes[slot]);
+			assert(((u64)slots[slot] % 16) == 0, "Heap allocation is not 16 byte aligned");
+			*(u8*)slots[slot] = (u8)slot;
+			result.live_bytes += sizes[slot];
+			result.peak_live_bytes = max(result.peak_live_bytes, result.live_bytes);
+		}
+	}
+	
+	result.stats = heap_get_stats();
+	
+	for (u64 i = 0; i < slot_count; i += 1) {
+		if (slots[i]) dealloc_proc(slots[i]);
+	}
+	dealloc(get_heap_allocator(), slots);
+	dealloc(get_heap_allocator(), sizes);
+	seed_for_random = prev_seed;
+	
+	return result;
+}
+void test_heap_workloads() {
+	test_heap_workload(heap_block_alloc, heap_block_dealloc, 20000);
+	test_heap_workload(heap_alloc, heap_dealloc, 20000);
+}
+
+// Refuses to reallocate, so alloc_resize does alloc + copy + dealloc every time
+void *test_copying_heap_allocator_proc(u64 size, void *p, Allocator_Message message, void *data) {
+	if (message == ALLOCATOR_REALLOCATE) return 0;
+	return heap_allocator_proc(size, p, message, data);
+}
+
+// Grows array_count growing arrays one item at a time and counts what had to be copied
+// when an array moved. examples/heap_benchmark.c times it.
+typedef struct Test_Realloc_Workload_Result {
+	u64 move_count;
+	u64 moved_bytes;
+} Test_Realloc_Workload_Result;
+Test_Realloc_Workload_Result test_heap_realloc_workload(Allocator allocator, u64 array_count, u64 item_count) {
+	u64 **arrays = alloc(get_heap_allocator(), array_count*sizeof(u64*));
+	for (u64 i = 0; i < array_count; i += 1) {
+		growing_array_init((void**)&arrays[i], sizeof(u64), allocator);
+	}
+	
+	Test_Realloc_Workload_Result result = ZERO(Test_Realloc_Workload_Result);
+	
+	// Interleaved so the arrays get in each others way like they would in practice
+	for (u64 n = 0; n < item_count; n += 1) {
+		for (u64 i = 0; i < array_count; i += 1) {
+			u64 *before = arrays[i];
+			u64 capacity_bytes = growing_array_get_allocated_count(arrays[i])*sizeof(u64)+sizeof(Growing_Array_Header);
+			growing_array_add((void**)&arrays[i], &n);
+			if (arrays[i] != before) {
+				result.moved_bytes += capacity_bytes;
+				result.move_count += 1;
+			}
+		}
+	}
+	
+	for (u64 i = 0; i < array_count; i += 1) {
+		for (u64 n = 0; n < item_count; n += 1) {
+			assert(arrays[i][n] == n, "Growing array corrupted after reallocation");
+		}
+		growing_array_deinit((void**)&arrays[i]);
+	}
+	dealloc(get_heap_allocator(), arrays);
+	
+	return result;
+}
+
+void test_heap_realloc() {
+	Allocator heap = get_heap_allocator();
+	
+	// Contents survive growing and shrinking through the size classes and the free list
+	u8 *p = alloc(heap, 100);
+	for (u64 i = 0; i < 100; i += 1) p[i] = (u8)i;
+	p = alloc_resize(heap, p, 100, KB(100));
+	for (u64 i = 0; i < 100; i += 1) assert(p[i] == (u8)i, "alloc_resize lost data when growing");
+#if DO_ZERO_INITIALIZATION
+	for (u64 i = 100; i < KB(100); i += 1) assert(p[i] == 0, "alloc_resize did not zero the grown part");
+#endif
+	p = alloc_resize(heap, p, KB(100), 50);
+	for (u64 i = 0; i < 50; i += 1) assert(p[i] == (u8)i, "alloc_resize lost data when shrinking");
+	dealloc(heap, p);
+	
+	// Shrinking a large allocation is done in place and the tail can be grown back into
+	void *large = alloc(heap, KB(256));
+	void *shrunk = heap_realloc(large, KB(64));
+	assert(shrunk == large, "Shrinking a large allocation should not move it");
+	assert(heap_get_allocation_size(shrunk) < KB(65), "Shrinking a large allocation did not give back the tail");
+	void *grown = heap_realloc(shrunk, KB(200));
+	assert(grown == large, "Growing into the adjacent free node should not move the allocation");
+	assert(heap_get_allocation_size(grown) >= KB(200), "Grown allocation is too small");
+	dealloc(heap, grown);
+	
+	// Small allocations stay put if they still fit the size class
+	void *small = alloc(heap, 100);
+	assert(heap_realloc(small, 110) == small, "Reallocating within the same size class should not move");
+	dealloc(heap, small);
+	
+	Allocator copying_heap = heap;
+	copying_heap.proc = test_copying_heap_allocator_proc;
+	
+	// A lone array can mostly grow into the free space after it
+	Test_Realloc_Workload_Result copying  = test_heap_realloc_workload(copying_heap, 1, 100000);
+	Test_Realloc_Workload_Result resizing = test_heap_realloc_workload(heap,         1, 100000);
+	assert(resizing.moved_bytes < copying.moved_bytes, "Resizing in place should copy less than %llu bytes, copied %llu", copying.moved_bytes, resizing.moved_bytes);
+	
+	test_heap_realloc_workload(copying_heap, 8, 10000);
+	test_heap_realloc_workload(heap,         8, 10000);
+}
+
+void test_large_allocations() {
+	Allocator heap = get_heap_allocator();
+	
+	Heap_Stats before = heap_get_stats();
+	
+	u8 *p = alloc(heap, MB(3));
+	assert(!is_pointer_in_program_memory(p), "Large allocations should not come from the heap blocks");
+	assert(heap_get_allocation_size(p) >= MB(3), "Large allocation is too small");
+	for (u64 i = 0; i < MB(3); i += KB(4)) p[i] = (u8)(i/KB(4));
+	
+	Heap_Stats during = heap_get_stats();
+	assert(during.large_allocation_count == before.large_allocation_count+1, "Large allocation is not tracked");
+	assert(during.large_committed_bytes >= before.large_committed_bytes+MB(3), "Large allocation is not tracked");
+	
+	// We reserve extra address space so this grows without moving
+	u8 *grown = heap_realloc(p, MB(5));
+	assert(grown == p, "Growing a large allocation within its reservation should not move it");
+	for (u64 i = 0; i < MB(3); i += KB(4)) assert(grown[i] == (u8)(i/KB(4)), "Large allocation lost data when growing");
+	grown[MB(5)-1] = 1;
+	
+	u8 *shrunk = heap_realloc(grown, MB(2));
+	assert(shrunk == p, "Shrinking a large allocation should not move it");
+	assert(heap_get_allocation_size(shrunk) < MB(3), "Shrinking a large allocation did not decommit the tail");
+	
+	dealloc(heap, shrunk);
+	
+	// Used to assert past 500mb
+	u8 *huge = alloc_uninitialized(heap, MB(600));
+	huge[0] = 1;
+	huge[MB(600)-1] = 2;
+	dealloc(heap, huge);
+	
+	// Many at once to grow the side table
+	void *many[2000];
+	for (u64 i = 0; i < 2000; i += 1) many[i] = alloc_uninitialized(heap, LARGE_ALLOCATION_THRESHOLD);
+	for (u64 i = 0; i < 2000; i += 2) dealloc(heap, many[i]);
+	for (u64 i = 1; i < 2000; i += 2) assert(heap_get_allocation_size(many[i]) >= LARGE_ALLOCATION_THRESHOLD, "Large allocation table lost an entry");
+	for (u64 i = 1; i < 2000; i += 2) dealloc(heap, many[i]);
+	
+	Heap_Stats after = heap_get_stats();
+	assert(after.large_allocation_count == before.large_allocation_count, "Large allocations were not all freed");
+	assert(after.large_committed_bytes == before.large_committed_bytes, "Large allocation memory was not given back");
+}
+
+void test_temporary_storage() {
+	reset_temporary_storage();
+	
+	Temporary_Storage_Stats stats = get_temporary_storage_stats();
+	assert(stats.used == 0, "Temporary storage should be empty after reset");
+	
+	u8 *first = talloc(100);
+	assert(((u64)first % 16) == 0, "Temporary allocations should be 16 byte aligned");
+	first[0] = 69;
+	
+	// Used to wrap around past TEMPORARY_STORAGE_SIZE and hand out memory we were still using
+	const u64 block_size = KB(256);
+	const u64 block_count = (TEMPORARY_STORAGE_SIZE/block_size)*3;
+	u8 *blocks[(TEMPORARY_STORAGE_SIZE/KB(256))*3];
+	for (u64 i = 0; i < block_count; i += 1) {
+		blocks[i] = talloc(block_size);
+		memset(blocks[i], (int)(i+1), block_size);
+	}
+	assert(first[0] == 69, "Temporary storage wrapped around");
+	for (u64 i = 0; i < block_count; i += 1) {
+		assert(blocks[i][0] == (u8)(i+1) && blocks[i][block_size-1] == (u8)(i+1), "Temporary storage corruption");
+	}
+	
+	// Larger than a whole chunk
+	u8 *huge = talloc(TEMPORARY_STORAGE_CHUNK_RESERVE_SIZE+MB(1));
+	huge[0] = 1;
+	huge[TEMPORARY_STORAGE_CHUNK_RESERVE_SIZE+MB(1)-1] = 2;
+	
+	// Only what we allocated counts, not the rest of the chunk we spilled out of
+	u64 expected_used = ((100+15) & ~15ULL) + block_size*block_count + TEMPORARY_STORAGE_CHUNK_RESERVE_SIZE+MB(1);
+	stats = get_temporary_storage_stats();
+	assert(stats.used == expected_used, "Temporary storage used %llu bytes, expected %llu", stats.used, expected_used);
+	assert(stats.high_water_mark == expected_used, "Temporary storage high water mark is %llu, expected %llu", stats.high_water_mark, expected_used);
+	assert(stats.chunk_count >= 2, "Temporary storage did not grow");
+	u64 frame_peak = stats.high_water_mark;
+	
+	// Marks
+	Temp_Mark mark = temp_mark();
+	u8 *a = talloc(64);
+	talloc(MB(1));
+	temp_restore(mark);
+	u8 *b = talloc(64);
+	assert(a == b, "temp_restore did not release the memory allocated after the mark");
+	
+	u64 used_before_scope = get_temporary_storage_stats().used;
+	u8 *in_scope = 0;
+	temp_scope() {
+		in_scope = talloc(KB(4));
+		string s = tprint("%i", 1337);
+		assert(strings_match(s, STR("1337")), "tprint in temp_scope failed");
+	}
+	assert(get_temporary_storage_stats().used == used_before_scope, "temp_scope did not restore");
+	assert(talloc(KB(4)) == in_scope, "temp_scope did not restore");
+	
+	reset_temporary_storage();
+	
+	stats = get_temporary_storage_stats();
+	assert(stats.used == 0 && stats.high_water_mark == 0, "Bad temporary storage stats after reset");
+	assert(stats.last_frame_high_water_mark >= frame_peak, "Frame high water mark was not recorded");
+	assert(stats.all_time_high_water_mark >= frame_peak, "All time high water mark was not recorded");
+	
+	// Chunks are kept around, so this should not need to commit anything new
+	u64 committed = stats.committed;
+	u64 chunk_count = stats.chunk_count;
+	for (u64 i = 0; i < block_count; i += 1) talloc(block_size);
+	stats = get_temporary_storage_stats();
+	assert(stats.chunk_count == chunk_count, "Temporary storage chunks were not reused");
+	assert(stats.committed == committed, "Temporary storage chunks were not reused");
+	
+	reset_temporary_storage();
+	assert(talloc(100) == first, "Temporary storage did not start over at reset");
+	reset_temporary_storage();
+}
+
+void test_arena() {
+	Arena *arena = make_arena(MB(64));
+	
+	u8 *a = arena_push(arena, 3);
+	u8 *b = arena_push(arena, 5);
+	assert(((u64)a % ARENA_DEFAULT_ALIGNMENT) == 0 && ((u64)b % ARENA_DEFAULT_ALIGNMENT) == 0, "Arena allocations are not aligned");
+	assert(b > a, "Arena should bump forward");
+	u8 *c = arena_push_aligned(arena, 8, 256);
+	assert(((u64)c % 256) == 0, "arena_push_aligned ignored the alignment");
+	
+	// Pop & push gives back the same memory
+	arena_pop(arena, 8);
+	assert(arena_push_aligned(arena, 8, 256) == c, "arena_pop did not give the memory back");
+	
+	// Growing past the first commit
+	u64 used_before = arena_get_used(arena);
+	u8 *big = arena_push(arena, MB(10));
+	for (u64 i = 0; i < MB(10); i += KB(4)) big[i] = (u8)i;
+	assert(arena_get_used(arena) >= used_before+MB(10), "Bad arena usage");
+	
+	u64 *zeroed = arena_push_zero(arena, 128*sizeof(u64));
+	for (u64 i = 0; i < 128; i += 1) assert(zeroed[i] == 0, "arena_push_zero did not zero");
+	
+	// Save points
+	Arena_Save_Point save = arena_save(arena);
+	u8 *x = arena_push(arena, 1000);
+	arena_push(arena, 1000);
+	arena_restore(save);
+	assert(arena_push(arena, 1000) == x, "arena_restore did not free what was pushed after the save point");
+	
+	u64 used_before_scope = arena_get_used(arena);
+	arena_scope(arena) {
+		arena_push(arena, KB(100));
+		arena_scope(arena) {
+			arena_push(arena, KB(100));
+		}
+		assert(arena_get_used(arena) >= used_before_scope+KB(100) && arena_get_used(arena) < used_before_scope+KB(200), "Nested arena_scope did not restore");
+	}
+	assert(arena_get_used(arena) == used_before_scope, "arena_scope did not restore");
+	
+	// Allocator adapter
+	Allocator allocator = arena_get_allocator(arena);
+	u64 *numbers;
+	growing_array_init((void**)&numbers, sizeof(u64), allocator);
+	for (u64 i = 0; i < 10000; i += 1) growing_array_add((void**)&numbers, &i);
+	for (u64 i = 0; i < 10000; i += 1) assert(numbers[i] == i, "Growing array in arena got corrupted");
+	
+	// The array is the last allocation so it should have been grown in place
+	u64 used_by_array = arena_get_used(arena)-used_before_scope;
+	assert(used_by_array < 10000*sizeof(u64)*2, "Arena allocator did not resize the last allocation in place");
+	
+	string s = sprint(allocator, STR("Hello %s"), STR("arena"));
+	assert(strings_match(s, STR("Hello arena")), "sprint with arena allocator failed");
+	dealloc(allocator, s.data);
+	
+	u64 high_water_mark = arena->high_water_mark;
+	arena_clear(arena);
+	assert(arena_get_used(arena) == 0, "arena_clear did not clear");
+	assert(arena->high_water_mark == high_water_mark, "arena_clear should not reset the high water mark");
+	assert(arena_push(arena, 3) == a, "arena_clear did not start over");
+	
+	destroy_arena(arena);
+}
+
 void test_thread_proc1(Thread* t) {
 	os_sleep(5);
 	print("Hello from thread %llu\n", t->id);
@@ -225,6 +554,29 @@ void test_threads() {
 	os_unlock_mutex(m);
 }
 
+// Allocations are handed between threads through these mailboxes so about half of
+// the frees happen on another thread than the allocation.
+#define TEST_ALLOCATOR_MAX_THREADS 8
+#define TEST_ALLOCATOR_BATCH 64
+typedef struct Allocator_Scaling_Test {
+	u64 thread_count;
+	u64 round_count;
+	void **volatile mailboxes[TEST_ALLOCATOR_MAX_THREADS];
+} Allocator_Scaling_Test;
+typedef struct Allocator_Scaling_Thread {
+	Allocator_Scaling_Test *test;
+	u64 index;
+	f64 seconds;
+} Allocator_Scaling_Thread;
+
+void test_allocator_free_batch(void **objects) {
+	for (u64 i = 1; i < TEST_ALLOCATOR_BATCH; i += 2) {
+		assert(*(u64*)objects[i] == (u64)objects[i], "Memory corrupted in threaded allocator test");
+		dealloc(get_heap_allocator(), objects[i]);
+	}
+	dealloc(get_heap_allocator(), objects);
+}
+
 void test_allocator_threaded(Thread *t) {
 
 	Allocator heap = get_heap_allocator();
@@ -256,6 +608,138 @@ void test_allocator_threaded(Thread *t) {
             dealloc(heap, mixed_blocks[i]);
         }
     }
+    
+    Allocator_Scaling_Thread *data = (Allocator_Scaling_Thread*)t->data;
+    if (!data) return;
+    
+    Allocator_Scaling_Test *test = data->test;
+    void **volatile *inbox  = &test->mailboxes[data->index];
+    void **volatile *outbox = &test->mailboxes[(data->index+1)%test->thread_count];
+    
+    u64 seed = data->index*7919+1;
+    
+    float64 start_seconds = os_get_current_time_in_seconds();
+    
+    for (u64 round = 0; round < test->round_count; round += 1) {
+    	void **objects = alloc(heap, TEST_ALLOCATOR_BATCH*sizeof(void*));
+    	for (u64 i = 0; i < TEST_ALLOCATOR_BATCH; i += 1) {
+    		seed = seed*6364136223846793005ull + 1442695040888963407ull;
+    		objects[i] = alloc(heap, 16 + (seed >> 33) % 1024);
+    		*(u64*)objects[i] = (u64)objects[i];
+    	}
+    	
+    	for (u64 i = 0; i < TEST_ALLOCATOR_BATCH; i += 2) {
+    		assert(*(u64*)objects[i] == (u64)objects[i], "Memory corrupted in threaded allocator test");
+    		dealloc(heap, objects[i]);
+    	}
+    	
+    	// Let the next thread free the rest, or do it ourselves if its mailbox is full
+    	if (!compare_and_swap_64((u64*)outbox, (u64)objects, 0)) {
+    		test_allocator_free_batch(objects);
+    	}
+    	
+    	void **incoming = *inbox;
+    	if (incoming && compare_and_swap_64((u64*)inbox, 0, (u64)incoming)) {
+    		test_allocator_free_batch(incoming);
+    	}
+    }
+    
+    data->seconds = os_get_current_time_in_seconds()-start_seconds;
+}
+
+// Runs thread_count threads that allocate, free half and pass the rest on to the next thread
+// to free, like jobs handing results around. Returns the seconds the slowest thread took.
+f64 test_allocator_scaling_run(u64 thread_count, u64 round_count) {
+	Allocator_Scaling_Test test = ZERO(Allocator_Scaling_Test);
+	test.thread_count = thread_count;
+	test.round_count = round_count;
+	
+	Thread threads[TEST_ALLOCATOR_MAX_THREADS];
+	Allocator_Scaling_Thread data[TEST_ALLOCATOR_MAX_THREADS];
+	for (u64 i = 0; i < thread_count; i += 1) {
+		data[i].test = &test;
+		data[i].index = i;
+		data[i].seconds = 0;
+		os_thread_init(&threads[i], test_allocator_threaded);
+		threads[i].data = &data[i];
+		os_thread_start(&threads[i]);
+	}
+	
+	f64 seconds = 0;
+	for (u64 i = 0; i < thread_count; i += 1) {
+		os_thread_join(&threads[i]);
+		os_thread_destroy(&threads[i]);
+		seconds = max(seconds, data[i].seconds);
+	}
+	
+	for (u64 i = 0; i < thread_count; i += 1) {
+		if (test.mailboxes[i]) test_allocator_free_batch(test.mailboxes[i]);
+	}
+	
+	return seconds;
+}
+
+// examples/allocator_scaling_benchmark.c times this with more rounds
+void test_allocator_scaling() {
+	for (u64 thread_count = 1; thread_count <= TEST_ALLOCATOR_MAX_THREADS; thread_count *= 2) {
+		test_allocator_scaling_run(thread_count, 500);
+	}
+}
+
+// A thread that exits without heap_release_thread_cache() leaves its spans owned. A new
+// thread can get the same thread_local address, and that must not make it their owner.
+void test_slab_owner_after_thread_exit() {
+	Allocator heap = get_heap_allocator();
+	
+	void *p = alloc(heap, 48);
+	assert(is_pointer_in_slab_memory(p), "Expected a slab allocation");
+	Slab_Span *span = slab_get_span(p);
+	
+	// Same address, fresh heap, like a new thread would have
+	Slab_Thread_Heap exited = slab_thread_heap;
+	memset(&slab_thread_heap, 0, sizeof(Slab_Thread_Heap));
+	
+	void *q = alloc(heap, 48);
+	assert(slab_thread_heap.id != 0 && slab_thread_heap.id != exited.id, "Thread heaps should get unique ids");
+	assert(slab_get_span(q) != span, "A span of another thread was taken over");
+	
+	// Goes to the remote free list of the span, the exited heap still owns it
+	dealloc(heap, p);
+	assert(span->owner == exited.id, "Freeing took over a span of another thread");
+	dealloc(heap, q);
+	
+	heap_release_thread_cache();
+	slab_thread_heap = exited;
+	
+	// A thread fills a whole span and exits, so the span is abandoned with no room in it
+	Slab_Thread_Heap main_heap = slab_thread_heap;
+	memset(&slab_thread_heap, 0, sizeof(Slab_Thread_Heap));
+	
+	void *first = alloc(heap, 48);
+	Slab_Span *full = slab_get_span(first);
+	void **objects = alloc(heap, full->capacity*sizeof(void*));
+	u64 object_count = 0;
+	objects[object_count++] = first;
+	while (slab_span_has_room(full)) {
+		objects[object_count++] = alloc(heap, 48);
+		assert(slab_get_span(objects[object_count-1]) == full, "Expected the span to be filled first");
+	}
+	heap_release_thread_cache();
+	assert(full->owner == 0, "A full span should be abandoned when its thread exits");
+	
+	// A new thread must not allocate from it
+	memset(&slab_thread_heap, 0, sizeof(Slab_Thread_Heap));
+	void *r = alloc(heap, 48);
+	Slab_Span *r_span = slab_get_span(r);
+	assert(r_span != full, "Allocated from an abandoned span that was full");
+	assert((u8*)r >= slab_get_span_memory(r_span) && (u8*)r < r_span->end, "Allocated past the end of a span");
+	
+	// Freeing from another thread gives the abandoned span back once it's empty
+	for (u64 i = 0; i < object_count; i++) dealloc(heap, objects[i]);
+	dealloc(heap, objects);
+	dealloc(heap, r);
+	heap_release_thread_cache();
+	slab_thread_heap = main_heap;
 }
 
 void test_strings() {
@@ -1060,10 +1544,76 @@ void test_hash_table() {
     found_value = hash_table_find(&table, key1);
     assert(found_value == NULL, "Failed: Hash table should be empty after reset");
 
+    // Keys are copied, so a temporary key should still be found with a different string
+    string temp_key = tprint("Temp %i", 5);
+    int temp_value = 5;
+    hash_table_set(&table, temp_key, temp_value);
+    memset(temp_key.data, 0, temp_key.count);
+    string same_key = STR("Temp 5");
+    found_value = hash_table_find(&table, same_key);
+    assert(found_value != NULL && *found_value == 5, "Failed: String keys should be copied into the table");
+    
+    bool removed = hash_table_remove(&table, same_key);
+    assert(removed, "Failed: hash_table_remove should return true for existing key");
+    assert(!hash_table_contains(&table, same_key), "Failed: Key should not exist after remove");
+    removed = hash_table_remove(&table, same_key);
+    assert(!removed, "Failed: hash_table_remove should return false for missing key");
+
     hash_table_destroy(&table);
     assert(table.entries == NULL, "Failed: Hash table entries should be NULL after destroy");
     assert(table.count == 0, "Failed: Hash table count should be 0 after destroy");
     assert(table.capacity_count == 0, "Failed: Hash table capacity count should be 0 after destroy");
+    
+    // Colliding hashes must resolve to the right key
+    Hash_Table collide = make_hash_table(u64, u64, get_heap_allocator());
+    for (u64 i = 0; i < 64; i += 1) {
+    	u64 v = i*10;
+    	hash_table_add_raw(&collide, 1234, &i, &v, sizeof(u64), sizeof(u64));
+    }
+    for (u64 i = 0; i < 64; i += 1) {
+    	u64 *v = (u64*)hash_table_find_raw(&collide, 1234, &i, sizeof(u64));
+    	assert(v && *v == i*10, "Failed: Colliding hash returned wrong value");
+    }
+    for (u64 i = 0; i < 64; i += 2) {
+    	assert(hash_table_remove_raw(&collide, 1234, &i, sizeof(u64)), "Failed: remove colliding key");
+    }
+    for (u64 i = 0; i < 64; i += 1) {
+    	u64 *v = (u64*)hash_table_find_raw(&collide, 1234, &i, sizeof(u64));
+    	if (i % 2 == 0) {
+    		assert(!v, "Failed: Removed colliding key still found");
+    	} else {
+    		assert(v && *v == i*10, "Failed: Colliding hash returned wrong value after remove");
+    	}
+    }
+    hash_table_destroy(&collide);
+    
+    // Growth and removal
+    Hash_Table big = make_hash_table(u64, u64, get_heap_allocator());
+    const u64 big_count = 10000;
+    for (u64 i = 0; i < big_count; i += 1) {
+    	u64 v = i*3;
+    	bool added = hash_table_set(&big, i, v);
+    	assert(added, "Failed: Key should be newly added");
+    }
+    assert(big.count == big_count, "Failed: Hash table count should be %i, was %i", big_count, big.count);
+    assert(big.count*100 <= big.slot_count*HASH_TABLE_MAX_LOAD_PERCENT, "Failed: Hash table is past its max load factor");
+    for (u64 i = 0; i < big_count; i += 3) {
+    	assert(hash_table_remove(&big, i), "Failed: Remove existing key");
+    }
+    for (u64 i = 0; i < big_count; i += 1) {
+    	u64 *v = hash_table_find(&big, i);
+    	if (i % 3 == 0) {
+    		assert(!v, "Failed: Removed key %i still found", i);
+    	} else {
+    		assert(v && *v == i*3, "Failed: Wrong value for key %i", i);
+    	}
+    }
+    for (u64 i = 0; i < big.count; i += 1) {
+    	u64 key = *(u64*)hash_table_get_nth_key(&big, i);
+    	u64 value = *(u64*)hash_table_get_nth_value(&big, i);
+    	assert(key*3 == value, "Failed: Dense entries out of sync");
+    }
+    hash_table_destroy(&big);
 }
 
 #define NUM_BINS 100
@@ -1151,6 +1701,847 @@ void test_mutex() {
     mutex_destroy(&data.mutex);
 }
 
+#define WORKER_POOL_TEST_MAX_JOBS 300
+typedef struct Worker_Pool_Test_Data {
+	u64 runs[WORKER_POOL_TEST_MAX_JOBS];
+	u64 job_count;
+} Worker_Pool_Test_Data;
+void worker_pool_test_job(void *data, u64 job_index) {
+	Worker_Pool_Test_Data *test = (Worker_Pool_Test_Data*)data;
+	assert(job_index < test->job_count, "Job index %llu out of range for %llu jobs", job_index, test->job_count);
+	test->runs[job_index] += 1;
+}
+void test_worker_pool() {
+	u64 thread_counts[] = { 0, 1, 4 };
+	for (u64 t = 0; t < sizeof(thread_counts)/sizeof(thread_counts[0]); t++) {
+		Worker_Pool pool;
+		worker_pool_init(&pool, thread_counts[t]);
+		
+		// Runs of different sizes right after each other, so a worker from the last run
+		// doing a job of the next would show up
+		Worker_Pool_Test_Data data = ZERO(Worker_Pool_Test_Data);
+		for (u64 run = 0; run < 500; run++) {
+			u64 job_count = (run*37) % WORKER_POOL_TEST_MAX_JOBS;
+			memset(data.runs, 0, sizeof(data.runs));
+			data.job_count = job_count;
+			
+			worker_pool_run(&pool, worker_pool_test_job, &data, job_count);
+			
+			for (u64 i = 0; i < WORKER_POOL_TEST_MAX_JOBS; i++) {
+				u64 expected = i < job_count ? 1 : 0;
+				assert(data.runs[i] == expected, "Job %llu of %llu ran %llu times with %llu threads", i, job_count, data.runs[i], thread_counts[t]);
+			}
+		}
+		
+		worker_pool_destroy(&pool);
+	}
+}
+
+// Culling should keep exactly the ranges range2f_overlaps would, in order. examples/culling_benchmark.c
+// times it against culling whole grid cells first.
+void test_range_culling() {
+	const u64 item_count = 1000;
+	const float32 world_size = 1000;
+	
+	Range2f view = range2f_make(v2(400, 400), v2(640, 560));
+	
+	Range2f *items = alloc(get_heap_allocator(), item_count*sizeof(Range2f));
+	u32 *visible = alloc(get_heap_allocator(), item_count*sizeof(u32));
+	for (u64 i = 0; i < item_count; i++) {
+		Vector2 p = v2(get_random_float32_in_range(0, world_size), get_random_float32_in_range(0, world_size));
+		items[i] = range2f_make(p, v2_add(p, v2(16, 16)));
+	}
+	
+	// Touching counts as overlapping
+	items[0] = range2f_make(v2(384, 400), v2(400, 416));
+	items[1] = range2f_make(v2(640, 560), v2(656, 576));
+	items[2] = range2f_make(v2(383, 400), v2(399, 416));
+	
+	u64 expected_count = 0;
+	for (u64 i = 0; i < item_count; i++) {
+		if (range2f_overlaps(view, items[i])) expected_count += 1;
+	}
+	
+	u64 visible_count = range2f_cull_ranges(view, items, visible, item_count);
+	
+	assert(visible_count == expected_count, "Culled to %llu ranges, expected %llu", visible_count, expected_count);
+	assert(visible_count >= 2 && visible[0] == 0 && visible[1] == 1, "Ranges touching the view were culled");
+	for (u64 i = 0; i < visible_count; i++) {
+		assert(range2f_overlaps(view, items[visible[i]]), "Range %u is not visible", visible[i]);
+		assert(visible[i] != 2, "Range left of the view is visible");
+		if (i > 0) assert(visible[i] > visible[i-1], "Visible indices are not in order");
+	}
+	
+	assert(range2f_cull_ranges(view, items, visible, 0) == 0, "Culling nothing should find nothing");
+	
+	dealloc(get_heap_allocator(), items);
+	dealloc(get_heap_allocator(), visible);
+}
+
+void test_audio_kernels() {
+	const u64 max_samples = 1000;
+	f32 *f32_a = alloc(get_heap_allocator(), max_samples*sizeof(f32));
+	f32 *f32_b = alloc(get_heap_allocator(), max_samples*sizeof(f32));
+	f32 *f32_src = alloc(get_heap_allocator(), max_samples*sizeof(f32));
+	s16 *s16_a = alloc(get_heap_allocator(), max_samples*sizeof(s16));
+	s16 *s16_b = alloc(get_heap_allocator(), max_samples*sizeof(s16));
+	s16 *s16_src = alloc(get_heap_allocator(), max_samples*sizeof(s16));
+	
+	// Odd channel counts take the scalar path for ramps, odd lengths leave a scalar tail
+	u64 channel_counts[] = { 1, 2, 6, 8 };
+	for (u64 run = 0; run < 200; run++) {
+		u64 channels = channel_counts[run % 4];
+		u64 frame_count = get_random_int_in_range(0, max_samples/channels);
+		u64 sample_count = frame_count*channels;
+		f32 gain_from = get_random_float32_in_range(0, 2);
+		f32 gain_to = run % 3 == 0 ? gain_from : get_random_float32_in_range(0, 2);
+		
+		for (u64 i = 0; i < sample_count; i++) {
+			f32_a[i] = f32_b[i] = get_random_float32_in_range(-1, 1);
+			f32_src[i] = get_random_float32_in_range(-1, 1);
+			s16_a[i] = s16_b[i] = (s16)get_random_int_in_range(S16_MIN, S16_MAX);
+			s16_src[i] = (s16)get_random_int_in_range(S16_MIN, S16_MAX);
+		}
+		
+		mix_samples_f32(f32_a, f32_src, sample_count);
+		mix_samples_f32_scalar(f32_b, f32_src, sample_count);
+		assert(bytes_match(f32_a, f32_b, sample_count*sizeof(f32)), "f32 mix does not match scalar");
+		
+		mix_samples_s16(s16_a, s16_src, sample_count);
+		mix_samples_s16_scalar(s16_b, s16_src, sample_count);
+		assert(bytes_match(s16_a, s16_b, sample_count*sizeof(s16)), "s16 mix does not match scalar");
+		
+		apply_gain_ramp_f32(f32_a, frame_count, channels, gain_from, gain_to);
+		apply_gain_ramp_f32_scalar(f32_b, frame_count, channels, gain_from, gain_to);
+		for (u64 i = 0; i < sample_count; i++) {
+			assert(fabsf(f32_a[i]-f32_b[i]) <= 0.00001f, "f32 gain ramp does not match scalar at %llu (%f vs %f)", i, f32_a[i], f32_b[i]);
+		}
+		
+		apply_gain_ramp_s16(s16_a, frame_count, channels, gain_from, gain_to);
+		apply_gain_ramp_s16_scalar(s16_b, frame_count, channels, gain_from, gain_to);
+		assert(bytes_match(s16_a, s16_b, sample_count*sizeof(s16)), "s16 gain ramp does not match scalar");
+	}
+	
+	// Halves round away from zero wherever the sample is in the buffer, so odd samples at
+	// half gain come out the same in the SIMD part and the scalar tail
+	for (u64 i = 0; i < 19; i++) {
+		s16_a[i] = (s16)(i % 2 ? 2*i+1 : -(s32)(2*i+1));
+	}
+	apply_gain_ramp_s16(s16_a, 19, 1, 0.5f, 0.5f);
+	for (u64 i = 0; i < 19; i++) {
+		s16 expected = (s16)(i % 2 ? i+1 : -(s32)(i+1));
+		assert(s16_a[i] == expected, "Half gain rounded sample %llu to %d, expected %d", i, s16_a[i], expected);
+	}
+	
+	// Saturation
+	for (u64 i = 0; i < 64; i++) {
+		s16_a[i] = i % 2 ? 30000 : -30000;
+		s16_src[i] = i % 2 ? 10000 : -10000;
+	}
+	mix_samples_s16(s16_a, s16_src, 64);
+	for (u64 i = 0; i < 64; i++) {
+		assert(s16_a[i] == (i % 2 ? S16_MAX : S16_MIN), "s16 mix did not saturate");
+	}
+	apply_gain_ramp_s16(s16_a, 32, 2, 0.5f, 0.5f);
+	for (u64 i = 0; i < 64; i++) {
+		assert(s16_a[i] == (i % 2 ? 16384 : -16384), "Constant s16 gain is wrong");
+	}
+	apply_gain_ramp_s16(s16_a, 32, 2, 4.0f, 4.0f);
+	for (u64 i = 0; i < 64; i++) {
+		assert(s16_a[i] == (i % 2 ? S16_MAX : S16_MIN), "s16 gain did not saturate");
+	}
+	
+	// A ramp starts at gain_from and stops one step short of gain_to
+	for (u64 i = 0; i < 8; i++) f32_a[i] = 1.0f;
+	apply_gain_ramp_f32(f32_a, 4, 2, 0.0f, 1.0f);
+	for (u64 f = 0; f < 4; f++) {
+		assert(f32_a[f*2] == (f32)f*0.25f && f32_a[f*2+1] == (f32)f*0.25f, "Gain ramp has wrong gain on frame %llu", f);
+	}
+	
+	// Fused convert, channel map, gain ramp and mix into an f32 bus
+	u64 src_channel_counts[] = { 1, 2, 3 };
+	u64 out_channel_counts[] = { 1, 2, 6 };
+	for (u64 run = 0; run < 300; run++) {
+		u64 src_channels = src_channel_counts[run % 3];
+		u64 out_channels = out_channel_counts[(run/3) % 3];
+		Audio_Format_Bits src_bits = run % 2 ? AUDIO_BITS_16 : AUDIO_BITS_32;
+		u64 frame_count = get_random_int_in_range(0, 100);
+		f32 gain_from = get_random_float32_in_range(0, 2);
+		f32 gain_to = get_random_float32_in_range(0, 2);
+		
+		Audio_Mix_Matrix matrix;
+		get_audio_channel_map(&matrix, src_channels, out_channels);
+		for (u64 o = 0; o < out_channels; o++) {
+			for (u64 i = 0; i < src_channels; i++) matrix.m[o][i] *= get_random_float32_in_range(0, 1);
+		}
+		
+		for (u64 i = 0; i < frame_count*src_channels; i++) {
+			f32_src[i] = get_random_float32_in_range(-1, 1);
+			s16_src[i] = (s16)get_random_int_in_range(S16_MIN, S16_MAX);
+		}
+		for (u64 i = 0; i < frame_count*out_channels; i++) {
+			f32_a[i] = f32_b[i] = get_random_float32_in_range(-1, 1);
+		}
+		void *src = src_bits == AUDIO_BITS_32 ? (void*)f32_src : (void*)s16_src;
+		
+		mix_frames_to_bus(f32_a, out_channels, src, src_bits, src_channels, &matrix, frame_count, gain_from, gain_to);
+		mix_frames_to_bus_scalar(f32_b, out_channels, src, src_bits, src_channels, &matrix, frame_count, gain_from, gain_to);
+		for (u64 i = 0; i < frame_count*out_channels; i++) {
+			assert(fabsf(f32_a[i]-f32_b[i]) <= 0.00001f, "Mixing %llu to %llu channels does not match scalar at %llu (%f vs %f)", src_channels, out_channels, i, f32_a[i], f32_b[i]);
+		}
+	}
+	
+	// Channel maps like convert_frames
+	Audio_Mix_Matrix map;
+	get_audio_channel_map(&map, 1, 2);
+	assert(map.m[0][0] == 1 && map.m[1][0] == 1, "Mono should go to both stereo channels");
+	get_audio_channel_map(&map, 2, 1);
+	assert(map.m[0][0] == 0.5f && map.m[0][1] == 0.5f, "Stereo to mono should average");
+	get_audio_channel_map(&map, 2, 2);
+	assert(map.m[0][0] == 1 && map.m[0][1] == 0 && map.m[1][0] == 0 && map.m[1][1] == 1, "Stereo to stereo should be straight");
+	
+	// Bus to s16 output rounds and saturates
+	for (u64 i = 0; i < 37; i++) f32_a[i] = get_random_float32_in_range(-1.5, 1.5);
+	convert_samples_f32_to_s16(s16_a, f32_a, 37);
+	convert_samples_f32_to_s16_scalar(s16_b, f32_a, 37);
+	for (u64 i = 0; i < 37; i++) {
+		s32 diff = (s32)s16_a[i]-(s32)s16_b[i];
+		assert(diff >= -1 && diff <= 1, "f32 to s16 does not match scalar");
+		if (f32_a[i] >= 1.0f)  assert(s16_a[i] == S16_MAX, "f32 to s16 did not saturate");
+		if (f32_a[i] < -1.0f)  assert(s16_a[i] == S16_MIN, "f32 to s16 did not saturate");
+	}
+	
+	dealloc(get_heap_allocator(), f32_a);
+	dealloc(get_heap_allocator(), f32_b);
+	dealloc(get_heap_allocator(), f32_src);
+	dealloc(get_heap_allocator(), s16_a);
+	dealloc(get_heap_allocator(), s16_b);
+	dealloc(get_heap_allocator(), s16_src);
+}
+
+void test_audio_output_stage() {
+	const u64 frame_count = 480;
+	const u64 channels = 2;
+	const u64 sample_rate = 48000;
+	f32 *bus = alloc(get_heap_allocator(), frame_count*channels*sizeof(f32));
+	s16 *out = alloc(get_heap_allocator(), frame_count*channels*sizeof(s16));
+	
+	// Quiet buffers are left alone
+	f32 gain = 1.0f;
+	for (u64 i = 0; i < frame_count*channels; i++) bus[i] = get_random_float32_in_range(-0.9, 0.9);
+	f32 first = bus[0];
+	audio_limit_samples(bus, frame_count, channels, sample_rate, &gain);
+	assert(gain == 1.0f && bus[0] == first, "Limiter touched a quiet buffer");
+	
+	// Loud buffers never go over the threshold
+	for (u64 i = 0; i < frame_count*channels; i++) bus[i] = get_random_float32_in_range(-4, 4);
+	audio_limit_samples(bus, frame_count, channels, sample_rate, &gain);
+	assert(gain < 1.0f, "Limiter did not pull the gain down");
+	assert(get_audio_samples_peak(bus, frame_count*channels) <= AUDIO_LIMITER_THRESHOLD+0.00001f, "Limiter let a sample over the threshold");
+	
+	// and the gain comes back up smoothly after
+	f32 last_gain = gain;
+	for (u64 i = 0; i < 100; i++) {
+		for (u64 j = 0; j < frame_count*channels; j++) bus[j] = 0.1f;
+		audio_limit_samples(bus, frame_count, channels, sample_rate, &gain);
+		assert(gain >= last_gain, "Limiter gain went down on a quiet buffer");
+		last_gain = gain;
+	}
+	assert(gain == 1.0f, "Limiter gain did not recover, it's at %f", gain);
+	
+	// Dither stays within +-1.5 LSB, and averages out to values between two LSBs
+	const f32 value = 0.3f/32768.0f;
+	for (u64 i = 0; i < frame_count*channels; i++) bus[i] = value;
+	u64 seed = 1;
+	f64 sum = 0;
+	for (u64 run = 0; run < 20; run++) {
+		convert_samples_f32_to_s16_dithered(out, bus, frame_count*channels, &seed);
+		for (u64 i = 0; i < frame_count*channels; i++) {
+			assert(out[i] >= -1 && out[i] <= 2, "Dithered sample %d is too far from 0.3", out[i]);
+			sum += out[i];
+		}
+	}
+	f64 mean = sum/(f64)(20*frame_count*channels);
+	assert(mean > 0.25 && mean < 0.35, "Dither should average to about 0.3 LSB, got %f", mean);
+	
+	convert_samples_f32_to_s16(out, bus, frame_count*channels);
+	assert(out[0] == 0, "Without dither 0.3 LSB should round to 0");
+	
+	dealloc(get_heap_allocator(), bus);
+	dealloc(get_heap_allocator(), out);
+}
+
+// Random noise in a memory source, as if it was loaded with audio_open_source_load_format()
+Audio_Source test_make_audio_source(Audio_Format format, u64 frame_count) {
+	Audio_Source src = ZERO(Audio_Source);
+	mutex_init(&src.mutex_for_destroy);
+	src.kind = AUDIO_SOURCE_MEMORY;
+	src.format = format;
+	src.number_of_frames = frame_count;
+	src.allocator = get_heap_allocator();
+	
+	u64 sample_count = frame_count*format.channels;
+	src.pcm_frames = alloc(src.allocator, sample_count*get_audio_bit_width_byte_size(format.bit_width));
+	for (u64 i = 0; i < sample_count; i++) {
+		if (format.bit_width == AUDIO_BITS_32) ((f32*)src.pcm_frames)[i] = get_random_float32_in_range(-0.5, 0.5);
+		else                                   ((s16*)src.pcm_frames)[i] = (s16)get_random_int_in_range(-16384, 16384);
+	}
+	return src;
+}
+
+// A constant source should fade in and out smoothly, across callbacks that don't line up
+// with the end of the fade.
+void test_audio_fades() {
+	Audio_Format format = { AUDIO_BITS_32, 2, 48000 };
+	const u64 frames_per_callback = 100;
+	f32 bus[100*2];
+	
+	Audio_Source src = test_make_audio_source(format, 48000);
+	for (u64 i = 0; i < 48000*2; i++) ((f32*)src.pcm_frames)[i] = 0.5f;
+	
+	// Not in the player pool, so the audio thread never sees it
+	Audio_Player p = ZERO(Audio_Player);
+	Audio_Scratch scratch = ZERO(Audio_Scratch);
+	p.volume = 1.0;
+	p.disable_spacialization = true;
+	audio_player_set_source(&p, src, false);
+	audio_player_set_looping(&p, true);
+	
+	audio_player_set_state(&p, AUDIO_PLAYER_STATE_PLAYING);
+	assert(p.fade_frames > frames_per_callback, "Expected the fade to take a few callbacks");
+	
+	f32 last = 0;
+	u64 callbacks = 0;
+	while (p.fade_frames > 0 || callbacks == 0) {
+		memset(bus, 0, sizeof(bus));
+		audio_player_mix_to_bus(&p, bus, frames_per_callback, format, &scratch);
+		for (u64 i = 0; i < frames_per_callback*2; i++) {
+			assert(bus[i] >= last-0.000001f && bus[i] <= 0.5f+0.000001f, "Fade in is not smooth at callback %llu sample %llu (%f after %f)", callbacks, i, bus[i], last);
+			last = bus[i];
+		}
+		if (callbacks == 0) assert(bus[0] < 0.01f, "Fade in should start from silence");
+		callbacks += 1;
+	}
+	memset(bus, 0, sizeof(bus));
+	audio_player_mix_to_bus(&p, bus, frames_per_callback, format, &scratch);
+	for (u64 i = 0; i < frames_per_callback*2; i++) {
+		assert(fabsf(bus[i]-0.5f) < 0.000001f, "Should be at full volume after the fade in");
+	}
+	
+	audio_player_set_state(&p, AUDIO_PLAYER_STATE_PAUSED);
+	last = 0.5f;
+	while (p.fade_frames > 0) {
+		memset(bus, 0, sizeof(bus));
+		audio_player_mix_to_bus(&p, bus, frames_per_callback, format, &scratch);
+		for (u64 i = 0; i < frames_per_callback*2; i++) {
+			assert(bus[i] <= last+0.000001f && bus[i] >= -0.000001f, "Fade out is not smooth (%f after %f)", bus[i], last);
+			last = bus[i];
+		}
+	}
+	assert(last < 0.01f, "Fade out should end in silence");
+	memset(bus, 0, sizeof(bus));
+	audio_player_mix_to_bus(&p, bus, frames_per_callback, format, &scratch);
+	for (u64 i = 0; i < frames_per_callback*2; i++) {
+		assert(bus[i] == 0, "Paused player should be silent");
+	}
+	
+	audio_scratch_release(&scratch);
+	audio_source_destroy(&src);
+}
+
+// Two unspatialized players at half volume should add up to the source, and a player of an
+// s16 source should come out as the same samples in f32.
+void test_audio_mixing() {
+	Audio_Format out_format = { AUDIO_BITS_32, 2, 48000 };
+	const u64 frames_per_callback = 480;
+	const u64 sample_count = frames_per_callback*out_format.channels;
+	
+	Audio_Source f32_src = test_make_audio_source(out_format, 48000);
+	Audio_Source s16_src = test_make_audio_source((Audio_Format){ AUDIO_BITS_16, 2, 48000 }, 48000);
+	
+	f32 *bus = alloc(get_heap_allocator(), sample_count*sizeof(f32));
+	s16 *converted = alloc(get_heap_allocator(), sample_count*sizeof(s16));
+	Audio_Scratch scratch = ZERO(Audio_Scratch);
+	
+	// Not in the player pool, so the audio thread never sees them
+	Audio_Player a = ZERO(Audio_Player);
+	Audio_Player b = ZERO(Audio_Player);
+	Audio_Player c = ZERO(Audio_Player);
+	Audio_Player *players[] = { &a, &b, &c };
+	for (u64 i = 0; i < 3; i++) {
+		players[i]->volume = i < 2 ? 0.5 : 1.0;
+		players[i]->disable_spacialization = true;
+		audio_player_set_source(players[i], i < 2 ? f32_src : s16_src, false);
+		audio_player_set_looping(players[i], true);
+		players[i]->state = AUDIO_PLAYER_STATE_PLAYING;
+	}
+	
+	for (u64 callback = 0; callback < 3; callback++) {
+		u64 first = callback*sample_count;
+		
+		memset(bus, 0, sample_count*sizeof(f32));
+		audio_player_mix_to_bus(&a, bus, frames_per_callback, out_format, &scratch);
+		audio_player_mix_to_bus(&b, bus, frames_per_callback, out_format, &scratch);
+		for (u64 i = 0; i < sample_count; i++) {
+			f32 expected = ((f32*)f32_src.pcm_frames)[first+i];
+			assert(fabsf(bus[i]-expected) < 0.0001f, "Mixed sample %llu is %f, expected %f", i, bus[i], expected);
+		}
+		
+		memset(bus, 0, sample_count*sizeof(f32));
+		audio_player_mix_to_bus(&c, bus, frames_per_callback, out_format, &scratch);
+		convert_samples_f32_to_s16(converted, bus, sample_count);
+		for (u64 i = 0; i < sample_count; i++) {
+			s16 expected = ((s16*)s16_src.pcm_frames)[first+i];
+			s32 diff = (s32)converted[i]-(s32)expected;
+			assert(diff >= -1 && diff <= 1, "Mixed sample %llu is %d, expected %d", i, converted[i], expected);
+		}
+	}
+	
+	audio_scratch_release(&scratch);
+	dealloc(get_heap_allocator(), bus);
+	dealloc(get_heap_allocator(), converted);
+	audio_source_destroy(&f32_src);
+	audio_source_destroy(&s16_src);
+}
+
+// Looping players of the given sources at random spots, volumes and positions. They're not in
+// the player pool, so the audio thread never sees them. Free them with dealloc.
+Audio_Player *test_make_audio_players(u64 player_count, Audio_Source a, Audio_Source b) {
+	Audio_Player *players = alloc(get_heap_allocator(), player_count*sizeof(Audio_Player));
+	memset(players, 0, player_count*sizeof(Audio_Player));
+	for (u64 i = 0; i < player_count; i++) {
+		Audio_Player *p = &players[i];
+		audio_player_set_source(p, i % 2 ? b : a, false);
+		audio_player_set_looping(p, true);
+		audio_player_set_progression_factor(p, get_random_float32_in_range(0, 0.9));
+		p->position = v3(get_random_float32_in_range(-1, 1), get_random_float32_in_range(-1, 1), 0);
+		p->volume = get_random_float32_in_range(0.1, 1.0);
+		p->state = AUDIO_PLAYER_STATE_PLAYING;
+	}
+	return players;
+}
+
+// Mixes the same callback on worker pools of different sizes and checks it against mixing
+// on one thread.
+void test_parallel_audio_mixing() {
+	const u64 player_count = 64;
+	const u64 frames = 480;
+	Audio_Format out_format = { AUDIO_BITS_32, 2, 48000 };
+	u64 sample_count = frames*out_format.channels;
+	
+	f32 *reference = alloc(get_heap_allocator(), sample_count*sizeof(f32));
+	f32 *bus       = alloc(get_heap_allocator(), sample_count*sizeof(f32));
+	f32 *submixes  = alloc(get_heap_allocator(), 15*sample_count*sizeof(f32));
+	Audio_Player **players = alloc(get_heap_allocator(), player_count*sizeof(Audio_Player*));
+	Audio_Scratch scratch[WORKER_POOL_MAX_THREADS+1] = {0};
+	
+	Audio_Source same_src = test_make_audio_source(out_format, 48000);
+	Audio_Source convert_src = test_make_audio_source((Audio_Format){ AUDIO_BITS_16, 1, 44100 }, 44100);
+	
+	// Same players for each pool, starting from the same spot
+	Audio_Player *first_players = test_make_audio_players(player_count, same_src, convert_src);
+	Audio_Player *run_players = alloc(get_heap_allocator(), player_count*sizeof(Audio_Player));
+	for (u64 i = 0; i < player_count; i++) players[i] = &run_players[i];
+	
+	memcpy(run_players, first_players, player_count*sizeof(Audio_Player));
+	memset(reference, 0, sample_count*sizeof(f32));
+	for (u64 i = 0; i < player_count; i++) audio_player_mix_to_bus(players[i], reference, frames, out_format, &scratch[0]);
+	
+	u64 thread_counts[] = { 1, 3, 7, 15 };
+	for (u64 t = 0; t < sizeof(thread_counts)/sizeof(thread_counts[0]); t++) {
+		Worker_Pool pool;
+		worker_pool_init(&pool, thread_counts[t]);
+		
+		// Submixes are added in the same order every time, but not in the order a single
+		// thread adds the players, so they're only close.
+		memcpy(run_players, first_players, player_count*sizeof(Audio_Player));
+		memset(bus, 0, sample_count*sizeof(f32));
+		audio_mix_players_parallel(&pool, players, player_count, bus, submixes, scratch, frames, out_format);
+		for (u64 i = 0; i < sample_count; i++) {
+			assert(fabsf(bus[i]-reference[i]) < 0.0001f, "Mixing with %llu workers gave %f for sample %llu, expected %f", thread_counts[t], bus[i], i, reference[i]);
+		}
+		
+		worker_pool_destroy(&pool);
+	}
+	
+	audio_source_destroy(&same_src);
+	audio_source_destroy(&convert_src);
+	
+	dealloc(get_heap_allocator(), reference);
+	dealloc(get_heap_allocator(), bus);
+	dealloc(get_heap_allocator(), submixes);
+	dealloc(get_heap_allocator(), players);
+	dealloc(get_heap_allocator(), first_players);
+	dealloc(get_heap_allocator(), run_players);
+	for (u64 i = 0; i < WORKER_POOL_MAX_THREADS+1; i++) audio_scratch_release(&scratch[i]);
+}
+
+// How far y is from the closest sine of the given frequency, in dB
+f64 test_sine_snr_db(const f32 *y, u64 stride, u64 count, f64 cycles_per_frame) {
+	f64 ss = 0, cc = 0, sc = 0, ys = 0, yc = 0, yy = 0;
+	for (u64 i = 0; i < count; i++) {
+		f64 s = sin(2.0*PI64*cycles_per_frame*(f64)i);
+		f64 c = cos(2.0*PI64*cycles_per_frame*(f64)i);
+		f64 v = y[i*stride];
+		ss += s*s; cc += c*c; sc += s*c;
+		ys += v*s; yc += v*c; yy += v*v;
+	}
+	f64 det = ss*cc-sc*sc;
+	f64 a = (ys*cc-yc*sc)/det;
+	f64 b = (yc*ss-ys*sc)/det;
+	f64 signal = a*ys+b*yc;
+	f64 noise = max(yy-signal, 1e-20);
+	return 10.0*log10(signal/noise);
+}
+
+// How clean each way of resampling came out in dB, and how long it took
+typedef struct Test_Resampling_Result {
+	u64 output_frames;
+	f64 old_snr;
+	f64 old_seconds;
+	f64 snrs[2]; // Linear, sinc
+	f64 seconds[2];
+} Test_Resampling_Result;
+
+// Resamples a sine the way players used to (linearly, every callback on its own) and with
+// Audio_Resampler in both qualities, and checks the resampler comes out cleaner.
+// examples/audio_resampling_benchmark.c runs it with more callbacks and prints the results.
+Test_Resampling_Result test_audio_resampling(int src_rate, int dst_rate, u64 callback_count) {
+	const u64 frames_per_callback = 480;
+	const u64 channels = 2;
+	const f64 frequency = 1000;
+	
+	Audio_Format src_format = { AUDIO_BITS_32, channels, src_rate };
+	Audio_Format dst_format = { AUDIO_BITS_32, channels, dst_rate };
+	
+	u64 out_count = frames_per_callback*callback_count;
+	u64 in_count = out_count*(u64)src_rate/(u64)dst_rate + frames_per_callback*4;
+	f32 *in = alloc(get_heap_allocator(), in_count*channels*sizeof(f32));
+	f32 *out = alloc(get_heap_allocator(), (out_count+frames_per_callback*4)*channels*sizeof(f32));
+	for (u64 i = 0; i < in_count; i++) {
+		f32 v = (f32)(0.5*sin(2.0*PI64*frequency*(f64)i/(f64)src_rate));
+		for (u64 c = 0; c < channels; c++) in[i*channels+c] = v;
+	}
+	
+	// Output of the first callbacks is left out, the filters start from silence
+	u64 skip = frames_per_callback*4;
+	f64 cycles_per_frame = frequency/(f64)dst_rate;
+	
+	// The old path, in place in the sample buffer like players did it
+	u64 sample_frames = (u64)round(frames_per_callback*((f32)src_rate/(f32)dst_rate));
+	f32 *sample_buffer = alloc(get_heap_allocator(), max(sample_frames, frames_per_callback)*channels*sizeof(f32));
+	u64 old_in = 0;
+	float64 old_start = os_get_current_time_in_seconds();
+	for (u64 i = 0; i < callback_count; i++) {
+		memcpy(sample_buffer, in+old_in*channels, sample_frames*channels*sizeof(f32));
+		resample_frames(sample_buffer, dst_format, sample_buffer, src_format, sample_frames);
+		memcpy(out+i*frames_per_callback*channels, sample_buffer, frames_per_callback*channels*sizeof(f32));
+		old_in += sample_frames;
+	}
+	float64 old_end = os_get_current_time_in_seconds();
+	dealloc(get_heap_allocator(), sample_buffer);
+	
+	Test_Resampling_Result result = ZERO(Test_Resampling_Result);
+	result.output_frames = out_count;
+	result.old_snr = test_sine_snr_db(out+skip*channels, channels, out_count-skip, cycles_per_frame);
+	result.old_seconds = old_end-old_start;
+	
+	Audio_Resample_Quality qualities[] = { AUDIO_RESAMPLE_LINEAR, AUDIO_RESAMPLE_SINC };
+	Audio_Scratch scratch = ZERO(Audio_Scratch);
+	for (u64 q = 0; q < 2; q++) {
+		Audio_Resampler r;
+		audio_resampler_init(&r, channels, src_rate, dst_rate, qualities[q]);
+		
+		u64 used = 0;
+		float64 start = os_get_current_time_in_seconds();
+		for (u64 i = 0; i < callback_count; i++) {
+			u64 needed = audio_resampler_get_input_frame_count(&r, frames_per_callback);
+			audio_resampler_process(&r, out+i*frames_per_callback*channels, frames_per_callback, in+used*channels, AUDIO_BITS_32, needed, &scratch);
+			used += needed;
+		}
+		float64 end = os_get_current_time_in_seconds();
+		
+		// Exactly where we should be in the source, give or take the filter's lookahead
+		u64 expected = out_count*(u64)src_rate/(u64)dst_rate;
+		assert(used >= expected && used <= expected+AUDIO_RESAMPLER_SINC_TAPS, "Resampler used %llu source frames, expected about %llu", used, expected);
+		
+		result.snrs[q] = test_sine_snr_db(out+skip*channels, channels, out_count-skip, cycles_per_frame);
+		result.seconds[q] = end-start;
+		
+		// Same output whether it's done in one go or in pieces of any size
+		Audio_Resampler whole, pieces;
+		audio_resampler_init(&whole, channels, src_rate, dst_rate, qualities[q]);
+		audio_resampler_init(&pieces, channels, src_rate, dst_rate, qualities[q]);
+		f32 *expected_out = out;
+		f32 *pieces_out = out+frames_per_callback*2*channels;
+		u64 whole_in = audio_resampler_get_input_frame_count(&whole, frames_per_callback);
+		audio_resampler_process(&whole, expected_out, frames_per_callback, in, AUDIO_BITS_32, whole_in, &scratch);
+		u64 piece_sizes[] = { 1, 7, 100, 372 };
+		u64 done = 0;
+		u64 pieces_in = 0;
+		for (u64 i = 0; i < sizeof(piece_sizes)/sizeof(piece_sizes[0]); i++) {
+			u64 needed = audio_resampler_get_input_frame_count(&pieces, piece_sizes[i]);
+			audio_resampler_process(&pieces, pieces_out+done*channels, piece_sizes[i], in+pieces_in*channels, AUDIO_BITS_32, needed, &scratch);
+			done += piece_sizes[i];
+			pieces_in += needed;
+		}
+		assert(done == frames_per_callback, "Bad test");
+		for (u64 i = 0; i < frames_per_callback*channels; i++) {
+			assert(fabsf(pieces_out[i]-expected_out[i]) < 0.00001f, "Resampling in pieces gave %f for sample %llu, expected %f", pieces_out[i], i, expected_out[i]);
+		}
+	}
+	
+	assert(result.snrs[0] > result.old_snr, "Stateful linear resampling should be cleaner than the old per-callback path");
+	assert(result.snrs[1] > 70.0, "Sinc resampling should be clean");
+	
+	audio_scratch_release(&scratch);
+	dealloc(get_heap_allocator(), in);
+	dealloc(get_heap_allocator(), out);
+	
+	return result;
+}
+
+// Jumping in the source makes the mixing thread start the resampler over, so a player that
+// seeks sounds the same as one that starts at that spot.
+void test_audio_player_resampler_reset() {
+	Audio_Format out_format = { AUDIO_BITS_32, 2, 48000 };
+	const u64 frames = 480;
+	Audio_Source src = test_make_audio_source((Audio_Format){ AUDIO_BITS_16, 1, 44100 }, 44100);
+	
+	// Not in the player pool, so the audio thread never sees them
+	Audio_Player seeking = ZERO(Audio_Player);
+	Audio_Player fresh = ZERO(Audio_Player);
+	Audio_Player *players[] = { &seeking, &fresh };
+	for (u64 i = 0; i < 2; i++) {
+		players[i]->volume = 1.0;
+		players[i]->disable_spacialization = true;
+		audio_player_set_source(players[i], src, false);
+		players[i]->state = AUDIO_PLAYER_STATE_PLAYING;
+	}
+	
+	f32 *seeking_bus = alloc(get_heap_allocator(), frames*2*sizeof(f32));
+	f32 *fresh_bus = alloc(get_heap_allocator(), frames*2*sizeof(f32));
+	Audio_Scratch scratch = ZERO(Audio_Scratch);
+	
+	memset(seeking_bus, 0, frames*2*sizeof(f32));
+	audio_player_mix_to_bus(&seeking, seeking_bus, frames, out_format, &scratch);
+	audio_player_mix_to_bus(&seeking, seeking_bus, frames, out_format, &scratch);
+	
+	audio_player_set_progression_factor(&seeking, 0.5);
+	audio_player_set_progression_factor(&fresh, 0.5);
+	assert(seeking.resampler_reset, "Seeking should ask for a resampler reset");
+	
+	memset(seeking_bus, 0, frames*2*sizeof(f32));
+	memset(fresh_bus, 0, frames*2*sizeof(f32));
+	audio_player_mix_to_bus(&seeking, seeking_bus, frames, out_format, &scratch);
+	audio_player_mix_to_bus(&fresh, fresh_bus, frames, out_format, &scratch);
+	assert(!seeking.resampler_reset, "Mixing should take the resampler reset");
+	assert(bytes_match(seeking_bus, fresh_bus, frames*2*sizeof(f32)), "Seeking kept resampler state from before the seek");
+	
+	dealloc(get_heap_allocator(), seeking_bus);
+	dealloc(get_heap_allocator(), fresh_bus);
+	audio_scratch_release(&scratch);
+	audio_source_destroy(&src);
+}
+
+// Quads index random entries of scissors & userdata, or none
+void test_fill_random_draw_quads(Draw_Quad *quads, s8 *texture_indices, u64 count, Vector4 *scissors, u64 scissor_count, Draw_Quad_Userdata *userdata, u64 userdata_count) {
+	for (u64 i = 0; i < scissor_count; i++) {
+		scissors[i] = v4(get_random_float32_in_range(0, 1000), get_random_float32_in_range(0, 1000), get_random_float32_in_range(0, 1000), get_random_float32_in_range(0, 1000));
+	}
+	for (u64 i = 0; i < userdata_count; i++) {
+		for (u64 j = 0; j < VERTEX_2D_USER_DATA_COUNT; j++) {
+			userdata[i].data[j] = v4(get_random_float32(), get_random_float32(), get_random_float32(), get_random_float32());
+		}
+	}
+
+	for (u64 i = 0; i < count; i++) {
+		Draw_Quad *q = &quads[i];
+		*q = ZERO(Draw_Quad);
+		q->bottom_left  = v2(get_random_float32_in_range(-1, 1), get_random_float32_in_range(-1, 1));
+		q->top_left     = v2(get_random_float32_in_range(-1, 1), get_random_float32_in_range(-1, 1));
+		q->top_right    = v2(get_random_float32_in_range(-1, 1), get_random_float32_in_range(-1, 1));
+		q->bottom_right = v2(get_random_float32_in_range(-1, 1), get_random_float32_in_range(-1, 1));
+		q->color = quad_pack_color(v4(get_random_float32(), get_random_float32(), get_random_float32(), get_random_float32()));
+		q->uv = v4(get_random_float32(), get_random_float32(), get_random_float32(), get_random_float32());
+		q->scissor_index = (u16)get_random_int_in_range(0, scissor_count);
+		q->userdata_index = (u32)get_random_int_in_range(0, userdata_count);
+		q->type = (i % 10 == 0) ? QUAD_TYPE_TEXT : ((i % 2) ? QUAD_TYPE_REGULAR : QUAD_TYPE_CIRCLE);
+		q->image_min_filter = (Gfx_Filter_Mode)get_random_int_in_range(0, 1);
+		q->image_mag_filter = (Gfx_Filter_Mode)get_random_int_in_range(0, 1);
+		texture_indices[i] = (s8)get_random_int_in_range(-1, 31);
+	}
+}
+
+// Compares the SIMD path to the scalar one. examples/quad_packing_benchmark.c times them.
+void test_quad_instance_packing(u64 quad_count) {
+	Draw_Quad *quads = alloc(get_heap_allocator(), quad_count*sizeof(Draw_Quad));
+	s8 *texture_indices = alloc(get_heap_allocator(), quad_count);
+	Quad_Instance *scalar_instances = alloc(get_heap_allocator(), quad_count*sizeof(Quad_Instance));
+	Quad_Instance *instances = alloc(get_heap_allocator(), quad_count*sizeof(Quad_Instance));
+	const u64 scissor_count = 64;
+	const u64 userdata_count = 64;
+	Vector4 *scissors = alloc(get_heap_allocator(), scissor_count*sizeof(Vector4));
+	Draw_Quad_Userdata *userdata = alloc(get_heap_allocator(), userdata_count*sizeof(Draw_Quad_Userdata));
+	
+	test_fill_random_draw_quads(quads, texture_indices, quad_count, scissors, scissor_count, userdata, userdata_count);
+	
+	// Make sure clamping and scissors outside of the window are covered
+	quads[0].color = quad_pack_color(v4(-0.5, 1.5, 0.5, 1.0));
+	quads[0].scissor_index = 1;
+	scissors[0] = v4(-10.25, -3.5, 2000.75, 1.5);
+	
+	float32 ndc_pixel_width = 2.0/1280.0;
+	float32 ndc_pixel_height = 2.0/720.0;
+	float32 window_pixel_height = 720.0;
+	
+	pack_quads_to_instances_scalar(quads, scissors, userdata, texture_indices, quad_count, scalar_instances, ndc_pixel_width, ndc_pixel_height, window_pixel_height);
+	pack_quads_to_instances(quads, scissors, userdata, texture_indices, quad_count, instances, ndc_pixel_width, ndc_pixel_height, window_pixel_height);
+	
+	for (u64 i = 0; i < quad_count; i++) {
+		assert(bytes_match(&instances[i], &scalar_instances[i], sizeof(Quad_Instance)), "Quad instance packing does not match the scalar path at quad %llu", i);
+	}
+	
+	// Sanity check the reference against the quads
+	for (u64 i = 0; i < quad_count; i++) {
+		const Draw_Quad *q = &quads[i];
+		const Quad_Instance *instance = &scalar_instances[i];
+		
+		if (q->type != QUAD_TYPE_TEXT) {
+			assert(bytes_match(instance->corners, &q->bottom_left, sizeof(instance->corners)), "Bad corners");
+		} else {
+			assert(fabsf(instance->corners[3].x-q->bottom_right.x) <= ndc_pixel_width*0.5001f, "Text corner snapped too far");
+		}
+		assert(bytes_match(&instance->uv, &q->uv, sizeof(Vector4)), "Bad uv");
+		if (q->userdata_index) {
+			assert(bytes_match(instance->userdata, userdata[q->userdata_index-1].data, sizeof(instance->userdata)), "Bad userdata");
+		} else {
+			for (u64 j = 0; j < VERTEX_2D_USER_DATA_COUNT; j++) {
+				assert(instance->userdata[j].x == 0 && instance->userdata[j].y == 0 && instance->userdata[j].z == 0 && instance->userdata[j].w == 0, "Userdata should be zero");
+			}
+		}
+		
+		assert(instance->color == q->color, "Bad color");
+		assert(instance->texture_index == texture_indices[i], "Bad texture index");
+		assert(instance->type == (u8)q->type, "Bad type");
+		assert(instance->sampler == quad_sampler_table[q->image_min_filter][q->image_mag_filter], "Bad sampler");
+		assert(instance->has_scissor == (q->scissor_index != 0), "Bad has_scissor");
+		
+		// Flipped to y down and rounded to whole pixels
+		if (q->scissor_index) {
+			Vector4 scissor = scissors[q->scissor_index-1];
+			assert(fabsf(instance->scissor[0] - scissor.x1) <= 0.5f, "Bad scissor x1");
+			assert(fabsf(instance->scissor[1] - (window_pixel_height-scissor.y2)) <= 0.5f, "Scissor was not flipped");
+			assert(fabsf(instance->scissor[2] - scissor.x2) <= 0.5f, "Bad scissor x2");
+			assert(fabsf(instance->scissor[3] - (window_pixel_height-scissor.y1)) <= 0.5f, "Scissor was not flipped");
+		}
+	}
+	assert(scalar_instances[0].color == 0xFF80FF00, "Bad clamped color %x", scalar_instances[0].color);
+	assert(scalar_instances[0].scissor[0] == -10 && scalar_instances[0].scissor[1] == 719 && scalar_instances[0].scissor[2] == 2001 && scalar_instances[0].scissor[3] == 724, "Bad scissor rounding");
+	
+	dealloc(get_heap_allocator(), scissors);
+	dealloc(get_heap_allocator(), userdata);
+	dealloc(get_heap_allocator(), quads);
+	dealloc(get_heap_allocator(), texture_indices);
+	dealloc(get_heap_allocator(), scalar_instances);
+	dealloc(get_heap_allocator(), instances);
+}
+
+// Gives the quads made up textures, in runs like sprites usually come. Returns the images,
+// which the caller deallocs with the heap allocator.
+Gfx_Image *test_give_quads_texture_runs(Draw_Quad *quads, u64 quad_count, u64 image_count) {
+	Gfx_Image *images = alloc(get_heap_allocator(), image_count*sizeof(Gfx_Image));
+	memset(images, 0, image_count*sizeof(Gfx_Image));
+	for (u64 i = 0; i < image_count; i++) images[i].gfx_handle = (Gfx_Handle)((i+1)*64);
+	Gfx_Image *image = 0;
+	for (u64 i = 0; i < quad_count; i++) {
+		if (i % 50 == 0) {
+			u64 image_index = get_random_int_in_range(0, image_count);
+			image = image_index < image_count ? &images[image_index] : 0;
+		}
+		quads[i].image = image;
+	}
+	return images;
+}
+
+// Splits quads using more textures than there are slots into segments, then packs them with
+// worker pools of different sizes and checks that they all match packing on one thread.
+// examples/parallel_packing_benchmark.c times it.
+void test_parallel_quad_packing() {
+	// Just enough to go parallel, with a last job that isn't full
+	const u64 quad_count = QUAD_PACK_MIN_PARALLEL_COUNT + QUAD_PACK_JOB_SIZE/2 + 1;
+	
+	Draw_Quad *quads = alloc(get_heap_allocator(), quad_count*sizeof(Draw_Quad));
+	s8 *texture_indices = alloc(get_heap_allocator(), quad_count);
+	Quad_Instance *reference = alloc(get_heap_allocator(), quad_count*sizeof(Quad_Instance));
+	Quad_Instance *instances = alloc(get_heap_allocator(), quad_count*sizeof(Quad_Instance));
+	const u64 scissor_count = 64;
+	const u64 userdata_count = 64;
+	Vector4 *scissors = alloc(get_heap_allocator(), scissor_count*sizeof(Vector4));
+	Draw_Quad_Userdata *userdata = alloc(get_heap_allocator(), userdata_count*sizeof(Draw_Quad_Userdata));
+	
+	test_fill_random_draw_quads(quads, texture_indices, quad_count, scissors, scissor_count, userdata, userdata_count);
+	Gfx_Image *images = test_give_quads_texture_runs(quads, quad_count, 100);
+	
+	Quad_Segment *segments = 0;
+	split_quads_into_segments(quads, quad_count, texture_indices, &segments);
+	
+	// Segments cover every quad in order, and the texture indices point at the right texture
+	u64 segment_count = growing_array_get_valid_count(segments);
+	u64 next_quad = 0;
+	for (u64 i = 0; i < segment_count; i++) {
+		Quad_Segment *segment = &segments[i];
+		assert(segment->first_quad == next_quad && segment->quad_count > 0, "Segments have a gap");
+		assert(segment->texture_count <= MAX_BOUND_TEXTURES, "Too many textures in segment");
+		for (u64 j = segment->first_quad; j < segment->first_quad+segment->quad_count; j++) {
+			if (quads[j].image) {
+				assert(texture_indices[j] >= 0 && (u64)texture_indices[j] < segment->texture_count, "Bad texture index");
+				assert(segment->textures[texture_indices[j]] == quads[j].image->gfx_handle, "Texture index is for the wrong texture");
+			} else {
+				assert(texture_indices[j] == -1, "Quad without image should have no texture index");
+			}
+		}
+		next_quad += segment->quad_count;
+	}
+	assert(next_quad == quad_count, "Segments don't cover all quads");
+	assert(segment_count > 1, "Expected to run out of texture slots");
+	
+	float32 ndc_pixel_width = 2.0/1280.0;
+	float32 ndc_pixel_height = 2.0/720.0;
+	float32 window_pixel_height = 720.0;
+	
+	pack_quads_to_instances(quads, scissors, userdata, texture_indices, quad_count, reference, ndc_pixel_width, ndc_pixel_height, window_pixel_height);
+	
+	u64 thread_counts[] = { 1, 3, 7, 15 };
+	for (u64 t = 0; t < sizeof(thread_counts)/sizeof(thread_counts[0]); t++) {
+		Worker_Pool pool;
+		worker_pool_init(&pool, thread_counts[t]);
+		
+		memset(instances, 0, quad_count*sizeof(Quad_Instance));
+		pack_quads_to_instances_parallel(&pool, quads, scissors, userdata, texture_indices, quad_count, instances, ndc_pixel_width, ndc_pixel_height, window_pixel_height);
+		assert(bytes_match(instances, reference, quad_count*sizeof(Quad_Instance)), "Parallel packing with %llu workers does not match one thread", thread_counts[t]);
+		
+		// Job sizes that don't divide the quads, and one job for all of them
+		u64 job_sizes[] = { 1000, 4099, quad_count };
+		for (u64 j = 0; j < sizeof(job_sizes)/sizeof(job_sizes[0]); j++) {
+			memset(instances, 0, quad_count*sizeof(Quad_Instance));
+			pack_quads_to_instances_in_jobs(&pool, quads, scissors, userdata, texture_indices, quad_count, instances, ndc_pixel_width, ndc_pixel_height, window_pixel_height, job_sizes[j]);
+			assert(bytes_match(instances, reference, quad_count*sizeof(Quad_Instance)), "Packing in jobs of %llu with %llu workers does not match one thread", job_sizes[j], thread_counts[t]);
+		}
+		
+		worker_pool_destroy(&pool);
+	}
+	
+	growing_array_deinit((void**)&segments);
+	dealloc(get_heap_allocator(), images);
+	dealloc(get_heap_allocator(), scissors);
+	dealloc(get_heap_allocator(), userdata);
+	dealloc(get_heap_allocator(), quads);
+	dealloc(get_heap_allocator(), texture_indices);
+	dealloc(get_heap_allocator(), reference);
+	dealloc(get_heap_allocator(), instances);
+}
+
 #ifndef OOGABOOGA_HEADLESS
 int compare_draw_quads(const void *a, const void *b) {
     return ((Draw_Quad*)a)->z-((Draw_Quad*)b)->z;
@@ -1221,6 +2612,583 @@ void test_sort() {
     
     print("Merge sort took on average %llu cycles and %.2f ms\n", cycles / num_samples, (seconds * 1000.0) / (float64)num_samples);
 }
+
+// Sorts quads by z with radix_sort moving whole quads, and with radix_sort_key_index and one
+// move per quad like the renderer does, and checks they agree. examples/z_sort_benchmark.c
+// times them.
+void test_quad_z_sort() {
+	const u64 quad_count = 5000;
+	
+	Draw_Quad *quads = alloc(get_heap_allocator(), quad_count*sizeof(Draw_Quad));
+	Draw_Quad *reference = alloc(get_heap_allocator(), quad_count*sizeof(Draw_Quad));
+	Draw_Quad *help = alloc(get_heap_allocator(), quad_count*sizeof(Draw_Quad));
+	Draw_Quad *sorted_quads = alloc(get_heap_allocator(), quad_count*sizeof(Draw_Quad));
+	u64 *keys = alloc(get_heap_allocator(), quad_count*sizeof(u64));
+	u64 *help_keys = alloc(get_heap_allocator(), quad_count*sizeof(u64));
+	
+	memset(quads, 0, quad_count*sizeof(Draw_Quad));
+	for (u64 i = 0; i < quad_count; i++) {
+		// Half random, half in order, with plenty of equal z to check that it's stable
+		if (i % 2 == 0) quads[i].z = get_random_int_in_range(-MAX_Z+1, MAX_Z-1);
+		else            quads[i].z = (s32)(i/64);
+		quads[i].userdata_index = (u32)i;
+	}
+	memcpy(reference, quads, quad_count*sizeof(Draw_Quad));
+	
+	radix_sort(reference, help, quad_count, sizeof(Draw_Quad), offsetof(Draw_Quad, z), MAX_Z_BITS);
+	
+	for (u64 i = 0; i < quad_count; i++) {
+		keys[i] = ((u64)draw_quad_get_sort_key(&quads[i], false) << 32) | i;
+	}
+	u64 *sorted = radix_sort_key_index(keys, help_keys, quad_count, Z_SORT_KEY_BITS);
+	for (u64 i = 0; i < quad_count; i++) {
+		sorted_quads[i] = quads[(u32)sorted[i]];
+	}
+	
+	for (u64 i = 0; i < quad_count; i++) {
+		assert(bytes_match(&sorted_quads[i], &reference[i], sizeof(Draw_Quad)), "Key index sort does not match radix_sort at %llu", i);
+	}
+	
+	// Keys that only differ in the lowest digit only need one pass, and keys that
+	// are all the same need none
+	for (u64 i = 0; i < quad_count; i++) {
+		keys[i] = ((u64)(0x1200 + (quad_count-i)%200) << 32) | i;
+	}
+	sorted = radix_sort_key_index(keys, help_keys, quad_count, 32);
+	assert(sorted == help_keys, "Passes for digits that are all the same should be skipped");
+	for (u64 i = 1; i < quad_count; i++) {
+		assert((sorted[i] >> 32) >= (sorted[i-1] >> 32), "Not sorted");
+		if ((sorted[i] >> 32) == (sorted[i-1] >> 32)) assert((u32)sorted[i] > (u32)sorted[i-1], "Not stable");
+	}
+	for (u64 i = 0; i < quad_count; i++) {
+		keys[i] = (3ULL << 32) | i;
+	}
+	sorted = radix_sort_key_index(keys, help_keys, quad_count, 32);
+	assert(sorted == keys && (u32)sorted[quad_count-1] == quad_count-1, "Equal keys should not be moved");
+	
+	dealloc(get_heap_allocator(), quads);
+	dealloc(get_heap_allocator(), reference);
+	dealloc(get_heap_allocator(), help);
+	dealloc(get_heap_allocator(), sorted_quads);
+	dealloc(get_heap_allocator(), keys);
+	dealloc(get_heap_allocator(), help_keys);
+}
+
+// Checks that batched sprites come out the same as drawing them one by one with draw_image.
+// examples/sprite_batch_benchmark.c times both ways.
+void test_draw_sprites_batch() {
+	const u64 sprite_count = 2000;
+	
+	Draw_Frame saved_frame = draw_frame;
+	draw_frame = ZERO(Draw_Frame);
+	draw_frame.projection = m4_make_orthographic_projection(-640, 640, -360, 360, -1, 10);
+	draw_frame.view = m4_make_translation(v3(30, -20, 0));
+	
+	Gfx_Image image = ZERO(Gfx_Image);
+	
+	Vector2 *positions = alloc(get_heap_allocator(), sprite_count*sizeof(Vector2));
+	Vector2 *sizes = alloc(get_heap_allocator(), sprite_count*sizeof(Vector2));
+	Vector4 *colors = alloc(get_heap_allocator(), sprite_count*sizeof(Vector4));
+	s32 *z = alloc(get_heap_allocator(), sprite_count*sizeof(s32));
+	// Some of them off screen so culling is tested too
+	for (u64 i = 0; i < sprite_count; i++) {
+		positions[i] = v2(get_random_float32_in_range(-800, 800), get_random_float32_in_range(-500, 500));
+		sizes[i] = v2(get_random_float32_in_range(1, 64), get_random_float32_in_range(1, 64));
+		colors[i] = v4(get_random_float32(), get_random_float32(), get_random_float32(), 1);
+		z[i] = (s32)(positions[i].y*100);
+	}
+	
+	// The SIMD projection matches the scalar one
+	Affine2 a = m4_to_affine2(draw_frame_get_world_to_clip());
+	u64 check_count = min(sprite_count, 1001);
+	Vector2 *corners = alloc(get_heap_allocator(), check_count*4*sizeof(Vector2));
+	Vector2 *scalar_corners = alloc(get_heap_allocator(), check_count*4*sizeof(Vector2));
+	bool *visible = alloc(get_heap_allocator(), check_count);
+	bool *scalar_visible = alloc(get_heap_allocator(), check_count);
+	project_rects(a, positions, sizes, corners, visible, check_count);
+	project_rects_scalar(a, positions, sizes, scalar_corners, scalar_visible, check_count);
+	for (u64 i = 0; i < check_count; i++) {
+		assert(visible[i] == scalar_visible[i], "project_rects culls differently than the scalar path");
+		for (u64 j = 0; j < 4; j++) {
+			Vector2 c = corners[i*4+j];
+			Vector2 r = scalar_corners[i*4+j];
+			assert(fabsf(c.x-r.x) < 0.00001 && fabsf(c.y-r.y) < 0.00001, "project_rects does not match the scalar path");
+		}
+	}
+	
+	for (u64 i = 0; i < sprite_count; i++) {
+		push_z_layer(z[i]);
+		draw_image(&image, positions[i], sizes[i], colors[i]);
+		pop_z_layer();
+	}
+	u64 one_by_one_count = draw_frame.num_quads;
+	
+	Draw_Quad *reference = alloc(get_heap_allocator(), one_by_one_count*sizeof(Draw_Quad));
+	memcpy(reference, quad_buffer, one_by_one_count*sizeof(Draw_Quad));
+	draw_frame.num_quads = 0;
+	
+	u64 submitted = draw_sprites_batch_z(&image, positions, sizes, colors, z, sprite_count);
+	
+	assert(submitted == one_by_one_count && draw_frame.num_quads == one_by_one_count, "Batch submitted %llu quads, draw_image %llu", submitted, one_by_one_count);
+	for (u64 i = 0; i < one_by_one_count; i++) {
+		Draw_Quad *q = &quad_buffer[i];
+		Draw_Quad *r = &reference[i];
+		float32 *corners = &q->bottom_left.x;
+		float32 *reference_corners = &r->bottom_left.x;
+		for (u64 j = 0; j < 8; j++) {
+			assert(fabsf(corners[j]-reference_corners[j]) < 0.0001, "Batched quad %llu has different corners", i);
+		}
+		assert(q->color == r->color, "Bad color");
+		assert(bytes_match(&q->uv, &r->uv, sizeof(Vector4)), "Bad uv");
+		assert(q->userdata_index == r->userdata_index, "Bad userdata");
+		assert(q->image == r->image && q->z == r->z && q->type == r->type && q->scissor_index == r->scissor_index, "Batched quad %llu is different", i);
+		assert(q->image_min_filter == r->image_min_filter && q->image_mag_filter == r->image_mag_filter, "Bad filters");
+	}
+	
+	// Tilemap visits only what's on screen, and gets the same tiles as drawing them all
+	draw_frame.num_quads = 0;
+	const u64 map_width = 200;
+	const u64 map_height = 100;
+	Vector2 origin = v2(-1000, -500);
+	Vector2 tile_size = v2(10, 10);
+	Vector4 *tile_colors = alloc(get_heap_allocator(), map_width*map_height*sizeof(Vector4));
+	for (u64 i = 0; i < map_width*map_height; i++) tile_colors[i] = v4((float32)i, 0, 0, 1);
+	for (u64 y = 0; y < map_height; y++) {
+		for (u64 x = 0; x < map_width; x++) {
+			draw_rect(v2(origin.x + x*tile_size.x, origin.y + y*tile_size.y), tile_size, tile_colors[y*map_width+x]);
+		}
+	}
+	u64 tile_reference_count = draw_frame.num_quads;
+	draw_frame.num_quads = 0;
+	u64 tile_count = draw_tilemap(origin, tile_size, map_width, map_height, 0, tile_colors);
+	assert(tile_count == tile_reference_count, "draw_tilemap submitted %llu tiles, expected %llu", tile_count, tile_reference_count);
+	assert(tile_count < map_width*map_height, "Expected some tiles to be culled");
+	
+	dealloc(get_heap_allocator(), positions);
+	dealloc(get_heap_allocator(), sizes);
+	dealloc(get_heap_allocator(), colors);
+	dealloc(get_heap_allocator(), z);
+	dealloc(get_heap_allocator(), corners);
+	dealloc(get_heap_allocator(), scalar_corners);
+	dealloc(get_heap_allocator(), visible);
+	dealloc(get_heap_allocator(), scalar_visible);
+	dealloc(get_heap_allocator(), reference);
+	dealloc(get_heap_allocator(), tile_colors);
+	
+	draw_frame = saved_frame;
+}
+
+void test_static_batch() {
+	Draw_Frame saved_frame = draw_frame;
+	draw_frame = ZERO(Draw_Frame);
+	draw_frame.projection = m4_make_orthographic_projection(-640, 640, -360, 360, -1, 10);
+	draw_frame.view = m4_scalar(1.0);
+	
+	Gfx_Image images[40];
+	memset(images, 0, sizeof(images));
+	for (u64 i = 0; i < 40; i++) images[i].gfx_handle = (Gfx_Handle)(u64)(0x1000 + i*16);
+	
+	// Something in the frame before recording, which should be left alone
+	push_z_layer(5);
+	draw_rect(v2(0, 0), v2(10, 10), COLOR_RED);
+	pop_z_layer();
+	u64 quads_before = draw_frame.num_quads;
+	u64 scissors_before = draw_frame.num_scissors;
+	Matrix4 projection_before = draw_frame.projection;
+	
+	Static_Batch batch = ZERO(Static_Batch);
+	assert(!static_batch_is_valid(&batch), "A new static batch should not be valid");
+	
+	static_batch_begin(&batch);
+	// Way off screen, but nothing is culled while recording. Later ones have lower z and
+	// should come first.
+	for (u64 i = 0; i < 40; i++) {
+		push_z_layer(-(s32)i);
+		draw_image(&images[i], v2(5000 + i*10, -5000), v2(8, 8), COLOR_WHITE);
+		pop_z_layer();
+	}
+	Vector2 positions[3] = { v2(-9000, 0), v2(0, 9000), v2(1, 1) };
+	Vector2 sizes[3] = { v2(1, 1), v2(2, 2), v2(3, 3) };
+	push_z_layer(-100);
+	u64 batched = draw_sprites_batch(0, positions, sizes, 0, 3);
+	pop_z_layer();
+	assert(batched == 3, "Sprites should not be culled while recording a static batch");
+	push_window_scissor(v2(0, 0), v2(100, 100));
+	draw_rect(v2(1, 1), v2(1, 1), COLOR_GREEN);
+	pop_window_scissor();
+	static_batch_end(&batch);
+	
+	assert(static_batch_is_valid(&batch), "Static batch should be valid after recording");
+	assert(batch.quad_count == 44, "Expected 44 quads in the static batch, got %llu", batch.quad_count);
+	assert(draw_frame.num_quads == quads_before, "Recording a static batch should not leave quads in the frame");
+	assert(draw_frame.num_scissors == scissors_before, "Recording a static batch should not leave scissors in the frame");
+	assert(bytes_match(&draw_frame.projection, &projection_before, sizeof(Matrix4)), "Projection was not restored");
+	assert(!draw_frame._recording_static_batch, "Still recording");
+	
+	// 40 textures don't fit in one draw call
+	u64 segment_count = growing_array_get_valid_count(batch.segments);
+	assert(segment_count == 2, "Expected 2 segments, got %llu", segment_count);
+	assert(batch.segments[0].first_quad == 0 && batch.segments[0].texture_count == MAX_BOUND_TEXTURES, "Bad first segment");
+	assert(batch.segments[1].first_quad + batch.segments[1].quad_count == batch.quad_count, "Segments don't cover the batch");
+	assert(batch.segments[0].quad_count + batch.segments[1].quad_count == batch.quad_count, "Segments don't cover the batch");
+	// z sorted: the 3 rects at z -100 first, then the images from the last one drawn
+	assert(batch.segments[0].quad_count == 3+MAX_BOUND_TEXTURES, "Bad first segment quad count %llu", batch.segments[0].quad_count);
+	assert(batch.segments[0].textures[0] == images[39].gfx_handle, "Static batch was not sorted by z");
+	
+	Matrix4 xform = m4_make_translation(v3(100, 0, 0));
+	draw_static_batch(&batch, xform);
+	assert(draw_frame.static_batch_draw_count == 1 && draw_frame.static_batch_draws[0].batch == &batch, "Static batch draw was not recorded");
+	Matrix4 expected = m4_mul(draw_frame_get_world_to_clip(), xform);
+	assert(bytes_match(&draw_frame.static_batch_draws[0].transform, &expected, sizeof(Matrix4)), "Bad static batch transform");
+	
+	static_batch_invalidate(&batch);
+	assert(!static_batch_is_valid(&batch), "Static batch should not be valid after invalidating");
+	
+	delete_static_batch(&batch);
+	
+	draw_frame = saved_frame;
+}
+
+void test_world_to_clip_cache() {
+	Draw_Frame saved_frame = draw_frame;
+	draw_frame = ZERO(Draw_Frame);
+	
+	draw_frame.projection = m4_make_orthographic_projection(-640, 640, -360, 360, -1, 10);
+	draw_frame.view = m4_make_scale(v3(2, 2, 1));
+	draw_frame.view = m4_translate(draw_frame.view, v3(100, -50, 0));
+	
+	Matrix4 expected = m4_mul(draw_frame.projection, m4_inverse(draw_frame.view));
+	Matrix4 world_to_clip = draw_frame_get_world_to_clip();
+	assert(bytes_match(&world_to_clip, &expected, sizeof(Matrix4)), "Bad world_to_clip");
+	
+	// Changing the view directly is noticed
+	draw_frame.view = m4_translate(draw_frame.view, v3(-30, 20, 0));
+	expected = m4_mul(draw_frame.projection, m4_inverse(draw_frame.view));
+	world_to_clip = draw_frame_get_world_to_clip();
+	assert(bytes_match(&world_to_clip, &expected, sizeof(Matrix4)), "world_to_clip was not updated when view changed");
+	
+	// The visible rect is what maps to the edges of clip space
+	Range2f visible_rect = draw_frame_get_visible_world_rect();
+	Vector2 visible_min = m4_transform(world_to_clip, v4(visible_rect.min.x, visible_rect.min.y, 0, 1)).xy;
+	Vector2 visible_max = m4_transform(world_to_clip, v4(visible_rect.max.x, visible_rect.max.y, 0, 1)).xy;
+	assert(fabsf(visible_min.x+1) < 0.001 && fabsf(visible_min.y+1) < 0.001, "Bad visible world rect min");
+	assert(fabsf(visible_max.x-1) < 0.001 && fabsf(visible_max.y-1) < 0.001, "Bad visible world rect max");
+	assert(draw_frame_is_world_rect_visible(range2f_make(visible_rect.max, v2_add(visible_rect.max, v2(1, 1)))), "A rect touching the screen should be visible");
+	assert(!draw_frame_is_world_rect_visible(range2f_make(v2_add(visible_rect.max, v2(1, 1)), v2_add(visible_rect.max, v2(2, 2)))), "A rect off screen should not be visible");
+	
+	// clip_to_world takes points back where they came from
+	Matrix4 clip_to_world = draw_frame_get_clip_to_world();
+	Vector2 world = v2(123, -45);
+	Vector2 clip = m4_transform(world_to_clip, v4(world.x, world.y, 0, 1)).xy;
+	Vector2 back = m4_transform(clip_to_world, v4(clip.x, clip.y, 0, 1)).xy;
+	assert(fabsf(back.x-world.x) < 0.01 && fabsf(back.y-world.y) < 0.01, "clip_to_world is not the inverse of world_to_clip");
+	
+	// The 2D batch transform gives the same as a full m4_transform
+	Matrix4 m = m4_mul(world_to_clip, m4_rotate_z(m4_make_translation(v3(3, 4, 0)), 0.7));
+	Vector2 points[64];
+	Vector2 transformed[64];
+	for (u64 i = 0; i < 64; i++) {
+		points[i] = v2(get_random_float32_in_range(-1000, 1000), get_random_float32_in_range(-1000, 1000));
+	}
+	m4_transform_points_2d(m, points, transformed, 64);
+	for (u64 i = 0; i < 64; i++) {
+		Vector2 reference = m4_transform(m, v4(points[i].x, points[i].y, 0, 1)).xy;
+		assert(fabsf(reference.x-transformed[i].x) < 0.0001 && fabsf(reference.y-transformed[i].y) < 0.0001, "m4_transform_points_2d does not match m4_transform");
+	}
+	// In place
+	m4_transform_points_2d(m, points, points, 64);
+	assert(bytes_match(points, transformed, sizeof(points)), "m4_transform_points_2d in place gives a different result");
+	
+	draw_frame = saved_frame;
+}
+
+void test_draw_quad_side_tables() {
+	Draw_Frame saved_frame = draw_frame;
+	draw_frame = ZERO(Draw_Frame);
+	draw_frame.projection = m4_scalar(1.0);
+	draw_frame.view = m4_scalar(1.0);
+	
+	// Quads get the scissor on top of the stack, or none
+	Draw_Quad *no_scissor = draw_rect(v2(-0.5, -0.5), v2(1, 1), COLOR_WHITE);
+	push_window_scissor(v2(10, 20), v2(30, 40));
+	Draw_Quad *outer = draw_rect(v2(-0.5, -0.5), v2(1, 1), COLOR_WHITE);
+	push_window_scissor(v2(1, 2), v2(3, 4));
+	Draw_Quad *inner = draw_circle(v2(-0.5, -0.5), v2(1, 1), COLOR_RED);
+	pop_window_scissor();
+	Draw_Quad *outer_again = draw_rect(v2(-0.5, -0.5), v2(1, 1), COLOR_WHITE);
+	pop_window_scissor();
+	Draw_Quad *no_scissor_again = draw_rect(v2(-0.5, -0.5), v2(1, 1), COLOR_WHITE);
+	
+	assert(no_scissor->scissor_index == 0 && no_scissor_again->scissor_index == 0, "Quad should have no scissor");
+	assert(outer->scissor_index != 0 && outer->scissor_index == outer_again->scissor_index, "Quads in the same scissor should share it");
+	assert(inner->scissor_index != 0 && inner->scissor_index != outer->scissor_index, "Bad inner scissor");
+	Vector4 expected_outer = v4(10, 20, 30, 40);
+	Vector4 expected_inner = v4(1, 2, 3, 4);
+	assert(bytes_match(&scissor_buffer[outer->scissor_index-1], &expected_outer, sizeof(Vector4)), "Bad outer scissor");
+	assert(bytes_match(&scissor_buffer[inner->scissor_index-1], &expected_inner, sizeof(Vector4)), "Bad inner scissor");
+	assert(draw_frame.num_scissors == 2, "Expected 2 scissors, got %llu", draw_frame.num_scissors);
+	
+	// Colors are packed when the quad is made
+	assert(inner->color == 0xFF0000FF, "Bad packed color %x", inner->color);
+	assert(inner->type == QUAD_TYPE_CIRCLE, "Bad type");
+	
+	// Userdata is zero until it's asked for, and then stays with the quad
+	assert(outer->userdata_index == 0, "Quad should have no userdata");
+	Vector4 *userdata = draw_quad_userdata(outer);
+	for (u64 i = 0; i < VERTEX_2D_USER_DATA_COUNT; i++) {
+		assert(userdata[i].x == 0 && userdata[i].y == 0 && userdata[i].z == 0 && userdata[i].w == 0, "New userdata should be zero");
+	}
+	userdata[0] = v4(1, 2, 3, 4);
+	assert(draw_quad_userdata(outer) == userdata, "Asking again should give the same userdata");
+	assert(draw_quad_userdata(inner) != userdata, "Quads should not share userdata");
+	assert(draw_frame.num_userdata == 2, "Expected 2 userdata, got %llu", draw_frame.num_userdata);
+	assert(userdata_buffer[outer->userdata_index-1].data[0].w == 4, "Userdata was not kept");
+	
+	// Culled quads can be written to, which doesn't go anywhere
+	Draw_Quad *culled = draw_rect(v2(5, 5), v2(1, 1), COLOR_WHITE);
+	u64 userdata_count = draw_frame.num_userdata;
+	draw_quad_userdata(culled)[0] = v4(1, 1, 1, 1);
+	assert(draw_frame.num_userdata == userdata_count, "Culled quad should not take userdata");
+	assert(draw_quad_userdata(culled)[0].x == 0, "Culled quad userdata should be zero");
+	
+	draw_frame = saved_frame;
+}
+
+void test_z_sort_runs() {
+	// Finds the runs of quads that come in z order
+	Draw_Frame saved_frame = draw_frame;
+	draw_frame = ZERO(Draw_Frame);
+	draw_frame.projection = m4_scalar(1.0);
+	draw_frame.view = m4_scalar(1.0);
+	
+	s32 zs[] = { 0, 0, 5, 5, 10,   2, 3,   -4,   -4, 100, 100 };
+	for (u64 i = 0; i < sizeof(zs)/sizeof(zs[0]); i++) {
+		push_z_layer(zs[i]);
+		draw_rect(v2(-0.5, -0.5), v2(1, 1), COLOR_WHITE);
+		pop_z_layer();
+	}
+	// Culled quads are not submitted and don't count
+	push_z_layer(-100);
+	draw_rect(v2(5, 5), v2(1, 1), COLOR_WHITE);
+	pop_z_layer();
+	
+	assert(draw_frame.num_quads == 11, "Expected 11 quads, got %llu", draw_frame.num_quads);
+	u64 run_starts[Z_SORT_MAX_MERGE_RUNS];
+	u64 run_count = draw_quads_find_z_runs(quad_buffer, draw_frame.num_quads, run_starts);
+	assert(run_count == 3, "Expected 3 runs, got %llu", run_count);
+	assert(run_starts[0] == 0 && run_starts[1] == 5 && run_starts[2] == 7, "Bad run starts");
+	
+	// Quads are returned by the draw procedures, so z can change after they are submitted
+	Draw_Quad *q = draw_rect(v2(-0.5, -0.5), v2(1, 1), COLOR_WHITE);
+	assert(draw_quads_find_z_runs(quad_buffer, draw_frame.num_quads, run_starts) == 4, "Expected the quad with z 0 to start a run");
+	q->z = 200;
+	run_count = draw_quads_find_z_runs(quad_buffer, draw_frame.num_quads, run_starts);
+	assert(run_count == 3, "Changing z after submitting was not seen, got %llu runs", run_count);
+	
+	// More runs than can be merged are counted, but only the first starts are written
+	draw_frame.num_quads = 0;
+	for (u64 i = 0; i < Z_SORT_MAX_MERGE_RUNS+3; i++) {
+		push_z_layer(-(s32)i);
+		draw_rect(v2(-0.5, -0.5), v2(1, 1), COLOR_WHITE);
+		pop_z_layer();
+	}
+	run_count = draw_quads_find_z_runs(quad_buffer, draw_frame.num_quads, run_starts);
+	assert(run_count == Z_SORT_MAX_MERGE_RUNS+3, "Expected %llu runs, got %llu", (u64)Z_SORT_MAX_MERGE_RUNS+3, run_count);
+	assert(run_starts[Z_SORT_MAX_MERGE_RUNS-1] == Z_SORT_MAX_MERGE_RUNS-1, "Bad run starts");
+	
+	draw_frame = saved_frame;
+	
+	// Merging sorted runs matches the radix sort, including the order of equal keys
+	const u64 count = 10000;
+	u64 *keys = alloc(get_heap_allocator(), count*sizeof(u64));
+	u64 *help = alloc(get_heap_allocator(), count*sizeof(u64));
+	u64 *reference = alloc(get_heap_allocator(), count*sizeof(u64));
+	u64 *reference_help = alloc(get_heap_allocator(), count*sizeof(u64));
+	
+	for (u64 run_count = 1; run_count <= Z_SORT_MAX_MERGE_RUNS+1; run_count++) {
+		u64 run_starts[Z_SORT_MAX_MERGE_RUNS+1];
+		u64 run_length = count/run_count;
+		for (u64 r = 0; r < run_count; r++) {
+			run_starts[r] = r*run_length;
+		}
+		
+		u64 key = 0;
+		for (u64 i = 0; i < count; i++) {
+			bool run_start = false;
+			for (u64 r = 0; r < run_count; r++) if (run_starts[r] == i) run_start = true;
+			if (run_start) key = get_random_int_in_range(0, 100);
+			key += get_random_int_in_range(0, 2);
+			keys[i] = (key << 32) | i;
+		}
+		memcpy(reference, keys, count*sizeof(u64));
+		
+		u64 *merged = merge_sorted_runs(keys, help, count, run_starts, run_count);
+		u64 *sorted = radix_sort_key_index(reference, reference_help, count, 32);
+		
+		if (run_count == 1) assert(merged == keys, "A single run should not be moved");
+		assert(bytes_match(merged, sorted, count*sizeof(u64)), "Merging %llu runs does not match radix sort", run_count);
+	}
+	
+	dealloc(get_heap_allocator(), keys);
+	dealloc(get_heap_allocator(), help);
+	dealloc(get_heap_allocator(), reference);
+	dealloc(get_heap_allocator(), reference_help);
+}
+
+void test_texture_slots() {
+	Texture_Slots slots = ZERO(Texture_Slots);
+	
+	// Made up handles, nothing is bound
+	for (u64 i = 0; i < MAX_BOUND_TEXTURES; i++) {
+		s8 slot = texture_slots_get(&slots, (Gfx_Handle)((i+1)*64));
+		assert(slot == (s8)i, "Expected slot %llu, got %d", i, slot);
+	}
+	assert(slots.count == MAX_BOUND_TEXTURES, "Bad texture slot count");
+	for (u64 i = 0; i < MAX_BOUND_TEXTURES; i++) {
+		assert(texture_slots_get(&slots, (Gfx_Handle)((i+1)*64)) == (s8)i, "Texture did not keep its slot");
+		assert(slots.textures[i] == (Gfx_Handle)((i+1)*64), "Slot has the wrong texture");
+	}
+	assert(texture_slots_get(&slots, (Gfx_Handle)(12345*64)) == -1, "Should be out of slots");
+	assert(slots.count == MAX_BOUND_TEXTURES, "Failed lookup should not take a slot");
+	
+	texture_slots_reset(&slots);
+	assert(slots.count == 0, "Reset did not clear slots");
+	assert(texture_slots_get(&slots, (Gfx_Handle)(32*64)) == 0, "Old slots survived the reset");
+	assert(texture_slots_get(&slots, (Gfx_Handle)(1*64)) == 1, "Old slots survived the reset");
+	
+	// Wrapping the generation must not bring back old entries
+	slots.generation = 0xFFFFFFFF;
+	texture_slots_get(&slots, (Gfx_Handle)(7*64));
+	texture_slots_reset(&slots);
+	assert(slots.generation == 1 && texture_slots_get(&slots, (Gfx_Handle)(7*64)) == 0, "Generation wrap kept old entries");
+	
+	// Texture sort keys order by z first and group by texture within a z
+	Gfx_Image a = ZERO(Gfx_Image);
+	Gfx_Image b = ZERO(Gfx_Image);
+	a.gfx_handle = (Gfx_Handle)(&a);
+	b.gfx_handle = (Gfx_Handle)(&b);
+	Draw_Quad q = ZERO(Draw_Quad);
+	s32 zs[] = { -MAX_Z+1, -5, 0, 3, MAX_Z };
+	u32 last_max = 0;
+	for (u64 i = 0; i < sizeof(zs)/sizeof(zs[0]); i++) {
+		q.z = zs[i];
+		q.image = 0;
+		u32 no_image = draw_quad_get_sort_key(&q, true);
+		q.image = &a;
+		u32 key_a = draw_quad_get_sort_key(&q, true);
+		q.image = &b;
+		u32 key_b = draw_quad_get_sort_key(&q, true);
+		
+		assert(no_image > last_max && key_a > last_max && key_b > last_max, "Texture sort key does not sort by z first");
+		assert((u64)max(key_a, key_b) < (1ULL << TEXTURE_SORT_KEY_BITS), "Texture sort key out of range");
+		assert(draw_quad_get_sort_key(&q, false) < (1ULL << Z_SORT_KEY_BITS), "Z sort key out of range");
+		last_max = max(no_image, max(key_a, key_b));
+	}
+}
+
+void test_image_atlas() {
+	
+	///
+	// Packing
+	Image_Atlas_Rect rects[300];
+	for (u64 i = 0; i < 300; i++) {
+		rects[i] = ZERO(Image_Atlas_Rect);
+		rects[i].width  = (u32)get_random_int_in_range(1, 40);
+		rects[i].height = (u32)get_random_int_in_range(1, 40);
+	}
+	rects[7].width = 0;
+	
+	bool ok = image_atlas_pack_rects(rects, 300, 512, 512);
+	assert(ok, "Rects should fit");
+	for (u64 i = 0; i < 300; i++) {
+		Image_Atlas_Rect a = rects[i];
+		if (a.width == 0 || a.height == 0) continue;
+		assert(a.x+a.width <= 512 && a.y+a.height <= 512, "Rect %llu is outside of the atlas", i);
+		for (u64 j = 0; j < i; j++) {
+			Image_Atlas_Rect b = rects[j];
+			if (b.width == 0 || b.height == 0) continue;
+			bool overlap = a.x < b.x+b.width && b.x < a.x+a.width && a.y < b.y+b.height && b.y < a.y+a.height;
+			assert(!overlap, "Rects %llu and %llu overlap", i, j);
+		}
+	}
+	
+	Image_Atlas_Rect too_wide = {0, 0, 600, 10};
+	assert(!image_atlas_pack_rects(&too_wide, 1, 512, 512), "Rect wider than the atlas should not fit");
+	
+	///
+	// Blitting with extruded edges
+	u32 pixels[3*2] = {
+		1, 2, 3,
+		4, 5, 6,
+	};
+	u32 canvas[8*8];
+	memset(canvas, 0, sizeof(canvas));
+	image_atlas_blit((u8*)canvas, 8, (u8*)pixels, 3, 2, 2, 2, 1);
+	assert(canvas[2*8+2] == 1 && canvas[3*8+4] == 6, "Image was not copied");
+	assert(canvas[2*8+1] == 1 && canvas[3*8+5] == 6, "Sides were not extruded");
+	assert(canvas[1*8+3] == 2 && canvas[4*8+3] == 5, "Bottom and top were not extruded");
+	assert(canvas[1*8+1] == 1 && canvas[4*8+5] == 6, "Corners were not extruded");
+	assert(canvas[0] == 0 && canvas[5*8+6] == 0 && canvas[2*8+6] == 0, "Blit wrote outside of the extruded image");
+	
+	///
+	// Building, with a cache
+	string cache_path = STR("test_image_atlas.cache");
+	if (os_is_file(cache_path)) os_file_delete(cache_path);
+	
+	Image_Atlas_Builder builder;
+	image_atlas_builder_init(&builder, get_heap_allocator());
+	u64 image_count = 20;
+	for (u64 i = 0; i < image_count; i++) {
+		u32 w = (u32)get_random_int_in_range(1, 70);
+		u32 h = (u32)get_random_int_in_range(1, 70);
+		u32 *image_pixels = talloc(w*h*sizeof(u32));
+		for (u64 p = 0; p < w*h; p++) image_pixels[p] = (u32)i+1;
+		s64 index = image_atlas_add_image_from_pixels(&builder, image_pixels, w, h);
+		assert(index == (s64)i, "Bad image atlas index");
+	}
+	
+	Image_Atlas *atlas = image_atlas_build(&builder, cache_path);
+	assert(atlas && atlas->count == image_count, "Failed building image atlas");
+	for (u64 i = 0; i < image_count; i++) {
+		Gfx_Image *image = image_atlas_get_image(atlas, i);
+		Image_Atlas_Rect r = atlas->rects[i];
+		assert(image->atlas == atlas->image && image->gfx_handle == atlas->image->gfx_handle, "Sub image does not point to the atlas");
+		assert(image->width == builder.sources[i].width && image->height == builder.sources[i].height, "Sub image has the wrong size");
+		assert(r.x >= builder.extrude && r.y >= builder.extrude, "Extruded pixels don't fit");
+		assert(image->atlas_uv.x1 == (float32)r.x/(float32)atlas->image->width, "Bad atlas uv");
+		assert(image->atlas_uv.y2 == (float32)(r.y+r.height)/(float32)atlas->image->height, "Bad atlas uv");
+	}
+	
+	// The cache has the packed pixels
+	string cache;
+	ok = os_read_entire_file(cache_path, &cache, get_heap_allocator());
+	assert(ok, "Image atlas cache was not written");
+	u64 key = image_atlas_builder_get_key(&builder);
+	u32 *cached_pixels = (u32*)(cache.data + sizeof(Image_Atlas_Cache_Header) + image_count*sizeof(Image_Atlas_Rect));
+	for (u64 i = 0; i < image_count; i++) {
+		Image_Atlas_Rect r = atlas->rects[i];
+		assert(cached_pixels[r.y*atlas->image->width + r.x] == i+1, "Image %llu was not packed where its rect says", i);
+		assert(cached_pixels[(r.y+r.height-1)*atlas->image->width + r.x+r.width-1] == i+1, "Image %llu was not packed where its rect says", i);
+	}
+	
+	Image_Atlas *cached = image_atlas_make_from_cache(cache, key, get_heap_allocator());
+	assert(cached && bytes_match(cached->rects, atlas->rects, image_count*sizeof(Image_Atlas_Rect)), "Image atlas from cache does not match");
+	assert(!image_atlas_make_from_cache(cache, key+1, get_heap_allocator()), "Image atlas cache with the wrong key was used");
+	delete_image_atlas(cached);
+	
+	// Changing an image must invalidate the cache
+	builder.sources[3].pixels[0] ^= 0xFF;
+	assert(image_atlas_builder_get_key(&builder) != key, "Changed image did not change the atlas key");
+	
+	Image_Atlas *rebuilt = image_atlas_build(&builder, cache_path);
+	assert(rebuilt && rebuilt->count == image_count, "Failed rebuilding image atlas");
+	delete_image_atlas(rebuilt);
+	
+	dealloc_string(get_heap_allocator(), cache);
+	delete_image_atlas(atlas);
+	image_atlas_builder_deinit(&builder);
+	os_file_delete(cache_path);
+}
 #endif /* OOGABOOGA_HEADLESS */
 
 typedef struct Test_Thing {
@@ -1289,20 +3257,143 @@ void test_growing_array() {
     assert(growing_array_get_valid_count(things) == 99, "Failed: growing_array_get_valid_count");
 }
 
+typedef struct Test_Pool_Thing {
+	u64 id;
+	float32 stuff[5];
+} Test_Pool_Thing;
+
+void test_pool() {
+	Pool pool;
+	pool_init(&pool, sizeof(Test_Pool_Thing), 16, get_heap_allocator());
+	
+	const u64 count = 1000;
+	Test_Pool_Thing **things = alloc(get_heap_allocator(), count*sizeof(Test_Pool_Thing*));
+	Pool_Handle *handles = alloc(get_heap_allocator(), count*sizeof(Pool_Handle));
+	
+	for (u64 i = 0; i < count; i += 1) {
+		things[i] = pool_acquire(&pool, &handles[i]);
+		assert(things[i]->id == 0, "Pool items should be zero initialized");
+		assert(((u64)things[i] % 16) == 0, "Pool items should be 16 byte aligned");
+		things[i]->id = i;
+	}
+	assert(pool_get_count(&pool) == count, "Bad pool count");
+	
+	// Pointers must stay put while the pool grows
+	for (u64 i = 0; i < count; i += 1) {
+		assert(things[i]->id == i, "Pool item moved or got corrupted");
+		assert(pool_get(&pool, handles[i]) == things[i], "Pool handle lookup failed");
+		Pool_Handle h = pool_get_handle(&pool, things[i]);
+		assert(h.index == handles[i].index && h.generation == handles[i].generation, "pool_get_handle mismatch");
+	}
+	
+	// Release every other one
+	for (u64 i = 0; i < count; i += 2) {
+		pool_release(&pool, things[i]);
+	}
+	assert(pool_get_count(&pool) == count/2, "Bad pool count after release");
+	for (u64 i = 0; i < count; i += 1) {
+		if (i % 2 == 0) {
+			assert(!pool_handle_is_valid(&pool, handles[i]), "Released handle should be stale");
+			assert(pool_get(&pool, handles[i]) == 0, "Released handle should be stale");
+		} else {
+			assert(pool_get(&pool, handles[i]) == things[i], "Live handle went stale");
+		}
+	}
+	assert(!pool_release_handle(&pool, handles[0]), "Releasing a stale handle should do nothing");
+	
+	Pool_Handle zero = ZERO(Pool_Handle);
+	assert(pool_get(&pool, zero) == 0, "Zero handle should never be valid");
+	
+	// Dense iteration only sees live items
+	u64 seen = 0;
+	for (u64 i = 0; i < pool_get_count(&pool); i += 1) {
+		Test_Pool_Thing *thing = pool_get_nth(&pool, i);
+		assert(thing->id % 2 == 1, "Dense iteration saw a released item");
+		seen += 1;
+	}
+	assert(seen == count/2, "Dense iteration missed items");
+	
+	// Released slots are reused, and old handles to them stay stale
+	u64 block_count = pool.block_count;
+	for (u64 i = 0; i < count; i += 2) {
+		Pool_Handle h;
+		Test_Pool_Thing *thing = pool_acquire(&pool, &h);
+		thing->id = i;
+		assert(pool_get(&pool, handles[i]) == 0, "Stale handle became valid after the slot was reused");
+		handles[i] = h;
+		things[i] = thing;
+	}
+	assert(pool.block_count == block_count, "Pool should reuse released slots before growing");
+	
+	// Releasing while iterating backwards
+	for (s64 i = (s64)pool_get_count(&pool)-1; i >= 0; i -= 1) {
+		Test_Pool_Thing *thing = pool_get_nth(&pool, i);
+		if (thing->id % 3 == 0) pool_release(&pool, thing);
+	}
+	for (u64 i = 0; i < count; i += 1) {
+		bool should_live = i % 3 != 0;
+		assert(pool_handle_is_valid(&pool, handles[i]) == should_live, "Releasing while iterating went wrong");
+	}
+	for (u64 i = 0; i < pool_get_count(&pool); i += 1) {
+		Test_Pool_Thing *thing = pool_get_nth(&pool, i);
+		assert(thing->id % 3 != 0, "Releasing while iterating went wrong");
+	}
+	
+	pool_clear(&pool);
+	assert(pool_get_count(&pool) == 0, "pool_clear did not clear");
+	for (u64 i = 0; i < count; i += 1) assert(!pool_handle_is_valid(&pool, handles[i]), "Handle valid after clear");
+	
+	pool_deinit(&pool);
+	dealloc(get_heap_allocator(), things);
+	dealloc(get_heap_allocator(), handles);
+}
+
 void oogabooga_run_tests() {
 	
 	print("Testing growing array... ");
 	test_growing_array();
 	print("OK!\n");
+	
+	print("Testing pool... ");
+	test_pool();
+	print("OK!\n");
     
 	print("Testing allocator... ");
 	test_allocator(true);
 	print("OK!\n");
 	
+	print("Testing heap workload... ");
+	test_heap_workloads();
+	print("OK!\n");
+	
+	print("Testing heap realloc... ");
+	test_heap_realloc();
+	print("OK!\n");
+	
+	print("Testing large allocations... ");
+	test_large_allocations();
+	print("OK!\n");
+	
+	print("Testing temporary storage... ");
+	test_temporary_storage();
+	print("OK!\n");
+	
+	print("Testing arena... ");
+	test_arena();
+	print("OK!\n");
+	
 	print("Testing threads... ");
 	test_threads();
 	print("OK!\n");
 	
+	print("Testing threaded allocator... ");
+	test_allocator_scaling();
+	print("OK!\n");
+	
+	print("Testing slab owner after thread exit... ");
+	test_slab_owner_after_thread_exit();
+	print("OK!\n");
+	
 	print("Testing strings... ");
 	test_strings();
 	print("OK!\n");
@@ -1330,11 +3421,89 @@ void oogabooga_run_tests() {
 	print("Testing mutex... ");
 	test_mutex();
 	print("OK!\n");
+	
+	print("Testing worker pool... ");
+	test_worker_pool();
+	print("OK!\n");
+	
+	print("Testing range culling... ");
+	test_range_culling();
+	print("OK!\n");
+	
+	print("Testing audio kernels... ");
+	test_audio_kernels();
+	print("OK!\n");
+	
+	print("Testing audio output stage... ");
+	test_audio_output_stage();
+	print("OK!\n");
+	
+	print("Testing audio fades... ");
+	test_audio_fades();
+	print("OK!\n");
+	
+	print("Testing audio mixing... ");
+	test_audio_mixing();
+	print("OK!\n");
+	
+	print("Testing audio resampling... ");
+	test_audio_resampling(44100, 48000, 20);
+	test_audio_resampling(22050, 48000, 20);
+	test_audio_resampling(48000, 44100, 20);
+	print("OK!\n");
+	
+	print("Testing audio player resampler reset... ");
+	test_audio_player_resampler_reset();
+	print("OK!\n");
+	
+	print("Testing parallel audio mixing... ");
+	test_parallel_audio_mixing();
+	print("OK!\n");
+	
+	print("Testing quad instance packing... ");
+	test_quad_instance_packing(4099);
+	print("OK!\n");
+	
+	print("Testing parallel quad packing... ");
+	test_parallel_quad_packing();
+	print("OK!\n");
 
 #ifndef OOGABOOGA_HEADLESS
 	print("Testing radix sort... ");
 	test_sort();
 	print("OK!\n");
+	
+	print("Testing quad z sort... ");
+	test_quad_z_sort();
+	print("OK!\n");
+	
+	print("Testing draw sprites batch... ");
+	test_draw_sprites_batch();
+	print("OK!\n");
+	
+	print("Testing static batch... ");
+	test_static_batch();
+	print("OK!\n");
+	
+	print("Testing world to clip cache... ");
+	test_world_to_clip_cache();
+	print("OK!\n");
+	
+	print("Testing draw quad side tables... ");
+	test_draw_quad_side_tables();
+	print("OK!\n");
+	
+	print("Testing z sort runs... ");
+	test_z_sort_runs();
+	print("OK!\n");
+	
+	print("Testing texture slots... ");
+	test_texture_slots();
+	print("OK!\n");
+	
+	print("Testing image atlas... ");
+	test_image_atlas();
+	print("OK!\n");
 #endif
 
 	
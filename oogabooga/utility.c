@@ -54,6 +54,114 @@ void radix_sort(void *collection, void *help_buffer, u64 item_count, u64 item_si
     }
 }
 
+// Sorts (key, index) pairs packed as (key << 32) | index, on the lowest key_bits of the key.
+// Keys are unsigned. Only 8 bytes move per item and pass, so it's a lot cheaper than
+// radix_sort on big items. Reorder the items once with the sorted indices afterwards.
+// - Histograms for all passes are counted in a single read up front
+// - Passes where every key has the same digit are skipped
+// - Passes go back and forth between items and help_buffer instead of copying back
+// Returns whichever of items and help_buffer holds the sorted pairs.
+u64 *radix_sort_key_index(u64 *items, u64 *help_buffer, u64 item_count, u64 key_bits) {
+    assert(key_bits <= 32, "radix_sort_key_index keys are at most 32 bits, got %llu", key_bits);
+    
+    const u64 RADIX = 256;
+    const u64 BITS_PER_PASS = 8;
+    const u64 PASS_COUNT = (key_bits + BITS_PER_PASS - 1) / BITS_PER_PASS;
+    
+    if (item_count <= 1) return items;
+    
+    u64 histograms[4][256];
+    memset(histograms, 0, sizeof(histograms));
+    
+    for (u64 i = 0; i < item_count; ++i) {
+        u32 key = (u32)(items[i] >> 32);
+        histograms[0][(key >>  0) & 0xFF] += 1;
+        histograms[1][(key >>  8) & 0xFF] += 1;
+        histograms[2][(key >> 16) & 0xFF] += 1;
+        histograms[3][(key >> 24) & 0xFF] += 1;
+    }
+    
+    u64 *src = items;
+    u64 *dst = help_buffer;
+    
+    for (u64 pass = 0; pass < PASS_COUNT; ++pass) {
+        u64 shift = 32 + pass * BITS_PER_PASS;
+        u64 *count = histograms[pass];
+        
+        // Nothing would move
+        if (count[(src[0] >> shift) & 0xFF] == item_count) continue;
+        
+        u64 offsets[256];
+        u64 sum = 0;
+        for (u64 i = 0; i < RADIX; ++i) {
+            offsets[i] = sum;
+            sum += count[i];
+        }
+        
+        for (u64 i = 0; i < item_count; ++i) {
+            u64 item = src[i];
+            dst[offsets[(item >> shift) & 0xFF]++] = item;
+        }
+        
+        u64 *temp = src;
+        src = dst;
+        dst = temp;
+    }
+    
+    return src;
+}
+
+// Merges runs of already sorted u64 items into one sorted array, two runs at a time.
+// run_starts[0] must be 0 and the starts must be increasing. Comparing the whole u64 keeps
+// it stable for (key << 32) | index pairs as long as the indices increase along the array.
+// Like radix_sort_key_index it goes back and forth between items and help_buffer, and
+// returns whichever of them holds the result.
+u64 *merge_sorted_runs(u64 *items, u64 *help_buffer, u64 item_count, const u64 *run_starts, u64 run_count) {
+    assert(run_count == 0 || run_starts[0] == 0, "The first run must start at 0");
+    
+    if (run_count <= 1 || item_count <= 1) return items;
+    
+    // One extra start at the end so every run ends where the next one starts
+    u64 *starts = (u64*)alloc(get_temporary_allocator(), (run_count + 1) * sizeof(u64));
+    memcpy(starts, run_starts, run_count * sizeof(u64));
+    starts[run_count] = item_count;
+    
+    u64 *src = items;
+    u64 *dst = help_buffer;
+    
+    while (run_count > 1) {
+        u64 new_run_count = 0;
+        
+        for (u64 r = 0; r < run_count; r += 2) {
+            u64 left = starts[r];
+            u64 end = starts[min(r + 2, run_count)];
+            u64 right = (r + 1 < run_count) ? starts[r + 1] : end;
+            
+            u64 left_index = left;
+            u64 right_index = right;
+            u64 k = left;
+            
+            while (left_index < right && right_index < end) {
+                if (src[right_index] < src[left_index]) dst[k++] = src[right_index++];
+                else                                    dst[k++] = src[left_index++];
+            }
+            while (left_index < right)   dst[k++] = src[left_index++];
+            while (right_index < end)    dst[k++] = src[right_index++];
+            
+            starts[new_run_count++] = left;
+        }
+        
+        starts[new_run_count] = item_count;
+        run_count = new_run_count;
+        
+        u64 *temp = src;
+        src = dst;
+        dst = temp;
+    }
+    
+    return src;
+}
+
 void merge_sort(void *collection, void *help_buffer, u64 item_count, u64 item_size, int (*compare)(const void *, const void *)) {
     u8 *items = (u8 *)collection;
     u8 *buffer = (u8 *)help_buffer;
@@ -38,7 +38,6 @@ typedef enum EntityArchetype
 typedef struct Entity
 {
 	// more or less common
-	bool is_valid;
 	EntityArchetype arch;
 	Vector2 pos;
 	s32 health;
@@ -89,10 +88,10 @@ BuildingData get_building_data(BuildingID id)
 	return buildings[id];
 }
 
-#define MAX_ENTITY_COUNT 128
+#define ENTITIES_PER_BLOCK 128
 typedef struct World
 {
-	Entity entities[MAX_ENTITY_COUNT];
+	Pool entities; // of Entity
 	ItemData inventory_items[ARCH_MAX];
 	UXState ux_state;
 	BuildingID building_to_place;
@@ -111,23 +110,12 @@ WorldFrame world_frame;
 
 Entity *entity_create()
 {
-	Entity *found_entity = null;
-	for (int i = 0; i < MAX_ENTITY_COUNT; i++)
-	{
-		Entity *current_entity = &world->entities[i];
-		if (!current_entity->is_valid)
-		{
-			found_entity = current_entity;
-		}
-	}
-	assert(found_entity, "no more free entities");
-	found_entity->is_valid = true;
-	return found_entity;
+	return pool_acquire(&world->entities, null);
 }
 
 void entity_destroy(Entity *entity)
 {
-	memset(entity, 0, sizeof(Entity));
+	pool_release(&world->entities, entity);
 }
 
 void setup_player(Entity *entity)
@@ -562,6 +550,7 @@ int entry(int argc, char **argv)
 	window.clear_color = hex_to_rgba(0x222323ff);
 
 	world = alloc(get_heap_allocator(), sizeof(World));
+	pool_init(&world->entities, sizeof(Entity), ENTITIES_PER_BLOCK, get_heap_allocator());
 	// spawn rocks
 	for (int i = 0; i < 30; i++)
 	{
@@ -591,16 +580,33 @@ int entry(int argc, char **argv)
 
 	// resources setup
 
-	sprites[SPRITE_NIL] = (Sprite){.image = load_image_from_disk(fixed_string("res/sprites/missing_texture.png"), get_heap_allocator())};
-	sprites[SPRITE_PLAYER] = (Sprite){.image = load_image_from_disk(fixed_string("res/sprites/player.png"), get_heap_allocator())};
-	sprites[SPRITE_PINE_TREE] = (Sprite){.image = load_image_from_disk(fixed_string("res/sprites/pine_tree.png"), get_heap_allocator())};
-	sprites[SPRITE_OAK_TREE] = (Sprite){.image = load_image_from_disk(fixed_string("res/sprites/oak_tree.png"), get_heap_allocator())};
-	sprites[SPRITE_ROCK0] = (Sprite){.image = load_image_from_disk(fixed_string("res/sprites/rock0.png"), get_heap_allocator())};
-	sprites[SPRITE_ROCK1] = (Sprite){.image = load_image_from_disk(fixed_string("res/sprites/rock1.png"), get_heap_allocator())};
-	sprites[SPRITE_ITEM_WOOD] = (Sprite){.image = load_image_from_disk(fixed_string("res/sprites/item_wood.png"), get_heap_allocator())};
-	sprites[SPRITE_ITEM_STONE] = (Sprite){.image = load_image_from_disk(fixed_string("res/sprites/item_stone.png"), get_heap_allocator())};
-	sprites[SPRITE_FURNACE] = (Sprite){.image = load_image_from_disk(fixed_string("res/sprites/furnace.png"), get_heap_allocator())};
-	sprites[SPRITE_WORKBENCH] = (Sprite){.image = load_image_from_disk(fixed_string("res/sprites/workbench.png"), get_heap_allocator())};
+	// All sprites go in one atlas so they can be drawn in the same batch.
+	// The pack is cached in the build folder so it's only redone when a sprite changes.
+	const char *sprite_paths[SPRITE_MAX] = {
+		[SPRITE_NIL] = "res/sprites/missing_texture.png",
+		[SPRITE_PLAYER] = "res/sprites/player.png",
+		[SPRITE_PINE_TREE] = "res/sprites/pine_tree.png",
+		[SPRITE_OAK_TREE] = "res/sprites/oak_tree.png",
+		[SPRITE_ROCK0] = "res/sprites/rock0.png",
+		[SPRITE_ROCK1] = "res/sprites/rock1.png",
+		[SPRITE_ITEM_WOOD] = "res/sprites/item_wood.png",
+		[SPRITE_ITEM_STONE] = "res/sprites/item_stone.png",
+		[SPRITE_FURNACE] = "res/sprites/furnace.png",
+		[SPRITE_WORKBENCH] = "res/sprites/workbench.png",
+	};
+	s64 sprite_atlas_indices[SPRITE_MAX];
+
+	Image_Atlas_Builder sprite_atlas_builder;
+	image_atlas_builder_init(&sprite_atlas_builder, get_heap_allocator());
+	for (int i = 0; i < SPRITE_MAX; i++)
+		sprite_atlas_indices[i] = image_atlas_add_image_from_disk(&sprite_atlas_builder, STR(sprite_paths[i]));
+	Image_Atlas *sprite_atlas = image_atlas_build(&sprite_atlas_builder, STR("build/sprites.atlas"));
+	image_atlas_builder_deinit(&sprite_atlas_builder);
+	assert(sprite_atlas, "Could not build the sprite atlas");
+
+	for (int i = 0; i < SPRITE_MAX; i++)
+		if (sprite_atlas_indices[i] >= 0)
+			sprites[i] = (Sprite){.image = image_atlas_get_image(sprite_atlas, sprite_atlas_indices[i])};
 
 	//@ship remove this
 	for (int i = 0; i < SPRITE_MAX; i++)
@@ -633,6 +639,7 @@ int entry(int argc, char **argv)
 		previous_t = os_get_current_time_in_seconds();
 
 		draw_frame.enable_z_sorting = true;
+		draw_frame.enable_texture_sorting = true;
 
 		world_frame = (WorldFrame){0};
 
@@ -662,10 +669,10 @@ int entry(int argc, char **argv)
 			f32 entity_selection_radius = 8.;
 
 			f32 closest_distance = 0;
-			for (int i = 0; i < MAX_ENTITY_COUNT; i++)
+			for (u64 i = 0; i < pool_get_count(&world->entities); i++)
 			{
-				Entity *entity = &world->entities[i];
-				if (entity->is_valid && entity->destroyable_world_entity)
+				Entity *entity = pool_get_nth(&world->entities, i);
+				if (entity->destroyable_world_entity)
 				{
 					f32 dist = v2_length(v2_sub(mouse_in_world, entity->pos));
 					if (dist < entity_selection_radius)
@@ -681,23 +688,21 @@ int entry(int argc, char **argv)
 		}
 
 		// update entities
+		// backwards because destroying an entity moves the last one into its place
 		f32 player_pickup_radius = 8.0;
-		for (int i = 0; i < MAX_ENTITY_COUNT; i++)
+		for (s64 i = (s64)pool_get_count(&world->entities) - 1; i >= 0; i--)
 		{
-			Entity *entity = &world->entities[i];
-			if (entity->is_valid)
+			Entity *entity = pool_get_nth(&world->entities, i);
+			// pick up nearby items
+			if (entity->is_item)
 			{
-				// pick up nearby items
-				if (entity->is_item)
-				{
-					// TODO - add physics to item pickup
+				// TODO - add physics to item pickup
 
-					f32 dist_to_player = v2_length(v2_sub(entity->pos, player_ent->pos));
-					if (dist_to_player < player_pickup_radius)
-					{
-						world->inventory_items[entity->arch].amount += 1;
-						entity_destroy(entity);
-					}
+				f32 dist_to_player = v2_length(v2_sub(entity->pos, player_ent->pos));
+				if (dist_to_player < player_pickup_radius)
+				{
+					world->inventory_items[entity->arch].amount += 1;
+					entity_destroy(entity);
 				}
 			}
 		}
@@ -707,27 +712,44 @@ int entry(int argc, char **argv)
 		s32 tilemap_radius_y = 8;
 		s32 player_tile_x = world_pos_to_tile_pos(player_ent->pos.x);
 		s32 player_tile_y = world_pos_to_tile_pos(player_ent->pos.y);
-		for (s32 x = player_tile_x - tilemap_radius_x; x < player_tile_x + tilemap_radius_x; x++)
 		{
-			for (s32 y = player_tile_y - tilemap_radius_y; y < player_tile_y + tilemap_radius_y; y++)
+			// the tiles never change, only where they are drawn. so they're recorded once into a
+			// static batch which follows the player in steps of 2 tiles, which keeps the checker
+			// pattern in place. one extra tile each way covers the rounding down to even tiles.
+			const u64 tiles_x = tilemap_radius_x * 2 + 1;
+			const u64 tiles_y = tilemap_radius_y * 2 + 1;
+			local_persist Static_Batch tilemap_batch = {0};
+			if (!static_batch_is_valid(&tilemap_batch))
 			{
-				Vector4 color = v4(0., 0., 0., 0.);
-				// color only even tiles
-				if ((x + (y % 2 == 0)) % 2 == 0)
+				Vector4 *tile_colors = talloc(tiles_x * tiles_y * sizeof(Vector4));
+				for (u64 y = 0; y < tiles_y; y++)
 				{
-					color = v4(1., 1., 1., 0.1);
+					for (u64 x = 0; x < tiles_x; x++)
+					{
+						Vector4 color = v4(0., 0., 0., 0.);
+						// color only even tiles
+						if ((x + (y % 2 == 0)) % 2 == 0)
+						{
+							color = v4(1., 1., 1., 0.1);
+						}
+						tile_colors[y * tiles_x + x] = color;
+					}
 				}
 
-				f32 tile_pos_in_world_x = tile_pos_to_world_pos(x) - TILE_WIDTH * 0.5;
-				f32 tile_pos_in_world_y = tile_pos_to_world_pos(y) - TILE_WIDTH * 0.5;
-				draw_rect(v2(tile_pos_in_world_x, tile_pos_in_world_y), v2(TILE_WIDTH, TILE_WIDTH), color);
-
-				// color the hovered tile
-				/* if (x == mouse_tile_pos_x && y == mouse_tile_pos_y)
-				{
-					draw_rect(v2_sub(tile_pos, v2(0.5 * TILE_WIDTH, 0.5 * TILE_WIDTH)), v2(TILE_WIDTH, TILE_WIDTH), v4(1., 0.9, 0., 1.));
-				} */
+				static_batch_begin(&tilemap_batch);
+				draw_tilemap(v2(TILE_WIDTH * -0.5, TILE_WIDTH * -0.5), v2(TILE_WIDTH, TILE_WIDTH), tiles_x, tiles_y, 0, tile_colors);
+				static_batch_end(&tilemap_batch);
 			}
+
+			s32 first_tile_x = (player_tile_x - tilemap_radius_x) & ~1;
+			s32 first_tile_y = (player_tile_y - tilemap_radius_y) & ~1;
+			draw_static_batch(&tilemap_batch, m4_make_translation(v3(tile_pos_to_world_pos(first_tile_x), tile_pos_to_world_pos(first_tile_y), 0.)));
+
+			// color the hovered tile
+			/* if (x == mouse_tile_pos_x && y == mouse_tile_pos_y)
+			{
+				draw_rect(v2_sub(tile_pos, v2(0.5 * TILE_WIDTH, 0.5 * TILE_WIDTH)), v2(TILE_WIDTH, TILE_WIDTH), v4(1., 0.9, 0., 1.));
+			} */
 		}
 
 		// click handling
@@ -794,33 +816,39 @@ int entry(int argc, char **argv)
 		player_ent->pos = v2_add(player_ent->pos, v2_mulf(input_axis, 50.0 * delta_t));
 
 		// entities rendering
-		for (int i = 0; i < MAX_ENTITY_COUNT; i++)
+		for (u64 i = 0; i < pool_get_count(&world->entities); i++)
 		{
-			Entity *entity = &world->entities[i];
-			if (entity->is_valid)
+			Entity *entity = pool_get_nth(&world->entities, i);
+			switch (entity->arch)
 			{
-				switch (entity->arch)
-				{
-				default:
-				{
-					Sprite *entity_sprite = get_sprite(entity->sprite_id);
-					Matrix4 xform = m4_scalar(1.0);
+			default:
+			{
+				Sprite *entity_sprite = get_sprite(entity->sprite_id);
+				Vector2 sprite_size = get_sprite_size(entity_sprite);
 
-					if (entity->is_item)
-						xform = m4_translate(xform, v3(0., sin_breathe(now_t, 2.5), 0.));
+				// skip entities that are off screen before doing any matrix work for them,
+				// with a unit of margin for the item bobbing
+				Vector2 sprite_min = v2(entity->pos.x - entity_sprite->image->width * 0.5, entity->pos.y - 0.5 * TILE_WIDTH - 1.);
+				Vector2 sprite_max = v2(sprite_min.x + sprite_size.x, sprite_min.y + sprite_size.y + 2.);
+				if (!draw_frame_is_world_rect_visible(range2f_make(sprite_min, sprite_max)))
+					break;
 
-					// xform = m4_translate(xform, v3(entity_sprite->size.x * -0.5, 0., 0.)); // pivot center bottom
-					xform = m4_translate(xform, v3(entity_sprite->image->width * -0.5, -0.5 * TILE_WIDTH, 0.)); // pivot center and a little up to account for the tile
-					xform = m4_translate(xform, v3(entity->pos.x, entity->pos.y, 0.));							// position
+				Matrix4 xform = m4_scalar(1.0);
 
-					Vector4 color = COLOR_WHITE;
-					if (world_frame.selected_entity == entity)
-						color = COLOR_RED;
+				if (entity->is_item)
+					xform = m4_translate(xform, v3(0., sin_breathe(now_t, 2.5), 0.));
 
-					draw_image_xform(entity_sprite->image, xform, get_sprite_size(entity_sprite), color);
-				}
-				break;
-				}
+				// xform = m4_translate(xform, v3(entity_sprite->size.x * -0.5, 0., 0.)); // pivot center bottom
+				xform = m4_translate(xform, v3(entity_sprite->image->width * -0.5, -0.5 * TILE_WIDTH, 0.)); // pivot center and a little up to account for the tile
+				xform = m4_translate(xform, v3(entity->pos.x, entity->pos.y, 0.));							// position
+
+				Vector4 color = COLOR_WHITE;
+				if (world_frame.selected_entity == entity)
+					color = COLOR_RED;
+
+				draw_image_xform(entity_sprite->image, xform, sprite_size, color);
+			}
+			break;
 			}
 		}
 